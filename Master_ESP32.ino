@@ -2,6 +2,9 @@
 #include "enhanced_protocol.h"
 #include "uart_interface.h"
 #include "spi_interface.h"
+#include "esp32_spi_bus.h"
+#include "compression_dictionary.h"
+#include "logger.h"
 #include <SPI.h>
 
 //UART Configuration
@@ -15,23 +18,24 @@ HardwareSerial SerialPort(2);
 #define SPI_SCK 18
 #define SPI_CS 5
 
+//ARQ Configuration (1 = stop-and-wait)
+#define ARQ_WINDOW_SIZE 8
+#define DELAYED_ACK_MS 5//Wait this long for outgoing DATA to carry the ACK
+#define LINK_BONDING false//Stripe DATA over UART and SPI together (slave must match), no auto-switch while on
+#define PAYLOAD_COMPRESSION true//LZSS payloads on the UART link once the slave answers with the same dictionary
+#define UART_FEC false//Reed-Solomon parity on frames sent over UART, repairs a few bad bytes without a NACK (long, noisy runs)
+
 //Protocol instance
 EnhancedProtocol protocol(true);
 UARTInterface uart_interface(&SerialPort, 115200);
 SPIInterface spi_interface(true, SPI_CS);//master mode
+ESP32DMABus spi_bus(SPI2_HOST, SPI_CS, SPI_SCK, SPI_MISO, SPI_MOSI);//HSPI, queued DMA transfers for spi_interface
 
 void send_ack(uint16_t seq_num)//Chuyển data frame thành ACK frame
 {
-    UartFrame ack_frame;
-    uint8_t empty_data[1] = {0};
-    
-    if(protocol.create_frame(TYPE_ACK, empty_data, 0, &ack_frame))
+    //Use current communication interface, ACK carries cumulative ack + SACK bitmap
+    if(protocol.send_ack(seq_num))
     {
-        ack_frame.sequence_num = seq_num;
-
-        //Use current communication interface
-        protocol.get_comm_interface()->send(&ack_frame);
-
         Serial.print("Sent ACK for frame ");
         Serial.print(seq_num);
     }
@@ -39,14 +43,8 @@ void send_ack(uint16_t seq_num)//Chuyển data frame thành ACK frame
 
 void send_nack(uint16_t seq_num)//Chuyển data frame thành NACK frame
 {
-    UartFrame nack_frame;
-    uint8_t empty_data[1] = {0};
-    
-    if(protocol.create_frame(TYPE_NACK, empty_data, 0, &nack_frame))
+    if(protocol.send_nack(seq_num))
     {
-        nack_frame.sequence_num = seq_num;
-        protocol.get_comm_interface()->send(&nack_frame);
-
         Serial.print("Sent NACK for frame ");
         Serial.println(seq_num);
     }
@@ -54,31 +52,32 @@ void send_nack(uint16_t seq_num)//Chuyển data frame thành NACK frame
 }
 
 // =============================================== SPI FUNCTIONS ==========================================================
+void spi_delivery_done(void* context, uint16_t seq_num, bool delivered)
+{
+    Serial.print("SPI frame ");
+    Serial.print(seq_num);
+    Serial.println(delivered ? " delivery comfirmed" : " delivery failed");
+}
+
 void send_test_data_spi()
 {
     static uint16_t spi_test_counter = 0;
     static unsigned long last_throughput_check = 0;
 
-    UartFrame frame;
+    FrameHandle frame = frame_pool.acquire();
     String message = "SPI_TEST_" + String(spi_test_counter) + " - Time: " + String(millis());
 
-    if(protocol.create_frame(TYPE_DATA, (uint8_t*)message.c_str(), message.length(), &frame))
+    if(frame && protocol.create_frame(TYPE_DATA, (uint8_t*)message.c_str(), message.length(), frame.get()))
     {
         Serial.println("=== SPI MODE TEST ===");
         Serial.print("Sending frame ");
-        Serial.print(frame.sequence_num);
+        Serial.print(frame->sequence_num);
         Serial.println(" via SPI");
 
-        bool success = protocol.send_reliable(&frame);
-
-        if(success)
-        {
-            Serial.println("SPI derivery comfirmed");
-            delay(100);
-        }
-        else
+        //Returns at once, spi_delivery_done() reports the outcome from protocol.service()
+        if(!protocol.send_async(frame, spi_delivery_done))
         {
-            Serial.println("SPI delivery failed");
+            Serial.println("SPI send queue full");
         }
          spi_test_counter++;
     }
@@ -216,15 +215,52 @@ bool SPIInterface::wait_for_slave_ready(uint32_t timeout_ms)
 
 */
 
+void send_test_burst_spi(uint8_t count)
+{
+    //Whole burst goes through the sliding window, only missing frames are resent
+    static uint16_t burst_counter = 0;
+    FrameHandle frames[ARQ_WINDOW_SIZE];//pooled, held until the window is done with them
+
+    if(count > ARQ_WINDOW_SIZE) count = ARQ_WINDOW_SIZE;
+    for(uint8_t i = 0; i < count; i++)
+    {
+        frames[i] = frame_pool.acquire();
+        if(!frames[i])
+        {
+            count = i;//pool exhausted, send what we have
+            break;
+        }
+        String message = "SPI_BURST_" + String(burst_counter++) + " - Time: " + String(millis());
+        protocol.create_frame(TYPE_DATA, (uint8_t*)message.c_str(), message.length(), frames[i].get());
+    }
+
+    uint16_t delivered = protocol.send_reliable(frames, count);
+    Serial.print("Burst delivered ");
+    Serial.print(delivered);
+    Serial.print("/");
+    Serial.println(count);
+}
+
 void test_spi_performance()
 {
     Serial.println("STARTING SPI PERFORMANCE TEST");
     Serial.println("=============================");
 
-    for(int i = 0; i < 5; i++)
+    if(protocol.get_window_size() > 1)
     {
-        send_test_data_spi();
-        delay(500);// Send 500ms to test throughput
+        send_test_burst_spi(5);
+    }
+    else
+    {
+        for(int i = 0; i < 5; i++)
+        {
+            send_test_data_spi();
+            unsigned long sent_at = millis();
+            while(millis() - sent_at < 500)// Send 500ms to test throughput
+            {
+                if(!protocol.service()) delay(1);//ACKs and retransmissions keep running between test frames
+            }
+        }
     }
 
     Serial.println("=============================");
@@ -237,23 +273,13 @@ void send_test_data()//Gửi thông tin data
     static uint16_t test_counter = 0;
     static unsigned long last_throughput_check = 0;
 
-    UartFrame frame;
     String message = "Test " +String(test_counter) + " - Time: " + String(millis());
 
-    if(protocol.create_frame(TYPE_DATA, (uint8_t*)message.c_str(), message.length(), &frame))//Tạo message frame
+    //Short messages share a TYPE_BATCH frame, sent when full or BATCH_DELAY_MS after the first one
+    if(!protocol.send_message((const uint8_t*)message.c_str(), message.length()))
     {
-        bool success = protocol.send_reliable(&frame);//Kiểm tra frame
-
-        if(success)
-        {
-            Serial.print("Reliable delivery comfirmed via ");
-            Serial.println(protocol.get_current_mode() == MODE_UART ? "UART" : "SPI");
-        }
-        else
-        {
-            Serial.print("Delivery failed for packet ");
-            Serial.println(frame.sequence_num);
-        }
+        Serial.print("Delivery failed for message ");
+        Serial.println(test_counter);
     }
     test_counter++;
 
@@ -267,54 +293,47 @@ void send_test_data()//Gửi thông tin data
     }
 }
 
-void receive_frames()//Nhan frame
-{
-    UartFrame frame;
-    if (protocol.get_comm_interface() -> receive(&frame))
-    {
-        process_received_frame(&frame);
-    }
-}
-
 //=======================================================COMMON FUNCTIONS ===========================================================================
-void process_received_frame(UartFrame* frame)//Xử lí frame đã nhận
+void handle_valid_frame(UartFrame* frame)//Called by protocol.service() for every valid inbound DATA frame
 {
-    Serial.print("<<< MASTER RECEIVED: ");
-    protocol.print_frame_info(frame);//In thông tin frame
-    Serial.println();
-
-    if(protocol.validate_frame(frame))//Kiểm tra frame
+    switch(frame->packet_type)
     {
-        switch(frame->packet_type)
-        {
-            case TYPE_DATA:
-                Serial.print("Data: ");
-                for(int i = 0; i < frame->data_length; i++)
-                {
-                    Serial.print((char)frame->data[i]);
-                }
-                Serial.println();
+        case TYPE_DATA:
+            if(!protocol.accept_data_frame(frame))
+            {
+                Serial.println("Duplicate frame - re-ACK only");
                 send_ack(frame->sequence_num);
                 break;
-            case TYPE_ACK:
-                Serial.println("ACK processed");
-                break;
-            case TYPE_NACK:
-                Serial.println("NACK processed - will retry");
-                break;
-            case TYPE_PING:
-                Serial.println("PING processed - signal is up");
-                break;
-            case TYPE_PONG:
-                Serial.println("PONG processed - signal is down");
-                break;
+            }
+            Serial.print("Data: ");
+            for(int i = 0; i < frame->data_length; i++)
+            {
+                Serial.print((char)frame->data[i]);
+            }
+            Serial.println();
+            protocol.queue_ack(frame->sequence_num);//Rides on our next DATA frame if there is one
+            break;
+        case TYPE_BATCH:
+            if(protocol.accept_data_frame(frame))
+            {
+                Serial.print("Batch messages: ");
+                Serial.println(protocol.deliver_batch(frame));
+            }
+            protocol.queue_ack(frame->sequence_num);
+            break;
+        case TYPE_ACK:
+            Serial.println("ACK processed");
+            break;
+        case TYPE_NACK:
+            Serial.println("NACK processed - will retry");
+            break;
+        case TYPE_PING:
+            Serial.println("PING processed - signal is up");
+            break;
+        case TYPE_PONG:
+            Serial.println("PONG processed - signal is down");
+            break;
 
-        }
-    }
-    else
-    {
-        Serial.println("INVALID FRAME");
-        send_nack(frame->sequence_num);
     }
 }
 
@@ -324,16 +343,11 @@ void check_and_switch_mode()
     CommunicationMode recommended = protocol.get_auto_switch().recommend_mode();
     CommunicationMode current = protocol.get_current_mode();
 
-    if(recommended == MODE_SPI && current == MODE_UART)
-    {
-        Serial.println("Auto-switching to SPI for better performance...");
-        protocol.switch_to_spi(SPI_CS, &SPI, 1000000);
-    }
-    else if (recommended == MODE_UART && current == MODE_SPI)
-    {
-        Serial.println("Switching back to UART...");
-        protocol.switch_to_uart(&SerialPort, 115200);
-    }
+    if(recommended == current || protocol.is_switching()) return;
+
+    //Handshake with the slave: data keeps flowing on the current link until the new one is confirmed
+    Serial.print(recommended == MODE_SPI ? "Auto-switching to SPI for better performance..." : "Switching back to UART...");
+    Serial.println(protocol.begin_switch(recommended) ? "" : " not now (last handover still settling)");
 }
 
 void display_current_mode()
@@ -359,9 +373,29 @@ void setup()
 
     //Initialize SPI
     SPI.begin(SPI_SCK, SPI_MISO, SPI_MOSI, SPI_CS);
+    spi_interface.set_bus_driver(&spi_bus);//double-buffered: next frame is encoded while the DMA sends the current one
+    spi_interface.begin();
 
-    //Set default interface (UART)
+    //Set default interface (UART), the other one is the handover target
     protocol.set_communication_interface(&spi_interface);
+    protocol.add_interface(&uart_interface);
+    protocol.set_window_size(ARQ_WINDOW_SIZE);
+    protocol.set_delayed_ack(DELAYED_ACK_MS);
+    protocol.set_frame_handler(handle_valid_frame);
+    protocol.set_compression_dictionary((const uint8_t*)TELEMETRY_DICTIONARY, sizeof(TELEMETRY_DICTIONARY) - 1);
+    if(PAYLOAD_COMPRESSION)
+    {
+        protocol.set_compression(MODE_UART, true);//UART is the throughput limit, SPI has bandwidth to spare
+    }
+    if(UART_FEC)
+    {
+        protocol.set_fec(MODE_UART, true);
+    }
+    if(LINK_BONDING)
+    {
+        uart_interface.set_tx_flush(false);//UART frames drain from the driver buffer while SPI sends
+        protocol.set_bonding(true);
+    }
     protocol.get_performance_monitor().reset_statistics();
 
     //Wait for Serial
@@ -372,6 +406,9 @@ void setup()
     Serial.println("========================================");
     Serial.println("Auto-switch: ENABLE");
     Serial.println("Initial Mode: SPI");
+    Serial.print("ARQ Window: "); Serial.println(protocol.get_window_size());
+    Serial.print("Link bonding: "); Serial.println(protocol.is_bonding() ? "ON" : "OFF");
+    Serial.print("UART FEC: "); Serial.println(protocol.is_fec_enabled(MODE_UART) ? "ON" : "OFF");
     Serial.println("========================================");
 
     delay(1000);
@@ -393,13 +430,17 @@ void loop()
         last_send = millis();
     }
     
-    //Nhận và xử lí frame được nhận
-    receive_frames();
+    //Nhận và xử lí frame được nhận: ACKs for async sends, DATA to handle_valid_frame, retransmit timers, delayed ACKs
+    protocol.service();
+    protocol.service_batch();//Send an open batch once BATCH_DELAY_MS has passed
+    logger.drain(8);//Format deferred log records in idle time
     
     //In thông số mỗi 15s
     if(millis() - last_stats > 15000)
     {
         protocol.print_statistics();
+        frame_pool.print_statistics();
+        protocol.print_link_statistics();
 
         //Display metrics auto-switch
         float throughput, latency, error_rate;
@@ -414,15 +455,21 @@ void loop()
 
         
 
+        //The slave may have booted after our probes, ask again
+        if(PAYLOAD_COMPRESSION && !protocol.is_compressing(MODE_UART))
+        {
+            protocol.set_compression(MODE_UART, true);
+        }
+
         last_stats = millis();
     }
 
-    //Auto-switch check every 10s
-    /*if(millis() - last_mode_check > 15000)
+    //Auto-switch check every 15s, protocol.service() runs the handover
+    if(millis() - last_mode_check > 15000)
     {
         check_and_switch_mode();
         last_mode_check = millis();
-    }*/
+    }
 
     delay(10);//Delay để tránh watchdog timer
 }
\ No newline at end of file
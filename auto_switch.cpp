@@ -1,4 +1,5 @@
 #include "auto_switch.h"
+#include "logger.h"
 
 AutoSwitchProtocol::AutoSwitchProtocol(PerformanceMonitor& monitor, float throughput_thresh, float latency_thresh, float error_rate) : 
 	perf(monitor),
@@ -12,9 +13,9 @@ bool AutoSwitchProtocol::should_switch_to_spi()
 {
 	if (!has_sufficient_data()) return false;//Not having enough packets => false
 
-	//Take metrics
-	float throughput = perf.get_throughput_kbps();
-	float latency = perf.get_average_latency();
+	//Take metrics, windowed so a change in link quality shows up within seconds
+	float throughput = perf.get_windowed_throughput_kbps();
+	float latency = perf.get_ewma_latency();
 	float error_rate = perf.get_error_rate();
 
 	//Switch to SPI condition: high throughtput, low latency, low error rate.
@@ -22,14 +23,8 @@ bool AutoSwitchProtocol::should_switch_to_spi()
 	bool latency_ok = latency < max_latency_threshold;
 	bool error_ok = error_rate < max_error_rate;
 
-	Serial.print("SPI Switch Check - Throughput: ");
-	Serial.print(throughput);
-	Serial.print("kbps, Latency: ");
-	Serial.print(latency);
-	Serial.print("ms, Error: ");
-	Serial.print(error_rate);
-	Serial.print("% -> ");
-	Serial.println(throughput_ok && latency_ok && error_ok ? "YES" : "NO");
+	LOG_DEBUG("SPI switch check - throughput %.2f kbps, latency %.2f ms, error %.2f%% -> %s",
+		throughput, latency, error_rate, throughput_ok && latency_ok && error_ok ? "YES" : "NO");
 
 	return throughput_ok && latency_ok && error_ok;
 }
@@ -39,19 +34,15 @@ bool AutoSwitchProtocol::should_switch_to_uart()
 	if (!has_sufficient_data()) return false;//Not having enough packets => false
 
 	//Take metrics
-	float throughput = perf.get_throughput_kbps();
+	float throughput = perf.get_windowed_throughput_kbps();
 	float error_rate = perf.get_error_rate();
 
 	//UART Switch Condition: low throughput or high error
 	bool low_throughput = throughput < (throughput_threshold * 0.7); // Throughput Limit: 70%
 	bool high_errors = error_rate > (max_error_rate * 2.0);// Errors x2
 
-	Serial.print("UART Switch Check - Throughput:");
-	Serial.print(throughput);
-	Serial.print("kbps, Error: ");
-	Serial.print(error_rate);
-	Serial.print("% -> ");
-	Serial.println(low_throughput || high_errors ? "YES" : "NO");
+	LOG_DEBUG("UART switch check - throughput %.2f kbps, error %.2f%% -> %s",
+		throughput, error_rate, low_throughput || high_errors ? "YES" : "NO");
 
 	return low_throughput || high_errors;
 }
@@ -73,8 +64,8 @@ CommunicationMode AutoSwitchProtocol::recommend_mode()
 void AutoSwitchProtocol::get_current_metrics(float& throughput, float& latency, float& error_rate) const
 {
 	//Take metrics of performance
-	throughput = perf.get_throughput_kbps();
-	latency = perf.get_average_latency();
+	throughput = perf.get_windowed_throughput_kbps();
+	latency = perf.get_ewma_latency();
 	error_rate = perf.get_error_rate();
 }
 
@@ -89,8 +80,8 @@ float AutoSwitchProtocol::calculate_switch_score() const
 	if (!has_sufficient_data()) return 0.0f;
 
 	//Take metrics
-	float throughput = perf.get_throughput_kbps();
-	float latency = perf.get_average_latency();
+	float throughput = perf.get_windowed_throughput_kbps();
+	float latency = perf.get_ewma_latency();
 	float error_rate = perf.get_error_rate();
 
 	//Calculate score
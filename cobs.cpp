@@ -0,0 +1,41 @@
+#include "cobs.h"
+
+uint16_t COBS::encode(const uint8_t* input, uint16_t length, uint8_t* output)
+{
+	uint16_t code_index = 0;
+	uint16_t out = 1;
+	uint8_t code = 1;
+
+	for (uint16_t i = 0; i < length; i++)
+	{
+		if (input[i] != 0)
+		{
+			output[out++] = input[i];
+			code++;
+		}
+		if (input[i] == 0 || code == 0xFF)
+		{
+			//Close the run: a zero byte, or a full 254-byte run without one
+			output[code_index] = code;
+			code_index = out++;
+			code = 1;
+		}
+	}
+	output[code_index] = code;
+	return out;
+}
+
+uint16_t COBS::decode(const uint8_t* input, uint16_t length, uint8_t* output)
+{
+	Decoder decoder;
+	decoder.reset();
+	uint16_t out = 0;
+
+	for (uint16_t i = 0; i < length; i++)
+	{
+		if (input[i] == COBS_DELIMITER) return 0;
+		uint8_t byte;
+		if (decoder.feed(input[i], byte)) output[out++] = byte;
+	}
+	return decoder.complete() ? out : 0;
+}
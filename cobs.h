@@ -0,0 +1,47 @@
+#pragma once
+#ifndef COBS_H
+#define COBS_H
+
+//Consistent Overhead Byte Stuffing: removes every 0x00 from a block so 0x00 can delimit frames.
+//Overhead is 1 byte per started 254-byte run, the receiver resyncs at the next delimiter.
+
+#include <stdint.h>
+
+#define COBS_DELIMITER 0x00
+#define COBS_MAX_ENCODED_SIZE(length) ((length) + (length) / 254 + 1)//without the delimiter
+
+class COBS
+{
+public:
+	static uint16_t encode(const uint8_t* input, uint16_t length, uint8_t* output);//returns encoded length, no delimiter
+	static uint16_t decode(const uint8_t* input, uint16_t length, uint8_t* output);//returns decoded length, 0 on a malformed block
+
+	//Streaming decoder state, for receivers that decode byte by byte
+	struct Decoder
+	{
+		uint8_t code;//code byte of the current run, 0 before the first one
+		uint8_t remaining;//data bytes left in the current run
+
+		void reset() { code = 0; remaining = 0; }
+		//Feeds one non-delimiter byte, returns true and sets decoded when it yields an output byte
+		bool feed(uint8_t byte, uint8_t& decoded)
+		{
+			if (remaining == 0)
+			{
+				//Code byte: a run shorter than 254 bytes stands for a zero before the next run
+				bool zero = code != 0 && code != 0xFF;
+				code = byte;
+				remaining = byte - 1;
+				decoded = 0;
+				return zero;
+			}
+			remaining--;
+			decoded = byte;
+			return true;
+		}
+		//A delimiter ends a well-formed block only between runs
+		bool complete() const { return code != 0 && remaining == 0; }
+	};
+};
+
+#endif // !COBS_H
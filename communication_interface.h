@@ -3,6 +3,7 @@
 #define COMMUNICATION_INTERFACE_H
 
 #include "protocol.h"
+#include "frame_pool.h"
 
 //Communication Mode
 enum CommunicationMode
@@ -24,15 +25,21 @@ public:
 	virtual ~CommunicationInterface() {};
 
 	//Core communication methods
-	virtual bool send(const UartFrame* frame) = 0;
-	virtual bool receive(UartFrame* frame) = 0;
+	virtual bool send(const UartFrame* frame) = 0;//frame is only read, never copied whole
+	virtual FrameHandle receive() = 0;//lends a pooled frame, empty handle until a frame is complete
 	virtual bool available() = 0;
 
+	//Takes ownership of a pooled frame, the buffer goes back to the pool once it is on the wire
+	bool send_frame(FrameHandle frame) { return send(frame.get()); }
+
 	//Mode and configuration
 	virtual CommunicationMode get_mode() = 0;
 	virtual void begin() = 0;
 	virtual void reset_receiver() = 0;
 
+	//CRC computed while the last frame returned by receive() arrived (false if not tracked)
+	virtual bool get_rx_crc(uint16_t& /*crc*/) const { return false; }
+
 	//Performance monitoring
 	virtual uint32_t get_baud_rate() const = 0;
 	virtual bool is_connected() const = 0;
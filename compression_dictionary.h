@@ -0,0 +1,13 @@
+#pragma once
+#ifndef COMPRESSION_DICTIONARY_H
+#define COMPRESSION_DICTIONARY_H
+
+//Preset LZSS dictionary for the telemetry text both sketches exchange (EnhancedProtocol::set_compression_dictionary).
+//Master and slave load the same bytes; a changed dictionary only takes effect once both run it, peers with
+//different dictionaries see different ids and stay uncompressed. Text that repeats most sits last.
+
+static const char TELEMETRY_DICTIONARY[] =
+	"SPI_BURST_SPI_TEST_UART_TEST_ - Latency: ms - Throughput: kbps - Error: % - Mode: UART - Mode: SPI"
+	" - Temp: C - Humidity: % - Voltage: V - Seq: - Time: 1 - Time: 2 - Time: 3 Test 1Test 2Test 3 - Time: ";
+
+#endif // !COMPRESSION_DICTIONARY_H
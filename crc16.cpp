@@ -3,31 +3,208 @@
 const uint16_t CRC16::CRC16_POLYNOMIAL = 0x1021;
 const uint16_t CRC16::CRC16_INITIAL = 0xFFFF;
 
-uint16_t CRC16::calculate(const uint8_t* data, uint16_t length)
+//========================== Compile-time table generation (C++11 constexpr) ==========================
+namespace
 {
-	uint16_t crc = CRC16_INITIAL;
+	constexpr uint16_t POLYNOMIAL = 0x1021;
+
+	//Shift 'bits' bits through the CRC register, MSB first
+	constexpr uint16_t crc_shift(uint16_t crc, uint8_t bits)
+	{
+		return bits == 0 ? crc : crc_shift((crc & 0x8000) ? (uint16_t)((crc << 1) ^ POLYNOMIAL) : (uint16_t)(crc << 1), bits - 1);
+	}
+
+	//T[k][x] = CRC contribution of byte x followed by k zero bytes
+	constexpr uint16_t append_zero_byte(uint16_t value)
+	{
+		return (uint16_t)((value << 8) ^ crc_shift((uint16_t)(value & 0xFF00), 8));
+	}
 
-	for (uint16_t i = 0; i < length; i++)
+	constexpr uint16_t table_entry(uint8_t slice, uint16_t index)
 	{
-		crc ^= (uint16_t)data[i] << 8;
+		return slice == 0 ? crc_shift((uint16_t)(index << 8), 8) : append_zero_byte(table_entry(slice - 1, index));
+	}
+
+	template<uint16_t... I> struct IndexList {};
+	template<uint16_t N, uint16_t... I> struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+	template<uint16_t... I> struct MakeIndexList<0, I...> { typedef IndexList<I...> type; };
+
+	template<uint8_t Slice, typename Indices> struct SliceTable;
+	template<uint8_t Slice, uint16_t... I> struct SliceTable<Slice, IndexList<I...> >
+	{
+		static constexpr uint16_t values[sizeof...(I)] = { table_entry(Slice, I)... };
+	};
+	template<uint8_t Slice, uint16_t... I> constexpr uint16_t SliceTable<Slice, IndexList<I...> >::values[sizeof...(I)];
+
+	typedef MakeIndexList<256>::type ByteIndices;
+	typedef SliceTable<0, ByteIndices> T0;
+	typedef SliceTable<1, ByteIndices> T1;
+	typedef SliceTable<2, ByteIndices> T2;
+	typedef SliceTable<3, ByteIndices> T3;
+	typedef SliceTable<4, ByteIndices> T4;
+	typedef SliceTable<5, ByteIndices> T5;
+	typedef SliceTable<6, ByteIndices> T6;
+	typedef SliceTable<7, ByteIndices> T7;
+
+	//Cross-check vectors: CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF, no reflection, no xorout)
+	constexpr uint16_t bitwise_crc(const char* s, uint16_t length, uint16_t crc)
+	{
+		return length == 0 ? crc : bitwise_crc(s + 1, length - 1, crc_shift((uint16_t)(crc ^ ((uint8_t)s[0] << 8)), 8));
+	}
+
+	constexpr uint16_t table_crc(const char* s, uint16_t length, uint16_t crc)
+	{
+		return length == 0 ? crc : table_crc(s + 1, length - 1, (uint16_t)((crc << 8) ^ T0::values[(uint8_t)((crc >> 8) ^ (uint8_t)s[0])]));
+	}
+
+	static_assert(T0::values[1] == POLYNOMIAL, "CRC16 table must be generated from polynomial 0x1021");
+	static_assert(bitwise_crc("123456789", 9, 0xFFFF) == 0x29B1, "CRC16 bitwise check value mismatch");
+	static_assert(table_crc("123456789", 9, 0xFFFF) == 0x29B1, "CRC16 table check value mismatch");
+	static_assert(table_crc("", 0, 0xFFFF) == 0xFFFF, "CRC16 empty input must return the initial value");
+	static_assert(table_crc("A", 1, 0xFFFF) == 0xB915, "CRC16 single byte check value mismatch");
+	static_assert(T1::values[0x5A] == append_zero_byte(T0::values[0x5A]), "CRC16 slice table mismatch");
 
-		for (uint8_t j = 0; j < 8; j++)
+	//Engine bodies, continuing from a running crc value
+	uint16_t update_bitwise(uint16_t crc, const uint8_t* data, uint16_t length)
+	{
+		for (uint16_t i = 0; i < length; i++)
 		{
-			if (crc & 0x8000)
-			{
-				crc = (crc << 1) ^ CRC16_POLYNOMIAL;
-			}
-			else
+			crc ^= (uint16_t)data[i] << 8;
+
+			for (uint8_t j = 0; j < 8; j++)
 			{
-				crc <<= 1;
+				if (crc & 0x8000)
+				{
+					crc = (crc << 1) ^ POLYNOMIAL;
+				}
+				else
+				{
+					crc <<= 1;
+				}
 			}
 		}
+
+		return crc;
+	}
+
+	inline uint16_t update_byte(uint16_t crc, uint8_t byte)
+	{
+		return (uint16_t)((crc << 8) ^ T0::values[(uint8_t)((crc >> 8) ^ byte)]);
+	}
+
+	uint16_t update_table(uint16_t crc, const uint8_t* data, uint16_t length)
+	{
+		while (length--)
+		{
+			crc = update_byte(crc, *data++);
+		}
+
+		return crc;
 	}
 
-	return crc;
+	uint16_t update_slice4(uint16_t crc, const uint8_t* data, uint16_t length)
+	{
+		//The 16-bit register only overlaps the first 2 bytes of each block
+		while (length >= 4)
+		{
+			crc = T3::values[(uint8_t)(data[0] ^ (crc >> 8))] ^
+				T2::values[(uint8_t)(data[1] ^ crc)] ^
+				T1::values[data[2]] ^
+				T0::values[data[3]];
+			data += 4;
+			length -= 4;
+		}
+
+		return update_table(crc, data, length);
+	}
+
+	uint16_t update_slice8(uint16_t crc, const uint8_t* data, uint16_t length)
+	{
+		while (length >= 8)
+		{
+			crc = T7::values[(uint8_t)(data[0] ^ (crc >> 8))] ^
+				T6::values[(uint8_t)(data[1] ^ crc)] ^
+				T5::values[data[2]] ^
+				T4::values[data[3]] ^
+				T3::values[data[4]] ^
+				T2::values[data[5]] ^
+				T1::values[data[6]] ^
+				T0::values[data[7]];
+			data += 8;
+			length -= 8;
+		}
+
+		return update_table(crc, data, length);
+	}
+}
+
+//=============================================== ENGINES ==========================================================
+uint16_t CRC16::calculate_bitwise(const uint8_t* data, uint16_t length)
+{
+	return update_bitwise(CRC16_INITIAL, data, length);
+}
+
+uint16_t CRC16::calculate_table(const uint8_t* data, uint16_t length)
+{
+	return update_table(CRC16_INITIAL, data, length);
+}
+
+uint16_t CRC16::calculate_slice4(const uint8_t* data, uint16_t length)
+{
+	return update_slice4(CRC16_INITIAL, data, length);
+}
+
+uint16_t CRC16::calculate_slice8(const uint8_t* data, uint16_t length)
+{
+	return update_slice8(CRC16_INITIAL, data, length);
+}
+
+uint16_t CRC16::begin()
+{
+	return CRC16_INITIAL;
+}
+
+uint16_t CRC16::calculate(const uint8_t* data, uint16_t length)
+{
+	return finalize(update(begin(), data, length));
+}
+
+uint16_t CRC16::update(uint16_t crc, const uint8_t* data, uint16_t length)
+{
+#if CRC16_ENGINE == CRC16_ENGINE_SLICE8
+	return update_slice8(crc, data, length);
+#elif CRC16_ENGINE == CRC16_ENGINE_SLICE4
+	return update_slice4(crc, data, length);
+#elif CRC16_ENGINE == CRC16_ENGINE_TABLE
+	return update_table(crc, data, length);
+#else
+	return update_bitwise(crc, data, length);
+#endif
+}
+
+uint16_t CRC16::update(uint16_t crc, uint8_t byte)
+{
+#if CRC16_ENGINE == CRC16_ENGINE_BITWISE
+	return update_bitwise(crc, &byte, 1);
+#else
+	return update_byte(crc, byte);
+#endif
+}
+
+const char* CRC16::engine_name()
+{
+#if CRC16_ENGINE == CRC16_ENGINE_SLICE8
+	return "slice-by-8";
+#elif CRC16_ENGINE == CRC16_ENGINE_SLICE4
+	return "slice-by-4";
+#elif CRC16_ENGINE == CRC16_ENGINE_TABLE
+	return "table";
+#else
+	return "bitwise";
+#endif
 }
 
 bool CRC16::verify(const uint8_t* data, uint16_t length, uint16_t received_crc)
 {
 	return calculate(data, length) == received_crc;
-}
\ No newline at end of file
+}
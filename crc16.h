@@ -4,12 +4,35 @@
 
 #include <stdint.h>
 
+//CRC16 engine selection (compile time)
+#define CRC16_ENGINE_BITWISE 0//8 shifts per byte, no table
+#define CRC16_ENGINE_TABLE 1//256-entry table, 1 lookup per byte
+#define CRC16_ENGINE_SLICE4 2//4 x 256-entry tables, 4 bytes per step
+#define CRC16_ENGINE_SLICE8 3//8 x 256-entry tables, 8 bytes per step
+
+#ifndef CRC16_ENGINE
+#define CRC16_ENGINE CRC16_ENGINE_TABLE
+#endif
+
 class CRC16
 {
 public:
 	static uint16_t calculate(const uint8_t* data, uint16_t length);//tinh crc16
 	static bool verify(const uint8_t* data, uint16_t length, uint16_t received_crc);//ham kiem tra
 
+	//Streaming API: crc = begin(); crc = update(crc, ...); ... finalize(crc) == calculate(all bytes)
+	static uint16_t begin();
+	static uint16_t update(uint16_t crc, uint8_t byte);
+	static uint16_t update(uint16_t crc, const uint8_t* data, uint16_t length);
+	static uint16_t finalize(uint16_t crc) { return crc; }//CCITT-FALSE has no final xor
+
+	//Engine variants, always available for benchmarking and cross-checking
+	static uint16_t calculate_bitwise(const uint8_t* data, uint16_t length);
+	static uint16_t calculate_table(const uint8_t* data, uint16_t length);
+	static uint16_t calculate_slice4(const uint8_t* data, uint16_t length);
+	static uint16_t calculate_slice8(const uint8_t* data, uint16_t length);
+	static const char* engine_name();
+
 private:
 	static const uint16_t CRC16_POLYNOMIAL;//Constant da thuc crc16
 	static const uint16_t CRC16_INITIAL;//Constant kiem tra crc16
@@ -1,13 +1,80 @@
 #include "enhanced_protocol.h"
 #include "uart_interface.h"
 #include "spi_interface.h"
+#include "logger.h"
 #include <Arduino.h>
 
 EnhancedProtocol::EnhancedProtocol(bool enable_auto_switch) : 
 	comm_interface(nullptr), 
 	auto_switch(perf_monitor), 
-	auto_switch_enable(enable_auto_switch) 
-{}
+	auto_switch_enable(enable_auto_switch),
+	window_size(1),
+	async_pending(0),
+	stream_opened(false),
+	frame_handler(nullptr),
+	delayed_ack_ms(0),
+	ack_pending(false),
+	pending_ack_seq(0),
+	ack_pending_since(0),
+	batch_length(0),
+	batch_opened(0),
+	batch_delay_ms(BATCH_DELAY_MS),
+	message_handler(nullptr),
+	messages_sent(0),
+	batches_sent(0),
+	next_message_id(0),
+	standby_interface(nullptr),
+	rx_source(nullptr),
+	reply_link(0),
+	handover_state(HANDOVER_IDLE),
+	handover_target(MODE_UART),
+	handover_id(0),
+	handover_attempts(0),
+	handover_started(0),
+	handover_sent(0),
+	last_switch_ms(0),
+	bonding(false),
+	tx_link(0),
+	rx_turn(0),
+	bonding_started(0)
+{
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		interfaces[i] = nullptr;
+		links[i].busy_until = 0;
+		links[i].delivery_q8 = 256;
+		links[i].frames_sent = 0;
+		links[i].bytes_sent = 0;
+		links[i].bytes_acked = 0;
+		compression[i] = COMPRESSION_OFF;
+		compression_probes[i] = 0;
+		compression_probe_sent[i] = 0;
+		fec[i] = false;
+	}
+	compression_dictionary.load(nullptr, 0);
+	for (uint8_t i = 0; i < MAX_WINDOW_SIZE; i++)
+	{
+		tx_window[i].sent_time = 0;
+		tx_window[i].attempts = 0;
+		tx_window[i].acked = false;
+		tx_window[i].done = false;
+		tx_window[i].link = 0;
+		tx_window[i].nacks = 0;
+		tx_window[i].unsent = false;
+	}
+	for (uint8_t i = 0; i < MAX_ASYNC_SENDS; i++)
+	{
+		async_sends[i].frame = nullptr;
+		async_sends[i].callback = nullptr;
+		async_sends[i].context = nullptr;
+		async_sends[i].sent_time = 0;
+		async_sends[i].attempts = 0;
+		async_sends[i].link = 0;
+		async_sends[i].nacks = 0;
+		async_sends[i].unsent = false;
+	}
+	perf_monitor.rto_updated(get_rto_us());
+}
 
 void EnhancedProtocol::set_communication_interface(CommunicationInterface* interface)
 {
@@ -18,108 +85,625 @@ void EnhancedProtocol::set_communication_interface(CommunicationInterface* inter
 		comm_interface->reset_receiver();//Reset old interface
 	}
 
+	//Direct switch, no handshake: drop any handover in progress and bonding
+	handover_state = HANDOVER_IDLE;
+	standby_interface = nullptr;
+	bonding = false;
+
 	comm_interface = interface;
 	if (comm_interface)
 	{
+		add_interface(comm_interface);
 		comm_interface->reset_receiver();//Reset new interface
+		perf_monitor.rto_updated(get_rto_us());
 		Serial.print("Communication interface set to: ");
 		Serial.println(comm_interface->get_mode() == MODE_UART ? "UART" : "SPI");
 	}
 }
 
+void EnhancedProtocol::add_interface(CommunicationInterface* interface)
+{
+	if (interface)
+	{
+		interfaces[link_index(interface->get_mode())] = interface;
+	}
+}
+
+FrameHandle EnhancedProtocol::receive_frame()
+{
+	rx_source = nullptr;
+	if (!comm_interface) return FrameHandle();
+
+	//Bonded, or during a handover (probes on the new link, stragglers on the old one), the other link
+	//is read too; turns alternate so a busy link cannot starve the other
+	CommunicationInterface* other = bonding ? interfaces[1 - link_index(get_current_mode())] : standby_interface;
+	CommunicationInterface* order[2] = { comm_interface, other };
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		CommunicationInterface* link = order[(rx_turn + i) & 1];
+		if (!link || !link->available()) continue;
+
+		FrameHandle frame = link->receive();
+		if (frame)
+		{
+			rx_turn = (rx_turn + i + 1) & 1;
+			rx_source = link;
+			return frame;
+		}
+	}
+	return FrameHandle();
+}
+
+bool EnhancedProtocol::set_bonding(bool enable)
+{
+	if (enable && (!interfaces[0] || !interfaces[1] || !comm_interface || is_switching() || standby_interface)) return false;
+	if (enable && !bonding)
+	{
+		CommunicationInterface* other = interfaces[1 - link_index(get_current_mode())];
+		other->reset_receiver();
+		for (uint8_t i = 0; i < 2; i++)
+		{
+			links[i].busy_until = micros();
+			links[i].delivery_q8 = 256;
+			links[i].frames_sent = 0;
+			links[i].bytes_sent = 0;
+			links[i].bytes_acked = 0;
+		}
+		bonding_started = millis();
+	}
+	bonding = enable;
+	return true;
+}
+
+CommunicationInterface* EnhancedProtocol::select_link(const UartFrame* frame, uint8_t avoid_link)
+{
+	if (!bonding)
+	{
+		tx_link = link_index(get_current_mode());
+		return comm_interface;
+	}
+
+	//Earliest expected delivery: what is queued plus this frame at the link rate and half the measured
+	//round trip, plus a retransmission timeout weighted by the odds of losing it (delivery ratio q):
+	//(arrival + (1 - q) / q * rto), so a degrading link sheds traffic before it has to be switched away from
+	uint16_t wire_bytes = wire_size(frame);
+	uint32_t now = micros();
+	uint32_t best_cost = 0xFFFFFFFF;
+	uint32_t best_busy_until = now;
+	tx_link = link_index(get_current_mode());
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		if (i == avoid_link) continue;
+		uint32_t rate = interfaces[i]->get_baud_rate();
+		uint32_t bits = interfaces[i]->get_mode() == MODE_UART ? 10 : 8;//start/stop bits on UART
+		uint32_t serialize_us = rate ? (uint32_t)((uint64_t)wire_bytes * bits * 1000000UL / rate) : 0;
+		uint32_t queued_us = (int32_t)(links[i].busy_until - now) > 0 ? links[i].busy_until - now : 0;
+		uint64_t arrival_us = queued_us + serialize_us + rto_estimators[i].get_srtt_us() / 2;
+		uint64_t retry_us = (uint64_t)(256 - links[i].delivery_q8) * rto_estimators[i].get_rto_us();
+		uint32_t cost = (uint32_t)((arrival_us * 256 + retry_us) / links[i].delivery_q8);
+		if (cost < best_cost)
+		{
+			best_cost = cost;
+			tx_link = i;
+			best_busy_until = now + queued_us + serialize_us;
+		}
+	}
+
+	links[tx_link].busy_until = best_busy_until;
+	links[tx_link].frames_sent++;
+	links[tx_link].bytes_sent += wire_bytes;
+	return interfaces[tx_link];
+}
+
+CommunicationInterface* EnhancedProtocol::select_reply_link(const UartFrame* frame)
+{
+	//Bonded, the answer goes back the way the frame came: we have no loss figures of our own for a link we
+	//only ACK on, and a resend the peer moved off a lossy link gets its ACK over the good one
+	if (!bonding || !interfaces[reply_link]) return select_link(frame);
+	tx_link = reply_link;
+	links[tx_link].frames_sent++;
+	links[tx_link].bytes_sent += wire_size(frame);
+	return interfaces[tx_link];
+}
+
+void EnhancedProtocol::link_acked(uint8_t link, uint16_t wire_bytes)
+{
+	links[link].bytes_acked += wire_bytes;
+	links[link].delivery_q8 += (256 - links[link].delivery_q8 + 7) >> 3;
+}
+
+void EnhancedProtocol::link_timed_out(uint8_t link)
+{
+	//Floor keeps a dead link probed now and then, so it is picked up again once it recovers
+	links[link].delivery_q8 -= links[link].delivery_q8 >> 3;
+	if (links[link].delivery_q8 < 8) links[link].delivery_q8 = 8;
+}
+
+float EnhancedProtocol::get_link_throughput_kbps(CommunicationMode mode) const
+{
+	uint32_t elapsed_ms = millis() - bonding_started;
+	if (elapsed_ms == 0) return 0.0;
+	return links[link_index(mode)].bytes_acked * 8.0 / elapsed_ms;//bits per ms = kbps
+}
+
+void EnhancedProtocol::print_link_statistics()
+{
+	Serial.println("LINKS:");
+	Serial.print(" Bonding: "); Serial.println(bonding ? "ON" : "OFF");
+	float aggregate_kbps = 0;
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		if (!interfaces[i]) continue;
+		CommunicationMode mode = interfaces[i]->get_mode();
+		aggregate_kbps += get_link_throughput_kbps(mode);
+		Serial.print(mode == MODE_UART ? " UART: " : " SPI: ");
+		Serial.print(links[i].frames_sent); Serial.print(" frames, ");
+		Serial.print(get_link_throughput_kbps(mode), 2); Serial.print(" kbps acked, SRTT ");
+		Serial.print(rto_estimators[i].get_srtt_us() / 1000.0, 3); Serial.print(" ms, delivery ");
+		Serial.print(get_link_delivery(mode), 1); Serial.println("%");
+	}
+	Serial.print(" Aggregate: "); Serial.print(aggregate_kbps, 2); Serial.println(" kbps");
+}
+
 CommunicationMode EnhancedProtocol::get_current_mode() const
 {
 	return comm_interface ? comm_interface->get_mode() : MODE_UART;
 }
 
+struct BlockingSend
+{
+	uint16_t seq_num;
+	bool done;
+	bool delivered;
+};
+
+static void blocking_send_complete(void* context, uint16_t seq_num, bool delivered)
+{
+	BlockingSend* result = (BlockingSend*)context;
+	if (seq_num != result->seq_num) return;
+	result->done = true;
+	result->delivered = delivered;
+}
+
 bool EnhancedProtocol::send_reliable(UartFrame* frame)
 {
 	if (!comm_interface)
 	{
-		Serial.println("ERROR: No communication interface set!");
+		LOG_ERROR("No communication interface set");
+		return false;
+	}
+
+	//Earlier async sends may hold every slot, keep them moving until this frame fits
+	while (!can_send_async(frame->sequence_num))
+	{
+		if (!service()) delay(1);
+	}
+
+	BlockingSend result = { frame->sequence_num, false, false };
+	if (!send_async(frame, blocking_send_complete, &result)) return false;
+	LOG_DEBUG("Sent frame %u via %s, waiting for ACK", frame->sequence_num, get_current_mode() == MODE_UART ? "UART" : "SPI");
+
+	while (!result.done)
+	{
+		if (!service()) delay(1);
+	}
+
+	if (result.delivered && auto_switch_enable)
+	{
+		perform_auto_switch();
+	}
+	return result.delivered;
+}
+
+bool EnhancedProtocol::send_async(const FrameHandle& frame, SendCallback callback, void* context)
+{
+	return frame && start_async(frame.get(), frame, callback, context);
+}
+
+bool EnhancedProtocol::send_async(UartFrame* frame, SendCallback callback, void* context)
+{
+	return frame && start_async(frame, FrameHandle(), callback, context);
+}
+
+bool EnhancedProtocol::can_send_async(uint16_t seq_num)
+{
+	if (!free_async_slot()) return false;
+
+	//The receiver only tracks RX_WINDOW_SPAN sequences: a newer frame would slide its window past
+	//an outstanding one, and the cumulative ack would then claim a frame that never arrived.
+	//Bonded, the peer's reorder buffer holds REORDER_SLOTS: anything further ahead reads as a gap given up on
+	int16_t span = bonding ? REORDER_SLOTS : RX_WINDOW_SPAN;
+	for (uint8_t i = 0; i < MAX_ASYNC_SENDS; i++)
+	{
+		if (!async_sends[i].frame) continue;
+		int16_t distance = seq_diff(seq_num, async_sends[i].frame->sequence_num);
+		if (distance >= span || distance <= -span) return false;
+	}
+	return true;
+}
+
+EnhancedProtocol::AsyncSend* EnhancedProtocol::free_async_slot()
+{
+	for (uint8_t i = 0; i < MAX_ASYNC_SENDS; i++)
+	{
+		if (!async_sends[i].frame) return &async_sends[i];
+	}
+	return nullptr;
+}
+
+bool EnhancedProtocol::start_async(UartFrame* frame, const FrameHandle& handle, SendCallback callback, void* context)
+{
+	if (!comm_interface)
+	{
+		LOG_ERROR("No communication interface set");
 		return false;
 	}
 
-	int retries = MAX_RETRIES;
-	while (retries > 0)
+	if (!can_send_async(frame->sequence_num))
 	{
-		//Start timing
-		start_packet_timing(frame->sequence_num);
+		LOG_WARN("No async send slot for frame %u", frame->sequence_num);
+		return false;
+	}
+	AsyncSend* send = free_async_slot();
+
+	send->frame = frame;
+	send->handle = handle;
+	send->callback = callback;
+	send->context = context;
+	send->attempts = 0;
+	send->nacks = 0;
+	send->unsent = false;
+	async_pending++;
+	transmit_async(*send);
+	return true;
+}
+
+void EnhancedProtocol::transmit_async(AsyncSend& send, bool counted)
+{
+	start_packet_timing(send.frame->sequence_num);
+	uint32_t now = micros();
+	bool sent = send_frame(send.frame, send.attempts ? send.link : LINK_ANY);
+	send.link = tx_link;
+	if (!sent)
+	{
+		//Nothing went out: not an attempt and not a timeout, service() sends it again on its next pass
+		if (!send.unsent) send.sent_time = now;
+		send.unsent = true;
+		return;
+	}
+	send.sent_time = now;
+	if (counted) send.attempts++;
+	send.unsent = false;
+}
 
-		//Send frame
-		if (!send_frame(frame))
+bool EnhancedProtocol::service()
+{
+	if (!comm_interface) return false;
+	bool busy = false;
+
+	//ACKs for outstanding sends, DATA for the frame handler
+	while (true)
+	{
+		FrameHandle response = receive_frame();
+		if (!response) break;//nothing complete yet
+		if (validate_received_frame(response.get()))
 		{
-			record_retransmission();
-			retries--;
-			continue;
+			process_frame(response.get());
 		}
+		busy = true;
+	}
+	return service_timers() || busy;
+}
 
-		Serial.print("Sent frame ");
-		Serial.print(frame->sequence_num);
-		Serial.print(" via ");
-		Serial.print(get_current_mode() == MODE_UART ? "UART" : "SPI");
-		Serial.println(", waiting for ACK...");
+void EnhancedProtocol::process_frame(UartFrame* frame)
+{
+	process_async_ack(frame);
+	dispatch_inbound(frame);
+}
+
+bool EnhancedProtocol::service_timers()
+{
+	bool busy = false;
+	service_acks();
+	service_handover();
+	service_compression();
 
-		//Wait for ACK
-		uint32_t dynamic_timeout = calculate_dynamic_timeout();
-		if (wait_for_ack(frame->sequence_num, dynamic_timeout))
+	//Retransmit timers, per link the frame last went out on
+	uint32_t timeouts[2] = { rto_estimators[0].get_rto_us(), rto_estimators[1].get_rto_us() };
+	bool timed_out[2] = { false, false };
+	for (uint8_t i = 0; i < MAX_ASYNC_SENDS && async_pending; i++)
+	{
+		AsyncSend& send = async_sends[i];
+		if (!send.frame) continue;
+		if (send.unsent)
 		{
-			Serial.println("ACK received - SUCCESS");
-			
-			if (auto_switch_enable)
+			busy = true;
+			if (!unsent_expired(send.sent_time, send.link))
 			{
-				perform_auto_switch();
+				transmit_async(send);
+				continue;
 			}
-			return true;
+			LOG_WARN("Frame %u could not be sent", send.frame->sequence_num);
+			record_packet_lost(send.frame->sequence_num);
+			complete_async(send, false);
+			continue;
+		}
+		if (micros() - send.sent_time < timeouts[send.link]) continue;
+		timed_out[send.link] = true;
+		link_timed_out(send.link);
+		busy = true;
+
+		if (send.attempts >= MAX_RETRIES)
+		{
+			record_timeout();//timeouts++
+			record_packet_lost(send.frame->sequence_num);//lost_packets++
+			LOG_INFO("Frame %u not acknowledged after %u attempts", send.frame->sequence_num, send.attempts);
+			complete_async(send, false);
+			continue;
 		}
 
-		//Timeout - retry
-		retries--;
 		record_retransmission();//retransmissions++
-		Serial.print("Timeout - Retransmitting frame ");
-		Serial.print(frame-> sequence_num);
-		Serial.print(", attemps left:  ");
-		Serial.println(retries);
+		LOG_INFO("Timeout - retransmitting frame %u, attempt %u", send.frame->sequence_num, send.attempts + 1);
+		transmit_async(send);
+	}
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		if (timed_out[i]) rto_backoff(i);
 	}
+	return busy;
+}
 
-	record_timeout();//timeouts++
-	record_packet_lost(frame->sequence_num);//lost_packets++
-	return false;
+void EnhancedProtocol::process_async_ack(const UartFrame* response)
+{
+	for (uint8_t i = 0; i < MAX_ASYNC_SENDS && async_pending; i++)
+	{
+		AsyncSend& send = async_sends[i];
+		if (!send.frame) continue;
+
+		uint16_t seq = send.frame->sequence_num;
+		if (ack_covers(response, seq))
+		{
+			LOG_DEBUG("ACK received for frame %u", seq);
+			rto_sample(seq, send.attempts > 1 || send.nacks, send.link);
+			link_acked(send.link, wire_size(send.frame));
+			complete_async(send, true);
+		}
+		else if (response->packet_type == TYPE_NACK && response->sequence_num == seq && send.nacks < MAX_NACK_RESENDS)
+		{
+			//The peer is there and got it damaged: resend now, no backoff and no retry used
+			LOG_INFO("NACK for %u, resending", seq);
+			send.nacks++;
+			record_retransmission();
+			transmit_async(send, false);
+		}
+	}
 }
 
-bool EnhancedProtocol::send_frame(UartFrame* frame)
+void EnhancedProtocol::complete_async(AsyncSend& send, bool delivered)
+{
+	//Slot is free before the callback runs, so the callback can send again
+	uint16_t seq = send.frame->sequence_num;
+	SendCallback callback = send.callback;
+	void* context = send.context;
+	send.frame = nullptr;
+	send.handle.release();
+	async_pending--;
+
+	if (callback) callback(context, seq, delivered);
+}
+
+bool EnhancedProtocol::send_frame(UartFrame* frame, uint8_t avoid_link)
 {
 	if (!comm_interface) return false;
-	return comm_interface->send(frame);
+	if (is_data_frame(frame))
+	{
+		attach_pending_ack(frame);
+	}
+	return select_link(frame, avoid_link)->send(frame);
 }
 
-bool EnhancedProtocol::wait_for_ack(uint16_t seq_num, uint32_t timeout_ms)
+void EnhancedProtocol::attach_pending_ack(UartFrame* frame)
+{
+	if (!ack_pending || !rx_window.is_synced()) return;
+
+	//Only the cumulative ack fits in the header, out-of-order frames wait for a SACK
+	uint16_t cumulative_ack = rx_window.get_cumulative_ack();
+	if (seq_before(cumulative_ack, pending_ack_seq)) return;
+
+	frame->flags |= FRAME_FLAG_ACK;
+	frame->ack_num = cumulative_ack;
+	frame->crc16 = calculate_frame_crc(frame);
+
+	ack_pending = false;
+	perf_monitor.ack_sent(true);
+}
+
+void EnhancedProtocol::dispatch_inbound(UartFrame* frame)
+{
+	if (frame->packet_type == TYPE_SWITCH)
+	{
+		process_switch_frame(frame);
+	}
+	else if (frame->packet_type == TYPE_PING || frame->packet_type == TYPE_PONG)
+	{
+		process_probe_frame(frame);
+	}
+	else if (is_data_frame(frame) && frame_handler)
+	{
+		frame_handler(frame);
+	}
+}
+
+void EnhancedProtocol::queue_ack(uint16_t seq_num)
+{
+	if (delayed_ack_ms == 0)
+	{
+		send_ack(seq_num);
+		return;
+	}
+
+	if (!ack_pending)
+	{
+		ack_pending = true;
+		ack_pending_since = millis();
+	}
+	pending_ack_seq = seq_num;
+}
+
+void EnhancedProtocol::service_acks()
+{
+	if (ack_pending && millis() - ack_pending_since >= delayed_ack_ms)
+	{
+		send_ack(pending_ack_seq);
+	}
+}
+
+bool EnhancedProtocol::send_message(const uint8_t* data, uint8_t length)
+{
+	if (!data || length == 0 || length > MAX_BATCH_RECORD_LEN)
+	{
+		LOG_WARN("Message of %u bytes does not fit a batch record", length);
+		return false;
+	}
+
+	//Flush on size: records never span frames
+	bool delivered = true;
+	uint16_t capacity = get_payload_capacity();
+	if (batch_frame && batch_length + BATCH_RECORD_HEADER_SIZE + length > capacity)
+	{
+		delivered = flush_batch();
+	}
+
+	if (!batch_frame)
+	{
+		batch_frame = frame_pool.acquire();
+		if (!batch_frame) return false;
+		batch_length = 0;
+		batch_opened = millis();
+	}
+
+	batch_frame->data[batch_length] = length;
+	memcpy(&batch_frame->data[batch_length + BATCH_RECORD_HEADER_SIZE], data, length);
+	batch_length += BATCH_RECORD_HEADER_SIZE + length;
+	messages_sent++;
+
+	//Full: nothing else can be added, do not wait for the timer
+	if (batch_length + BATCH_RECORD_HEADER_SIZE >= capacity)
+	{
+		delivered = flush_batch() && delivered;
+	}
+	return delivered;
+}
+
+bool EnhancedProtocol::flush_batch()
+{
+	if (!batch_frame) return true;
+
+	FrameHandle frame = batch_frame;
+	batch_frame.release();
+	if (!create_frame(TYPE_BATCH, frame->data, batch_length, frame.get())) return false;
+	batches_sent++;
+	return send_reliable(frame.get());
+}
+
+void EnhancedProtocol::service_batch()
+{
+	if (batch_frame && millis() - batch_opened >= batch_delay_ms)
+	{
+		flush_batch();
+	}
+}
+
+struct FragmentSource
+{
+	EnhancedProtocol* protocol;//its create_frame: fragments are compressed and protected like DATA
+	const uint8_t* message;
+	uint32_t length;
+	uint16_t slice;
+	uint8_t message_id;
+};
+
+static bool fragment_source(void* context, uint16_t index, FrameHandle& frame)
+{
+	FragmentSource* source = (FragmentSource*)context;
+	frame = frame_pool.acquire();
+	if (!frame) return false;
+
+	//Fragment is encoded in place, create_frame only adds header, sequence and CRC
+	uint16_t fragment_length = encode_fragment(frame->data, source->message_id, index, source->message, source->length, source->slice);
+	return source->protocol->create_frame(TYPE_FRAGMENT, frame->data, fragment_length, frame.get());
+}
+
+bool EnhancedProtocol::send_fragmented(const uint8_t* data, uint32_t length)
+{
+	if (!data || length == 0 || length > MAX_MESSAGE_SIZE)
+	{
+		LOG_WARN("Message of %lu bytes cannot be fragmented", length);
+		return false;
+	}
+
+	//Fragments are built as the window opens, so at most window_size of them hold pool frames.
+	//Sized for the link at the start: room for FEC parity if it is on
+	uint16_t slice = get_payload_capacity() - FRAGMENT_HEADER_SIZE;
+	FragmentSource source = { this, data, length, slice, next_message_id++ };
+	uint16_t count = fragment_count(length, slice);
+	uint16_t delivered = send_window(fragment_source, &source, count, true);//the receiver cannot use part of a message
+	if (delivered != count)
+	{
+		LOG_WARN("Message %u: %u of %u fragments delivered", source.message_id, delivered, count);
+		return false;
+	}
+	return true;
+}
+
+uint16_t EnhancedProtocol::deliver_batch(const UartFrame* frame)
+{
+	if (!frame || frame->packet_type != TYPE_BATCH) return 0;
+
+	uint16_t records = 0;
+	uint16_t position = 0;
+	while (position + BATCH_RECORD_HEADER_SIZE <= frame->data_length)
+	{
+		uint8_t length = frame->data[position];
+		position += BATCH_RECORD_HEADER_SIZE;
+		if (length == 0 || position + length > frame->data_length)
+		{
+			LOG_WARN("Malformed batch %u, record %u", frame->sequence_num, records);
+			break;
+		}
+		if (message_handler) message_handler(&frame->data[position], length);
+		position += length;
+		records++;
+	}
+	return records;
+}
+
+bool EnhancedProtocol::wait_for_ack(uint16_t seq_num, uint32_t timeout_us)
 {
 	//For checking packet type and send to Master
 	if (!comm_interface) return false;
 
-	uint32_t start_time = millis();
-	while (millis() - start_time < timeout_ms)
+	uint32_t start_time = micros();
+	while (micros() - start_time < timeout_us)
 	{
-		if (comm_interface->available())
+		service_acks();
+		service_handover();
+
+		FrameHandle response = receive_frame();
+		if (response && validate_received_frame(response.get()))
 		{
-			UartFrame response;
-			if (comm_interface->receive(&response))
+			bool acked = ack_covers(response.get(), seq_num);
+			dispatch_inbound(response.get());
+
+			if (acked)
 			{
-				if (validate_frame(&response))
-				{
-					if (response.packet_type == TYPE_ACK && response.sequence_num == seq_num)
-					{
-						end_packet_timing(seq_num);
-						Serial.println("VALID ACK RECEIVED");
-						return true;
-					}
-					else if (response.packet_type == TYPE_NACK && response.sequence_num == seq_num)
-					{
-						Serial.println("NACK RECEIVED");
-						return false;
-					}
-				}
+				LOG_DEBUG("Valid ACK for %u", seq_num);
+				return true;
+			}
+			else if (response->packet_type == TYPE_NACK && response->sequence_num == seq_num)
+			{
+				LOG_INFO("NACK for %u", seq_num);
+				return false;
 			}
 		}
 		delay(1);
@@ -127,81 +711,753 @@ bool EnhancedProtocol::wait_for_ack(uint16_t seq_num, uint32_t timeout_ms)
 	return false;
 }
 
-uint32_t EnhancedProtocol::calculate_dynamic_timeout()
+void EnhancedProtocol::set_window_size(uint8_t size)
+{
+	window_size = constrain(size, 1, MAX_WINDOW_SIZE);
+}
+
+static bool array_source(void* context, uint16_t index, FrameHandle& frame)
+{
+	frame = ((const FrameHandle*)context)[index];
+	return (bool)frame;
+}
+
+uint16_t EnhancedProtocol::send_reliable(const FrameHandle* frames, uint16_t count)
+{
+	if (!frames) return 0;
+	return send_window(array_source, (void*)frames, count);
+}
+
+uint16_t EnhancedProtocol::send_window(FrameSource source, void* context, uint16_t count, bool stop_on_loss)
+{
+	if (!comm_interface || !source) return 0;
+
+	uint16_t delivered = 0;
+	if (window_size <= 1)
+	{
+		//Stop-and-wait
+		for (uint16_t i = 0; i < count; i++)
+		{
+			FrameHandle frame;
+			if (!source(context, i, frame)) break;
+			if (send_reliable(frame.get())) delivered++;
+			else if (stop_on_loss) break;
+		}
+		return delivered;
+	}
+
+	uint16_t base = 0;//oldest frame not yet done
+	uint16_t next = 0;//next frame to send for the first time
+	bool lost = false;//a frame was given up
+
+	while (base < count)
+	{
+		bool busy = false;
+
+		//Fill the window, frames are only requested once they can be sent
+		while (next < count && next - base < window_size && !(stop_on_loss && lost))
+		{
+			WindowSlot& slot = tx_window[next % MAX_WINDOW_SIZE];
+			if (!source(context, next, slot.frame)) break;
+			slot.attempts = 0;
+			slot.acked = false;
+			slot.done = false;
+			slot.nacks = 0;
+			slot.unsent = false;
+			transmit_window_slot(slot.frame.get(), slot);
+			next++;
+			busy = true;
+		}
+		if (base == next)
+		{
+			if (!lost) LOG_WARN("Window transfer stopped at frame %u of %u, no frame available", next, count);
+			break;
+		}
+
+		//Cumulative ACK + SACK bitmap, or an ack piggybacked on the peer's DATA
+		FrameHandle response = receive_frame();
+		if (response && validate_received_frame(response.get()))
+		{
+			process_window_ack(response.get(), base, next);
+			process_async_ack(response.get());
+			dispatch_inbound(response.get());
+			busy = true;
+		}
+		service_acks();
+		service_handover();
+
+		//Per-frame retransmit timers, only missing frames are resent
+		uint32_t timeouts[2] = { rto_estimators[0].get_rto_us(), rto_estimators[1].get_rto_us() };
+		bool timed_out[2] = { false, false };
+		for (uint16_t i = base; i < next; i++)
+		{
+			WindowSlot& slot = tx_window[i % MAX_WINDOW_SIZE];
+			if (slot.done) continue;
+			if (slot.unsent)
+			{
+				busy = true;
+				if (!unsent_expired(slot.sent_time, slot.link))
+				{
+					transmit_window_slot(slot.frame.get(), slot);
+					continue;
+				}
+				slot.done = true;
+				lost = true;
+				record_packet_lost(slot.frame->sequence_num);
+				continue;
+			}
+			if (micros() - slot.sent_time < timeouts[slot.link]) continue;
+			timed_out[slot.link] = true;
+			link_timed_out(slot.link);
+
+			if (slot.attempts >= MAX_RETRIES)
+			{
+				slot.done = true;
+				lost = true;
+				record_timeout();
+				record_packet_lost(slot.frame->sequence_num);
+				continue;
+			}
+
+			record_retransmission();
+			transmit_window_slot(slot.frame.get(), slot);
+			busy = true;
+		}
+		for (uint8_t l = 0; l < 2; l++)
+		{
+			if (timed_out[l]) rto_backoff(l);//once per pass, however many frames expired together
+		}
+
+		//Slide past finished frames
+		while (base < next && tx_window[base % MAX_WINDOW_SIZE].done)
+		{
+			WindowSlot& slot = tx_window[base % MAX_WINDOW_SIZE];
+			if (slot.acked) delivered++;
+			slot.frame.release();
+			base++;
+		}
+
+		if (!busy) delay(1);
+	}
+
+	if (auto_switch_enable)
+	{
+		perform_auto_switch();
+	}
+	return delivered;
+}
+
+bool EnhancedProtocol::transmit_window_slot(UartFrame* frame, WindowSlot& slot, bool counted)
+{
+	start_packet_timing(frame->sequence_num);
+	uint32_t now = micros();
+	bool sent = send_frame(frame, slot.attempts ? slot.link : LINK_ANY);
+	slot.link = tx_link;
+	if (!sent)
+	{
+		//Nothing went out: retried on the next pass without a timeout, see transmit_async()
+		if (!slot.unsent) slot.sent_time = now;
+		slot.unsent = true;
+		return false;
+	}
+	slot.sent_time = now;
+	if (counted) slot.attempts++;
+	slot.unsent = false;
+	return true;
+}
+
+bool EnhancedProtocol::unsent_expired(uint32_t first_failure, uint8_t link) const
+{
+	//As long as the retries would have taken: the interface is stuck, not just busy
+	return micros() - first_failure >= (uint32_t)MAX_RETRIES * rto_estimators[link].get_rto_us();
+}
+
+void EnhancedProtocol::process_window_ack(const UartFrame* response, uint16_t base, uint16_t next)
+{
+	for (uint16_t i = base; i < next; i++)
+	{
+		WindowSlot& slot = tx_window[i % MAX_WINDOW_SIZE];
+		if (slot.done) continue;
+
+		uint16_t seq = slot.frame->sequence_num;
+		if (ack_covers(response, seq))
+		{
+			rto_sample(seq, slot.attempts > 1 || slot.nacks, slot.link);
+			link_acked(slot.link, wire_size(slot.frame.get()));
+			slot.acked = true;
+			slot.done = true;
+		}
+		else if (response->packet_type == TYPE_NACK && response->sequence_num == seq && slot.nacks < MAX_NACK_RESENDS)
+		{
+			//As in process_async_ack(): resend now, outside the retry budget
+			slot.nacks++;
+			record_retransmission();
+			transmit_window_slot(slot.frame.get(), slot, false);
+		}
+	}
+}
+
+bool EnhancedProtocol::accept_data_frame(const UartFrame* frame)
+{
+	return frame && rx_window.accept(frame->sequence_num, (frame->flags & FRAME_FLAG_SYN) != 0);
+}
+
+bool EnhancedProtocol::send_ack(uint16_t seq_num)
+{
+	if (!comm_interface) return false;
+
+	FrameHandle ack_frame = frame_pool.acquire();
+	if (!ack_frame) return false;
+
+	uint8_t sack[SACK_PAYLOAD_SIZE];
+	uint16_t sack_length = 0;
+	if (rx_window.is_synced())
+	{
+		encode_sack(sack, rx_window.get_cumulative_ack(), rx_window.get_sack_bitmap());
+		sack_length = SACK_PAYLOAD_SIZE;
+	}
+
+	if (!create_ack_frame(TYPE_ACK, seq_num, sack, sack_length, ack_frame.get())) return false;
+	add_fec(ack_frame.get());
+	if (!select_reply_link(ack_frame.get())->send_frame(ack_frame)) return false;
+
+	//A standalone ACK supersedes any pending piggyback; a failed one leaves it pending
+	ack_pending = false;
+	perf_monitor.ack_sent(false);
+	return true;
+}
+
+bool EnhancedProtocol::send_nack(uint16_t seq_num)
+{
+	if (!comm_interface) return false;
+
+	FrameHandle nack_frame = frame_pool.acquire();
+	if (!nack_frame || !create_ack_frame(TYPE_NACK, seq_num, nullptr, 0, nack_frame.get())) return false;
+	add_fec(nack_frame.get());
+	return select_reply_link(nack_frame.get())->send_frame(nack_frame);
+}
+
+bool EnhancedProtocol::validate_received_frame(UartFrame* frame)
+{
+	//The CRC belongs to the link the frame came in on
+	CommunicationInterface* source = rx_source ? rx_source : comm_interface;
+	rx_source = nullptr;
+	if (source) reply_link = link_index(source->get_mode());
+
+	uint16_t rx_crc;
+	bool valid = source && source->get_rx_crc(rx_crc) ? validate_frame(frame, rx_crc) : validate_frame(frame);
+
+	//Only the sender's flag says parity is there, our own FEC setting is about what we send
+	if (!valid && (frame->flags & FRAME_FLAG_FEC))
+	{
+		valid = repair_frame(frame);
+	}
+	if (valid && (frame->flags & FRAME_FLAG_FEC))
+	{
+		if (frame->data_length < RS_PARITY_BYTES) return false;
+		frame->data_length -= RS_PARITY_BYTES;
+		frame->flags &= ~FRAME_FLAG_FEC;
+	}
+	if (!valid || !(frame->flags & FRAME_FLAG_COMPRESSED)) return valid;
+	return decompress_payload(frame);
+}
+
+bool EnhancedProtocol::create_frame(PacketType type, const uint8_t* data, uint16_t data_len, UartFrame* frame)
+{
+	bool compress = comm_interface && compression[link_index(get_current_mode())] == COMPRESSION_ON &&
+		(type == TYPE_DATA || type == TYPE_BATCH || type == TYPE_FRAGMENT) && data && data_len >= COMPRESSION_MIN_LEN && data_len <= MAX_DATA_LEN;
+	uint8_t packed[MAX_DATA_LEN];
+	uint16_t packed_length = 0;
+	if (compress)
+	{
+		//Only a gain is kept: capacity one byte short of the original
+		packed_length = LZSS::encode(data, data_len, packed, data_len - 1, &compression_dictionary);
+		if (packed_length == 0) perf_monitor.payload_uncompressible();
+	}
+
+	if (packed_length == 0)
+	{
+		if (!Protocol::create_frame(type, data, data_len, frame)) return false;
+	}
+	else
+	{
+		if (!Protocol::create_frame(type, packed, packed_length, frame)) return false;
+		frame->flags |= FRAME_FLAG_COMPRESSED;
+		perf_monitor.payload_compressed(data_len, packed_length);
+	}
+
+	//Our first sequenced frame: the peer's receive window starts here, even if later frames overtake it
+	if (is_data_frame(frame) && !stream_opened)
+	{
+		frame->flags |= FRAME_FLAG_SYN;
+		stream_opened = true;
+	}
+	frame->crc16 = calculate_frame_crc(frame);
+
+	//Parity last: it covers the payload as it goes on the wire
+	add_fec(frame);
+	return true;
+}
+
+uint16_t EnhancedProtocol::get_payload_capacity() const
+{
+	return comm_interface && fec[link_index(get_current_mode())] ? MAX_DATA_LEN - RS_PARITY_BYTES : MAX_DATA_LEN;
+}
+
+bool EnhancedProtocol::set_fec(CommunicationMode mode, bool enable)
+{
+	uint8_t link = link_index(mode);
+	if (!interfaces[link]) return false;
+	fec[link] = enable;
+	LOG_INFO("FEC %s for %s", enable ? "on" : "off", mode == MODE_UART ? "UART" : "SPI");
+	return true;
+}
+
+void EnhancedProtocol::fec_header(const UartFrame* frame, uint8_t* header)
+{
+	header[0] = frame->version;
+	header[1] = (uint8_t)((frame->packet_type | frame->flags) & ~FRAME_FLAG_ACK);
+	header[2] = (uint8_t)(frame->sequence_num & 0xFF);
+	header[3] = (uint8_t)(frame->sequence_num >> 8);
+	header[4] = (uint8_t)(frame->data_length & 0xFF);
+	header[5] = (uint8_t)(frame->data_length >> 8);
+}
+
+void EnhancedProtocol::add_fec(UartFrame* frame)
+{
+	if (!comm_interface || !fec[link_index(get_current_mode())]) return;
+	if (frame->data_length + RS_PARITY_BYTES > MAX_DATA_LEN || FEC_HEADER_SIZE + frame->data_length + RS_PARITY_BYTES > RS_MAX_CODEWORD)
+	{
+		perf_monitor.fec_frame_unprotected();
+		return;
+	}
+
+	//Flag and length first: the parity covers the header as it goes on the wire
+	uint16_t payload_length = frame->data_length;
+	frame->data_length += RS_PARITY_BYTES;
+	frame->flags |= FRAME_FLAG_FEC;
+
+	uint8_t header[FEC_HEADER_SIZE];
+	fec_header(frame, header);
+	uint8_t* parity = &frame->data[payload_length];
+	ReedSolomon::begin(parity);
+	ReedSolomon::update(parity, header, FEC_HEADER_SIZE);
+	ReedSolomon::update(parity, frame->data, payload_length);
+	frame->crc16 = calculate_frame_crc(frame);
+	perf_monitor.fec_frame_sent();
+}
+
+bool EnhancedProtocol::repair_frame(UartFrame* frame)
+{
+	//A length that cannot hold a codeword means the header was hit where the parity cannot help
+	uint16_t length = FEC_HEADER_SIZE + frame->data_length;
+	if (frame->data_length < RS_PARITY_BYTES || frame->data_length > MAX_DATA_LEN || length > RS_MAX_CODEWORD)
+	{
+		perf_monitor.fec_unrepaired();
+		return false;
+	}
+
+	uint8_t codeword[FEC_HEADER_SIZE + MAX_DATA_LEN];
+	fec_header(frame, codeword);
+	memcpy(&codeword[FEC_HEADER_SIZE], frame->data, frame->data_length);
+	int16_t corrected = ReedSolomon::decode(codeword, length);
+
+	//The corrected header has to describe the frame as it was framed on the wire
+	uint16_t corrected_length = codeword[4] | ((uint16_t)codeword[5] << 8);
+	if (corrected < 0 || !(codeword[1] & FRAME_FLAG_FEC) || corrected_length != frame->data_length)
+	{
+		perf_monitor.fec_unrepaired();
+		LOG_WARN("Frame %u beyond FEC repair", frame->sequence_num);
+		return false;
+	}
+
+	frame->version = codeword[0];
+	frame->packet_type = codeword[1] & FRAME_TYPE_MASK;
+	frame->flags = (uint8_t)((codeword[1] & ~FRAME_TYPE_MASK) | (frame->flags & FRAME_FLAG_ACK));
+	frame->sequence_num = codeword[2] | ((uint16_t)codeword[3] << 8);
+	memcpy(frame->data, &codeword[FEC_HEADER_SIZE], frame->data_length);
+
+	if (calculate_frame_crc(frame) != frame->crc16)
+	{
+		//Corrections the CRC disagrees with may be a miscorrection; with none, only the ack field or
+		//the CRC itself was hit, and that ack cannot be trusted
+		if (corrected > 0)
+		{
+			perf_monitor.fec_unrepaired();
+			LOG_WARN("Frame %u beyond FEC repair", frame->sequence_num);
+			return false;
+		}
+		frame->flags &= ~FRAME_FLAG_ACK;
+		frame->crc16 = calculate_frame_crc(frame);
+	}
+	perf_monitor.fec_repaired((uint8_t)corrected);
+	perf_monitor.packet_received(wire_size(frame));
+	return true;
+}
+
+bool EnhancedProtocol::decompress_payload(UartFrame* frame)
 {
-	//For calculating base timeout
+	uint8_t plain[MAX_DATA_LEN];
+	uint16_t length = LZSS::decode(frame->data, frame->data_length, plain, MAX_DATA_LEN, &compression_dictionary);
+	if (length == 0)
+	{
+		perf_monitor.decompression_failed();
+		LOG_WARN("Frame %u does not decompress", frame->sequence_num);
+		return false;
+	}
 
-	uint32_t base_timeout = ACK_TIMEOUT_MS;
+	//From here on the frame reads as if it had been sent uncompressed (crc16 still covers the wire bytes)
+	memcpy(frame->data, plain, length);
+	frame->data_length = length;
+	frame->flags &= ~FRAME_FLAG_COMPRESSED;
+	return true;
+}
 
-	PerformanceMonitor& perf = const_cast<EnhancedProtocol*>(this)->get_performance_monitor();
-	float avg_latency = Protocol::perf_monitor.get_average_latency();
+void EnhancedProtocol::set_compression_dictionary(const uint8_t* dictionary, uint16_t length)
+{
+	compression_dictionary.load(dictionary, length);
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		if (compression[i] == COMPRESSION_ON) set_compression(interfaces[i]->get_mode(), true);//the peer has to agree again
+	}
+}
 
-	if (get_current_mode() == MODE_SPI)
+bool EnhancedProtocol::set_compression(CommunicationMode mode, bool enable)
+{
+	uint8_t link = link_index(mode);
+	if (!interfaces[link]) return false;
+	if (!enable)
 	{
-		base_timeout = 1500;
+		compression[link] = COMPRESSION_OFF;
+		return true;
 	}
 
-	if (avg_latency > 100.0)
+	compression[link] = COMPRESSION_PROBING;
+	compression_probes[link] = 1;
+	compression_probe_sent[link] = millis();
+	send_compression_probe(TYPE_PING, mode);
+	return true;
+}
+
+bool EnhancedProtocol::send_compression_probe(PacketType type, CommunicationMode mode)
+{
+	//Over the active link: the peer only listens on the other one during a handover or when bonded
+	FrameHandle probe = frame_pool.acquire();
+	if (!comm_interface || !probe) return false;
+
+	uint8_t payload[COMPRESSION_PROBE_SIZE] = { PROBE_COMPRESSION, (uint8_t)mode,
+		(uint8_t)(compression_dictionary.id & 0xFF), (uint8_t)(compression_dictionary.id >> 8) };
+	return create_ack_frame(type, 0, payload, sizeof(payload), probe.get()) && comm_interface->send_frame(probe);
+}
+
+void EnhancedProtocol::process_probe_frame(const UartFrame* frame)
+{
+	if (frame->data_length < COMPRESSION_PROBE_SIZE || frame->data[0] != PROBE_COMPRESSION) return;//a plain PING / PONG
+
+	CommunicationMode mode = (CommunicationMode)frame->data[1];
+	uint16_t id = frame->data[2] | ((uint16_t)frame->data[3] << 8);
+	if (frame->packet_type == TYPE_PING)
 	{
-		base_timeout += 1000;
+		send_compression_probe(TYPE_PONG, mode);//with our dictionary id, the sender decides
+		return;
 	}
 
-	return base_timeout;
+	uint8_t link = link_index(mode);
+	if (compression[link] != COMPRESSION_PROBING) return;
+	if (id == compression_dictionary.id)
+	{
+		compression[link] = COMPRESSION_ON;
+		LOG_INFO("Compression on for %s", mode == MODE_UART ? "UART" : "SPI");
+	}
+	else
+	{
+		compression[link] = COMPRESSION_OFF;
+		LOG_WARN("Compression off for %s: peer has another dictionary", mode == MODE_UART ? "UART" : "SPI");
+	}
+}
+
+void EnhancedProtocol::service_compression()
+{
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		if (compression[i] != COMPRESSION_PROBING || millis() - compression_probe_sent[i] < COMPRESSION_PROBE_MS) continue;
+		if (compression_probes[i] >= MAX_RETRIES)
+		{
+			compression[i] = COMPRESSION_OFF;
+			LOG_WARN("Compression off for %s: peer did not answer", i == 1 ? "SPI" : "UART");
+			continue;
+		}
+		compression_probes[i]++;
+		compression_probe_sent[i] = millis();
+		send_compression_probe(TYPE_PING, interfaces[i]->get_mode());
+	}
+}
+
+void EnhancedProtocol::set_rto_bounds(uint32_t min_us, uint32_t max_us)
+{
+	rto_estimators[0].set_bounds(min_us, max_us);
+	rto_estimators[1].set_bounds(min_us, max_us);
+	perf_monitor.rto_updated(get_rto_us());
+}
+
+void EnhancedProtocol::rto_sample(uint16_t seq_num, bool retransmitted, uint8_t link)
+{
+	uint32_t rtt_us = end_packet_timing(seq_num);
+
+	//Karn: the ACK of a resent frame may belong to any of its copies, keep the backed-off RTO
+	if (retransmitted || rtt_us == 0) return;
+
+	rto_estimators[link].sample(rtt_us);
+	perf_monitor.rto_updated(rto_estimators[link].get_rto_us());
+}
+
+void EnhancedProtocol::rto_backoff(uint8_t link)
+{
+	rto_estimators[link].backoff();
+	perf_monitor.rto_updated(rto_estimators[link].get_rto_us());
+	LOG_DEBUG("RTO backed off to %lu us", rto_estimators[link].get_rto_us());
 }
 
 void EnhancedProtocol::perform_auto_switch()
 {
-	//For recommending mode for send packets
-	if (!auto_switch_enable || !comm_interface) return;
+	//Hands the link over when the monitor prefers the other mode and both ends have it
+	if (!auto_switch_enable || !comm_interface || is_switching()) return;
+	if (millis() - last_switch_ms < SWITCH_HOLDOFF_MS) return;
 
 	CommunicationMode recommended = auto_switch.recommend_mode();
 	CommunicationMode current = get_current_mode();
 
-	if (recommended != current)
+	if (recommended != current && begin_switch(recommended))
 	{
-		Serial.print("Auto-switch recommended: ");
-		Serial.println(recommended == MODE_UART ? "UART" : "SPI");
+		LOG_INFO("Auto-switch to %s", recommended == MODE_UART ? "UART" : "SPI");
 	}
 }
 
-void EnhancedProtocol::switch_to_spi(uint8_t cs_pin, SPIClass* spi_instance, uint32_t frequency)
+bool EnhancedProtocol::begin_switch(CommunicationMode mode)
+{
+	CommunicationInterface* target = get_interface(mode);
+	if (!comm_interface || !target || target == comm_interface) return false;
+	if (handover_state != HANDOVER_IDLE || standby_interface || bonding) return false;//running, settling, or both links in use
+
+	handover_id++;
+	handover_target = mode;
+	handover_state = HANDOVER_REQUESTED;
+	handover_started = micros();
+	handover_attempts = 1;
+	send_switch(comm_interface, SWITCH_REQUEST, handover_id, mode);
+	handover_sent = micros();
+	LOG_INFO("Handover %u to %s requested", handover_id, mode == MODE_UART ? "UART" : "SPI");
+	return true;
+}
+
+bool EnhancedProtocol::send_switch(CommunicationInterface* link, uint8_t op, uint16_t id, CommunicationMode mode)
 {
-	//Send UART command to slave to switch to SPI
-	Serial.println("Initiating SPI handshake...");
-	
-	//Just send switch command if current mode is UART mode
-	/*if (comm_interface && comm_interface->get_mode() == MODE_UART)
+	if (!link) return false;
+
+	FrameHandle switch_frame = frame_pool.acquire();
+	uint8_t payload[SWITCH_PAYLOAD_SIZE] = { op, (uint8_t)mode };
+	return switch_frame && create_ack_frame(TYPE_SWITCH, id, payload, sizeof(payload), switch_frame.get()) && link->send_frame(switch_frame);
+}
+
+void EnhancedProtocol::process_switch_frame(const UartFrame* frame)
+{
+	if (frame->data_length < SWITCH_PAYLOAD_SIZE) return;
+
+	uint8_t op = frame->data[0];
+	CommunicationMode mode = (CommunicationMode)frame->data[1];
+	uint16_t id = frame->sequence_num;
+
+	switch (op)
 	{
-		UartFrame switch_cmd;
-		uint8_t cmd_data[] = "SWITCH_TO_SPI";
-		if (create_frame(TYPE_DATA, cmd_data, sizeof(cmd_data) - 1, &switch_cmd))
+	case SWITCH_REQUEST:
+		if (handover_state == HANDOVER_ACCEPTED && id == handover_id)
+		{
+			send_switch(comm_interface, SWITCH_ACCEPT, id, mode);//our ACCEPT was lost
+			handover_sent = micros();
+		}
+		else if (handover_state != HANDOVER_IDLE || standby_interface || !get_interface(mode) || get_interface(mode) == comm_interface)
+		{
+			LOG_WARN("Handover %u to %s refused", id, mode == MODE_UART ? "UART" : "SPI");
+			send_switch(comm_interface, SWITCH_ABORT, id, mode);
+		}
+		else
 		{
-			comm_interface->send(&switch_cmd);
-			Serial.println("SPI switch command sent via UART");
+			//Peer: listen on the new link as well, keep sending on the old one until CONFIRM proves the new one
+			handover_id = id;
+			handover_target = mode;
+			handover_started = micros();
+			standby_interface = get_interface(mode);
+			standby_interface->reset_receiver();//stale bytes from while the link was idle
+			send_switch(comm_interface, SWITCH_ACCEPT, id, mode);
+			handover_state = HANDOVER_ACCEPTED;
+			handover_sent = micros();
+		}
+		break;
+
+	case SWITCH_ACCEPT:
+		//Initiator: the peer listens on both links, probe the new one
+		if (handover_state != HANDOVER_REQUESTED || id != handover_id) break;
+		standby_interface = get_interface(handover_target);
+		standby_interface->reset_receiver();
+		handover_state = HANDOVER_CONFIRMING;
+		handover_attempts = 1;
+		send_switch(standby_interface, SWITCH_CONFIRM, id, handover_target);
+		handover_sent = micros();
+		break;
 
-			//Wait for slave to acknowledge
-			delay(500);
+	case SWITCH_CONFIRM:
+		if (id != handover_id) break;
+		if (handover_state == HANDOVER_ACCEPTED)
+		{
+			//Peer: new link works towards us, send on it from now on and keep draining the old one
+			swap_links();
+			send_switch(comm_interface, SWITCH_CONFIRMED, id, mode);
+			finish_handover(true);
+		}
+		else if (handover_state == HANDOVER_IDLE && standby_interface)
+		{
+			send_switch(comm_interface, SWITCH_CONFIRMED, id, mode);//our CONFIRMED was lost
 		}
-	}*/
+		break;
+
+	case SWITCH_CONFIRMED:
+		if (handover_state != HANDOVER_CONFIRMING || id != handover_id) break;
 
-	static SPIInterface spi_interface(true, SPI_CS);
-	spi_interface.begin();
-	set_communication_interface(&spi_interface);
-	Serial.println("Switched to SPI mode");
+		//First round trip on the new link seeds its RTO (Karn: not after a resent CONFIRM)
+		if (handover_attempts == 1)
+		{
+			get_rto_estimator(handover_target).sample(micros() - handover_sent);
+		}
+		swap_links();
+		finish_handover(true);
+		break;
+
+	case SWITCH_ABORT:
+		if (id != handover_id) break;
+		if (handover_state != HANDOVER_IDLE)
+		{
+			finish_handover(false);
+		}
+		else if (standby_interface && get_current_mode() == handover_target)
+		{
+			//Initiator never saw our CONFIRMED and stayed on the old link, follow it
+			LOG_WARN("Handover %u aborted by the peer after it completed", id);
+			perf_monitor.switch_failed();
+			swap_links();
+			drop_standby();
+		}
+		break;
+	}
 }
 
-void EnhancedProtocol::switch_to_uart(HardwareSerial* serial_port, uint32_t baud_rate)
+void EnhancedProtocol::service_handover()
+{
+	if (handover_state == HANDOVER_IDLE)
+	{
+		//Old link settled: nothing more can arrive on it, and the initiator can no longer abort
+		if (standby_interface && millis() - last_switch_ms >= SWITCH_SETTLE_MS)
+		{
+			drop_standby();
+		}
+		return;
+	}
+
+	uint32_t elapsed_us = micros() - handover_sent;
+	if (handover_state == HANDOVER_ACCEPTED)
+	{
+		//Peer: the initiator gets MAX_RETRIES CONFIRM attempts before it aborts
+		if (elapsed_us >= SWITCH_SETTLE_MS * 1000UL)
+		{
+			LOG_WARN("Handover %u not confirmed, staying on %s", handover_id, get_current_mode() == MODE_UART ? "UART" : "SPI");
+			finish_handover(false);
+		}
+		return;
+	}
+
+	if (elapsed_us < SWITCH_TIMEOUT_MS * 1000UL) return;
+	if (handover_attempts >= MAX_RETRIES)
+	{
+		LOG_WARN("Handover %u to %s failed, staying on the old link", handover_id, handover_target == MODE_UART ? "UART" : "SPI");
+		send_switch(comm_interface, SWITCH_ABORT, handover_id, handover_target);//peer stops waiting
+		finish_handover(false);
+		return;
+	}
+
+	handover_attempts++;
+	if (handover_state == HANDOVER_REQUESTED) send_switch(comm_interface, SWITCH_REQUEST, handover_id, handover_target);
+	else send_switch(standby_interface, SWITCH_CONFIRM, handover_id, handover_target);
+	handover_sent = micros();
+}
+
+void EnhancedProtocol::swap_links()
+{
+	CommunicationInterface* old_link = comm_interface;
+	comm_interface = standby_interface;
+	standby_interface = old_link;
+	perf_monitor.rto_updated(get_rto_us());
+}
+
+void EnhancedProtocol::drop_standby()
 {
-	//For switching mode to UART
+	standby_interface->reset_receiver();
+	standby_interface = nullptr;
+}
+
+void EnhancedProtocol::finish_handover(bool switched)
+{
+	if (switched)
+	{
+		uint32_t elapsed_us = micros() - handover_started;
+		perf_monitor.switch_completed(elapsed_us);
+		LOG_INFO("Handover %u to %s done in %lu us", handover_id, handover_target == MODE_UART ? "UART" : "SPI", elapsed_us);
+	}
+	else
+	{
+		//Never sent on the new link, nothing to move back
+		perf_monitor.switch_failed();
+		if (standby_interface) drop_standby();
+	}
+	handover_state = HANDOVER_IDLE;
+	last_switch_ms = millis();
+}
+
+void EnhancedProtocol::switch_to_spi(uint8_t cs_pin, SPIClass* /*spi_instance*/, uint32_t /*frequency*/)
+{
+	//Handshake with the slave over the current link, see begin_switch()
+	if (!get_interface(MODE_SPI))
+	{
+		static SPIInterface spi_interface(true, cs_pin);
+		spi_interface.begin();
+		add_interface(&spi_interface);
+	}
 
-	if (serial_port)
+	if (!comm_interface)
+	{
+		set_communication_interface(get_interface(MODE_SPI));
+	}
+	else if (begin_switch(MODE_SPI))
 	{
-		serial_port->begin(baud_rate);
+		Serial.println("SPI handover started");
 	}
-	Serial.println("Switched to UART mode");
+}
 
-	/*static UARTInterface uart_interface(serial_port, baud_rate);
-	uart_interface.begin();
-	set_communication_interface(&uart_interface);
-	Serial.println("Switched to UART mode");*/
+void EnhancedProtocol::switch_to_uart(HardwareSerial* serial_port, uint32_t baud_rate)
+{
+	//For switching mode to UART, handshake with the slave over the current link
+	if (!get_interface(MODE_UART))
+	{
+		if (!serial_port) return;
+		static UARTInterface uart_interface(serial_port, baud_rate);
+		uart_interface.begin();
+		add_interface(&uart_interface);
+	}
+
+	if (!comm_interface)
+	{
+		set_communication_interface(get_interface(MODE_UART));
+	}
+	else if (begin_switch(MODE_UART))
+	{
+		Serial.println("UART handover started");
+	}
 }
\ No newline at end of file
@@ -5,8 +5,51 @@
 #include "protocol.h"
 #include "communication_interface.h"
 #include "auto_switch.h"
+#include "sliding_window.h"
+#include "fragmentation.h"
+#include "rto_estimator.h"
+#include "lzss.h"
+#include "reed_solomon.h"
 #include <SPI.h>
 
+#define BATCH_DELAY_MS 10//longest a message waits in an open batch (Nagle timer)
+#define MAX_ASYNC_SENDS 8//outstanding send_async() frames
+#define MAX_NACK_RESENDS 8//immediate resends per frame on NACK, outside MAX_RETRIES, then the timer takes over
+
+//Link handover: TYPE_SWITCH data = op(1) mode(1), seq = handover id
+#define SWITCH_PAYLOAD_SIZE 2
+#define SWITCH_TIMEOUT_MS 50//per REQUEST/CONFIRM attempt, MAX_RETRIES attempts before falling back
+#define SWITCH_SETTLE_MS ((MAX_RETRIES + 1) * SWITCH_TIMEOUT_MS)//peer wait for CONFIRM, old link drain time
+#define SWITCH_HOLDOFF_MS 5000//least time on a link before perform_auto_switch() leaves it
+
+#define LINK_ANY 0xFF//select_link(): no link to avoid
+
+//Compression negotiation: TYPE_PING / TYPE_PONG data = op(1) mode(1) dictionary id(2), not sequenced
+#define PROBE_COMPRESSION 0x01
+#define COMPRESSION_PROBE_SIZE 4
+#define COMPRESSION_PROBE_MS 200//between probes, MAX_RETRIES unanswered probes leave the link uncompressed
+#define COMPRESSION_MIN_LEN 8//shorter payloads are sent as they are
+
+//FEC parity covers version, type|flags (less FRAME_FLAG_ACK), seq and len, then the data: the piggybacked
+//ack is attached at send time and stays outside, a frame repaired without its CRC drops it
+#define FEC_HEADER_SIZE 6
+
+static_assert(RS_PARITY_BYTES <= FRAGMENT_MAX_RESERVE, "fragments cannot leave room for the FEC parity");
+
+enum SwitchOp
+{
+	SWITCH_REQUEST = 0x01,//initiator -> peer on the old link
+	SWITCH_ACCEPT = 0x02,//peer -> initiator on the old link, peer now reads both links
+	SWITCH_CONFIRM = 0x03,//initiator -> peer on the new link, peer sends on the new link from here on
+	SWITCH_CONFIRMED = 0x04,//peer -> initiator on the new link, initiator moves over, handover done
+	SWITCH_ABORT = 0x05//on the old link: refused or timed out, both stay on the old link
+};
+
+typedef void (*FrameHandler)(UartFrame* frame);
+typedef void (*MessageHandler)(const uint8_t* data, uint8_t length);
+typedef bool (*FrameSource)(void* context, uint16_t index, FrameHandle& frame);//builds or fetches frame 'index' of a window transfer
+typedef void (*SendCallback)(void* context, uint16_t seq_num, bool delivered);//send_async() completion
+
 class EnhancedProtocol : public Protocol//Derived Class of Class Protocol
 {
 private:
@@ -14,24 +57,232 @@ private:
 	AutoSwitchProtocol auto_switch;
 	bool auto_switch_enable;
 
+	//Selective-repeat sender state, slot = frame index % MAX_WINDOW_SIZE
+	struct WindowSlot
+	{
+		FrameHandle frame;//held until the slot slides out of the window
+		uint32_t sent_time;//micros()
+		uint8_t attempts;//transmissions that reached the wire
+		uint8_t link;//link index of the last transmission
+		uint8_t nacks;//resends on NACK
+		bool unsent;//send_frame() failed locally, sent_time is the first failure
+		bool acked;
+		bool done;//acked or given up
+	};
+	WindowSlot tx_window[MAX_WINDOW_SIZE];
+	uint8_t window_size;
+
+	//Non-blocking sends, driven by service()
+	struct AsyncSend
+	{
+		UartFrame* frame;//nullptr = free
+		FrameHandle handle;//keeps a pooled frame alive, empty for caller-owned frames
+		SendCallback callback;
+		void* context;
+		uint32_t sent_time;//micros()
+		uint8_t attempts;//transmissions that reached the wire
+		uint8_t link;//link index of the last transmission
+		uint8_t nacks;//resends on NACK
+		bool unsent;//send_frame() failed locally, sent_time is the first failure
+	};
+	AsyncSend async_sends[MAX_ASYNC_SENDS];
+	uint8_t async_pending;
+
+	bool stream_opened;//our first sequenced frame went out with FRAME_FLAG_SYN
+	ReceiveWindow rx_window;
+	ReorderBuffer reorder;
+
+	//Retransmission timeout per link mode, UART and SPI round trips differ by orders of magnitude
+	RtoEstimator rto_estimators[2];
+
+	//Inbound DATA seen while waiting for ACKs
+	FrameHandler frame_handler;
+
+	//Delayed ACK, piggybacked on the next outgoing DATA frame when possible
+	uint16_t delayed_ack_ms;//0 = ACK immediately
+	bool ack_pending;
+	uint16_t pending_ack_seq;
+	uint32_t ack_pending_since;
+
+	//Nagle-style batching: small messages are appended to an open TYPE_BATCH frame
+	FrameHandle batch_frame;//records are written straight into its data
+	uint16_t batch_length;
+	uint32_t batch_opened;//millis() of the first record
+	uint16_t batch_delay_ms;
+	MessageHandler message_handler;
+	uint32_t messages_sent;
+	uint32_t batches_sent;
+
+	//Large messages: fragments go through the sliding window, the receiver reassembles into a caller buffer
+	uint8_t next_message_id;
+	Reassembler reassembler;
+
+	//Live link handover, sequence numbers and windows live here and carry over unchanged
+	enum HandoverState
+	{
+		HANDOVER_IDLE,
+		HANDOVER_REQUESTED,//initiator, REQUEST sent on the old link
+		HANDOVER_CONFIRMING,//initiator, CONFIRM sent on the new link, still sending on the old one
+		HANDOVER_ACCEPTED//peer, reading both links, waiting for CONFIRM
+	};
+	CommunicationInterface* interfaces[2];//per mode, indexed like rto_estimators
+	CommunicationInterface* standby_interface;//other link, read alongside comm_interface until the handover settles
+	CommunicationInterface* rx_source;//link of the frame last returned by receive_frame(), nullptr = comm_interface
+	uint8_t reply_link;//link index the last validated frame came in on, bonded ACK / NACK go back on it
+	HandoverState handover_state;
+	CommunicationMode handover_target;
+	uint16_t handover_id;
+	uint8_t handover_attempts;
+	uint32_t handover_started;//micros(), REQUEST sent or received
+	uint32_t handover_sent;//micros(), last REQUEST/CONFIRM sent or ACCEPT sent by the peer
+	uint32_t last_switch_ms;//millis(), handover finished (settle start)
+
+	//Bonding: DATA is striped over both links, each frame goes where it is expected to arrive first
+	struct LinkStats
+	{
+		uint32_t busy_until;//micros(), estimated end of what this link was handed
+		uint16_t delivery_q8;//EWMA of frames acknowledged (256) vs timed out (0), gain 1/8
+		uint32_t frames_sent;
+		uint32_t bytes_sent;
+		uint32_t bytes_acked;
+	};
+	LinkStats links[2];//indexed like interfaces
+	bool bonding;
+	uint8_t tx_link;//link index of the last send_frame()
+	uint8_t rx_turn;//receive_frame() alternates between the links it reads
+	uint32_t bonding_started;//millis(), per-link throughput is measured from here
+
+	//Payload compression, per link: requested with set_compression(), on once the peer answered the probe
+	enum CompressionState { COMPRESSION_OFF, COMPRESSION_PROBING, COMPRESSION_ON };
+	CompressionState compression[2];//indexed like interfaces
+	uint8_t compression_probes[2];
+	uint32_t compression_probe_sent[2];//millis()
+	LZSS::Dictionary compression_dictionary;
+
+	bool fec[2];//forward error correction on frames sent over the link, indexed like interfaces
+
 public:
 	EnhancedProtocol(bool enable_auto_switch = true);
 	virtual ~EnhancedProtocol() = default;
 
-	void set_communication_interface(CommunicationInterface* interface);
+	void set_communication_interface(CommunicationInterface* interface);//also registers it for its mode
 	CommunicationInterface* get_comm_interface() { return comm_interface; }
+	FrameHandle receive_frame();//from the active link, or from the old one while a handover drains it
+
+	//Non-blocking reliable send: the frame goes out now, service() matches ACKs, retransmits on RTO
+	//and calls callback once it is acknowledged or MAX_RETRIES attempts have timed out
+	bool send_async(const FrameHandle& frame, SendCallback callback = nullptr, void* context = nullptr);//false if no slot is free
+	bool send_async(UartFrame* frame, SendCallback callback = nullptr, void* context = nullptr);//frame must stay valid until the callback
+	bool service();//call from loop(): receive, ACK matching, retransmit timers, delayed ACKs. True if anything happened
+	//The two halves of service() for callers that receive frames themselves (see ProtocolTasks)
+	void process_frame(UartFrame* frame);//validated inbound frame: ACK matching, then the frame handler
+	bool service_timers();//delayed ACKs and retransmissions
+	uint8_t get_pending_sends() const { return async_pending; }
+	bool can_send_async(uint16_t seq_num);//free slot, and seq_num within RX_WINDOW_SPAN of every outstanding send
 
 	//Override methods for uinfied interface
-	bool send_reliable(UartFrame* frame);
-	bool wait_for_ack(uint16_t seq_num, uint32_t timeout_ms);
+	bool send_reliable(UartFrame* frame);//send_async() + service() until it completes
+	bool wait_for_ack(uint16_t seq_num, uint32_t timeout_us);
+
+	//Sliding window ARQ (selective repeat), window size 1 = stop-and-wait
+	void set_window_size(uint8_t size);
+	uint8_t get_window_size() const { return window_size; }
+	uint16_t send_reliable(const FrameHandle* frames, uint16_t count);//pooled frames, returns frames delivered
+	//Frames are requested as the window opens. stop_on_loss: once a frame is given up no new ones are
+	//requested, for transfers that are useless incomplete (fragments)
+	uint16_t send_window(FrameSource source, void* context, uint16_t count, bool stop_on_loss = false);
+
+	//Receiver side: duplicate filter and cumulative/SACK acknowledgements
+	bool accept_data_frame(const UartFrame* frame);//false for duplicates
+	bool send_ack(uint16_t seq_num);
+	bool send_nack(uint16_t seq_num);
+
+	//Piggybacked acknowledgements
+	void set_delayed_ack(uint16_t delay_ms) { delayed_ack_ms = delay_ms; }
+	void queue_ack(uint16_t seq_num);//ACK now, or on the next DATA frame within delayed_ack_ms
+	void service_acks();//standalone ACK once the delayed-ACK timer expires
+
+	//In-order delivery: accepted DATA, BATCH and FRAGMENT frames go in, come out by sequence number from the
+	//sender's SYN frame on (bonded links and selective repeat deliver out of order). hold_in_order() false =
+	//deliver that frame now yourself.
+	bool hold_in_order(const FrameHandle& frame) { return reorder.push(frame); }
+	FrameHandle next_in_order() { return reorder.pop(); }
+	ReorderBuffer& get_reorder_buffer() { return reorder; }
+
+	//Called with validated DATA frames received while send_reliable is waiting
+	void set_frame_handler(FrameHandler handler) { frame_handler = handler; }
+
+	//Message batching: send_message() appends to the open batch, which goes out reliably when the next
+	//message does not fit, when it is batch_delay_ms old (service_batch) or on flush_batch()
+	bool send_message(const uint8_t* data, uint8_t length);//up to MAX_BATCH_RECORD_LEN bytes
+	bool flush_batch();//true if there was nothing to send or the batch was delivered
+	void service_batch();
+	void set_batch_delay(uint16_t delay_ms) { batch_delay_ms = delay_ms; }
+	uint16_t get_batch_delay() const { return batch_delay_ms; }
+	void set_message_handler(MessageHandler handler) { message_handler = handler; }
+	uint16_t deliver_batch(const UartFrame* frame);//message_handler per record, returns records
+	uint32_t get_messages_sent() const { return messages_sent; }
+	uint32_t get_batches_sent() const { return batches_sent; }
+
+	//Fragmentation: messages up to MAX_MESSAGE_SIZE bytes as numbered TYPE_FRAGMENT frames, sent a window
+	//at a time so only missing fragments are resent. The receiver reports each message once it is whole.
+	bool send_fragmented(const uint8_t* data, uint32_t length);//true when every fragment was acknowledged
+	void set_reassembly_buffer(uint8_t* buffer, uint32_t capacity, MessageCompleteHandler handler) { reassembler.set_buffer(buffer, capacity, handler); }
+	bool can_reassemble(const UartFrame* frame) const { return reassembler.fits(frame); }//false: do not ACK, the message cannot be taken
+	FragmentStatus deliver_fragment(const UartFrame* frame) { return reassembler.accept(frame); }
+	Reassembler& get_reassembler() { return reassembler; }
+
+	//Validate a frame just returned by the interface, reusing its receive-time CRC when available
+	bool validate_received_frame(UartFrame* frame);
+
+	//Live handover (make before break): both ends register an interface per mode, one side calls begin_switch().
+	//REQUEST/ACCEPT go over the old link, CONFIRM/CONFIRMED over the new one. Each end keeps sending on the
+	//old link until the new one has carried a frame both ways, and reads both until SWITCH_SETTLE_MS after
+	//the switch; if confirmation times out both simply stay on the old link. Sequence numbers, windows and
+	//outstanding sends carry over unchanged. Driven by service() / service_timers(); switch time is
+	//reported by PerformanceMonitor.
+	void add_interface(CommunicationInterface* interface);
+	CommunicationInterface* get_interface(CommunicationMode mode) { return interfaces[link_index(mode)]; }
+	bool begin_switch(CommunicationMode mode);//false if a handover is running or settling, or mode has no interface
+	bool is_switching() const { return handover_state != HANDOVER_IDLE; }
+
+	//Bonding: both ends read both links, DATA and ACKs go out on whichever link is expected to deliver
+	//first (queued + serialization time at the link rate and half its SRTT, plus its RTO weighted by its
+	//recent loss), so a degrading link sheds traffic to the other without a switch. Both ends must enable it.
+	bool set_bonding(bool enable);//false if an interface is missing or a handover is running
+	bool is_bonding() const { return bonding; }
+	uint32_t get_link_frames(CommunicationMode mode) const { return links[link_index(mode)].frames_sent; }
+	float get_link_throughput_kbps(CommunicationMode mode) const;//acknowledged wire bytes since set_bonding()
+	float get_link_delivery(CommunicationMode mode) const { return links[link_index(mode)].delivery_q8 * 100.0f / 256; }//%
+	void print_link_statistics();
+
+	//Payload compression: DATA, BATCH and FRAGMENT payloads are LZSS-compressed against a preset dictionary
+	//while the active link has compression on, and go out as they are when that does not shrink them.
+	//set_compression() asks the peer (PING/PONG with the dictionary id, over the active link) and compresses on
+	//that link only once it answered with the same dictionary. Receivers decompress in validate_received_frame().
+	bool create_frame(PacketType type, const uint8_t* data, uint16_t data_len, UartFrame* frame) override;//Protocol::create_frame, compressed
+	void set_compression_dictionary(const uint8_t* dictionary, uint16_t length);//same bytes on both ends, renegotiates
+	bool set_compression(CommunicationMode mode, bool enable);//false if mode has no interface
+	bool is_compressing(CommunicationMode mode) const { return compression[link_index(mode)] == COMPRESSION_ON; }
+	const LZSS::Dictionary& get_compression_dictionary() const { return compression_dictionary; }
+
+	//Forward error correction: while the active link has FEC on, frames from create_frame() and ACK / NACK
+	//carry RS_PARITY_BYTES of Reed-Solomon parity, and a receiver repairs up to RS_PARITY_BYTES / 2 corrupted
+	//bytes instead of NACKing. Only the sender opts in, validate_received_frame() repairs and strips the parity
+	//of any FEC frame. Payloads with no room left for the parity go out unprotected.
+	bool set_fec(CommunicationMode mode, bool enable);//false if mode has no interface
+	bool is_fec_enabled(CommunicationMode mode) const { return fec[link_index(mode)]; }
+	uint16_t get_payload_capacity() const;//largest payload that still gets FEC on the active link
 
 	//Mode management
 	void switch_to_spi(uint8_t cs_pin, SPIClass* spi_instance, uint32_t frequency = 1000000);
 	void switch_to_uart(HardwareSerial* serial_port, uint32_t frequency = 115200);
 	CommunicationMode get_current_mode() const;
 
-	uint32_t calculate_dynamic_timeout();
-	
+	//Adaptive retransmission timeout (RFC 6298), exported to PerformanceMonitor::get_rto_us()
+	RtoEstimator& get_rto_estimator(CommunicationMode mode) { return rto_estimators[link_index(mode)]; }
+	uint32_t get_rto_us() { return current_rto().get_rto_us(); }
+	void set_rto_bounds(uint32_t min_us, uint32_t max_us);
 
 	//Auto_switch access
 	void enable_auto_switch(bool enable) { auto_switch_enable = enable; }
@@ -39,6 +290,37 @@ public:
 	void perform_auto_switch();//Manual trigger
 
 private:
-	bool send_frame(UartFrame* frame);
+	static uint8_t link_index(CommunicationMode mode) { return mode == MODE_SPI ? 1 : 0; }
+	bool send_frame(UartFrame* frame, uint8_t avoid_link = LINK_ANY);//sets tx_link
+	CommunicationInterface* select_link(const UartFrame* frame, uint8_t avoid_link = LINK_ANY);//sets tx_link, bonded resends avoid the link that timed out
+	CommunicationInterface* select_reply_link(const UartFrame* frame);//ACK / NACK
+	void link_acked(uint8_t link, uint16_t wire_bytes);
+	void link_timed_out(uint8_t link);
+	void attach_pending_ack(UartFrame* frame);
+	void dispatch_inbound(UartFrame* frame);
+	bool transmit_window_slot(UartFrame* frame, WindowSlot& slot, bool counted = true);//counted: uses an attempt of MAX_RETRIES
+	void process_window_ack(const UartFrame* response, uint16_t base, uint16_t next);
+	AsyncSend* free_async_slot();
+	bool start_async(UartFrame* frame, const FrameHandle& handle, SendCallback callback, void* context);
+	void transmit_async(AsyncSend& send, bool counted = true);
+	bool unsent_expired(uint32_t first_failure, uint8_t link) const;
+	void process_async_ack(const UartFrame* response);
+	void complete_async(AsyncSend& send, bool delivered);
+	RtoEstimator& current_rto() { return get_rto_estimator(get_current_mode()); }
+	void rto_sample(uint16_t seq_num, bool retransmitted, uint8_t link);
+	void rto_backoff(uint8_t link);
+	bool send_switch(CommunicationInterface* link, uint8_t op, uint16_t id, CommunicationMode mode);
+	void process_switch_frame(const UartFrame* frame);
+	bool send_compression_probe(PacketType type, CommunicationMode mode);
+	void process_probe_frame(const UartFrame* frame);
+	void service_compression();
+	bool decompress_payload(UartFrame* frame);
+	void add_fec(UartFrame* frame);//recomputes the CRC when it adds parity
+	bool repair_frame(UartFrame* frame);
+	static void fec_header(const UartFrame* frame, uint8_t* header);
+	void service_handover();
+	void swap_links();//comm_interface <-> standby_interface
+	void drop_standby();
+	void finish_handover(bool switched);
 };
 #endif // !ENHANCED_PROTOCOL_H
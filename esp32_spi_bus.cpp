@@ -0,0 +1,90 @@
+#include "esp32_spi_bus.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <string.h>
+
+ESP32DMABus::ESP32DMABus(spi_host_device_t spi_host, int8_t cs, int8_t sck, int8_t miso, int8_t mosi) :
+	host(spi_host), cs_pin(cs), sck_pin(sck), miso_pin(miso), mosi_pin(mosi), device(nullptr), clock_hz(0), next_descriptor(0), in_flight(0)
+{
+}
+
+ESP32DMABus::~ESP32DMABus()
+{
+	if (device)
+	{
+		spi_bus_remove_device(device);
+		spi_bus_free(host);
+	}
+}
+
+bool ESP32DMABus::begin(uint32_t clock)
+{
+	if (device) return true;
+
+	spi_bus_config_t bus = {};
+	bus.mosi_io_num = mosi_pin;
+	bus.miso_io_num = miso_pin;
+	bus.sclk_io_num = sck_pin;
+	bus.quadwp_io_num = -1;
+	bus.quadhd_io_num = -1;
+	bus.max_transfer_sz = SPI_TRANSFER_SIZE;
+	if (spi_bus_initialize(host, &bus, SPI_DMA_CH_AUTO) != ESP_OK) return false;
+
+	spi_device_interface_config_t config = {};
+	config.clock_speed_hz = clock;
+	config.mode = 0;
+	config.spics_io_num = cs_pin;
+	config.cs_ena_pretrans = 2;//CS guard in SPI clock cycles
+	config.cs_ena_posttrans = 2;
+	config.queue_size = SPI_QUEUE_DEPTH;
+	if (spi_bus_add_device(host, &config, &device) != ESP_OK)
+	{
+		spi_bus_free(host);
+		device = nullptr;
+		return false;
+	}
+	clock_hz = clock;
+	return true;
+}
+
+bool ESP32DMABus::queue(SPITransaction* transaction)
+{
+	if (!device || in_flight == SPI_QUEUE_DEPTH) return false;
+	if (transaction->cs_pin >= 0 && transaction->cs_pin != cs_pin) return false;//one device, its CS is the hardware's
+
+	//DMA moves whole 32-bit words: round the transfer up, the padding goes out as zeros
+	uint16_t length = (transaction->length + 3) & ~3;
+	memset(&transaction->tx[transaction->length], 0, length - transaction->length);
+	transaction->length = length;
+
+	spi_transaction_t& descriptor = descriptors[next_descriptor];
+	memset(&descriptor, 0, sizeof(descriptor));
+	descriptor.length = transaction->length * 8;
+	descriptor.rxlength = descriptor.length;
+	descriptor.tx_buffer = transaction->tx;
+	descriptor.rx_buffer = transaction->rx;
+	descriptor.user = transaction;
+	if (spi_device_queue_trans(device, &descriptor, 0) != ESP_OK) return false;
+
+	next_descriptor = (next_descriptor + 1) % SPI_QUEUE_DEPTH;
+	in_flight++;
+	return true;
+}
+
+SPITransaction* ESP32DMABus::poll()
+{
+	return wait(0);
+}
+
+SPITransaction* ESP32DMABus::wait(uint32_t timeout_us)
+{
+	if (!device || in_flight == 0) return nullptr;
+
+	spi_transaction_t* descriptor;
+	TickType_t ticks = timeout_us ? pdMS_TO_TICKS(timeout_us / 1000 + 1) : 0;
+	if (spi_device_get_trans_result(device, &descriptor, ticks) != ESP_OK) return nullptr;
+
+	in_flight--;
+	return (SPITransaction*)descriptor->user;
+}
+#endif
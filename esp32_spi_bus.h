@@ -0,0 +1,38 @@
+#pragma once
+#ifndef ESP32_SPI_BUS_H
+#define ESP32_SPI_BUS_H
+
+//SPIBusDriver on the ESP-IDF spi_master driver: transactions are queued to the DMA engine
+//and CS is driven by hardware, so there are no per-frame CS delays or CPU byte loops.
+
+#include "spi_bus.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <driver/spi_master.h>
+
+class ESP32DMABus : public SPIBusDriver
+{
+private:
+	spi_host_device_t host;
+	int8_t cs_pin, sck_pin, miso_pin, mosi_pin;
+	spi_device_handle_t device;
+	uint32_t clock_hz;
+
+	spi_transaction_t descriptors[SPI_QUEUE_DEPTH];//must stay valid until the result is fetched
+	uint8_t next_descriptor;
+	uint8_t in_flight;
+
+public:
+	ESP32DMABus(spi_host_device_t spi_host, int8_t cs, int8_t sck, int8_t miso, int8_t mosi);
+	~ESP32DMABus();
+
+	bool begin(uint32_t clock) override;
+	bool queue(SPITransaction* transaction) override;
+	SPITransaction* poll() override;
+	SPITransaction* wait(uint32_t timeout_us) override;
+	uint8_t get_in_flight() const override { return in_flight; }
+	uint32_t get_clock_hz() const override { return clock_hz; }
+};
+#endif
+
+#endif // !ESP32_SPI_BUS_H
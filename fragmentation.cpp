@@ -0,0 +1,117 @@
+#include "fragmentation.h"
+#include "logger.h"
+#include <string.h>
+
+uint16_t encode_fragment(uint8_t* buffer, uint8_t message_id, uint16_t index, const uint8_t* message, uint32_t message_length,
+	uint16_t slice)
+{
+	uint16_t count = fragment_count(message_length, slice);
+	uint32_t offset = (uint32_t)index * slice;
+	uint16_t payload = (uint16_t)(message_length - offset < slice ? message_length - offset : slice);
+
+	buffer[0] = message_id;
+	buffer[1] = (uint8_t)(index & 0xFF);
+	buffer[2] = (uint8_t)(index >> 8);
+	buffer[3] = (uint8_t)(count & 0xFF);
+	buffer[4] = (uint8_t)(count >> 8);
+	buffer[5] = (uint8_t)(FRAGMENT_PAYLOAD_SIZE - slice);
+	memcpy(&buffer[FRAGMENT_HEADER_SIZE], &message[offset], payload);
+	return FRAGMENT_HEADER_SIZE + payload;
+}
+
+Reassembler::Reassembler() : buffer(nullptr), capacity(0), handler(nullptr), completed_messages(0), abandoned_messages(0), rejected_fragments(0)
+{
+	reset();
+}
+
+void Reassembler::set_buffer(uint8_t* message_buffer, uint32_t buffer_capacity, MessageCompleteHandler on_complete)
+{
+	buffer = message_buffer;
+	capacity = buffer_capacity;
+	handler = on_complete;
+	reset();
+}
+
+void Reassembler::reset()
+{
+	active = false;
+	complete = false;
+	message_id = 0;
+	expected = 0;
+	slice = 0;
+	received = 0;
+	length = 0;
+}
+
+void Reassembler::start(uint8_t id, uint16_t count, uint16_t fragment_slice)
+{
+	if (is_active()) abandoned_messages++;
+
+	active = true;
+	complete = false;
+	message_id = id;
+	expected = count;
+	slice = fragment_slice;
+	received = 0;
+	length = 0;
+	memset(received_bitmap, 0, (count + 7) / 8);
+}
+
+bool Reassembler::fits(const UartFrame* frame) const
+{
+	if (!frame || frame->packet_type != TYPE_FRAGMENT || frame->data_length <= FRAGMENT_HEADER_SIZE || !buffer) return false;
+
+	uint16_t index = frame->data[1] | ((uint16_t)frame->data[2] << 8);
+	uint16_t count = frame->data[3] | ((uint16_t)frame->data[4] << 8);
+	uint8_t reserve = frame->data[5];
+	uint16_t fragment_slice = FRAGMENT_PAYLOAD_SIZE - reserve;
+	uint16_t payload = frame->data_length - FRAGMENT_HEADER_SIZE;
+
+	bool last = index + 1 == count;
+	if (reserve > FRAGMENT_MAX_RESERVE || count == 0 || count > MAX_FRAGMENTS || index >= count || (!last && payload != fragment_slice) ||
+		payload > fragment_slice)
+	{
+		return false;
+	}
+
+	//The whole message must fit, not just this slice: a fragment early in a message too big is no use either
+	uint32_t message_bytes = (uint32_t)(count - 1) * fragment_slice + (last ? payload : 1);
+	return message_bytes <= capacity;
+}
+
+FragmentStatus Reassembler::accept(const UartFrame* frame)
+{
+	if (!fits(frame))
+	{
+		if (frame && frame->data_length > FRAGMENT_HEADER_SIZE) LOG_WARN("Fragment of message %u rejected, %lu byte buffer", frame->data[0], capacity);
+		rejected_fragments++;
+		return FRAGMENT_REJECTED;
+	}
+
+	uint8_t id = frame->data[0];
+	uint16_t index = frame->data[1] | ((uint16_t)frame->data[2] << 8);
+	uint16_t count = frame->data[3] | ((uint16_t)frame->data[4] << 8);
+	uint16_t fragment_slice = FRAGMENT_PAYLOAD_SIZE - frame->data[5];
+	uint16_t payload = frame->data_length - FRAGMENT_HEADER_SIZE;
+	uint32_t offset = (uint32_t)index * fragment_slice;
+	bool last = index + 1 == count;
+
+	//A different id or shape is a new message, the old one is given up
+	if (!active || id != message_id || count != expected || fragment_slice != slice) start(id, count, fragment_slice);
+	if (complete) return FRAGMENT_STORED;//late retransmission of a finished message
+
+	uint8_t mask = (uint8_t)(1 << (index & 7));
+	if (received_bitmap[index >> 3] & mask) return FRAGMENT_STORED;//duplicate
+	received_bitmap[index >> 3] |= mask;
+
+	memcpy(&buffer[offset], &frame->data[FRAGMENT_HEADER_SIZE], payload);
+	received++;
+	if (last) length = offset + payload;
+
+	if (received < expected) return FRAGMENT_STORED;
+
+	complete = true;
+	completed_messages++;
+	if (handler) handler(message_id, buffer, length);
+	return FRAGMENT_COMPLETE;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#ifndef FRAGMENTATION_H
+#define FRAGMENTATION_H
+
+//Messages larger than one frame: TYPE_FRAGMENT frames carrying a fragment header and a slice of the message
+
+#include <stdint.h>
+#include "protocol.h"
+
+//Fragment header (little-endian): message id(1) index(2) count(2) reserve(1), then the payload slice.
+//Every fragment but the last carries exactly FRAGMENT_PAYLOAD_SIZE - reserve bytes: the sender leaves
+//reserve bytes of each frame for per-link overhead (FEC parity), the same for the whole message.
+#define FRAGMENT_HEADER_SIZE 6
+#define FRAGMENT_PAYLOAD_SIZE (MAX_DATA_LEN - FRAGMENT_HEADER_SIZE)//largest slice
+#define FRAGMENT_MAX_RESERVE 16
+#ifndef MAX_MESSAGE_SIZE
+#define MAX_MESSAGE_SIZE 65536UL
+#endif
+#define MAX_FRAGMENTS ((MAX_MESSAGE_SIZE + FRAGMENT_PAYLOAD_SIZE - FRAGMENT_MAX_RESERVE - 1) / (FRAGMENT_PAYLOAD_SIZE - FRAGMENT_MAX_RESERVE))
+
+static_assert(FRAGMENT_PAYLOAD_SIZE > FRAGMENT_MAX_RESERVE, "MAX_DATA_LEN leaves no room for a fragment slice");
+
+static_assert(MAX_FRAGMENTS <= 0xFFFF, "fragment index and count are 16-bit, raise MAX_DATA_LEN or lower MAX_MESSAGE_SIZE");
+
+typedef void (*MessageCompleteHandler)(uint8_t message_id, const uint8_t* data, uint32_t length);
+
+//What Reassembler::accept() did with a fragment
+enum FragmentStatus
+{
+	FRAGMENT_REJECTED,//malformed or beyond the buffer: do not ACK it, the sender gives the message up
+	FRAGMENT_STORED,//kept (or a copy of one already kept), the message is not complete yet
+	FRAGMENT_COMPLETE//completed the message, reported once
+};
+
+inline uint16_t fragment_count(uint32_t message_length, uint16_t slice = FRAGMENT_PAYLOAD_SIZE) { return (uint16_t)((message_length + slice - 1) / slice); }
+//slice: FRAGMENT_PAYLOAD_SIZE - FRAGMENT_MAX_RESERVE .. FRAGMENT_PAYLOAD_SIZE, returns data_length
+uint16_t encode_fragment(uint8_t* buffer, uint8_t message_id, uint16_t index, const uint8_t* message, uint32_t message_length,
+	uint16_t slice = FRAGMENT_PAYLOAD_SIZE);
+
+//Receiver side: collects one message at a time into a caller-provided buffer
+class Reassembler
+{
+private:
+	uint8_t* buffer;
+	uint32_t capacity;
+	MessageCompleteHandler handler;
+
+	bool active;
+	bool complete;//reported, later fragments of this message are ignored
+	uint8_t message_id;
+	uint16_t expected;//fragments in the message
+	uint16_t slice;//bytes in every fragment but the last
+	uint16_t received;
+	uint32_t length;//known once the last fragment is in
+	uint8_t received_bitmap[(MAX_FRAGMENTS + 7) / 8];
+
+	//Statistics
+	uint32_t completed_messages;
+	uint32_t abandoned_messages;//replaced by a new message before completing
+	uint32_t rejected_fragments;//malformed or beyond the buffer
+
+	void start(uint8_t id, uint16_t count, uint16_t fragment_slice);
+
+public:
+	Reassembler();
+
+	void set_buffer(uint8_t* message_buffer, uint32_t buffer_capacity, MessageCompleteHandler on_complete);
+	bool fits(const UartFrame* frame) const;//accept() would not reject it: check before the frame is ACKed
+	FragmentStatus accept(const UartFrame* frame);
+	void reset();
+
+	bool is_active() const { return active && !complete; }
+	uint16_t get_received() const { return received; }
+	uint16_t get_expected() const { return expected; }
+	uint32_t get_completed_messages() const { return completed_messages; }
+	uint32_t get_abandoned_messages() const { return abandoned_messages; }
+	uint32_t get_rejected_fragments() const { return rejected_fragments; }
+};
+
+#endif // !FRAGMENTATION_H
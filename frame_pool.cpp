@@ -0,0 +1,81 @@
+#include "frame_pool.h"
+#include <Arduino.h>
+
+FramePool frame_pool;
+
+FrameHandle::FrameHandle(const FrameHandle& other) : pool(other.pool), index(other.index)
+{
+	if (pool) pool->add_ref(index);
+}
+
+FrameHandle& FrameHandle::operator=(const FrameHandle& other)
+{
+	if (this != &other)
+	{
+		if (other.pool) other.pool->add_ref(other.index);
+		release();
+		pool = other.pool;
+		index = other.index;
+	}
+	return *this;
+}
+
+UartFrame* FrameHandle::get() const
+{
+	return pool ? &pool->frames[index] : nullptr;
+}
+
+void FrameHandle::release()
+{
+	if (pool)
+	{
+		pool->remove_ref(index);
+		pool = nullptr;
+	}
+}
+
+FramePool::FramePool() : in_use(0), high_water_mark(0), exhausted_count(0)
+{
+	for (uint8_t i = 0; i < FRAME_POOL_SIZE; i++)
+	{
+		ref_counts[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+FrameHandle FramePool::acquire()
+{
+	for (uint8_t i = 0; i < FRAME_POOL_SIZE; i++)
+	{
+		//Claim a free slot, another task may be claiming the same one
+		uint8_t expected = 0;
+		if (ref_counts[i].load(std::memory_order_relaxed) == 0 && ref_counts[i].compare_exchange_strong(expected, 1, std::memory_order_acquire))
+		{
+			uint8_t now_in_use = in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+			uint8_t peak = high_water_mark.load(std::memory_order_relaxed);
+			while (now_in_use > peak && !high_water_mark.compare_exchange_weak(peak, now_in_use, std::memory_order_relaxed)) {}
+			return FrameHandle(this, i);
+		}
+	}
+
+	exhausted_count.fetch_add(1, std::memory_order_relaxed);
+	return FrameHandle();
+}
+
+void FramePool::remove_ref(uint8_t index)
+{
+	//Release ordering: writes to the frame happen before the next owner claims it
+	uint8_t count = ref_counts[index].load(std::memory_order_relaxed);
+	while (count > 0 && !ref_counts[index].compare_exchange_weak(count, count - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {}
+	if (count == 1)
+	{
+		in_use.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+void FramePool::print_statistics()
+{
+	Serial.println("FRAME POOL:");
+	Serial.print(" In Use: "); Serial.print(get_in_use()); Serial.print("/"); Serial.println(FRAME_POOL_SIZE);
+	Serial.print(" High-water Mark: "); Serial.println(get_high_water_mark());
+	Serial.print(" Exhausted: "); Serial.println(get_exhausted_count());
+}
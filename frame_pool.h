@@ -0,0 +1,69 @@
+#pragma once
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+//Fixed-size, allocation-free pool of UartFrame buffers with reference-counted handles.
+//Reference counts are atomic, so handles may be copied and released on different tasks.
+
+#include <stdint.h>
+#include <atomic>
+#include "protocol.h"
+
+#ifndef FRAME_POOL_SIZE
+#define FRAME_POOL_SIZE 12//ARQ window + frame being received + ACK + application frame
+#endif
+
+class FramePool;
+
+class FrameHandle
+{
+private:
+	FramePool* pool;
+	uint8_t index;
+
+	friend class FramePool;
+	FrameHandle(FramePool* owner, uint8_t slot) : pool(owner), index(slot) {}
+
+public:
+	FrameHandle() : pool(nullptr), index(0) {}
+	FrameHandle(const FrameHandle& other);
+	FrameHandle& operator=(const FrameHandle& other);
+	~FrameHandle() { release(); }
+
+	UartFrame* get() const;
+	UartFrame* operator->() const { return get(); }
+	UartFrame& operator*() const { return *get(); }
+	explicit operator bool() const { return pool != nullptr; }
+
+	void release();//drop this reference, the buffer returns to the pool with the last one
+};
+
+class FramePool
+{
+private:
+	UartFrame frames[FRAME_POOL_SIZE];
+	std::atomic<uint8_t> ref_counts[FRAME_POOL_SIZE];//atomic: handles cross RX/TX tasks (protocol_tasks.h)
+
+	//Statistics
+	std::atomic<uint8_t> in_use;
+	std::atomic<uint8_t> high_water_mark;
+	std::atomic<uint32_t> exhausted_count;
+
+	friend class FrameHandle;
+	void add_ref(uint8_t index) { ref_counts[index].fetch_add(1, std::memory_order_relaxed); }
+	void remove_ref(uint8_t index);
+
+public:
+	FramePool();
+
+	FrameHandle acquire();//empty handle when the pool is exhausted
+
+	uint8_t get_in_use() const { return in_use.load(std::memory_order_relaxed); }
+	uint8_t get_high_water_mark() const { return high_water_mark.load(std::memory_order_relaxed); }
+	uint32_t get_exhausted_count() const { return exhausted_count.load(std::memory_order_relaxed); }
+	void print_statistics();
+};
+
+extern FramePool frame_pool;//shared by the interfaces and the protocol
+
+#endif // !FRAME_POOL_H
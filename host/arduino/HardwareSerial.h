@@ -0,0 +1,36 @@
+#pragma once
+#ifndef HARDWARE_SERIAL_H
+#define HARDWARE_SERIAL_H
+
+#include "Arduino.h"
+
+#define SERIAL_8N1 0x800001c
+
+//UART 0 is the debug console (stdout), other ports discard output and never receive.
+//Override the virtual methods to feed a port from a test harness.
+class HardwareSerial : public Stream
+{
+private:
+	int uart_nr;
+
+public:
+	HardwareSerial(int uart) : uart_nr(uart) {}
+
+	void begin(unsigned long /*baud*/, uint32_t /*config*/ = SERIAL_8N1, int8_t /*rx_pin*/ = -1, int8_t /*tx_pin*/ = -1) {}
+	void end() {}
+	size_t setRxBufferSize(size_t size) { return size; }
+
+	int available() override { return 0; }
+	int read() override { return -1; }
+	int peek() override { return -1; }
+
+	size_t write(uint8_t byte) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+	using Print::write;
+
+	operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif // !HARDWARE_SERIAL_H
@@ -0,0 +1,70 @@
+#pragma once
+#ifndef SPI_H
+#define SPI_H
+
+#include "Arduino.h"
+
+#define FSPI 1
+#define HSPI 2
+#define VSPI 3
+
+#define SPI_MODE0 0
+#define SPI_MODE1 1
+#define SPI_MODE2 2
+#define SPI_MODE3 3
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+class SPISettings
+{
+public:
+	SPISettings() : clock(1000000), bit_order(MSBFIRST), data_mode(SPI_MODE0) {}
+	SPISettings(uint32_t clock_hz, uint8_t order, uint8_t mode) : clock(clock_hz), bit_order(order), data_mode(mode) {}
+
+	uint32_t clock;
+	uint8_t bit_order;
+	uint8_t data_mode;
+};
+
+//No device on the bus: MISO reads as zero. Transfers take their clocked time on the host clock.
+class SPIClass
+{
+private:
+	uint32_t clock_hz;
+	uint64_t pending_bits;//clocked but shorter than a microsecond so far
+
+	void clock_bits(uint32_t bits)
+	{
+		if (clock_hz == 0) return;
+		pending_bits += bits;
+		uint32_t us = (uint32_t)(pending_bits * 1000000 / clock_hz);
+		if (us == 0) return;
+		pending_bits -= (uint64_t)us * clock_hz / 1000000;
+		delayMicroseconds(us);
+	}
+
+public:
+	SPIClass(uint8_t /*spi_bus*/ = HSPI) : clock_hz(1000000), pending_bits(0) {}
+
+	void begin(int8_t /*sck*/ = -1, int8_t /*miso*/ = -1, int8_t /*mosi*/ = -1, int8_t /*ss*/ = -1) {}
+	void end() {}
+
+	void beginTransaction(SPISettings settings) { clock_hz = settings.clock; }
+	void endTransaction() {}
+
+	void setBitOrder(uint8_t /*order*/) {}
+	void setDataMode(uint8_t /*mode*/) {}
+	void setFrequency(uint32_t frequency) { clock_hz = frequency; }
+
+	uint8_t transfer(uint8_t /*data*/) { clock_bits(8); return 0; }
+	void transferBytes(const uint8_t* /*data*/, uint8_t* out, uint32_t size)
+	{
+		if (out) memset(out, 0, size);
+		clock_bits(size * 8);
+	}
+};
+
+extern SPIClass SPI;
+
+#endif // !SPI_H
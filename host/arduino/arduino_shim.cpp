@@ -0,0 +1,139 @@
+#include "Arduino.h"
+#include "SPI.h"
+#include "host_shim.h"
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+
+HardwareSerial Serial(0);
+SPIClass SPI(VSPI);
+
+static SteadyClock steady_clock;
+static HostClock* active_clock = &steady_clock;
+static uint64_t clock_origin_us = steady_clock.now_us();
+static bool console_enabled = true;
+
+//Host clock
+uint64_t SteadyClock::now_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void SteadyClock::sleep_us(uint64_t us)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void set_host_clock(HostClock* clock)
+{
+	active_clock = clock ? clock : &steady_clock;
+	clock_origin_us = clock ? 0 : steady_clock.now_us();
+}
+
+HostClock& host_clock()
+{
+	return *active_clock;
+}
+
+void set_host_console(bool enabled)
+{
+	console_enabled = enabled;
+}
+
+//Time, 32-bit like the ESP32 core so wrap-around arithmetic behaves the same
+unsigned long millis()
+{
+	return (uint32_t)((active_clock->now_us() - clock_origin_us) / 1000);
+}
+
+unsigned long micros()
+{
+	return (uint32_t)(active_clock->now_us() - clock_origin_us);
+}
+
+void delay(uint32_t ms)
+{
+	active_clock->sleep_us((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	active_clock->sleep_us(us);
+}
+
+//Print
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+	size_t written = 0;
+	while (size--) written += write(*buffer++);
+	return written;
+}
+
+size_t Print::print(long value, int base)
+{
+	if (base == DEC && value < 0)
+	{
+		return print('-') + print((unsigned long)-value, DEC);
+	}
+	return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+	char digits[sizeof(unsigned long) * 8 + 1];
+	char* cursor = &digits[sizeof(digits) - 1];
+	*cursor = '\0';
+
+	if (base < 2) base = DEC;
+	do
+	{
+		uint8_t digit = value % base;
+		*--cursor = digit < 10 ? '0' + digit : 'A' + digit - 10;
+		value /= base;
+	} while (value);
+
+	return write(cursor);
+}
+
+size_t Print::print(double value, int digits)
+{
+	char text[64];
+	snprintf(text, sizeof(text), "%.*f", digits, value);
+	return write(text);
+}
+
+size_t Print::printf(const char* format, ...)
+{
+	char text[256];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	if (length < 0) return 0;
+	return write(text);
+}
+
+//Stream
+size_t Stream::readBytes(uint8_t* buffer, size_t length)
+{
+	size_t count = 0;
+	while (count < length && available() > 0)
+	{
+		buffer[count++] = (uint8_t)read();
+	}
+	return count;
+}
+
+//HardwareSerial
+size_t HardwareSerial::write(uint8_t byte)
+{
+	if (uart_nr == 0 && console_enabled) fputc(byte, stdout);
+	return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+	if (uart_nr == 0 && console_enabled) fwrite(buffer, 1, size, stdout);
+	return size;
+}
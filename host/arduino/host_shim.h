@@ -0,0 +1,46 @@
+#pragma once
+#ifndef HOST_SHIM_H
+#define HOST_SHIM_H
+
+//Host-only controls for the Arduino shim: time source and console echo
+
+#include <stdint.h>
+
+//Time source behind millis()/micros()/delay()/delayMicroseconds()
+class HostClock
+{
+public:
+	virtual ~HostClock() {}
+	virtual uint64_t now_us() = 0;
+	virtual void sleep_us(uint64_t us) = 0;
+};
+
+//Wall clock (default)
+class SteadyClock : public HostClock
+{
+public:
+	uint64_t now_us() override;
+	void sleep_us(uint64_t us) override;
+};
+
+//Simulated time: delay() returns immediately and moves the clock forward
+class VirtualClock : public HostClock
+{
+private:
+	uint64_t time_us;
+
+public:
+	VirtualClock(uint64_t start_us = 0) : time_us(start_us) {}
+
+	uint64_t now_us() override { return time_us; }
+	void sleep_us(uint64_t us) override { time_us += us; }
+	void advance_us(uint64_t us) { time_us += us; }
+};
+
+void set_host_clock(HostClock* clock);//nullptr restores the wall clock
+HostClock& host_clock();
+
+//Serial (the debug console) echoes to stdout unless disabled
+void set_host_console(bool enabled);
+
+#endif // !HOST_SHIM_H
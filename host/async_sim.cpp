@@ -0,0 +1,154 @@
+//Master loop() responsiveness: blocking send_reliable() vs send_async() + service(), on a virtual clock
+//Build: host/CMakeLists.txt, target async_sim
+//Usage: async_sim [frames=2000] [payload=64] [loss=0.01] [baud=115200] [work_us=200] [interval_us=20000]
+//Every loop() pass does work_us of other work (display, sensors) and sends a frame every interval_us.
+//Reported: longest and mean loop() pass, i.e. how long the rest of the sketch can be kept waiting.
+//Exit status 1 unless every frame is acknowledged and arrives once with its payload intact.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	uint32_t delivered;
+	uint32_t corrupted;
+
+	SlaveSide() : protocol(false), delivered(0), corrupted(0) {}
+};
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.get_comm_interface()->receive();
+	if (frame && slave->protocol.validate_received_frame(frame.get()) && frame->packet_type == TYPE_DATA)
+	{
+		if (slave->protocol.accept_data_frame(frame.get()))
+		{
+			bool intact = true;
+			for (uint16_t i = 0; intact && i < frame->data_length; i++) intact = frame->data[i] == (uint8_t)(i * 7);
+			if (intact) slave->delivered++;
+			else slave->corrupted++;
+		}
+		slave->protocol.queue_ack(frame->sequence_num);
+	}
+}
+
+struct SendTally
+{
+	uint32_t completed;
+	uint32_t delivered;
+};
+
+static void count_completion(void* context, uint16_t /*seq_num*/, bool delivered)
+{
+	SendTally* tally = (SendTally*)context;
+	tally->completed++;
+	if (delivered) tally->delivered++;
+}
+
+struct LoopRun
+{
+	double seconds;
+	uint32_t delivered;
+	uint32_t acked;
+	uint32_t corrupted;
+	uint32_t passes;
+	uint64_t longest_pass_us;
+	double mean_pass_us;
+};
+
+static LoopRun run(bool async, uint32_t frame_count, uint16_t payload, float loss, uint32_t baud, uint32_t work_us, uint32_t interval_us)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(MODE_UART, baud);
+	link.master_end.set_loss_rate(loss);
+	link.slave_end.set_loss_rate(loss);
+	link.slave_end.set_seed(0x5EED);
+
+	SlaveSide* slave = new SlaveSide();
+	slave->protocol.set_communication_interface(&link.slave_end);
+	link.master_end.set_idle_hook(slave_step, slave);
+
+	EnhancedProtocol master(false);
+	master.set_communication_interface(&link.master_end);
+
+	uint8_t data[MAX_DATA_LEN];
+	for (uint16_t i = 0; i < payload; i++) data[i] = (uint8_t)(i * 7);
+
+	LoopRun result = {};
+	SendTally tally = {};
+	uint32_t sent = 0;
+	uint64_t pass_total_us = 0;
+	uint64_t next_send_us = 0;
+	while ((async ? tally.completed : sent) < frame_count)
+	{
+		uint64_t pass_start = clock.now_us();
+		clock.advance_us(work_us);//the rest of loop()
+
+		if (sent < frame_count && clock.now_us() >= next_send_us && (!async || master.can_send_async(master.peek_next_sequence())))
+		{
+			next_send_us += interval_us;
+			FrameHandle frame = frame_pool.acquire();
+			if (frame && master.create_frame(TYPE_DATA, data, payload, frame.get()))
+			{
+				if (async) master.send_async(frame, count_completion, &tally);
+				else if (master.send_reliable(frame.get())) tally.delivered++;
+				sent++;
+			}
+		}
+		if (async) master.service();
+
+		uint64_t pass_us = clock.now_us() - pass_start;
+		if (pass_us > result.longest_pass_us) result.longest_pass_us = pass_us;
+		pass_total_us += pass_us;
+		result.passes++;
+	}
+
+	result.seconds = clock.now_us() / 1e6;
+	result.delivered = slave->delivered;
+	result.acked = tally.delivered;
+	result.corrupted = slave->corrupted;
+	result.mean_pass_us = result.passes ? (double)pass_total_us / result.passes : 0.0;
+	link.master_end.set_idle_hook(nullptr, nullptr);
+	delete slave;
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	float loss = argc > 3 ? (float)atof(argv[3]) : 0.01f;
+	uint32_t baud = argc > 4 ? strtoul(argv[4], nullptr, 10) : 115200;
+	uint32_t work_us = argc > 5 ? strtoul(argv[5], nullptr, 10) : 200;
+	uint32_t interval_us = argc > 6 ? strtoul(argv[6], nullptr, 10) : 20000;
+
+	payload = constrain(payload, 1, MAX_DATA_LEN);
+	set_host_console(false);
+
+	printf("%lu frames, %u byte payload, loss %.3f, %lu baud, %lu us of other work per loop(), one frame every %lu us\n",
+		(unsigned long)frame_count, payload, loss, (unsigned long)baud, (unsigned long)work_us, (unsigned long)interval_us);
+	printf("%-9s %10s %10s %12s %10s %16s %14s %6s\n", "send", "delivered", "seconds", "frames/s", "passes", "longest pass ms", "mean pass us",
+		"result");
+
+	const char* names[] = { "blocking", "async" };
+	bool pass = true;
+	for (uint8_t async = 0; async < 2; async++)
+	{
+		LoopRun result = run(async != 0, frame_count, payload, loss, baud, work_us, interval_us);
+		bool ok = result.delivered == frame_count && result.acked == frame_count && result.corrupted == 0;
+		pass = pass && ok;
+		printf("%-9s %10lu %10.3f %12.1f %10lu %16.3f %14.1f %6s\n", names[async], (unsigned long)result.delivered, result.seconds,
+			result.seconds > 0 ? result.delivered / result.seconds : 0.0, (unsigned long)result.passes,
+			result.longest_pass_us / 1000.0, result.mean_pass_us, ok ? "PASS" : "FAIL");
+	}
+	return pass ? 0 : 1;
+}
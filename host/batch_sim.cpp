@@ -0,0 +1,136 @@
+//Telemetry messages one per DATA frame vs batched into TYPE_BATCH frames, over a LoopbackLink on a virtual clock
+//Build: host/CMakeLists.txt, target batch_sim
+//Usage: batch_sim [messages=5000] [baud=115200] [batch_delay_ms=10] [interval_us=0] [latency_us=0]
+//Messages look like send_test_data()'s "Test N - Time: T" and are produced every interval_us (0 = back to back).
+//Both modes are stop-and-wait, as send_test_data() is. The slave checks every message arrives once, in order,
+//with its own number; exit status 1 otherwise.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	uint32_t messages;
+	uint32_t wrong;//out of order, repeated or garbled
+
+	SlaveSide() : protocol(false), messages(0), wrong(0) {}
+};
+
+static SlaveSide* active_slave;
+
+static void count_message(const uint8_t* data, uint8_t length)
+{
+	char expected[16];
+	int prefix = snprintf(expected, sizeof(expected), "Test %lu - ", (unsigned long)active_slave->messages);
+	if (length < prefix || memcmp(data, expected, prefix) != 0) active_slave->wrong++;
+	active_slave->messages++;
+}
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.get_comm_interface()->receive();
+	if (frame && slave->protocol.validate_received_frame(frame.get()) && Protocol::is_data_frame(frame.get()))
+	{
+		if (slave->protocol.accept_data_frame(frame.get()))
+		{
+			if (frame->packet_type == TYPE_BATCH) slave->protocol.deliver_batch(frame.get());
+			else count_message(frame->data, (uint8_t)frame->data_length);
+		}
+		slave->protocol.queue_ack(frame->sequence_num);
+	}
+}
+
+struct BatchRun
+{
+	uint32_t delivered;
+	uint32_t wrong;
+	uint32_t frames;
+	double seconds;
+};
+
+static BatchRun run(bool batched, uint32_t message_count, uint32_t baud, uint16_t batch_delay_ms, uint32_t interval_us, uint32_t latency_us)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(MODE_UART, baud);
+	link.master_end.set_latency_us(latency_us);
+	link.slave_end.set_latency_us(latency_us);
+	SlaveSide slave;
+	active_slave = &slave;
+	slave.protocol.set_communication_interface(&link.slave_end);
+	slave.protocol.set_message_handler(count_message);
+	link.master_end.set_idle_hook(slave_step, &slave);
+
+	EnhancedProtocol master(false);
+	master.set_communication_interface(&link.master_end);
+	master.set_batch_delay(batch_delay_ms);
+
+	char message[40];
+	uint64_t next_message_us = 0;
+	for (uint32_t i = 0; i < message_count; i++)
+	{
+		//Producer runs on its own schedule, the batch timer fires while waiting for it
+		while (clock.now_us() < next_message_us)
+		{
+			if (batched) master.service_batch();
+			clock.advance_us(100);
+		}
+		next_message_us = clock.now_us() + interval_us;
+
+		int length = snprintf(message, sizeof(message), "Test %lu - Time: %lu", (unsigned long)i, (unsigned long)millis());
+		if (batched)
+		{
+			master.send_message((const uint8_t*)message, (uint8_t)length);
+			continue;
+		}
+
+		FrameHandle frame = frame_pool.acquire();
+		if (frame && master.create_frame(TYPE_DATA, (const uint8_t*)message, length, frame.get()))
+		{
+			master.send_reliable(frame.get());
+		}
+	}
+	if (batched) master.flush_batch();
+
+	BatchRun result;
+	result.delivered = slave.messages;
+	result.wrong = slave.wrong;
+	result.frames = link.master_end.get_frames_sent();
+	result.seconds = clock.now_us() / 1e6;
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t message_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5000;
+	uint32_t baud = argc > 2 ? strtoul(argv[2], nullptr, 10) : 115200;
+	uint16_t batch_delay_ms = argc > 3 ? (uint16_t)atoi(argv[3]) : BATCH_DELAY_MS;
+	uint32_t interval_us = argc > 4 ? strtoul(argv[4], nullptr, 10) : 0;
+	uint32_t latency_us = argc > 5 ? strtoul(argv[5], nullptr, 10) : 0;
+
+	set_host_console(false);
+	printf("%lu messages, %lu baud, batch delay %u ms, one message every %lu us, %lu us one-way latency\n",
+		(unsigned long)message_count, (unsigned long)baud, batch_delay_ms, (unsigned long)interval_us, (unsigned long)latency_us);
+	printf("%-9s %10s %6s %10s %12s %12s %6s\n", "mode", "delivered", "wrong", "frames", "virtual s", "messages/s", "result");
+
+	const char* names[] = { "per-frame", "batched" };
+	bool pass = true;
+	for (uint8_t batched = 0; batched < 2; batched++)
+	{
+		BatchRun result = run(batched != 0, message_count, baud, batch_delay_ms, interval_us, latency_us);
+		bool ok = result.delivered == message_count && result.wrong == 0;
+		pass = pass && ok;
+		printf("%-9s %10lu %6lu %10lu %12.3f %12.0f %6s\n", names[batched], (unsigned long)result.delivered, (unsigned long)result.wrong,
+			(unsigned long)result.frames, result.seconds, result.seconds > 0 ? result.delivered / result.seconds : 0.0, ok ? "PASS" : "FAIL");
+	}
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,239 @@
+//UART + SPI bonding: one send_async() stream striped over both links, on a virtual clock
+//Build: host/CMakeLists.txt, target bonding_sim
+//Usage: bonding_sim [frames=5000] [payload=64] [loss=0] [uart_baud=115200] [spi_hz=1000000] [degraded_loss=0.3]
+//Runs: UART only, SPI only, bonded, and bonded with the SPI link degrading to degraded_loss halfway through.
+//Links are non-blocking (frames queue behind each other like a DMA / driver TX buffer) so one loop can keep
+//both busy. Bonded, the slave puts frames back in order with hold_in_order() / next_in_order(); it checks that
+//every frame is delivered once with its payload intact and counts deliveries out of sequence (reorder).
+//Exit status 1 unless every run delivers every frame intact with no send failed, bonded runs also in order.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	uint16_t payload;
+	std::vector<bool> seen;
+	uint32_t next_index;
+	uint32_t delivered;
+	uint32_t out_of_order;
+	uint32_t corrupted;
+
+	SlaveSide(uint32_t frames, uint16_t payload_size) : protocol(false), payload(payload_size), seen(frames, false),
+		next_index(0), delivered(0), out_of_order(0), corrupted(0) {}
+};
+
+static void fill_payload(uint8_t* data, uint16_t length, uint32_t index)
+{
+	memcpy(data, &index, sizeof(index));
+	for (uint16_t i = sizeof(index); i < length; i++) data[i] = (uint8_t)(index * 13 + i);
+}
+
+static void deliver(SlaveSide* slave, const UartFrame* frame)
+{
+	uint32_t index;
+	uint8_t expected[MAX_DATA_LEN];
+	memcpy(&index, frame->data, sizeof(index));
+	fill_payload(expected, slave->payload, index);
+	if (index >= slave->seen.size() || frame->data_length != slave->payload || memcmp(frame->data, expected, slave->payload) != 0 || slave->seen[index])
+	{
+		slave->corrupted++;
+		return;
+	}
+	if (index != slave->next_index) slave->out_of_order++;
+	slave->seen[index] = true;
+	slave->next_index = index + 1;
+	slave->delivered++;
+}
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.receive_frame();//whichever link has a frame
+	if (frame && slave->protocol.validate_received_frame(frame.get()) && frame->packet_type == TYPE_DATA)
+	{
+		//Bonded links reorder frames; unbonded, selective repeat still may (counted as reorder)
+		if (slave->protocol.accept_data_frame(frame.get()) && !(slave->protocol.is_bonding() && slave->protocol.hold_in_order(frame)))
+		{
+			deliver(slave, frame.get());
+		}
+		slave->protocol.queue_ack(frame->sequence_num);
+	}
+	for (FrameHandle next = slave->protocol.next_in_order(); next; next = slave->protocol.next_in_order())
+	{
+		deliver(slave, next.get());
+	}
+	slave->protocol.service_timers();
+}
+
+struct SendTally
+{
+	uint32_t completed;
+	uint32_t failed;
+};
+
+static void count_completion(void* context, uint16_t /*seq_num*/, bool delivered)
+{
+	SendTally* tally = (SendTally*)context;
+	tally->completed++;
+	if (!delivered) tally->failed++;
+}
+
+enum RunKind { RUN_UART, RUN_SPI, RUN_BONDED, RUN_DEGRADED };
+
+struct BondingRun
+{
+	double seconds;
+	uint32_t delivered;
+	uint32_t out_of_order;
+	uint32_t corrupted;
+	uint32_t failed_sends;
+	uint32_t retransmissions;
+	uint32_t link_frames[2];//UART, SPI
+	double link_kbps[2];
+	double early_spi_share;//% of frames on SPI before / after the degradation point
+	double late_spi_share;
+};
+
+static BondingRun run(RunKind kind, uint32_t frame_count, uint16_t payload, float loss, uint32_t uart_baud, uint32_t spi_hz, float degraded_loss)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink uart(MODE_UART, uart_baud);
+	LoopbackLink spi(MODE_SPI, spi_hz);
+	LoopbackInterface* ends[] = { &uart.master_end, &uart.slave_end, &spi.master_end, &spi.slave_end };
+	const uint32_t seeds[] = { 0x1234, 0x5EED, 0xC0DE, 0xFACE };
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		ends[i]->set_blocking(false);
+		ends[i]->set_loss_rate(loss);
+		ends[i]->set_seed(seeds[i]);
+	}
+
+	SlaveSide* slave = new SlaveSide(frame_count, payload);
+	EnhancedProtocol master(false);
+	if (kind == RUN_SPI)
+	{
+		slave->protocol.set_communication_interface(&spi.slave_end);
+		master.set_communication_interface(&spi.master_end);
+	}
+	else
+	{
+		slave->protocol.add_interface(&spi.slave_end);
+		slave->protocol.set_communication_interface(&uart.slave_end);
+		master.add_interface(&spi.master_end);
+		master.set_communication_interface(&uart.master_end);
+	}
+	if (kind == RUN_BONDED || kind == RUN_DEGRADED)
+	{
+		slave->protocol.set_bonding(true);
+		master.set_bonding(true);
+	}
+	uart.master_end.set_idle_hook(slave_step, slave);
+	spi.master_end.set_idle_hook(slave_step, slave);
+
+	BondingRun result = {};
+	SendTally tally = {};
+	uint8_t data[MAX_DATA_LEN];
+	uint32_t sent = 0;
+	uint32_t spi_at_half = 0;
+	uint32_t uart_at_half = 0;
+	while (tally.completed < frame_count)
+	{
+		if (sent < frame_count && master.can_send_async(master.peek_next_sequence()))
+		{
+			FrameHandle frame = frame_pool.acquire();
+			fill_payload(data, payload, sent);
+			if (frame && master.create_frame(TYPE_DATA, data, payload, frame.get()) && master.send_async(frame, count_completion, &tally))
+			{
+				sent++;
+				if (sent == frame_count / 2)
+				{
+					spi_at_half = master.get_link_frames(MODE_SPI);
+					uart_at_half = master.get_link_frames(MODE_UART);
+					if (spi_at_half + uart_at_half) result.early_spi_share = 100.0 * spi_at_half / (spi_at_half + uart_at_half);
+					if (kind == RUN_DEGRADED)
+					{
+						spi.master_end.set_loss_rate(degraded_loss);
+						spi.slave_end.set_loss_rate(degraded_loss);
+					}
+				}
+			}
+		}
+		if (!master.service()) clock.advance_us(20);
+	}
+
+	PerformanceMonitor& perf = master.get_performance_monitor();
+	result.seconds = clock.now_us() / 1e6;
+	result.delivered = slave->delivered;
+	result.out_of_order = slave->out_of_order;
+	result.corrupted = slave->corrupted;
+	result.failed_sends = tally.failed;
+	result.retransmissions = perf.get_retransmissions();
+	if (kind == RUN_BONDED || kind == RUN_DEGRADED)
+	{
+		const CommunicationMode modes[] = { MODE_UART, MODE_SPI };
+		for (uint8_t i = 0; i < 2; i++)
+		{
+			result.link_frames[i] = master.get_link_frames(modes[i]);
+			result.link_kbps[i] = master.get_link_throughput_kbps(modes[i]);
+		}
+		uint32_t late_total = result.link_frames[0] + result.link_frames[1] - spi_at_half - uart_at_half;
+		result.late_spi_share = late_total ? 100.0 * (result.link_frames[1] - spi_at_half) / late_total : 0.0;
+	}
+	else
+	{
+		uint8_t link = kind == RUN_SPI ? 1 : 0;
+		result.link_frames[link] = (kind == RUN_SPI ? spi : uart).master_end.get_frames_sent();
+		result.link_kbps[link] = (kind == RUN_SPI ? spi : uart).master_end.get_bytes_sent() * 8 / 1000.0 / result.seconds;
+		result.early_spi_share = result.late_spi_share = kind == RUN_SPI ? 100.0 : 0.0;
+	}
+	uart.master_end.set_idle_hook(nullptr, nullptr);
+	spi.master_end.set_idle_hook(nullptr, nullptr);
+	delete slave;
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	float loss = argc > 3 ? (float)atof(argv[3]) : 0.0f;
+	uint32_t uart_baud = argc > 4 ? strtoul(argv[4], nullptr, 10) : 115200;
+	uint32_t spi_hz = argc > 5 ? strtoul(argv[5], nullptr, 10) : 1000000;
+	float degraded_loss = argc > 6 ? (float)atof(argv[6]) : 0.3f;
+
+	frame_count = constrain(frame_count, 2, 1000000);
+	payload = constrain(payload, 4, MAX_DATA_LEN);
+	set_host_console(false);
+
+	printf("%lu frames, %u byte payload, loss %.3f, UART %lu baud, SPI %lu Hz, degraded SPI loss %.3f\n",
+		(unsigned long)frame_count, payload, loss, (unsigned long)uart_baud, (unsigned long)spi_hz, degraded_loss);
+	printf("%-9s %9s %7s %7s %6s %6s %13s %11s %11s %11s %10s %10s %9s %6s\n", "run", "delivered", "reorder", "corrupt", "failed", "retx",
+		"goodput kbps", "UART frames", "SPI frames", "UART kbps", "SPI kbps", "SPI % 1st", "SPI % 2nd", "result");
+
+	const char* names[] = { "uart only", "spi only", "bonded", "degraded" };
+	bool pass = true;
+	for (uint8_t r = RUN_UART; r <= RUN_DEGRADED; r++)
+	{
+		BondingRun result = run((RunKind)r, frame_count, payload, loss, uart_baud, spi_hz, degraded_loss);
+		bool ok = result.delivered == frame_count && result.corrupted == 0 && result.failed_sends == 0 &&
+			(r < RUN_BONDED || result.out_of_order == 0);
+		pass = pass && ok;
+		printf("%-9s %9lu %7lu %7lu %6lu %6lu %13.1f %11lu %11lu %11.1f %10.1f %10.1f %9.1f %6s\n", names[r], (unsigned long)result.delivered,
+			(unsigned long)result.out_of_order, (unsigned long)result.corrupted, (unsigned long)result.failed_sends,
+			(unsigned long)result.retransmissions, result.seconds > 0 ? result.delivered * payload * 8 / result.seconds / 1000.0 : 0.0,
+			(unsigned long)result.link_frames[0], (unsigned long)result.link_frames[1], result.link_kbps[0], result.link_kbps[1],
+			result.early_spi_share, result.late_spi_share, ok ? "PASS" : "FAIL");
+	}
+	return pass ? 0 : 1;
+}
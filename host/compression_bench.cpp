@@ -0,0 +1,314 @@
+//LZSS payload compression: ratio and host CPU cost per KB, then messages/s over a UART LoopbackLink
+//Build: host/CMakeLists.txt, target compression_bench
+//Usage: compression_bench [messages=2000] [baud=115200] [rounds=200]
+//Corpora: send_test_data()-style "Test N - Time: T" messages, SPI burst messages, full TYPE_BATCH payloads
+//of those, and random bytes. Dictionaries: none, TELEMETRY_DICTIONARY (static) and one trained from the first
+//messages of a separate sample. Frames that do not shrink count at their original size, as they are sent.
+//The link part runs stop-and-wait per-frame and batched sends with compression off and on (static dictionary).
+//Exit status 1 if a payload does not round-trip, or a link run loses or garbles a message.
+
+#include "enhanced_protocol.h"
+#include "compression_dictionary.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+typedef std::vector<uint8_t> Payload;
+
+static Payload text(const char* format, unsigned long a, unsigned long b)
+{
+	char buffer[64];
+	int length = snprintf(buffer, sizeof(buffer), format, a, b);
+	return Payload(buffer, buffer + length);
+}
+
+//Counters and millis() timestamps as the sketch produces them
+static std::vector<Payload> telemetry(uint32_t count, uint32_t first, const char* format)
+{
+	std::vector<Payload> messages;
+	unsigned long time_ms = 5000 + first * 2003;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		messages.push_back(text(format, first + i, time_ms));
+		time_ms += 1990 + (i * 37) % 25;
+	}
+	return messages;
+}
+
+//TYPE_BATCH data areas: [len bytes]... up to MAX_DATA_LEN
+static std::vector<Payload> batches(const std::vector<Payload>& messages)
+{
+	std::vector<Payload> frames(1);
+	for (const Payload& message : messages)
+	{
+		if (frames.back().size() + BATCH_RECORD_HEADER_SIZE + message.size() > MAX_DATA_LEN) frames.push_back(Payload());
+		frames.back().push_back((uint8_t)message.size());
+		frames.back().insert(frames.back().end(), message.begin(), message.end());
+	}
+	return frames;
+}
+
+static std::vector<Payload> random_payloads(uint32_t count, uint16_t length)
+{
+	std::mt19937 rng(0xC0FFEE);
+	std::vector<Payload> payloads(count, Payload(length));
+	for (Payload& payload : payloads)
+	{
+		for (uint8_t& byte : payload) byte = (uint8_t)rng();
+	}
+	return payloads;
+}
+
+struct CodecResult
+{
+	uint64_t original_bytes;
+	uint64_t sent_bytes;//compressed size, or original size when it did not shrink
+	uint32_t compressed;
+	uint32_t frames;
+	bool round_trip;
+	double encode_us_per_kb;
+	double decode_us_per_kb;
+};
+
+static CodecResult measure(const std::vector<Payload>& payloads, const LZSS::Dictionary* dictionary, uint32_t rounds)
+{
+	CodecResult result = {};
+	result.round_trip = true;
+	std::vector<Payload> packed(payloads.size());
+	uint8_t buffer[MAX_DATA_LEN];
+	uint8_t plain[MAX_DATA_LEN];
+
+	for (size_t i = 0; i < payloads.size(); i++)
+	{
+		const Payload& payload = payloads[i];
+		uint16_t length = LZSS::encode(payload.data(), (uint16_t)payload.size(), buffer, (uint16_t)payload.size() - 1, dictionary);
+		result.original_bytes += payload.size();
+		result.sent_bytes += length ? length : payload.size();
+		result.frames++;
+		if (!length) continue;
+		result.compressed++;
+		packed[i].assign(buffer, buffer + length);
+		uint16_t decoded = LZSS::decode(buffer, length, plain, MAX_DATA_LEN, dictionary);
+		if (decoded != payload.size() || memcmp(plain, payload.data(), decoded) != 0) result.round_trip = false;
+	}
+
+	//Every payload is encoded (the sender tries them all), only compressed ones are decoded
+	volatile uint16_t sink = 0;
+	uint64_t encoded_bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t r = 0; r < rounds; r++)
+	{
+		for (const Payload& payload : payloads)
+		{
+			sink = sink + LZSS::encode(payload.data(), (uint16_t)payload.size(), buffer, (uint16_t)payload.size() - 1, dictionary);
+			encoded_bytes += payload.size();
+		}
+	}
+	double encode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint64_t decoded_bytes = 0;
+	start = std::chrono::steady_clock::now();
+	for (uint32_t r = 0; r < rounds; r++)
+	{
+		for (const Payload& block : packed)
+		{
+			if (block.empty()) continue;
+			uint16_t length = LZSS::decode(block.data(), (uint16_t)block.size(), plain, MAX_DATA_LEN, dictionary);
+			sink = sink + length;
+			decoded_bytes += length;
+		}
+	}
+	double decode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	result.encode_us_per_kb = encoded_bytes ? encode_seconds * 1e6 / (encoded_bytes / 1024.0) : 0.0;
+	result.decode_us_per_kb = decoded_bytes ? decode_seconds * 1e6 / (decoded_bytes / 1024.0) : 0.0;
+	return result;
+}
+
+//Link run: the slave decompresses in validate_received_frame() and checks every message's text
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	const std::vector<Payload>* expected;
+	uint32_t delivered;
+	uint32_t mismatched;
+
+	SlaveSide() : protocol(false), expected(nullptr), delivered(0), mismatched(0) {}
+};
+
+static SlaveSide* active_slave;
+
+static void check_message(const uint8_t* data, uint16_t length)
+{
+	SlaveSide* slave = active_slave;
+	const Payload& expected = (*slave->expected)[slave->delivered % slave->expected->size()];
+	if (length != expected.size() || memcmp(data, expected.data(), length) != 0) slave->mismatched++;
+	slave->delivered++;
+}
+
+static void check_batch_message(const uint8_t* data, uint8_t length)
+{
+	check_message(data, length);
+}
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.get_comm_interface()->receive();
+	if (!frame || !slave->protocol.validate_received_frame(frame.get())) return;
+	if (!Protocol::is_data_frame(frame.get()))
+	{
+		slave->protocol.process_frame(frame.get());//compression probes
+		return;
+	}
+	if (slave->protocol.accept_data_frame(frame.get()))
+	{
+		if (frame->packet_type == TYPE_BATCH) slave->protocol.deliver_batch(frame.get());
+		else check_message(frame->data, frame->data_length);
+	}
+	slave->protocol.queue_ack(frame->sequence_num);
+}
+
+struct LinkRun
+{
+	uint32_t delivered;
+	uint32_t mismatched;
+	uint32_t frames;
+	uint64_t wire_bytes;
+	double seconds;
+	float ratio;
+};
+
+static LinkRun run_link(const std::vector<Payload>& messages, bool batched, bool compressed, uint32_t baud)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(MODE_UART, baud);
+	SlaveSide* slave = new SlaveSide();
+	active_slave = slave;
+	slave->expected = &messages;
+	slave->protocol.set_communication_interface(&link.slave_end);
+	slave->protocol.set_compression_dictionary((const uint8_t*)TELEMETRY_DICTIONARY, sizeof(TELEMETRY_DICTIONARY) - 1);
+	slave->protocol.set_message_handler(check_batch_message);
+	link.master_end.set_idle_hook(slave_step, slave);
+
+	EnhancedProtocol master(false);
+	master.set_communication_interface(&link.master_end);
+	master.set_compression_dictionary((const uint8_t*)TELEMETRY_DICTIONARY, sizeof(TELEMETRY_DICTIONARY) - 1);
+	if (compressed)
+	{
+		master.set_compression(MODE_UART, true);
+		while (!master.is_compressing(MODE_UART) && clock.now_us() < 1000000)
+		{
+			if (!master.service()) clock.advance_us(100);
+		}
+	}
+
+	uint64_t start_us = clock.now_us();
+	uint32_t frames_before = link.master_end.get_frames_sent();
+	uint32_t bytes_before = link.master_end.get_bytes_sent();
+	for (const Payload& message : messages)
+	{
+		if (batched)
+		{
+			master.send_message(message.data(), (uint8_t)message.size());
+			continue;
+		}
+		FrameHandle frame = frame_pool.acquire();
+		if (frame && master.create_frame(TYPE_DATA, message.data(), (uint16_t)message.size(), frame.get()))
+		{
+			master.send_reliable(frame.get());
+		}
+	}
+	if (batched) master.flush_batch();
+
+	LinkRun result;
+	result.delivered = slave->delivered;
+	result.mismatched = slave->mismatched;
+	result.frames = link.master_end.get_frames_sent() - frames_before;
+	result.wire_bytes = link.master_end.get_bytes_sent() - bytes_before;
+	result.seconds = (clock.now_us() - start_us) / 1e6;
+	result.ratio = master.get_performance_monitor().get_compression_ratio();
+	link.master_end.set_idle_hook(nullptr, nullptr);
+	delete slave;
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t message_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+	uint32_t baud = argc > 2 ? strtoul(argv[2], nullptr, 10) : 115200;
+	uint32_t rounds = argc > 3 ? strtoul(argv[3], nullptr, 10) : 200;
+
+	message_count = constrain(message_count, 1, 100000);
+	set_host_console(false);
+
+	std::vector<Payload> messages = telemetry(message_count, 0, "Test %lu - Time: %lu");
+	std::vector<Payload> bursts = telemetry(message_count, 0, "SPI_BURST_%lu - Time: %lu");
+	std::vector<Payload> batched = batches(messages);
+	std::vector<Payload> noise = random_payloads(message_count, 64);
+
+	//Trained: the first messages of a separate sample (other counters and times), as much as the window holds
+	std::string training;
+	for (const Payload& sample : telemetry(64, 900000, "Test %lu - Time: %lu"))
+	{
+		training.append(sample.begin(), sample.end());
+	}
+	if (training.size() > 256) training.erase(0, training.size() - 256);
+
+	LZSS::Dictionary none;
+	LZSS::Dictionary fixed;
+	LZSS::Dictionary trained;
+	none.load(nullptr, 0);
+	fixed.load((const uint8_t*)TELEMETRY_DICTIONARY, sizeof(TELEMETRY_DICTIONARY) - 1);
+	trained.load((const uint8_t*)training.data(), (uint16_t)training.size());
+
+	printf("%lu messages, %u byte dictionary (static), %u byte dictionary (trained), %lu rounds\n",
+		(unsigned long)message_count, fixed.length, trained.length, (unsigned long)rounds);
+	printf("%-10s %-8s %9s %11s %9s %12s %12s %10s\n", "corpus", "dict", "avg bytes", "compressed", "ratio", "enc us/KB", "dec us/KB", "roundtrip");
+
+	bool pass = true;
+	const std::vector<Payload>* corpora[] = { &messages, &bursts, &batched, &noise };
+	const char* corpus_names[] = { "telemetry", "spi burst", "batched", "random" };
+	const LZSS::Dictionary* dictionaries[] = { &none, &fixed, &trained };
+	const char* dictionary_names[] = { "none", "static", "trained" };
+	for (uint8_t c = 0; c < 4; c++)
+	{
+		for (uint8_t d = 0; d < 3; d++)
+		{
+			CodecResult result = measure(*corpora[c], dictionaries[d], rounds);
+			pass = pass && result.round_trip;
+			printf("%-10s %-8s %9.1f %10.1f%% %8.1f%% %12.2f %12.2f %10s\n", corpus_names[c], dictionary_names[d],
+				(double)result.original_bytes / result.frames, 100.0 * result.compressed / result.frames,
+				100.0 * result.sent_bytes / result.original_bytes, result.encode_us_per_kb, result.decode_us_per_kb,
+				result.round_trip ? "ok" : "FAILED");
+		}
+	}
+
+	printf("\nUART %lu baud, stop-and-wait, static dictionary\n", (unsigned long)baud);
+	printf("%-9s %-5s %10s %9s %8s %12s %12s %10s %6s\n", "send", "lz", "delivered", "mismatch", "frames", "wire bytes", "messages/s",
+		"ratio", "result");
+	for (uint8_t b = 0; b < 2; b++)
+	{
+		for (uint8_t z = 0; z < 2; z++)
+		{
+			LinkRun result = run_link(messages, b != 0, z != 0, baud);
+			bool ok = result.delivered == message_count && result.mismatched == 0;
+			pass = pass && ok;
+			printf("%-9s %-5s %10lu %9lu %8lu %12llu %12.1f %9.1f%% %6s\n", b ? "batched" : "per-frame", z ? "on" : "off",
+				(unsigned long)result.delivered, (unsigned long)result.mismatched, (unsigned long)result.frames,
+				(unsigned long long)result.wire_bytes, result.seconds > 0 ? result.delivered / result.seconds : 0.0, result.ratio,
+				ok ? "PASS" : "FAIL");
+		}
+	}
+	return pass ? 0 : 1;
+}
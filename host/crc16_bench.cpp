@@ -0,0 +1,176 @@
+//Host benchmark for the CRC16 engines
+//Build: host/CMakeLists.txt, target crc16_bench (or g++ -O2 -std=c++11 -I.. crc16_bench.cpp ../crc16.cpp)
+//Usage: crc16_bench [check]
+//Every engine is cross-checked against the bitwise reference first (exit status 1 on a mismatch), "check" stops there.
+
+#include "crc16.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+static inline uint64_t read_cycles() { return __rdtsc(); }
+#else
+#define HAVE_CYCLE_COUNTER 0
+static inline uint64_t read_cycles() { return 0; }
+#endif
+
+typedef uint16_t (*CrcFunction)(const uint8_t*, uint16_t);
+
+struct Engine
+{
+	const char* name;
+	CrcFunction function;
+};
+
+static const Engine ENGINES[] =
+{
+	{ "bitwise", CRC16::calculate_bitwise },
+	{ "table", CRC16::calculate_table },
+	{ "slice4", CRC16::calculate_slice4 },
+	{ "slice8", CRC16::calculate_slice8 },
+};
+static const int ENGINE_COUNT = sizeof(ENGINES) / sizeof(ENGINES[0]);
+
+static volatile uint16_t sink;
+
+static bool cross_check()
+{
+	//Reference vectors for CRC-16/CCITT-FALSE
+	struct Vector { const char* input; uint16_t expected; };
+	static const Vector VECTORS[] =
+	{
+		{ "", 0xFFFF },
+		{ "A", 0xB915 },
+		{ "123456789", 0x29B1 },
+		{ "Test 0 - Time: 1234", 0 },//expected filled from bitwise engine
+	};
+
+	bool ok = true;
+	for (const Vector& v : VECTORS)
+	{
+		uint16_t length = (uint16_t)strlen(v.input);
+		uint16_t reference = CRC16::calculate_bitwise((const uint8_t*)v.input, length);
+		if (v.expected != 0 && reference != v.expected)
+		{
+			printf("FAIL bitwise(\"%s\") = 0x%04X, expected 0x%04X\n", v.input, reference, v.expected);
+			ok = false;
+		}
+		for (int e = 0; e < ENGINE_COUNT; e++)
+		{
+			uint16_t crc = ENGINES[e].function((const uint8_t*)v.input, length);
+			if (crc != reference)
+			{
+				printf("FAIL %s(\"%s\") = 0x%04X, expected 0x%04X\n", ENGINES[e].name, v.input, crc, reference);
+				ok = false;
+			}
+		}
+	}
+
+	//Random buffers of every length and alignment up to a full frame and beyond
+	static uint8_t buffer[1024 + 8];
+	srand(1021);
+	for (size_t i = 0; i < sizeof(buffer); i++) buffer[i] = (uint8_t)rand();
+
+	for (uint16_t length = 0; length <= 1024; length++)
+	{
+		for (uint8_t offset = 0; offset < 8; offset++)
+		{
+			uint16_t reference = CRC16::calculate_bitwise(buffer + offset, length);
+			for (int e = 1; e < ENGINE_COUNT; e++)
+			{
+				if (ENGINES[e].function(buffer + offset, length) != reference)
+				{
+					printf("FAIL %s length %u offset %u\n", ENGINES[e].name, length, offset);
+					ok = false;
+				}
+			}
+		}
+	}
+
+	//Streaming API must match one-shot calculation for any split, including byte-at-a-time
+	for (uint16_t split = 0; split <= 141; split++)
+	{
+		uint16_t crc = CRC16::update(CRC16::begin(), buffer, split);
+		for (uint16_t i = split; i < 141; i++)
+		{
+			crc = CRC16::update(crc, buffer[i]);
+		}
+		if (CRC16::finalize(crc) != CRC16::calculate_bitwise(buffer, 141))
+		{
+			printf("FAIL streaming update split %u\n", split);
+			ok = false;
+		}
+	}
+
+	if (CRC16::calculate(buffer, 141) != CRC16::calculate_bitwise(buffer, 141))
+	{
+		printf("FAIL configured engine (%s)\n", CRC16::engine_name());
+		ok = false;
+	}
+	return ok;
+}
+
+static void benchmark(uint16_t length)
+{
+	static uint8_t buffer[4096];
+	for (uint16_t i = 0; i < length; i++) buffer[i] = (uint8_t)(i * 31 + 7);
+
+	const uint32_t target_bytes = 64u * 1024u * 1024u;
+	uint32_t iterations = target_bytes / (length ? length : 1);
+
+	printf("%6u B |", length);
+	for (int e = 0; e < ENGINE_COUNT; e++)
+	{
+		CrcFunction function = ENGINES[e].function;
+
+		auto start = std::chrono::steady_clock::now();
+		uint64_t cycles_start = read_cycles();
+		for (uint32_t i = 0; i < iterations; i++)
+		{
+			sink = function(buffer, length);
+			buffer[0] ^= (uint8_t)sink;//defeat loop-invariant hoisting
+		}
+		uint64_t cycles = read_cycles() - cycles_start;
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double bytes = (double)iterations * length;
+		if (HAVE_CYCLE_COUNTER)
+		{
+			printf(" %8.3f B/cyc", bytes / (double)cycles);
+		}
+		printf(" %8.1f MB/s |", bytes / seconds / 1e6);
+	}
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	printf("CRC16 engines (poly 0x1021, init 0xFFFF), configured: %s\n", CRC16::engine_name());
+
+	if (!cross_check())
+	{
+		printf("Cross-check FAILED\n");
+		return 1;
+	}
+	printf("Cross-check passed: all engines bit-identical to bitwise reference\n\n");
+	if (argc > 1 && strcmp(argv[1], "check") == 0) return 0;
+
+	printf("  size  |");
+	for (int e = 0; e < ENGINE_COUNT; e++)
+	{
+		printf(" %-28s|", ENGINES[e].name);
+	}
+	printf("\n");
+
+	//ACK header, typical "Test N" frame, full frame CRC span, bulk
+	const uint16_t sizes[] = { 6, 32, 134, 1024 };
+	for (uint16_t size : sizes)
+	{
+		benchmark(size);
+	}
+	return 0;
+}
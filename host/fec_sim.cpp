@@ -0,0 +1,296 @@
+//Forward error correction on a noisy UART: stop-and-wait DATA (one frame in flight, as the master sketch
+//sends) with and without Reed-Solomon parity, on a virtual clock
+//Build: host/CMakeLists.txt, target fec_sim
+//Usage: fec_sim [frames=5000] [payload=64] [baud=115200] [message=8192]
+//Each wire byte is hit with the listed probability (one bit flipped, several bytes of a frame can be hit).
+//The slave NACKs what fails validation, as slave_esp32.ino does. Latency is send_async() to ACK per frame;
+//repaired / unrepaired count both directions (DATA at the slave, ACKs at the master).
+//Then one message through send_fragmented() (window 8) at the same error rates: fragments must all carry
+//parity when FEC is on and the message must reassemble intact. Without FEC a fragment that fails all
+//MAX_RETRIES attempts leaves it incomplete.
+//Exit status 1 if a corrupted payload is delivered, or a run with FEC on loses a frame or the message.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	uint16_t payload;
+	uint32_t delivered;
+	uint32_t corrupted;
+	bool message_intact;//send_fragmented() runs
+
+	SlaveSide(uint16_t payload_size) : protocol(false), payload(payload_size), delivered(0), corrupted(0), message_intact(false) {}
+};
+
+static SlaveSide* active_slave;
+static const uint8_t* expected_message;
+static uint32_t expected_length;
+
+static void message_complete(uint8_t /*message_id*/, const uint8_t* data, uint32_t length)
+{
+	active_slave->message_intact = length == expected_length && memcmp(data, expected_message, length) == 0;
+}
+
+static void fill_payload(uint8_t* data, uint16_t length, uint32_t index)
+{
+	memcpy(data, &index, sizeof(index));
+	for (uint16_t i = sizeof(index); i < length; i++) data[i] = (uint8_t)(index * 31 + i);
+}
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.get_comm_interface()->receive();
+	if (frame)
+	{
+		if (!slave->protocol.validate_received_frame(frame.get()))
+		{
+			slave->protocol.send_nack(frame->sequence_num);
+		}
+		else if (frame->packet_type == TYPE_DATA)
+		{
+			if (slave->protocol.accept_data_frame(frame.get()))
+			{
+				//A repaired frame must carry exactly what was sent
+				uint32_t index;
+				uint8_t expected[MAX_DATA_LEN];
+				memcpy(&index, frame->data, sizeof(index));
+				fill_payload(expected, slave->payload, index);
+				if (frame->data_length == slave->payload && memcmp(frame->data, expected, slave->payload) == 0) slave->delivered++;
+				else slave->corrupted++;
+			}
+			slave->protocol.queue_ack(frame->sequence_num);
+		}
+		else if (frame->packet_type == TYPE_FRAGMENT)
+		{
+			if (!slave->protocol.can_reassemble(frame.get())) return;
+			if (slave->protocol.accept_data_frame(frame.get())) slave->protocol.deliver_fragment(frame.get());
+			slave->protocol.queue_ack(frame->sequence_num);
+		}
+	}
+	slave->protocol.service_acks();
+}
+
+struct PendingSend
+{
+	bool done;
+	bool delivered;
+};
+
+static void send_complete(void* context, uint16_t /*seq_num*/, bool delivered)
+{
+	PendingSend* pending = (PendingSend*)context;
+	pending->done = true;
+	pending->delivered = delivered;
+}
+
+struct FecRun
+{
+	double seconds;
+	uint32_t delivered;
+	uint32_t corrupted;
+	uint32_t failed;
+	uint32_t hit_frames;//frames with at least one byte hit, both directions
+	uint32_t crc_errors;
+	uint32_t repaired;
+	uint32_t unrepaired;
+	uint32_t retransmissions;
+	double mean_ms;
+	double p99_ms;
+	double max_ms;
+};
+
+static FecRun run(bool use_fec, float byte_error, uint32_t frame_count, uint16_t payload, uint32_t baud)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(MODE_UART, baud);
+	link.master_end.set_byte_error_rate(byte_error);
+	link.slave_end.set_byte_error_rate(byte_error);
+	link.master_end.set_seed(0x1234);
+	link.slave_end.set_seed(0x5EED);
+
+	SlaveSide* slave = new SlaveSide(payload);
+	slave->protocol.set_communication_interface(&link.slave_end);
+	link.master_end.set_idle_hook(slave_step, slave);
+
+	EnhancedProtocol master(false);
+	master.set_communication_interface(&link.master_end);
+	if (use_fec)
+	{
+		master.set_fec(MODE_UART, true);
+		slave->protocol.set_fec(MODE_UART, true);//its ACKs and NACKs
+	}
+
+	FecRun result = {};
+	std::vector<uint32_t> latencies;
+	latencies.reserve(frame_count);
+	uint8_t data[MAX_DATA_LEN];
+	for (uint32_t i = 0; i < frame_count; i++)
+	{
+		FrameHandle frame = frame_pool.acquire();
+		fill_payload(data, payload, i);
+		PendingSend pending = { false, false };
+		uint64_t start_us = clock.now_us();
+		if (!frame || !master.create_frame(TYPE_DATA, data, payload, frame.get()) || !master.send_async(frame, send_complete, &pending))
+		{
+			fprintf(stderr, "send %lu could not start\n", (unsigned long)i);
+			break;
+		}
+		while (!pending.done)
+		{
+			if (!master.service()) clock.advance_us(20);
+		}
+		if (!pending.delivered) result.failed++;
+		latencies.push_back((uint32_t)(clock.now_us() - start_us));
+	}
+
+	PerformanceMonitor& master_perf = master.get_performance_monitor();
+	PerformanceMonitor& slave_perf = slave->protocol.get_performance_monitor();
+	result.seconds = clock.now_us() / 1e6;
+	result.delivered = slave->delivered;
+	result.corrupted = slave->corrupted;
+	result.hit_frames = link.master_end.get_frames_corrupted() + link.slave_end.get_frames_corrupted();
+	result.crc_errors = master_perf.get_crc_errors() + slave_perf.get_crc_errors();
+	result.repaired = master_perf.get_fec_repaired() + slave_perf.get_fec_repaired();
+	result.unrepaired = master_perf.get_fec_unrepaired() + slave_perf.get_fec_unrepaired();
+	result.retransmissions = master_perf.get_retransmissions();
+	if (!latencies.empty())
+	{
+		uint64_t sum = 0;
+		for (size_t i = 0; i < latencies.size(); i++) sum += latencies[i];
+		std::sort(latencies.begin(), latencies.end());
+		result.mean_ms = sum / 1000.0 / latencies.size();
+		result.p99_ms = latencies[latencies.size() * 99 / 100] / 1000.0;
+		result.max_ms = latencies.back() / 1000.0;
+	}
+
+	link.master_end.set_idle_hook(nullptr, nullptr);
+	delete slave;
+	set_host_clock(nullptr);
+	return result;
+}
+
+struct FragmentRun
+{
+	bool intact;
+	double seconds;
+	uint32_t fragments;//sent, first attempts and retransmissions
+	uint32_t protected_frames;
+	uint32_t unprotected;
+	uint32_t repaired;
+	uint32_t retransmissions;
+};
+
+static FragmentRun run_fragmented(bool use_fec, float byte_error, uint32_t length, uint32_t baud)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(MODE_UART, baud);
+	link.master_end.set_byte_error_rate(byte_error);
+	link.slave_end.set_byte_error_rate(byte_error);
+	link.master_end.set_seed(0x1234);
+	link.slave_end.set_seed(0x5EED);
+
+	static uint8_t reassembly[MAX_MESSAGE_SIZE];
+	SlaveSide* slave = new SlaveSide(0);
+	active_slave = slave;
+	slave->protocol.set_communication_interface(&link.slave_end);
+	slave->protocol.set_reassembly_buffer(reassembly, sizeof(reassembly), message_complete);
+	link.master_end.set_idle_hook(slave_step, slave);
+
+	EnhancedProtocol master(false);
+	master.set_communication_interface(&link.master_end);
+	master.set_window_size(8);
+	if (use_fec)
+	{
+		master.set_fec(MODE_UART, true);
+		slave->protocol.set_fec(MODE_UART, true);
+	}
+
+	master.send_fragmented(expected_message, length);
+
+	PerformanceMonitor& master_perf = master.get_performance_monitor();
+	FragmentRun result;
+	result.intact = slave->message_intact;
+	result.seconds = clock.now_us() / 1e6;
+	result.fragments = link.master_end.get_frames_sent();
+	result.protected_frames = master_perf.get_fec_frames();
+	result.unprotected = master_perf.get_fec_unprotected();
+	result.repaired = slave->protocol.get_performance_monitor().get_fec_repaired();
+	result.retransmissions = master_perf.get_retransmissions();
+
+	link.master_end.set_idle_hook(nullptr, nullptr);
+	delete slave;
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	uint32_t baud = argc > 3 ? strtoul(argv[3], nullptr, 10) : 115200;
+	uint32_t message_length = argc > 4 ? strtoul(argv[4], nullptr, 10) : 8192;
+
+	frame_count = constrain(frame_count, 1, 1000000);
+	payload = constrain(payload, 4, MAX_DATA_LEN - RS_PARITY_BYTES);
+	message_length = constrain(message_length, 1, MAX_MESSAGE_SIZE);
+	set_host_console(false);
+
+	printf("%lu frames, %u byte payload, UART %lu baud, RS(%u parity bytes) corrects %u bytes per frame\n",
+		(unsigned long)frame_count, payload, (unsigned long)baud, RS_PARITY_BYTES, RS_PARITY_BYTES / 2);
+	printf("%-9s %-4s %9s %7s %6s %7s %7s %8s %10s %6s %8s %8s %8s %13s %6s\n", "byte err", "fec", "delivered", "corrupt", "failed",
+		"hit", "crc err", "repaired", "unrepaired", "retx", "mean ms", "p99 ms", "max ms", "goodput kbps", "result");
+
+	const float error_rates[] = { 0.0f, 0.0001f, 0.0005f, 0.001f, 0.002f, 0.005f };
+	bool pass = true;
+	for (uint8_t r = 0; r < sizeof(error_rates) / sizeof(error_rates[0]); r++)
+	{
+		for (uint8_t f = 0; f < 2; f++)
+		{
+			FecRun result = run(f == 1, error_rates[r], frame_count, payload, baud);
+			bool ok = result.corrupted == 0 && (f == 0 || (result.delivered == frame_count && result.failed == 0));
+			pass = pass && ok;
+			printf("%-9.4f %-4s %9lu %7lu %6lu %7lu %7lu %8lu %10lu %6lu %8.2f %8.2f %8.2f %13.1f %6s\n", error_rates[r], f ? "on" : "off",
+				(unsigned long)result.delivered, (unsigned long)result.corrupted, (unsigned long)result.failed,
+				(unsigned long)result.hit_frames, (unsigned long)result.crc_errors, (unsigned long)result.repaired,
+				(unsigned long)result.unrepaired, (unsigned long)result.retransmissions, result.mean_ms, result.p99_ms, result.max_ms,
+				result.seconds > 0 ? result.delivered * payload * 8 / result.seconds / 1000.0 : 0.0, ok ? "PASS" : "FAIL");
+		}
+	}
+
+	static uint8_t message[MAX_MESSAGE_SIZE];
+	for (uint32_t i = 0; i < message_length; i++) message[i] = (uint8_t)(i * 131 + (i >> 8));
+	expected_message = message;
+	expected_length = message_length;
+
+	printf("\n%lu byte message, send_fragmented()\n", (unsigned long)message_length);
+	printf("%-9s %-4s %6s %9s %9s %11s %8s %6s %8s %13s %6s\n", "byte err", "fec", "intact", "fragments", "protected", "unprotected",
+		"repaired", "retx", "seconds", "goodput kbps", "result");
+	for (uint8_t r = 0; r < sizeof(error_rates) / sizeof(error_rates[0]); r++)
+	{
+		for (uint8_t f = 0; f < 2; f++)
+		{
+			FragmentRun result = run_fragmented(f == 1, error_rates[r], message_length, baud);
+			bool ok = f == 0 || (result.intact && result.unprotected == 0);
+			pass = pass && ok;
+			printf("%-9.4f %-4s %6s %9lu %9lu %11lu %8lu %6lu %8.2f %13.1f %6s\n", error_rates[r], f ? "on" : "off", result.intact ? "yes" : "NO",
+				(unsigned long)result.fragments, (unsigned long)result.protected_frames, (unsigned long)result.unprotected,
+				(unsigned long)result.repaired, (unsigned long)result.retransmissions, result.seconds,
+				result.seconds > 0 && result.intact ? message_length * 8 / result.seconds / 1000.0 : 0.0, ok ? "PASS" : "FAIL");
+		}
+	}
+	return pass ? 0 : 1;
+}
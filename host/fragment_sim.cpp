@@ -0,0 +1,195 @@
+//64 KB message over UART and SPI loopback links on a virtual clock:
+//hand-chunked stop-and-wait DATA frames vs send_fragmented() through the sliding window, with and without
+//payload compression. The message is telemetry text; every run checks it arrives intact, the compressed one
+//also that its fragments went out compressed. A last run gives the receiver half the buffer it needs: it
+//must not ACK the fragments and send_fragmented() must fail. Exit status 1 if any of these checks fails.
+//Build: host/CMakeLists.txt, target fragment_sim
+//Usage: fragment_sim [bytes=65536] [window=8] [loss=0] [uart_baud=115200] [spi_hz=1000000]
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	uint8_t buffer[MAX_MESSAGE_SIZE];
+	uint32_t received;//bytes, either from DATA chunks or from one reassembled message
+	bool complete;
+
+	SlaveSide() : protocol(false), received(0), complete(false) {}
+};
+
+static SlaveSide* active_slave;
+static const uint8_t* expected_message;
+static uint32_t expected_length;
+
+static void message_complete(uint8_t /*message_id*/, const uint8_t* data, uint32_t length)
+{
+	active_slave->received = length;
+	active_slave->complete = length == expected_length && memcmp(data, expected_message, length) == 0;
+}
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.get_comm_interface()->receive();
+	if (!frame || !slave->protocol.validate_received_frame(frame.get())) return;
+	if (!Protocol::is_data_frame(frame.get()))
+	{
+		slave->protocol.process_frame(frame.get());//compression probes
+		return;
+	}
+	if (frame->packet_type == TYPE_FRAGMENT && !slave->protocol.can_reassemble(frame.get())) return;//no ACK, the sender fails the message
+	if (slave->protocol.accept_data_frame(frame.get()))
+	{
+		if (frame->packet_type == TYPE_FRAGMENT)
+		{
+			slave->protocol.deliver_fragment(frame.get());
+		}
+		else if (slave->received + frame->data_length <= MAX_MESSAGE_SIZE)
+		{
+			memcpy(&slave->buffer[slave->received], frame->data, frame->data_length);
+			slave->received += frame->data_length;
+			slave->complete = slave->received == expected_length && memcmp(slave->buffer, expected_message, expected_length) == 0;
+		}
+	}
+	slave->protocol.queue_ack(frame->sequence_num);
+}
+
+struct TransferRun
+{
+	bool complete;
+	bool acknowledged;//the sender saw every frame ACKed
+	double seconds;
+	uint32_t frames;
+	uint32_t wire_bytes;
+	uint32_t compressed_frames;
+	uint32_t retransmissions;
+};
+
+static TransferRun run(CommunicationMode mode, uint32_t rate, bool fragmented, bool compressed, uint8_t window, float loss,
+	uint32_t capacity = MAX_MESSAGE_SIZE)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(mode, rate);
+	link.master_end.set_loss_rate(loss);
+	link.slave_end.set_loss_rate(loss);
+	link.slave_end.set_seed(0x5EED);
+
+	SlaveSide* slave = new SlaveSide();//fresh receive window and reassembler per run
+	slave->protocol.set_communication_interface(&link.slave_end);
+	slave->protocol.set_reassembly_buffer(slave->buffer, capacity, message_complete);
+	active_slave = slave;
+	link.master_end.set_idle_hook(slave_step, slave);
+
+	EnhancedProtocol master(false);
+	master.set_communication_interface(&link.master_end);
+	master.set_window_size(window);
+	if (compressed)
+	{
+		master.set_compression(mode, true);
+		while (!master.is_compressing(mode) && clock.now_us() < 1000000)
+		{
+			if (!master.service()) clock.advance_us(100);
+		}
+	}
+
+	uint32_t frames_before = link.master_end.get_frames_sent();
+	uint32_t bytes_before = link.master_end.get_bytes_sent();
+	bool acknowledged = true;
+	if (fragmented)
+	{
+		acknowledged = master.send_fragmented(expected_message, expected_length);
+	}
+	else
+	{
+		//What the application does today: MAX_DATA_LEN chunks, one ACK round trip each
+		for (uint32_t offset = 0; offset < expected_length; offset += MAX_DATA_LEN)
+		{
+			uint16_t chunk = expected_length - offset < MAX_DATA_LEN ? expected_length - offset : MAX_DATA_LEN;
+			FrameHandle frame = frame_pool.acquire();
+			if (!frame || !master.create_frame(TYPE_DATA, &expected_message[offset], chunk, frame.get()) || !master.send_reliable(frame.get()))
+			{
+				acknowledged = false;
+				break;
+			}
+		}
+	}
+
+	TransferRun result;
+	result.complete = slave->complete;
+	result.acknowledged = acknowledged;
+	result.seconds = clock.now_us() / 1e6;
+	result.frames = link.master_end.get_frames_sent() - frames_before;
+	result.wire_bytes = link.master_end.get_bytes_sent() - bytes_before;
+	result.compressed_frames = master.get_performance_monitor().get_compressed_frames();
+	result.retransmissions = master.get_performance_monitor().get_retransmissions();
+	link.master_end.set_idle_hook(nullptr, nullptr);
+	delete slave;
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t length = argc > 1 ? strtoul(argv[1], nullptr, 10) : MAX_MESSAGE_SIZE;
+	uint8_t window = argc > 2 ? (uint8_t)atoi(argv[2]) : 8;
+	float loss = argc > 3 ? (float)atof(argv[3]) : 0.0f;
+	uint32_t uart_baud = argc > 4 ? strtoul(argv[4], nullptr, 10) : 115200;
+	uint32_t spi_hz = argc > 5 ? strtoul(argv[5], nullptr, 10) : 1000000;
+
+	length = constrain(length, 1, MAX_MESSAGE_SIZE);
+	window = constrain(window, 1, MAX_WINDOW_SIZE);
+	set_host_console(false);
+
+	//Log lines like the sketches send, so compression has something to work with
+	static uint8_t message[MAX_MESSAGE_SIZE];
+	char line[48];
+	for (uint32_t filled = 0, n = 0; filled < length; n++)
+	{
+		int line_length = snprintf(line, sizeof(line), "Test %lu - Time: %lu\n", (unsigned long)n, (unsigned long)(n * 250 + 1000));
+		uint32_t copied = length - filled < (uint32_t)line_length ? length - filled : (uint32_t)line_length;
+		memcpy(&message[filled], line, copied);
+		filled += copied;
+	}
+	expected_message = message;
+	expected_length = length;
+
+	printf("%lu byte message, window %u, loss %.3f\n", (unsigned long)length, window, loss);
+	printf("%-5s %-15s %9s %10s %12s %8s %10s %10s %8s\n", "link", "method", "complete", "seconds", "goodput kbps", "frames",
+		"wire bytes", "compressed", "retx");
+
+	const CommunicationMode modes[] = { MODE_UART, MODE_SPI };
+	const uint32_t rates[] = { uart_baud, spi_hz };
+	const char* links[] = { "UART", "SPI" };
+	const char* methods[] = { "chunked", "fragmented", "fragmented+lzss" };
+	bool pass = true;
+	for (uint8_t m = 0; m < 2; m++)
+	{
+		for (uint8_t method = 0; method < 3; method++)
+		{
+			TransferRun result = run(modes[m], rates[m], method > 0, method == 2, window, loss);
+			printf("%-5s %-15s %9s %10.3f %12.1f %8lu %10lu %10lu %8lu\n", links[m], methods[method], result.complete ? "yes" : "NO",
+				result.seconds, result.seconds > 0 ? length * 8 / result.seconds / 1000.0 : 0.0, (unsigned long)result.frames,
+				(unsigned long)result.wire_bytes, (unsigned long)result.compressed_frames, (unsigned long)result.retransmissions);
+			if (method > 0 && !result.complete) pass = false;
+			if (method == 2 && result.compressed_frames == 0) pass = false;
+		}
+	}
+
+	//Receiver cannot hold the message: nothing may be ACKed as if it had been taken
+	uint32_t capacity = length / 2;
+	TransferRun result = run(MODE_SPI, spi_hz, true, false, window, loss, capacity);
+	bool refused = !result.acknowledged && !result.complete;
+	printf("SPI fragmented into a %lu byte buffer: send_fragmented() %s after %.3f s, %lu frames (%s)\n", (unsigned long)capacity,
+		result.acknowledged ? "succeeded" : "failed", result.seconds, (unsigned long)result.frames, refused ? "expected" : "WRONG");
+	if (!refused) pass = false;
+	return pass ? 0 : 1;
+}
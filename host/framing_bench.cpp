@@ -0,0 +1,176 @@
+//Marker framing vs COBS framing: wire overhead and frames lost after single-byte drops
+//Build: host/CMakeLists.txt, target framing_bench
+//Usage: framing_bench [frames=10000] [payload=64] [drop_every=10] [baud=115200] [gap_us=0]
+//Every drop_every-th frame loses one random byte, frames are sent back to back (plus gap_us idle)
+//and parsed on a virtual clock, so the 500 ms receiver timeout only fires on real idle time.
+//Exit status 1 if an undamaged stream loses a frame, or COBS loses more intact frames than were damaged
+//(a dropped byte may take the next frame with it, no more). Marker framing has no such bound.
+
+#include "protocol.h"
+#include "uart_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+//Collects everything written to it
+class CaptureSerial : public HardwareSerial
+{
+public:
+	std::vector<uint8_t> bytes;
+
+	CaptureSerial() : HardwareSerial(1) {}
+
+	size_t write(uint8_t byte) override { bytes.push_back(byte); return 1; }
+	size_t write(const uint8_t* buffer, size_t size) override { bytes.insert(bytes.end(), buffer, buffer + size); return size; }
+};
+
+//Replays a byte stream at line rate on the virtual clock
+class TimedReplaySerial : public HardwareSerial
+{
+private:
+	const std::vector<uint8_t>& stream;
+	const std::vector<uint32_t>& gaps;//idle microseconds before each byte
+	VirtualClock& clock;
+	uint32_t byte_time_us;
+	size_t position;
+	bool gap_released;//idle time before stream[position] has passed and the receiver has seen it
+
+public:
+	TimedReplaySerial(const std::vector<uint8_t>& bytes, const std::vector<uint32_t>& idle, VirtualClock& virtual_clock, uint32_t baud) :
+		HardwareSerial(1), stream(bytes), gaps(idle), clock(virtual_clock), byte_time_us(10000000UL / baud), position(0), gap_released(false) {}
+
+	size_t remaining() const { return stream.size() - position; }
+
+	//Nothing arrives during an idle gap: pass_gap() moves the clock over it, release_gap() delivers the next byte
+	int available() override
+	{
+		if (position < stream.size() && gaps[position] && !gap_released) return 0;
+		return (int)(stream.size() - position);
+	}
+	void pass_gap()
+	{
+		if (position < stream.size()) clock.advance_us(gaps[position]);
+	}
+	void release_gap() { gap_released = true; }
+	int read() override
+	{
+		if (position >= stream.size()) return -1;
+		clock.advance_us(byte_time_us);
+		gap_released = false;
+		return stream[position++];
+	}
+	int peek() override { return position < stream.size() ? stream[position] : -1; }
+};
+
+struct FramingResult
+{
+	uint32_t wire_bytes;
+	uint32_t damaged;
+	uint32_t intact_lost;
+	uint32_t received;
+	uint32_t framing_errors;
+};
+
+static FramingResult run(UartFraming framing, uint32_t frame_count, uint16_t payload, uint32_t drop_every, uint32_t baud, uint32_t gap_us)
+{
+	FramingResult result = {};
+	std::mt19937 rng(0xF2A3);
+
+	//Encode the stream, one byte removed from every drop_every-th frame
+	Protocol sender;
+	CaptureSerial capture;
+	UARTInterface tx(&capture, baud, framing);
+	std::vector<uint8_t> stream;
+	std::vector<uint32_t> gaps;
+	std::vector<bool> damaged(frame_count, false);
+	uint8_t data[MAX_DATA_LEN];
+	UartFrame frame;
+
+	for (uint32_t i = 0; i < frame_count; i++)
+	{
+		for (uint16_t j = 0; j < payload; j++) data[j] = (uint8_t)rng();
+		sender.create_frame(TYPE_DATA, data, payload, &frame);
+		capture.bytes.clear();
+		tx.send(&frame);
+		result.wire_bytes += capture.bytes.size();
+
+		if (drop_every && i % drop_every == drop_every - 1)
+		{
+			capture.bytes.erase(capture.bytes.begin() + rng() % capture.bytes.size());
+			damaged[i] = true;
+			result.damaged++;
+		}
+		for (size_t j = 0; j < capture.bytes.size(); j++) gaps.push_back(j == 0 ? gap_us : 0);
+		stream.insert(stream.end(), capture.bytes.begin(), capture.bytes.end());
+	}
+
+	//Parse it back, frames are identified by sequence number (unique below 65536 frames)
+	VirtualClock clock;
+	set_host_clock(&clock);
+	TimedReplaySerial replay(stream, gaps, clock, baud);
+	UARTInterface rx(&replay, baud, framing);
+	Protocol receiver;
+	std::vector<bool> seen(frame_count, false);
+
+	while (replay.remaining() || rx.available())//the receiver may still hold buffered bytes
+	{
+		FrameHandle received = rx.receive();
+		if (!received)
+		{
+			replay.pass_gap();
+			rx.receive();//receiver polls the idle line, timeouts fire here
+			replay.release_gap();
+			continue;
+		}
+		if (!receiver.validate_frame(received.get())) continue;
+		uint16_t sequence = received->sequence_num;
+		if (sequence < frame_count && !damaged[sequence] && !seen[sequence])
+		{
+			seen[sequence] = true;
+			result.received++;
+		}
+	}
+	set_host_clock(nullptr);
+
+	for (uint32_t i = 0; i < frame_count; i++)
+	{
+		if (!damaged[i] && !seen[i]) result.intact_lost++;
+	}
+	result.framing_errors = rx.get_framing_errors();
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	uint32_t drop_every = argc > 3 ? strtoul(argv[3], nullptr, 10) : 10;
+	uint32_t baud = argc > 4 ? strtoul(argv[4], nullptr, 10) : 115200;
+	uint32_t gap_us = argc > 5 ? strtoul(argv[5], nullptr, 10) : 0;
+
+	frame_count = constrain(frame_count, 1, 65535);
+	payload = constrain(payload, 1, MAX_DATA_LEN);
+	if (baud == 0) baud = 115200;
+	set_host_console(false);
+
+	printf("%lu frames, %u byte payload, 1 byte dropped every %lu frames, %lu baud, %lu us gap\n",
+		(unsigned long)frame_count, payload, (unsigned long)drop_every, (unsigned long)baud, (unsigned long)gap_us);
+	printf("%-8s %12s %9s %12s %12s %14s %6s\n", "framing", "wire B/frame", "damaged", "intact lost", "lost/damaged", "framing errors",
+		"result");
+
+	const UartFraming modes[] = { FRAMING_MARKERS, FRAMING_COBS };
+	const char* names[] = { "markers", "cobs" };
+	bool pass = true;
+	for (uint8_t m = 0; m < 2; m++)
+	{
+		FramingResult result = run(modes[m], frame_count, payload, drop_every, baud, gap_us);
+		bool ok = result.damaged ? (modes[m] != FRAMING_COBS || result.intact_lost <= result.damaged) : result.intact_lost == 0;
+		pass = pass && ok;
+		printf("%-8s %12.2f %9lu %12lu %12.2f %14lu %6s\n", names[m], (double)result.wire_bytes / frame_count,
+			(unsigned long)result.damaged, (unsigned long)result.intact_lost,
+			result.damaged ? (double)result.intact_lost / result.damaged : 0.0, (unsigned long)result.framing_errors, ok ? "PASS" : "FAIL");
+	}
+	return pass ? 0 : 1;
+}
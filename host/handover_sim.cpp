@@ -0,0 +1,220 @@
+//Live UART <-> SPI handover under a continuous send_async() stream, over two LoopbackLinks on a virtual clock
+//Build: host/CMakeLists.txt, target handover_sim
+//Usage: handover_sim [frames=5000] [payload=64] [switch_every=500] [loss=0] [uart_baud=115200] [spi_hz=1000000]
+//The master calls begin_switch() every switch_every frames, alternating links. Runs: UART only (baseline),
+//switching, and switching with the SPI link dead (every handover has to fall back to UART).
+//The slave checks that every frame arrives exactly once with its payload intact; the longest gap between
+//two deliveries shows how long the data path stalls around a handover. Exit status 1 unless every run
+//delivers every frame once, intact, with no send failed.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	VirtualClock* clock;
+	uint16_t payload;
+	std::vector<bool> seen;
+	uint32_t delivered;
+	uint32_t duplicates;
+	uint32_t corrupted;
+	uint64_t last_delivery_us;
+	uint64_t longest_gap_us;
+
+	SlaveSide(VirtualClock* virtual_clock, uint32_t frames, uint16_t payload_size) : protocol(false), clock(virtual_clock), payload(payload_size),
+		seen(frames, false), delivered(0), duplicates(0), corrupted(0), last_delivery_us(0), longest_gap_us(0) {}
+};
+
+static void fill_payload(uint8_t* data, uint16_t length, uint32_t index)
+{
+	memcpy(data, &index, sizeof(index));
+	for (uint16_t i = sizeof(index); i < length; i++) data[i] = (uint8_t)(index * 13 + i);
+}
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.receive_frame();//both links while a handover settles
+	if (frame && slave->protocol.validate_received_frame(frame.get()))
+	{
+		slave->protocol.process_frame(frame.get());//TYPE_SWITCH drives the handover
+		if (frame->packet_type == TYPE_DATA)
+		{
+			if (slave->protocol.accept_data_frame(frame.get()))
+			{
+				uint32_t index;
+				uint8_t expected[MAX_DATA_LEN];
+				memcpy(&index, frame->data, sizeof(index));
+				fill_payload(expected, slave->payload, index);
+				if (index >= slave->seen.size() || frame->data_length != slave->payload || memcmp(frame->data, expected, slave->payload) != 0)
+				{
+					slave->corrupted++;
+				}
+				else if (slave->seen[index])
+				{
+					slave->duplicates++;
+				}
+				else
+				{
+					slave->seen[index] = true;
+					slave->delivered++;
+					uint64_t now = slave->clock->now_us();
+					if (slave->last_delivery_us && now - slave->last_delivery_us > slave->longest_gap_us) slave->longest_gap_us = now - slave->last_delivery_us;
+					slave->last_delivery_us = now;
+				}
+			}
+			slave->protocol.queue_ack(frame->sequence_num);
+		}
+	}
+	slave->protocol.service_timers();
+}
+
+struct SendTally
+{
+	uint32_t completed;
+	uint32_t failed;
+};
+
+static void count_completion(void* context, uint16_t /*seq_num*/, bool delivered)
+{
+	SendTally* tally = (SendTally*)context;
+	tally->completed++;
+	if (!delivered) tally->failed++;
+}
+
+struct HandoverRun
+{
+	double seconds;
+	uint32_t delivered;
+	uint32_t duplicates;
+	uint32_t corrupted;
+	uint32_t failed_sends;
+	uint32_t switches;
+	uint32_t switch_failures;
+	double mean_switch_ms;
+	double max_switch_ms;
+	double longest_gap_ms;
+	uint32_t retransmissions;
+};
+
+static HandoverRun run(uint32_t frame_count, uint16_t payload, uint32_t switch_every, float loss, uint32_t uart_baud, uint32_t spi_hz, bool spi_dead)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink uart(MODE_UART, uart_baud);
+	LoopbackLink spi(MODE_SPI, spi_hz);
+	float spi_loss = spi_dead ? 1.0f : loss;
+	uart.master_end.set_loss_rate(loss);
+	uart.slave_end.set_loss_rate(loss);
+	uart.slave_end.set_seed(0x5EED);
+	spi.master_end.set_loss_rate(spi_loss);
+	spi.slave_end.set_loss_rate(spi_loss);
+	spi.master_end.set_seed(0xC0DE);
+	spi.slave_end.set_seed(0xFACE);
+
+	SlaveSide* slave = new SlaveSide(&clock, frame_count, payload);
+	slave->protocol.add_interface(&spi.slave_end);
+	slave->protocol.set_communication_interface(&uart.slave_end);
+	uart.master_end.set_idle_hook(slave_step, slave);
+	spi.master_end.set_idle_hook(slave_step, slave);
+
+	EnhancedProtocol master(false);
+	master.add_interface(&spi.master_end);
+	master.set_communication_interface(&uart.master_end);
+
+	HandoverRun result = {};
+	SendTally tally = {};
+	uint8_t data[MAX_DATA_LEN];
+	uint32_t sent = 0;
+	uint32_t switches_seen = 0;
+	double switch_ms_total = 0;
+	while (tally.completed < frame_count)
+	{
+		if (sent < frame_count && master.can_send_async(master.peek_next_sequence()))
+		{
+			FrameHandle frame = frame_pool.acquire();
+			fill_payload(data, payload, sent);
+			if (frame && master.create_frame(TYPE_DATA, data, payload, frame.get()) && master.send_async(frame, count_completion, &tally))
+			{
+				sent++;
+				if (switch_every && sent % switch_every == 0)
+				{
+					master.begin_switch(master.get_current_mode() == MODE_UART ? MODE_SPI : MODE_UART);
+				}
+			}
+		}
+		if (!master.service()) clock.advance_us(20);
+
+		PerformanceMonitor& perf = master.get_performance_monitor();
+		if (perf.get_switches() != switches_seen)
+		{
+			switches_seen = perf.get_switches();
+			switch_ms_total += perf.get_last_switch_us() / 1000.0;
+		}
+	}
+
+	//Let the last ACKs and any handover in progress settle
+	uint64_t settle_until = clock.now_us() + SWITCH_SETTLE_MS * 2000UL;
+	while (clock.now_us() < settle_until)
+	{
+		if (!master.service()) clock.advance_us(100);
+	}
+
+	PerformanceMonitor& perf = master.get_performance_monitor();
+	result.seconds = clock.now_us() / 1e6;
+	result.delivered = slave->delivered;
+	result.duplicates = slave->duplicates;
+	result.corrupted = slave->corrupted;
+	result.failed_sends = tally.failed;
+	result.switches = perf.get_switches();
+	result.switch_failures = perf.get_switch_failures();
+	result.mean_switch_ms = result.switches ? switch_ms_total / result.switches : 0.0;
+	result.max_switch_ms = perf.get_max_switch_us() / 1000.0;
+	result.longest_gap_ms = slave->longest_gap_us / 1000.0;
+	result.retransmissions = perf.get_retransmissions();
+	uart.master_end.set_idle_hook(nullptr, nullptr);
+	spi.master_end.set_idle_hook(nullptr, nullptr);
+	delete slave;
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	uint32_t switch_every = argc > 3 ? strtoul(argv[3], nullptr, 10) : 500;
+	float loss = argc > 4 ? (float)atof(argv[4]) : 0.0f;
+	uint32_t uart_baud = argc > 5 ? strtoul(argv[5], nullptr, 10) : 115200;
+	uint32_t spi_hz = argc > 6 ? strtoul(argv[6], nullptr, 10) : 1000000;
+
+	payload = constrain(payload, 4, MAX_DATA_LEN);
+	set_host_console(false);
+
+	printf("%lu frames, %u byte payload, switch every %lu frames, loss %.3f, UART %lu baud, SPI %lu Hz\n",
+		(unsigned long)frame_count, payload, (unsigned long)switch_every, loss, (unsigned long)uart_baud, (unsigned long)spi_hz);
+	printf("%-10s %9s %5s %7s %6s %9s %7s %13s %12s %14s %6s %9s %6s\n", "run", "delivered", "dups", "corrupt", "failed",
+		"switches", "aborts", "mean switch ms", "max switch ms", "longest gap ms", "retx", "virtual s", "result");
+
+	const char* names[] = { "uart only", "switching", "spi dead" };
+	bool pass = true;
+	for (uint8_t r = 0; r < 3; r++)
+	{
+		HandoverRun result = run(frame_count, payload, r == 0 ? 0 : switch_every, loss, uart_baud, spi_hz, r == 2);
+		bool ok = result.delivered == frame_count && result.duplicates == 0 && result.corrupted == 0 && result.failed_sends == 0;
+		pass = pass && ok;
+		printf("%-10s %9lu %5lu %7lu %6lu %9lu %7lu %13.3f %12.3f %14.3f %6lu %9.3f %6s\n", names[r], (unsigned long)result.delivered,
+			(unsigned long)result.duplicates, (unsigned long)result.corrupted, (unsigned long)result.failed_sends, (unsigned long)result.switches,
+			(unsigned long)result.switch_failures, result.mean_switch_ms, result.max_switch_ms, result.longest_gap_ms,
+			(unsigned long)result.retransmissions, result.seconds, ok ? "PASS" : "FAIL");
+	}
+	return pass ? 0 : 1;
+}
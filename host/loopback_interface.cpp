@@ -0,0 +1,144 @@
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <Arduino.h>
+
+LoopbackInterface::LoopbackInterface(CommunicationMode link_mode, uint32_t baud) :
+	mode(link_mode),
+	baud_rate(baud),
+	bits_per_byte(link_mode == MODE_UART ? 10 : 8),
+	peer(nullptr),
+	blocking(true),
+	line_free_us(0),
+	latency_us(0),
+	loss_per_million(0),
+	corrupt_per_million(0),
+	byte_error_per_million(0),
+	drop_count(0),
+	rng_state(1),
+	idle_hook(nullptr),
+	idle_context(nullptr),
+	in_idle_hook(false),
+	frames_sent(0),
+	frames_lost(0),
+	frames_corrupted(0),
+	bytes_sent(0)
+{
+}
+
+void LoopbackInterface::connect(LoopbackInterface& a, LoopbackInterface& b)
+{
+	a.peer = &b;
+	b.peer = &a;
+}
+
+uint32_t LoopbackInterface::serialization_us(uint16_t wire_length) const
+{
+	if (baud_rate == 0) return 0;//unthrottled link
+	return (uint32_t)((uint64_t)wire_length * bits_per_byte * 1000000 / baud_rate);
+}
+
+bool LoopbackInterface::send(const UartFrame* frame)
+{
+	if (!peer || !frame) return false;
+
+	uint16_t wire_length = Protocol::wire_size(frame);
+	uint64_t sent_us;
+	if (blocking)
+	{
+		host_clock().sleep_us(serialization_us(wire_length));//the line is busy until the last byte is out
+		sent_us = host_clock().now_us();
+	}
+	else
+	{
+		uint64_t now_us = host_clock().now_us();
+		line_free_us = (line_free_us > now_us ? line_free_us : now_us) + serialization_us(wire_length);
+		sent_us = line_free_us;
+	}
+
+	frames_sent++;
+	bytes_sent += wire_length;
+
+	if (drop_count > 0 || chance(loss_per_million))
+	{
+		if (drop_count > 0) drop_count--;
+		frames_lost++;
+		return true;//lost on the wire, the sender cannot tell
+	}
+
+	WireFrame* next = peer->rx_queue.back();
+	if (!next)
+	{
+		frames_lost++;//receiver overrun
+		return true;
+	}
+
+	WireFrame& slot = *next;
+	slot.length = Protocol::encode_frame(frame, slot.bytes);
+	slot.ready_us = sent_us + latency_us;
+
+	if (chance(corrupt_per_million))
+	{
+		//Flip one bit anywhere on the wire, including markers and length
+		uint32_t bit = rng_state % (slot.length * 8);
+		slot.bytes[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+		frames_corrupted++;
+	}
+	else if (byte_error_per_million)
+	{
+		bool hit = false;
+		for (uint16_t i = 0; i < slot.length; i++)
+		{
+			if (!chance(byte_error_per_million)) continue;
+			slot.bytes[i] ^= (uint8_t)(1 << (rng_state >> 29));
+			hit = true;
+		}
+		if (hit) frames_corrupted++;
+	}
+
+	peer->rx_queue.push_back();
+	return true;
+}
+
+FrameHandle LoopbackInterface::receive()
+{
+	run_idle_hook();
+	if (!frame_ready()) return FrameHandle();
+
+	WireFrame& slot = *rx_queue.front();
+	FrameHandle frame = frame_pool.acquire();
+	bool decoded = frame && Protocol::decode_frame(slot.bytes, slot.length, frame.get());
+	rx_queue.pop_front();
+	return decoded ? frame : FrameHandle();
+}
+
+bool LoopbackInterface::available()
+{
+	run_idle_hook();
+	return frame_ready();
+}
+
+bool LoopbackInterface::frame_ready()
+{
+	const WireFrame* next = rx_queue.front();
+	return next && next->ready_us <= host_clock().now_us();
+}
+
+void LoopbackInterface::run_idle_hook()
+{
+	if (!idle_hook || in_idle_hook) return;
+
+	in_idle_hook = true;
+	idle_hook(idle_context);
+	in_idle_hook = false;
+}
+
+bool LoopbackInterface::chance(uint32_t per_million)
+{
+	if (per_million == 0) return false;
+
+	//xorshift32, deterministic for a given seed
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return (rng_state % 1000000) < per_million;
+}
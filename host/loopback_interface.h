@@ -0,0 +1,109 @@
+#pragma once
+#ifndef LOOPBACK_INTERFACE_H
+#define LOOPBACK_INTERFACE_H
+
+//In-memory CommunicationInterface for host builds. Frames travel in wire format and become
+//visible to the peer once they would have finished serializing at the configured baud rate.
+//Each direction is an SPSC queue, so one thread may send while another receives (protocol_tasks.h).
+
+#include "communication_interface.h"
+#include "spsc_queue.h"
+
+#define LOOPBACK_QUEUE_DEPTH 32//frames in flight per direction, power of two
+
+class LoopbackInterface : public CommunicationInterface
+{
+private:
+	struct WireFrame
+	{
+		uint8_t bytes[MAX_FRAME_SIZE];
+		uint16_t length;
+		uint64_t ready_us;//host clock time the last byte arrives
+	};
+
+	CommunicationMode mode;
+	uint32_t baud_rate;
+	uint8_t bits_per_byte;//start + 8N1 stop bits for UART, 8 for SPI
+	LoopbackInterface* peer;
+	bool blocking;
+	uint64_t line_free_us;//non-blocking: host clock time the last queued frame finishes serializing
+
+	//Frames on their way to this end, filled by the peer's send()
+	SPSCQueue<WireFrame, LOOPBACK_QUEUE_DEPTH> rx_queue;
+
+	//Link model
+	uint32_t latency_us;//added after serialization
+	uint32_t loss_per_million;
+	uint32_t corrupt_per_million;
+	uint32_t byte_error_per_million;
+	uint32_t drop_count;//next frames sent that are lost for certain
+	uint32_t rng_state;
+
+	//Single-threaded harness: runs the other side's loop while this end polls
+	void (*idle_hook)(void* context);
+	void* idle_context;
+	bool in_idle_hook;
+
+	//Statistics
+	uint32_t frames_sent;
+	uint32_t frames_lost;
+	uint32_t frames_corrupted;
+	uint32_t bytes_sent;
+
+public:
+	LoopbackInterface(CommunicationMode link_mode = MODE_UART, uint32_t baud = 115200);//baud 0 = no serialization delay
+
+	static void connect(LoopbackInterface& a, LoopbackInterface& b);
+
+	//CommunicationInterface implementation
+	bool send(const UartFrame* frame) override;//blocks for the serialization time, like a flushed UART write (see set_blocking)
+	FrameHandle receive() override;
+	bool available() override;
+
+	CommunicationMode get_mode() override { return mode; }
+	void begin() override {}
+	void reset_receiver() override {}
+
+	uint32_t get_baud_rate() const override { return baud_rate; }
+	bool is_connected() const override { return peer != nullptr; }
+
+	//Link model
+	void set_latency_us(uint32_t latency) { latency_us = latency; }
+	void set_loss_rate(float probability) { loss_per_million = (uint32_t)(probability * 1000000.0f); }
+	void set_corruption_rate(float probability) { corrupt_per_million = (uint32_t)(probability * 1000000.0f); }
+	//Noisy line: every wire byte independently gets a bit flipped, so one frame can take several hits
+	void set_byte_error_rate(float probability) { byte_error_per_million = (uint32_t)(probability * 1000000.0f); }
+	void set_seed(uint32_t seed) { rng_state = seed ? seed : 1; }
+	void drop_next(uint32_t count) { drop_count = count; }//the next count frames sent are lost
+	void set_idle_hook(void (*hook)(void* context), void* context) { idle_hook = hook; idle_context = context; }
+	//false: send() queues the frame behind the ones still on the line and returns at once, like a DMA
+	//or driver TX buffer, so one thread can keep two links busy
+	void set_blocking(bool block) { blocking = block; }
+
+	uint32_t serialization_us(uint16_t wire_length) const;
+
+	uint32_t get_frames_sent() const { return frames_sent; }
+	uint32_t get_frames_lost() const { return frames_lost; }
+	uint32_t get_frames_corrupted() const { return frames_corrupted; }
+	uint32_t get_bytes_sent() const { return bytes_sent; }
+
+private:
+	bool chance(uint32_t per_million);
+	void run_idle_hook();
+	bool frame_ready();
+};
+
+//Master and slave end of one simulated link
+class LoopbackLink
+{
+public:
+	LoopbackInterface master_end;
+	LoopbackInterface slave_end;
+
+	LoopbackLink(CommunicationMode link_mode = MODE_UART, uint32_t baud = 115200) : master_end(link_mode, baud), slave_end(link_mode, baud)
+	{
+		LoopbackInterface::connect(master_end, slave_end);
+	}
+};
+
+#endif // !LOOPBACK_INTERFACE_H
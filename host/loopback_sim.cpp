@@ -0,0 +1,123 @@
+//Master/slave session over a LoopbackLink on a virtual clock
+//Build: host/CMakeLists.txt, target loopback_sim
+//Usage: loopback_sim [frames=10000] [window=8] [payload=64] [baud=115200] [loss=0]
+//Exit status 1 unless every frame is acknowledged and arrives once with its payload intact.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	uint16_t payload;
+	uint32_t delivered;
+	uint32_t corrupted;
+
+	SlaveSide(uint16_t payload_size) : protocol(false), payload(payload_size), delivered(0), corrupted(0) {}
+};
+
+//One pass of the slave's loop(), run whenever the master polls its end of the link
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.get_comm_interface()->receive();
+	if (frame)
+	{
+		if (!slave->protocol.validate_received_frame(frame.get()))
+		{
+			slave->protocol.send_nack(frame->sequence_num);
+		}
+		else if (frame->packet_type == TYPE_DATA)
+		{
+			if (slave->protocol.accept_data_frame(frame.get()))
+			{
+				bool intact = frame->data_length == slave->payload;
+				for (uint16_t i = 0; intact && i < slave->payload; i++) intact = frame->data[i] == (uint8_t)i;
+				if (intact) slave->delivered++;
+				else slave->corrupted++;
+			}
+			slave->protocol.queue_ack(frame->sequence_num);
+		}
+	}
+	slave->protocol.service_acks();
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+	uint8_t window = argc > 2 ? (uint8_t)atoi(argv[2]) : 8;
+	uint16_t payload = argc > 3 ? (uint16_t)atoi(argv[3]) : 64;
+	uint32_t baud = argc > 4 ? strtoul(argv[4], nullptr, 10) : 115200;
+	float loss = argc > 5 ? (float)atof(argv[5]) : 0.0f;
+
+	window = constrain(window, 1, MAX_WINDOW_SIZE);
+	payload = constrain(payload, 1, MAX_DATA_LEN);
+
+	VirtualClock clock;
+	set_host_clock(&clock);
+	set_host_console(false);//per-frame protocol logging would dominate the run
+
+	LoopbackLink link(MODE_UART, baud);
+	link.master_end.set_loss_rate(loss);
+	link.slave_end.set_loss_rate(loss);
+	link.slave_end.set_seed(0x5EED);
+
+	SlaveSide slave(payload);
+	slave.protocol.set_communication_interface(&link.slave_end);
+	link.master_end.set_idle_hook(slave_step, &slave);
+
+	EnhancedProtocol master(true);
+	master.set_communication_interface(&link.master_end);
+	master.set_window_size(window);
+
+	uint8_t data[MAX_DATA_LEN];
+	for (uint16_t i = 0; i < payload; i++) data[i] = (uint8_t)i;
+
+	std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+	uint64_t virtual_start = clock.now_us();
+
+	uint32_t delivered = 0;
+	FrameHandle frames[MAX_WINDOW_SIZE];
+	for (uint32_t sent = 0; sent < frame_count;)
+	{
+		uint16_t batch = 0;
+		while (batch < window && sent + batch < frame_count)
+		{
+			frames[batch] = frame_pool.acquire();
+			if (!frames[batch]) break;
+			master.create_frame(TYPE_DATA, data, payload, frames[batch].get());
+			batch++;
+		}
+		if (batch == 0)
+		{
+			fprintf(stderr, "frame pool exhausted\n");
+			return 1;
+		}
+
+		delivered += master.send_reliable(frames, batch);
+		for (uint16_t i = 0; i < batch; i++) frames[i].release();
+		sent += batch;
+	}
+
+	double virtual_s = (clock.now_us() - virtual_start) / 1e6;
+	double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+
+	set_host_console(true);
+	printf("frames %u window %u payload %u baud %u loss %.3f\n", frame_count, window, payload, baud, loss);
+	printf("delivered %u (acked %u, corrupt %u), master tx %u frames / %u bytes, lost %u\n",
+		slave.delivered, delivered, slave.corrupted, link.master_end.get_frames_sent(), link.master_end.get_bytes_sent(),
+		link.master_end.get_frames_lost() + link.slave_end.get_frames_lost());
+	printf("virtual time %.3f s, goodput %.1f kbps, wall time %.1f ms\n",
+		virtual_s, virtual_s > 0 ? slave.delivered * payload * 8 / virtual_s / 1000.0 : 0.0, wall_ms);
+	master.print_statistics();
+	frame_pool.print_statistics();
+
+	bool pass = slave.delivered == frame_count && delivered == frame_count && slave.corrupted == 0;
+	printf("result %s\n", pass ? "PASS" : "FAIL");
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+#include "mock_spi_bus.h"
+#include "host_shim.h"
+#include <string.h>
+
+MockSPIBus::MockSPIBus(uint32_t guard_bits) : head(0), count(0), clock_hz(1000000), cs_guard_bits(guard_bits), bus_free_us(0),
+	responder(nullptr), responder_context(nullptr), device_count(0), transactions(0), bytes(0), busy_us(0)
+{
+}
+
+bool MockSPIBus::add_device(int8_t cs_pin, Responder callback, void* context)
+{
+	if (device_count == MOCK_SPI_MAX_DEVICES) return false;
+	devices[device_count].cs_pin = cs_pin;
+	devices[device_count].responder = callback;
+	devices[device_count].context = context;
+	device_count++;
+	return true;
+}
+
+bool MockSPIBus::begin(uint32_t clock)
+{
+	clock_hz = clock ? clock : 1000000;
+	return true;
+}
+
+bool MockSPIBus::queue(SPITransaction* transaction)
+{
+	if (count == SPI_QUEUE_DEPTH) return false;
+
+	//Starts when the bus frees up, like a DMA queue
+	uint64_t now = host_clock().now_us();
+	uint64_t start = bus_free_us > now ? bus_free_us : now;
+	uint64_t bits = (uint64_t)transaction->length * 8 + cs_guard_bits;
+	uint64_t duration = (bits * 1000000 + clock_hz - 1) / clock_hz;//whole microseconds, rounded up
+	bus_free_us = start + duration;
+
+	Responder callback = responder;
+	void* context = responder_context;
+	for (uint8_t i = 0; i < device_count; i++)
+	{
+		if (devices[i].cs_pin != transaction->cs_pin) continue;
+		callback = devices[i].responder;
+		context = devices[i].context;
+		break;
+	}
+	if (callback) callback(context, transaction->tx, transaction->rx, transaction->length);
+	else memset(transaction->rx, 0, transaction->length);
+
+	uint8_t slot = (head + count) % SPI_QUEUE_DEPTH;
+	queued[slot] = transaction;
+	done_us[slot] = bus_free_us;
+	count++;
+
+	transactions++;
+	bytes += transaction->length;
+	busy_us += duration;
+	return true;
+}
+
+SPITransaction* MockSPIBus::poll()
+{
+	if (count == 0 || host_clock().now_us() < done_us[head]) return nullptr;
+
+	SPITransaction* transaction = queued[head];
+	head = (head + 1) % SPI_QUEUE_DEPTH;
+	count--;
+	return transaction;
+}
+
+SPITransaction* MockSPIBus::wait(uint32_t timeout_us)
+{
+	if (count == 0) return nullptr;
+
+	uint64_t now = host_clock().now_us();
+	if (done_us[head] > now)
+	{
+		uint64_t remaining = done_us[head] - now;
+		host_clock().sleep_us(remaining < timeout_us ? remaining : timeout_us);
+	}
+	return poll();
+}
@@ -0,0 +1,64 @@
+#pragma once
+#ifndef MOCK_SPI_BUS_H
+#define MOCK_SPI_BUS_H
+
+//Host SPIBusDriver: a transaction occupies the bus for its clocked bits plus a CS guard and
+//finishes on the host clock (VirtualClock for simulation). A responder stands in for the slave;
+//on a shared bus each device has its own, picked by the transaction's cs_pin.
+
+#include "spi_bus.h"
+
+#define MOCK_SPI_MAX_DEVICES 8
+
+class MockSPIBus : public SPIBusDriver
+{
+public:
+	//Fills miso for a transaction as it starts, the bus reads zeros without one
+	typedef void (*Responder)(void* context, const uint8_t* mosi, uint8_t* miso, uint16_t length);
+
+private:
+	SPITransaction* queued[SPI_QUEUE_DEPTH];
+	uint64_t done_us[SPI_QUEUE_DEPTH];
+	uint8_t head;
+	uint8_t count;
+
+	uint32_t clock_hz;
+	uint32_t cs_guard_bits;//CS setup + hold, in SPI clock cycles
+	uint64_t bus_free_us;
+
+	Responder responder;//transactions for no registered device
+	void* responder_context;
+
+	struct Device
+	{
+		int8_t cs_pin;
+		Responder responder;
+		void* context;
+	};
+	Device devices[MOCK_SPI_MAX_DEVICES];
+	uint8_t device_count;
+
+	//Statistics
+	uint32_t transactions;
+	uint64_t bytes;
+	uint64_t busy_us;
+
+public:
+	MockSPIBus(uint32_t guard_bits = 4);
+
+	bool begin(uint32_t clock) override;
+	bool queue(SPITransaction* transaction) override;
+	SPITransaction* poll() override;
+	SPITransaction* wait(uint32_t timeout_us) override;
+	uint8_t get_in_flight() const override { return count; }
+	uint32_t get_clock_hz() const override { return clock_hz; }
+
+	void set_responder(Responder callback, void* context) { responder = callback; responder_context = context; }
+	bool add_device(int8_t cs_pin, Responder callback, void* context);//answers the transactions that assert cs_pin
+
+	uint32_t get_transactions() const { return transactions; }
+	uint64_t get_bytes() const { return bytes; }
+	uint64_t get_busy_us() const { return busy_us; }
+};
+
+#endif // !MOCK_SPI_BUS_H
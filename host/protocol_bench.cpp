@@ -0,0 +1,335 @@
+//Microbenchmarks for the protocol hot paths (Google Benchmark)
+//One iteration = one frame, so time/iteration is ns/frame; bytes/s counts payload (CRC: input bytes, receive: wire bytes)
+
+#include <benchmark/benchmark.h>
+#include "enhanced_protocol.h"
+#include "uart_interface.h"
+#include "performance.h"
+#include "host_shim.h"
+#include "logger.h"
+
+//Serial port replaying a fixed byte stream
+class ReplaySerial : public HardwareSerial
+{
+private:
+	const uint8_t* stream;
+	size_t length;
+	size_t position;
+
+public:
+	ReplaySerial(const uint8_t* bytes, size_t size) : HardwareSerial(1), stream(bytes), length(size), position(0) {}
+
+	void rewind() { position = 0; }
+
+	int available() override { return (int)(length - position); }
+	int read() override { return position < length ? stream[position++] : -1; }
+	int peek() override { return position < length ? stream[position] : -1; }
+};
+
+static void fill_payload(uint8_t* data, uint16_t length)
+{
+	for (uint16_t i = 0; i < length; i++) data[i] = (uint8_t)(i * 31 + 7);
+}
+
+static void payload_sizes(benchmark::internal::Benchmark* bench)
+{
+	const uint16_t sizes[] = { 8, 32, 64 };
+	for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		if (sizes[i] < MAX_DATA_LEN) bench->Arg(sizes[i]);
+	}
+	bench->Arg(MAX_DATA_LEN);
+}
+
+static void BM_Crc16Calculate(benchmark::State& state)
+{
+	uint16_t length = (uint16_t)state.range(0);
+	uint8_t data[1024];
+	fill_payload(data, length);
+
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(CRC16::calculate(data, length));
+	}
+	state.SetBytesProcessed(state.iterations() * length);
+	state.SetLabel(CRC16::engine_name());
+}
+BENCHMARK(BM_Crc16Calculate)->Arg(6)->Arg(32)->Arg(134)->Arg(1024);
+
+static void BM_CreateFrame(benchmark::State& state)
+{
+	uint16_t length = (uint16_t)state.range(0);
+	uint8_t data[MAX_DATA_LEN];
+	fill_payload(data, length);
+
+	Protocol protocol;
+	UartFrame frame;
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(protocol.create_frame(TYPE_DATA, data, length, &frame));
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_CreateFrame)->Apply(payload_sizes);
+
+static void BM_ValidateFrame(benchmark::State& state)
+{
+	uint16_t length = (uint16_t)state.range(0);
+	uint8_t data[MAX_DATA_LEN];
+	fill_payload(data, length);
+
+	Protocol protocol;
+	UartFrame frame;
+	protocol.create_frame(TYPE_DATA, data, length, &frame);
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(protocol.validate_frame(&frame));
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_ValidateFrame)->Apply(payload_sizes);
+
+static void BM_EncodeFrame(benchmark::State& state)
+{
+	uint16_t length = (uint16_t)state.range(0);
+	uint8_t data[MAX_DATA_LEN];
+	fill_payload(data, length);
+
+	Protocol protocol;
+	UartFrame frame;
+	protocol.create_frame(TYPE_DATA, data, length, &frame);
+	uint8_t wire[MAX_FRAME_SIZE];
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(Protocol::encode_frame(&frame, wire));
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * length);
+}
+BENCHMARK(BM_EncodeFrame)->Apply(payload_sizes);
+
+static void BM_UartReceive(benchmark::State& state)
+{
+	uint16_t length = (uint16_t)state.range(0);
+	uint8_t data[MAX_DATA_LEN];
+	fill_payload(data, length);
+
+	Protocol protocol;
+	UartFrame frame;
+	protocol.create_frame(TYPE_DATA, data, length, &frame);
+	uint8_t wire[MAX_FRAME_SIZE];
+	uint16_t wire_length = Protocol::encode_frame(&frame, wire);
+
+	ReplaySerial serial(wire, wire_length);
+	UARTInterface uart(&serial);
+	for (auto _ : state)
+	{
+		serial.rewind();
+		FrameHandle received = uart.receive();
+		if (!received)
+		{
+			state.SkipWithError("frame not parsed");
+			break;
+		}
+		benchmark::DoNotOptimize(received.get());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * wire_length);
+}
+BENCHMARK(BM_UartReceive)->Apply(payload_sizes);
+
+//Sends one frame through a UART in the given framing and keeps the bytes
+class CaptureSerial : public HardwareSerial
+{
+public:
+	uint8_t bytes[MAX_FRAME_SIZE * 2];
+	size_t length;
+
+	CaptureSerial() : HardwareSerial(1), length(0) {}
+
+	size_t write(uint8_t byte) override { bytes[length++] = byte; return 1; }
+	size_t write(const uint8_t* buffer, size_t size) override { memcpy(&bytes[length], buffer, size); length += size; return size; }
+};
+
+static void BM_UartReceiveCobs(benchmark::State& state)
+{
+	uint16_t length = (uint16_t)state.range(0);
+	uint8_t data[MAX_DATA_LEN];
+	fill_payload(data, length);
+
+	Protocol protocol;
+	UartFrame frame;
+	protocol.create_frame(TYPE_DATA, data, length, &frame);
+	CaptureSerial capture;
+	UARTInterface tx(&capture, 115200, FRAMING_COBS);
+	tx.send(&frame);
+
+	ReplaySerial serial(capture.bytes, capture.length);
+	UARTInterface uart(&serial, 115200, FRAMING_COBS);
+	for (auto _ : state)
+	{
+		serial.rewind();
+		FrameHandle received = uart.receive();
+		if (!received)
+		{
+			state.SkipWithError("frame not parsed");
+			break;
+		}
+		benchmark::DoNotOptimize(received.get());
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * capture.length);
+}
+BENCHMARK(BM_UartReceiveCobs)->Apply(payload_sizes);
+
+static void BM_ReceiveAndValidate(benchmark::State& state)
+{
+	//Full receive path: parse with streaming CRC, then validate without recomputing it
+	uint16_t length = (uint16_t)state.range(0);
+	uint8_t data[MAX_DATA_LEN];
+	fill_payload(data, length);
+
+	EnhancedProtocol protocol(false);
+	UartFrame frame;
+	protocol.create_frame(TYPE_DATA, data, length, &frame);
+	uint8_t wire[MAX_FRAME_SIZE];
+	uint16_t wire_length = Protocol::encode_frame(&frame, wire);
+
+	ReplaySerial serial(wire, wire_length);
+	UARTInterface uart(&serial);
+	protocol.set_communication_interface(&uart);
+	for (auto _ : state)
+	{
+		serial.rewind();
+		FrameHandle received = uart.receive();
+		benchmark::DoNotOptimize(received && protocol.validate_received_frame(received.get()));
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * wire_length);
+}
+BENCHMARK(BM_ReceiveAndValidate)->Apply(payload_sizes);
+
+static void BM_PerfPacketSent(benchmark::State& state)
+{
+	PerformanceMonitor monitor;
+	uint16_t length = (uint16_t)state.range(0);
+	for (auto _ : state)
+	{
+		monitor.packet_sent(length + FRAME_OVERHEAD, length);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PerfPacketSent)->Arg(64);
+
+static void BM_PerfPacketReceived(benchmark::State& state)
+{
+	PerformanceMonitor monitor;
+	for (auto _ : state)
+	{
+		monitor.packet_received(74);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PerfPacketReceived);
+
+static void BM_PerfLatencyMeasurement(benchmark::State& state)
+{
+	PerformanceMonitor monitor;
+	uint16_t sequence = 0;
+	for (auto _ : state)
+	{
+		monitor.start_latency_measurement(sequence);
+		monitor.end_latency_measurement(sequence);
+		sequence++;
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PerfLatencyMeasurement);
+
+static void BM_PerfWindowedRead(benchmark::State& state)
+{
+	//What AutoSwitchProtocol reads on every decision
+	PerformanceMonitor monitor;
+	for (int i = 0; i < 1000; i++) monitor.packet_sent(74, 64);
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(monitor.get_windowed_throughput_kbps());
+		benchmark::DoNotOptimize(monitor.get_ewma_latency());
+		benchmark::DoNotOptimize(monitor.get_average_jitter());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PerfWindowedRead);
+
+static void BM_LatencyHistogramRecord(benchmark::State& state)
+{
+	LatencyHistogram histogram;
+	uint32_t value = 1;
+	for (auto _ : state)
+	{
+		histogram.record(value);
+		value = value * 1103515245u + 12345u;//spread over every bucket range
+		value >>= 7;
+	}
+	benchmark::DoNotOptimize(histogram.get_count());
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LatencyHistogramRecord);
+
+static void BM_LatencyHistogramPercentile(benchmark::State& state)
+{
+	LatencyHistogram histogram;
+	for (uint32_t i = 1; i <= 10000; i++) histogram.record(i * 37);
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(histogram.get_percentile(99.9f));
+	}
+}
+BENCHMARK(BM_LatencyHistogramPercentile);
+
+static void BM_LogRecord(benchmark::State& state)
+{
+	//Cost on the caller's side, formatting happens later in drain()
+	uint16_t sequence = 0;
+	for (auto _ : state)
+	{
+		LOG_INFO("Timeout - retransmitting frame %u, attempts left: %d", sequence, 2);
+		if ((++sequence & (LOG_RING_SIZE / 2 - 1)) == 0)
+		{
+			state.PauseTiming();
+			logger.drain();
+			state.ResumeTiming();
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LogRecord);
+
+static void BM_LogDrain(benchmark::State& state)
+{
+	//Formatting cost per record, paid in idle time
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		for (int i = 0; i < LOG_RING_SIZE; i++) LOG_INFO("Timeout - retransmitting frame %u, attempts left: %d", i, 2);
+		state.ResumeTiming();
+		logger.drain();
+	}
+	state.SetItemsProcessed(state.iterations() * LOG_RING_SIZE);
+}
+BENCHMARK(BM_LogDrain);
+
+int main(int argc, char** argv)
+{
+	set_host_console(false);//protocol debug output would swamp the report
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -0,0 +1,140 @@
+//Fixed retransmission timeouts (the old 1000 ms UART / 1500 ms SPI) vs the adaptive RTO, on a virtual clock
+//Build: host/CMakeLists.txt, target rto_sim
+//Usage: rto_sim [frames=2000] [window=1] [payload=64] [loss=0.01] [uart_baud=115200] [spi_hz=1000000]
+//Loss applies to both directions. "stall/loss" is the extra time per lost frame over a lossless run.
+//Exit status 1 unless every frame is acknowledged and arrives once with its payload intact.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+
+struct SlaveSide
+{
+	EnhancedProtocol protocol;
+	uint32_t delivered;
+	uint32_t corrupted;
+
+	SlaveSide() : protocol(false), delivered(0), corrupted(0) {}
+};
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol.get_comm_interface()->receive();
+	if (frame && slave->protocol.validate_received_frame(frame.get()) && frame->packet_type == TYPE_DATA)
+	{
+		if (slave->protocol.accept_data_frame(frame.get()))
+		{
+			//Payload byte i is index + i, the first frame has sequence 0 so index = sequence
+			bool intact = true;
+			for (uint16_t i = 0; intact && i < frame->data_length; i++) intact = frame->data[i] == (uint8_t)(frame->sequence_num + i);
+			if (intact) slave->delivered++;
+			else slave->corrupted++;
+		}
+		slave->protocol.queue_ack(frame->sequence_num);
+	}
+}
+
+struct RtoRun
+{
+	double seconds;
+	uint32_t delivered;
+	uint32_t acked;
+	uint32_t corrupted;
+	uint32_t lost;//frames dropped by the link, both directions
+	uint32_t retransmissions;
+	uint32_t rto_us;
+	uint32_t srtt_us;
+};
+
+static RtoRun run(CommunicationMode mode, uint32_t rate, uint32_t fixed_rto_us, uint16_t frame_count, uint8_t window, uint16_t payload, float loss)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(mode, rate);
+	link.master_end.set_loss_rate(loss);
+	link.slave_end.set_loss_rate(loss);
+	link.slave_end.set_seed(0x5EED);
+
+	SlaveSide* slave = new SlaveSide();
+	slave->protocol.set_communication_interface(&link.slave_end);
+	link.master_end.set_idle_hook(slave_step, slave);
+
+	EnhancedProtocol master(false);
+	master.set_communication_interface(&link.master_end);
+	master.set_window_size(window);
+	if (fixed_rto_us) master.set_rto_bounds(fixed_rto_us, fixed_rto_us);
+
+	//Frames are built as the window opens, like send_fragmented()
+	struct PayloadSource
+	{
+		EnhancedProtocol* master;
+		uint16_t payload;
+		static bool build(void* context, uint16_t index, FrameHandle& frame)
+		{
+			PayloadSource* source = (PayloadSource*)context;
+			frame = frame_pool.acquire();
+			if (!frame) return false;
+			for (uint16_t i = 0; i < source->payload; i++) frame->data[i] = (uint8_t)(index + i);
+			return source->master->create_frame(TYPE_DATA, frame->data, source->payload, frame.get());
+		}
+	} source = { &master, payload };
+	uint16_t acked = master.send_window(PayloadSource::build, &source, frame_count);
+
+	RtoRun result;
+	result.seconds = clock.now_us() / 1e6;
+	result.delivered = slave->delivered;
+	result.acked = acked;
+	result.corrupted = slave->corrupted;
+	result.lost = link.master_end.get_frames_lost() + link.slave_end.get_frames_lost();
+	result.retransmissions = master.get_performance_monitor().get_retransmissions();
+	result.rto_us = master.get_performance_monitor().get_rto_us();
+	result.srtt_us = master.get_rto_estimator(mode).get_srtt_us();
+	link.master_end.set_idle_hook(nullptr, nullptr);
+	delete slave;
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint16_t frame_count = argc > 1 ? (uint16_t)atoi(argv[1]) : 2000;
+	uint8_t window = argc > 2 ? (uint8_t)atoi(argv[2]) : 1;
+	uint16_t payload = argc > 3 ? (uint16_t)atoi(argv[3]) : 64;
+	float loss = argc > 4 ? (float)atof(argv[4]) : 0.01f;
+	uint32_t uart_baud = argc > 5 ? strtoul(argv[5], nullptr, 10) : 115200;
+	uint32_t spi_hz = argc > 6 ? strtoul(argv[6], nullptr, 10) : 1000000;
+
+	window = constrain(window, 1, MAX_WINDOW_SIZE);
+	payload = constrain(payload, 1, MAX_DATA_LEN);
+	set_host_console(false);
+
+	printf("%u frames, window %u, %u byte payload, loss %.3f\n", frame_count, window, payload, loss);
+	printf("%-5s %-8s %10s %10s %6s %6s %12s %10s %10s %6s\n", "link", "rto", "delivered", "seconds", "lost", "retx", "stall/loss ms", "srtt ms",
+		"rto ms", "result");
+
+	const CommunicationMode modes[] = { MODE_UART, MODE_SPI };
+	const uint32_t rates[] = { uart_baud, spi_hz };
+	const uint32_t fixed_timeouts_us[] = { 1000000, 1500000 };//calculate_dynamic_timeout() at low latency
+	const char* links[] = { "UART", "SPI" };
+	bool pass = true;
+	for (uint8_t m = 0; m < 2; m++)
+	{
+		double lossless = run(modes[m], rates[m], 0, frame_count, window, payload, 0).seconds;
+		for (uint8_t adaptive = 0; adaptive < 2; adaptive++)
+		{
+			RtoRun result = run(modes[m], rates[m], adaptive ? 0 : fixed_timeouts_us[m], frame_count, window, payload, loss);
+			bool ok = result.delivered == frame_count && result.acked == frame_count && result.corrupted == 0;
+			pass = pass && ok;
+			printf("%-5s %-8s %10u %10.3f %6u %6u %12.2f %10.3f %10.3f %6s\n", links[m], adaptive ? "adaptive" : "fixed",
+				result.delivered, result.seconds, result.lost, result.retransmissions,
+				result.lost ? (result.seconds - lossless) * 1000.0 / result.lost : 0.0, result.srtt_us / 1000.0, result.rto_us / 1000.0,
+				ok ? "PASS" : "FAIL");
+		}
+	}
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+//Several sensor nodes on one SPI bus behind SPIBusManager, on a virtual clock
+//Build: host/CMakeLists.txt, target spi_bus_sim
+//Usage: spi_bus_sim [seconds=2] [payload=64] [spi_hz=SPI_CLOCK_SPEED]
+//Each node is a MockSPIBus device with its own EnhancedProtocol: it decodes what the master clocks in,
+//ACKs DATA, BATCH and FRAGMENT frames and answers with its pending frame in its next transaction. "bulk" nodes are kept
+//backlogged by the master (send_async while the manager has room); a "sensor" node gets no bulk data
+//and sends a reading every period, its latency is creation to the master's frame handler.
+//Exit status 1 if a bulk slave gets nothing or a corrupted frame, anything is retransmitted on the lossless bus,
+//or more than the last two sensor readings are missing.
+
+#include "spi_bus_manager.h"
+#include "mock_spi_bus.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+
+#define NODE_COUNT 3
+#define READING_SIZE 24
+
+class NodeEnd : public CommunicationInterface
+{
+private:
+	std::deque<std::vector<uint8_t> > outgoing;//encoded, clocked out one per transaction
+	std::deque<FrameHandle> incoming;
+	uint32_t clock_hz;
+
+public:
+	NodeEnd(uint32_t clock) : clock_hz(clock) {}
+
+	bool send(const UartFrame* frame) override
+	{
+		std::vector<uint8_t> wire(MAX_FRAME_SIZE);
+		wire.resize(Protocol::encode_frame(frame, wire.data()));
+		outgoing.push_back(wire);
+		return true;
+	}
+
+	FrameHandle receive() override
+	{
+		if (incoming.empty()) return FrameHandle();
+		FrameHandle frame = incoming.front();
+		incoming.pop_front();
+		return frame;
+	}
+
+	bool available() override { return !incoming.empty(); }
+	CommunicationMode get_mode() override { return MODE_SPI; }
+	void begin() override {}
+	void reset_receiver() override { incoming.clear(); }
+	uint32_t get_baud_rate() const override { return clock_hz; }
+	bool is_connected() const override { return true; }
+
+	//One transaction: our pending frame out on MISO (cut short if the master clocks too few bytes), its frame in
+	void exchange(const uint8_t* mosi, uint8_t* miso, uint16_t length)
+	{
+		memset(miso, 0, length);
+		if (!outgoing.empty())
+		{
+			const std::vector<uint8_t>& wire = outgoing.front();
+			memcpy(miso, wire.data(), wire.size() < length ? wire.size() : length);
+			outgoing.pop_front();
+		}
+
+		uint16_t frame_size = mosi[0] == START_MARKER ? Protocol::parse_wire_size(mosi) : 0;
+		if (frame_size == 0 || frame_size > length) return;
+		FrameHandle frame = frame_pool.acquire();
+		if (frame && Protocol::decode_frame(mosi, frame_size, frame.get())) incoming.push_back(frame);
+	}
+};
+
+struct Node
+{
+	NodeEnd end;
+	EnhancedProtocol protocol;
+	uint8_t weight;
+	bool bulk;//master keeps it backlogged
+	uint32_t reading_period_us;//0 = no readings
+	uint64_t next_reading_us;
+	uint32_t delivered;//DATA accepted from the master
+	uint64_t delivered_bytes;
+	uint32_t corrupted;//payload differs from what the master sends
+
+	Node(uint32_t clock_hz) : end(clock_hz), protocol(false), weight(1), bulk(true), reading_period_us(0), next_reading_us(0),
+		delivered(0), delivered_bytes(0), corrupted(0) {}
+};
+
+static void node_step(Node* node, uint64_t now_us)
+{
+	EnhancedProtocol& protocol = node->protocol;
+	for (FrameHandle frame = protocol.receive_frame(); frame; frame = protocol.receive_frame())
+	{
+		if (!protocol.validate_received_frame(frame.get())) continue;
+		if (Protocol::is_data_frame(frame.get()))
+		{
+			if (protocol.accept_data_frame(frame.get()))
+			{
+				node->delivered++;
+				node->delivered_bytes += frame->data_length;
+				for (uint16_t i = 0; i < frame->data_length; i++)
+				{
+					if (frame->data[i] != (uint8_t)(i * 31 + 7))
+					{
+						node->corrupted++;
+						break;
+					}
+				}
+			}
+			protocol.queue_ack(frame->sequence_num);
+		}
+		else
+		{
+			protocol.process_frame(frame.get());
+		}
+	}
+	protocol.service_timers();
+
+	if (node->reading_period_us && now_us >= node->next_reading_us && protocol.can_send_async(protocol.peek_next_sequence()))
+	{
+		//The reading carries its creation time
+		uint8_t reading[READING_SIZE] = { 0 };
+		memcpy(reading, &now_us, sizeof(now_us));
+		FrameHandle frame = frame_pool.acquire();
+		if (frame && protocol.create_frame(TYPE_DATA, reading, sizeof(reading), frame.get()) && protocol.send_async(frame))
+		{
+			node->next_reading_us += node->reading_period_us;
+		}
+	}
+}
+
+static void node_respond(void* context, const uint8_t* mosi, uint8_t* miso, uint16_t length)
+{
+	Node* node = (Node*)context;
+	node->end.exchange(mosi, miso, length);
+	node_step(node, host_clock().now_us());//its ACK goes out in the next transaction
+}
+
+struct Readings
+{
+	uint32_t count;
+	uint64_t latency_sum_us;
+	uint64_t latency_max_us;
+};
+
+static void on_reading(void* context, uint8_t /*slave*/, UartFrame* frame)
+{
+	Readings* readings = (Readings*)context;
+	if (frame->data_length != READING_SIZE) return;
+	uint64_t created_us;
+	memcpy(&created_us, frame->data, sizeof(created_us));
+	uint64_t latency = host_clock().now_us() - created_us;
+	readings->count++;
+	readings->latency_sum_us += latency;
+	if (latency > readings->latency_max_us) readings->latency_max_us = latency;
+}
+
+static bool run(const char* name, const uint8_t* weights, const bool* bulk, uint32_t reading_period_us, uint32_t seconds,
+	uint16_t payload, uint32_t spi_hz)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	MockSPIBus bus;
+	SPIBusManager manager;
+	std::vector<Node*> nodes;
+	Readings readings = {};
+	for (uint8_t i = 0; i < NODE_COUNT; i++)
+	{
+		Node* node = new Node(spi_hz);
+		node->weight = weights[i];
+		node->bulk = bulk[i];
+		node->reading_period_us = bulk[i] ? 0 : reading_period_us;
+		node->next_reading_us = reading_period_us;
+		node->protocol.set_communication_interface(&node->end);
+		nodes.push_back(node);
+
+		uint8_t cs_pin = (uint8_t)(SPI_CS + i);
+		manager.add_slave(cs_pin, weights[i]);
+		bus.add_device((int8_t)cs_pin, node_respond, node);
+	}
+	manager.set_bus_driver(&bus);
+	manager.begin(spi_hz);
+	manager.set_frame_handler(on_reading, &readings);
+
+	uint8_t data[MAX_DATA_LEN];
+	for (uint16_t i = 0; i < payload; i++) data[i] = (uint8_t)(i * 31 + 7);
+
+	uint64_t end_us = (uint64_t)seconds * 1000000;
+	while (clock.now_us() < end_us)
+	{
+		bool busy = false;
+		for (uint8_t i = 0; i < NODE_COUNT; i++)
+		{
+			if (!nodes[i]->bulk) continue;
+			EnhancedProtocol& protocol = manager.get_protocol(i);
+			while (manager.has_room(i) && protocol.can_send_async(protocol.peek_next_sequence()))
+			{
+				FrameHandle frame = frame_pool.acquire();
+				if (!frame || !protocol.create_frame(TYPE_DATA, data, payload, frame.get()) || !protocol.send_async(frame)) break;
+				busy = true;
+			}
+		}
+		busy = manager.service() || busy;
+		for (uint8_t i = 0; i < NODE_COUNT; i++)
+		{
+			node_step(nodes[i], clock.now_us());
+		}
+		if (!busy) clock.advance_us(10);
+	}
+
+	double elapsed_s = clock.now_us() / 1e6;
+	double link_total = manager.get_throughput_kbps();
+	double goodput_total = 0;
+	printf("\n%s: %.1f s, %u rounds, bus busy %.1f%%\n", name, elapsed_s, manager.get_rounds(), bus.get_busy_us() / 1e4 / elapsed_s);
+	printf("%-5s %-6s %-6s %12s %7s %11s %9s %9s %12s %13s %8s %5s\n", "slave", "weight", "role", "transactions", "polls",
+		"empty polls", "delivered", "corrupted", "link kbps", "goodput kbps", "share", "retx");
+	bool pass = true;
+	for (uint8_t i = 0; i < NODE_COUNT; i++)
+	{
+		Node* node = nodes[i];
+		double goodput = node->delivered_bytes * 8 / elapsed_s / 1000.0;
+		double link = manager.get_slave_throughput_kbps(i);
+		uint32_t retransmissions = manager.get_protocol(i).get_performance_monitor().get_retransmissions();
+		goodput_total += goodput;
+		if ((node->bulk && node->delivered == 0) || node->corrupted || retransmissions) pass = false;
+		printf("%-5u %-6u %-6s %12lu %7lu %11lu %9lu %9lu %12.1f %13.1f %7.1f%% %5lu\n", i, node->weight, node->bulk ? "bulk" : "sensor",
+			(unsigned long)manager.get_transactions(i), (unsigned long)manager.get_polls(i), (unsigned long)manager.get_empty_polls(i),
+			(unsigned long)node->delivered, (unsigned long)node->corrupted, link, goodput, link_total > 0 ? link * 100 / link_total : 0.0,
+			(unsigned long)retransmissions);
+	}
+	printf("%-5s %-6s %-6s %12s %7s %11s %9s %9s %12.1f %13.1f\n", "all", "", "", "", "", "", "", "", link_total, goodput_total);
+	if (reading_period_us)
+	{
+		//The last readings may still be on their way when the run ends
+		uint32_t expected = (uint32_t)(end_us / reading_period_us);
+		if (readings.count + 2 < expected) pass = false;
+		printf("sensor readings: %lu of %lu received, latency mean %.2f ms, max %.2f ms\n", (unsigned long)readings.count,
+			(unsigned long)expected, readings.count ? readings.latency_sum_us / 1000.0 / readings.count : 0.0,
+			readings.latency_max_us / 1000.0);
+	}
+	printf("result %s\n", pass ? "PASS" : "FAIL");
+
+	manager.set_bus_driver(nullptr);
+	for (size_t i = 0; i < nodes.size(); i++) delete nodes[i];
+	set_host_clock(nullptr);
+	return pass;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t seconds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	uint32_t spi_hz = argc > 3 ? strtoul(argv[3], nullptr, 10) : SPI_CLOCK_SPEED;
+
+	seconds = constrain(seconds, 1, 600);
+	payload = constrain(payload, 1, MAX_DATA_LEN);
+	set_host_console(false);
+
+	printf("%d slaves on one bus at %lu Hz, %u byte payload, poll interval %u us\n", NODE_COUNT, (unsigned long)spi_hz, payload,
+		SPI_POLL_INTERVAL_US);
+
+	const bool all_bulk[NODE_COUNT] = { true, true, true };
+	const bool one_sensor[NODE_COUNT] = { true, true, false };
+	const uint8_t equal[NODE_COUNT] = { 1, 1, 1 };
+	const uint8_t weighted[NODE_COUNT] = { 1, 2, 4 };
+	bool pass = run("equal weights, all backlogged", equal, all_bulk, 0, seconds, payload, spi_hz);
+	pass = run("weights 1/2/4, all backlogged", weighted, all_bulk, 0, seconds, payload, spi_hz) && pass;
+	pass = run("weights 1/2/4, slave 2 idle except a reading every 10 ms", weighted, one_sensor, 10000, seconds, payload, spi_hz) && pass;
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+//Blocking SPIClass transfers vs the queued (double-buffered) bus driver, on a virtual clock
+//Build: host/CMakeLists.txt, target spi_queue_bench
+//Usage: spi_queue_bench [frames=10000] [payload=128] [prep_us=0]
+//Both paths run at SPI_CLOCK_SPEED. prep_us is CPU time spent building each frame; the queued path
+//overlaps it with the transfer on the bus. The mock slave answers every queued transfer with an ACK
+//so responses are decoded too (the blocking path has no slave on the host, MISO reads zero).
+//"reverse" turns it around: the master sends ACKs and the slave answers each with a payload-sized
+//DATA frame, which the queued transfers must grow to clock.
+//Exit status 1 if a queued response is lost, or more reverse responses are truncated than the transfers
+//already queued (SPI_QUEUE_DEPTH) when the first long one showed up.
+
+#include "spi_interface.h"
+#include "mock_spi_bus.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+
+struct FrameResponder
+{
+	uint8_t wire[MAX_FRAME_SIZE];
+	uint16_t length;
+};
+
+static void respond_with_frame(void* context, const uint8_t* /*mosi*/, uint8_t* miso, uint16_t length)
+{
+	FrameResponder* responder = (FrameResponder*)context;
+	uint16_t copied = responder->length < length ? responder->length : length;
+	memcpy(miso, responder->wire, copied);
+	memset(&miso[copied], 0, length - copied);
+}
+
+struct SpiRun
+{
+	uint64_t elapsed_us;
+	uint32_t responses;
+	uint32_t truncated;
+	uint64_t wire_bytes;
+};
+
+static SpiRun run(bool queued, bool reverse, uint32_t frame_count, uint16_t payload, uint32_t prep_us)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	Protocol protocol;
+	UartFrame frame;
+	uint8_t data[MAX_DATA_LEN];
+	for (uint16_t i = 0; i < payload; i++) data[i] = (uint8_t)(i * 31 + 7);
+
+	FrameResponder responder;
+	UartFrame ack;
+	uint8_t ack_payload[6] = { 0 };
+	protocol.create_frame(TYPE_ACK, ack_payload, sizeof(ack_payload), &ack);
+	UartFrame response;
+	protocol.create_frame(TYPE_DATA, data, payload, &response);
+	responder.length = Protocol::encode_frame(reverse ? &response : &ack, responder.wire);
+
+	MockSPIBus bus;
+	bus.begin(SPI_CLOCK_SPEED);
+	bus.set_responder(respond_with_frame, &responder);
+
+	SPIInterface spi(true);
+	if (queued) spi.set_bus_driver(&bus);
+
+	SpiRun result = {};
+	for (uint32_t i = 0; i < frame_count; i++)
+	{
+		clock.advance_us(prep_us);
+		if (reverse) protocol.create_frame(TYPE_ACK, ack_payload, sizeof(ack_payload), &frame);
+		else protocol.create_frame(TYPE_DATA, data, payload, &frame);
+		spi.send(&frame);
+		result.wire_bytes += Protocol::wire_size(&frame);
+		while (spi.receive()) result.responses++;
+	}
+	spi.flush();
+	while (spi.receive()) result.responses++;
+
+	result.truncated = spi.get_truncated_responses();
+	result.elapsed_us = clock.now_us();
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 128;
+	uint32_t prep_us = argc > 3 ? strtoul(argv[3], nullptr, 10) : 0;
+
+	payload = constrain(payload, 1, MAX_DATA_LEN);
+	set_host_console(false);
+
+	printf("%lu frames, %u byte payload, %lu Hz SPI clock, %lu us prep per frame\n",
+		(unsigned long)frame_count, payload, (unsigned long)SPI_CLOCK_SPEED, (unsigned long)prep_us);
+	printf("%-8s %12s %12s %14s %10s %10s %10s %6s\n", "path", "elapsed ms", "frames/s", "wire kbit/s", "% clock", "responses", "truncated",
+		"result");
+
+	const char* names[] = { "blocking", "queued", "reverse" };
+	bool pass = true;
+	for (uint8_t r = 0; r < 3; r++)
+	{
+		SpiRun result = run(r != 0, r == 2, frame_count, payload, prep_us);
+		double seconds = result.elapsed_us / 1e6;
+		double wire_bits_per_second = result.wire_bytes * 8 / seconds;
+		bool ok = r == 0 || (result.responses + result.truncated == frame_count && result.truncated <= (r == 2 ? SPI_QUEUE_DEPTH : 0));
+		pass = pass && ok;
+		printf("%-8s %12.1f %12.0f %14.1f %9.1f%% %10lu %10lu %6s\n", names[r], result.elapsed_us / 1000.0, frame_count / seconds,
+			wire_bits_per_second / 1000.0, 100.0 * wire_bits_per_second / SPI_CLOCK_SPEED, (unsigned long)result.responses,
+			(unsigned long)result.truncated, r == 0 ? "-" : ok ? "PASS" : "FAIL");
+	}
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+//ProtocolTasks stress test: master and slave each run an RX and a TX thread over an unthrottled
+//LoopbackLink, the application threads only touch the SPSC queues. Every payload carries its
+//index and a pattern, the slave checks both and counts duplicates and gaps.
+//The same steps are also driven from one thread for comparison.
+//Build: host/CMakeLists.txt, target tasks_stress
+//Usage: tasks_stress [frames=100000] [payload=64] [loss=0]
+//Exit status 1 unless every frame is acknowledged and reaches the slave application once, intact.
+
+#include "protocol_tasks.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static void fill_payload(uint8_t* data, uint32_t index, uint16_t length)
+{
+	memcpy(data, &index, sizeof(index));
+	for (uint16_t i = sizeof(index); i < length; i++) data[i] = (uint8_t)(index * 13 + i);
+}
+
+struct Receiver
+{
+	std::vector<uint8_t> seen;
+	uint32_t frames;
+	uint32_t corrupt;
+	uint32_t duplicates;
+
+	Receiver(uint32_t count) : seen(count, 0), frames(0), corrupt(0), duplicates(0) {}
+
+	void check(const UartFrame* frame, uint16_t payload)
+	{
+		uint8_t expected[MAX_DATA_LEN];
+		uint32_t index;
+		memcpy(&index, frame->data, sizeof(index));
+		if (frame->data_length != payload || index >= seen.size())
+		{
+			corrupt++;
+			return;
+		}
+		fill_payload(expected, index, payload);
+		if (memcmp(expected, frame->data, payload) != 0) corrupt++;
+		else if (seen[index]) duplicates++;
+		else
+		{
+			seen[index] = 1;
+			frames++;
+		}
+	}
+};
+
+struct StressRun
+{
+	double seconds;
+	uint32_t delivered;//completions with delivered = true
+	uint32_t failed;
+	uint32_t received;
+	uint32_t corrupt;
+	uint32_t duplicates;
+	uint32_t rx_overruns;
+	uint32_t deferred;
+};
+
+static StressRun run(bool threaded, uint32_t frame_count, uint16_t payload, float loss)
+{
+	LoopbackLink link(MODE_SPI, 0);
+	link.master_end.set_loss_rate(loss);
+	link.slave_end.set_loss_rate(loss);
+	link.slave_end.set_seed(0x5EED);
+
+	EnhancedProtocol* master = new EnhancedProtocol(false);
+	EnhancedProtocol* slave = new EnhancedProtocol(false);
+	master->set_communication_interface(&link.master_end);
+	slave->set_communication_interface(&link.slave_end);
+	ProtocolTasks* master_tasks = new ProtocolTasks(*master);
+	ProtocolTasks* slave_tasks = new ProtocolTasks(*slave);
+	Receiver receiver(frame_count);
+
+	StressRun result = {};
+	uint8_t data[MAX_DATA_LEN];
+	uint32_t queued = 0;
+	std::atomic<bool> done(false);
+	std::atomic<uint32_t> checked(0);//frames the slave application has looked at
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread slave_app;
+	if (threaded)
+	{
+		master_tasks->start();
+		slave_tasks->start();
+		slave_app = std::thread([&]()
+		{
+			while (!done.load())
+			{
+				FrameHandle frame = slave_tasks->receive();
+				if (frame)
+				{
+					receiver.check(frame.get(), payload);
+					checked.fetch_add(1);
+				}
+				else std::this_thread::yield();
+			}
+			for (FrameHandle frame = slave_tasks->receive(); frame; frame = slave_tasks->receive()) receiver.check(frame.get(), payload);
+		});
+	}
+
+	while (result.delivered + result.failed < frame_count)
+	{
+		bool busy = false;
+		if (queued < frame_count)
+		{
+			fill_payload(data, queued, payload);
+			if (master_tasks->send(TYPE_DATA, data, payload))
+			{
+				queued++;
+				busy = true;
+			}
+		}
+
+		SendCompletion completion;
+		while (master_tasks->poll_completion(completion))
+		{
+			if (completion.delivered) result.delivered++;
+			else result.failed++;
+			busy = true;
+		}
+
+		if (!threaded)
+		{
+			master_tasks->tx_step();
+			slave_tasks->rx_step();
+			slave_tasks->tx_step();
+			master_tasks->rx_step();
+			for (FrameHandle frame = slave_tasks->receive(); frame; frame = slave_tasks->receive()) receiver.check(frame.get(), payload);
+		}
+		else if (!busy)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	if (threaded)
+	{
+		//Let the slave's last ACKed frames reach its application
+		uint32_t settle_until = millis() + 100;
+		while (millis() < settle_until && checked.load() < result.delivered) std::this_thread::yield();
+		done.store(true);
+		slave_app.join();
+		master_tasks->stop();
+		slave_tasks->stop();
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	result.received = receiver.frames;
+	result.corrupt = receiver.corrupt;
+	result.duplicates = receiver.duplicates;
+	result.rx_overruns = master_tasks->get_rx_overruns() + slave_tasks->get_rx_overruns();
+	result.deferred = slave_tasks->get_inbound_deferred();
+
+	delete master_tasks;
+	delete slave_tasks;
+	delete master;
+	delete slave;
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	float loss = argc > 3 ? (float)atof(argv[3]) : 0.0f;
+
+	payload = constrain(payload, 4, MAX_DATA_LEN);
+	set_host_console(false);
+
+	printf("%lu frames, %u byte payload, loss %.3f, %u hardware threads\n", (unsigned long)frame_count, payload, loss, std::thread::hardware_concurrency());
+	printf("%-8s %10s %10s %7s %10s %8s %6s %10s %9s %12s %6s\n", "mode", "delivered", "received", "failed", "corrupt", "dupes", "overrun", "deferred",
+		"seconds", "frames/s", "result");
+
+	const char* names[] = { "single", "threaded" };
+	bool pass = true;
+	for (uint8_t threaded = 0; threaded < 2; threaded++)
+	{
+		StressRun result = run(threaded != 0, frame_count, payload, loss);
+		bool ok = result.delivered == frame_count && result.received == frame_count && result.failed == 0 && result.corrupt == 0 &&
+			result.duplicates == 0;
+		pass = pass && ok;
+		printf("%-8s %10lu %10lu %7lu %10lu %8lu %6lu %10lu %9.3f %12.0f %6s\n", names[threaded], (unsigned long)result.delivered,
+			(unsigned long)result.received, (unsigned long)result.failed, (unsigned long)result.corrupt, (unsigned long)result.duplicates,
+			(unsigned long)result.rx_overruns, (unsigned long)result.deferred, result.seconds, result.delivered / result.seconds, ok ? "PASS" : "FAIL");
+	}
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+//DATA both ways over one UART: immediate ACKs vs delayed ACKs piggybacked on the reverse DATA, on a virtual clock
+//Build: host/CMakeLists.txt, target two_way_sim
+//Usage: two_way_sim [frames=2000] [payload=64] [baud=115200] [delay_ms=5] [interval_us=10000]
+//Both ends send indexed DATA with send_async(), either backlogged or one frame every interval_us each way.
+//Reported per run: standalone ACK frames, ACKs piggybacked on DATA, ACK frames saved against the
+//immediate-ACK run, wire bytes and goodput. Every index must arrive once each way, exit status 1 otherwise.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct Peer
+{
+	EnhancedProtocol protocol;
+	LoopbackInterface* end;
+	uint32_t sent;
+	uint32_t completed;
+	uint32_t failed;
+	uint64_t next_send_us;
+	std::vector<uint8_t> deliveries;//per index received from the other end
+
+	Peer() : protocol(false), end(nullptr), sent(0), completed(0), failed(0), next_send_us(0) {}
+};
+
+static void send_complete(void* context, uint16_t /*seq_num*/, bool delivered)
+{
+	Peer* peer = (Peer*)context;
+	peer->completed++;
+	if (!delivered) peer->failed++;
+}
+
+//One pass of a node's loop(): take in what arrived, ACK DATA (now or later), then send its own DATA
+static bool peer_step(Peer& peer, uint32_t frame_count, uint16_t payload, uint32_t interval_us, uint64_t now_us)
+{
+	EnhancedProtocol& protocol = peer.protocol;
+	bool busy = false;
+	for (FrameHandle frame = protocol.receive_frame(); frame; frame = protocol.receive_frame())
+	{
+		busy = true;
+		if (!protocol.validate_received_frame(frame.get())) continue;
+		if (Protocol::is_data_frame(frame.get()))
+		{
+			//An ack piggybacked on the peer's DATA completes our sends
+			protocol.process_frame(frame.get());
+			if (protocol.accept_data_frame(frame.get()))
+			{
+				uint32_t index;
+				memcpy(&index, frame->data, sizeof(index));
+				if (index >= peer.deliveries.size()) peer.deliveries.resize(index + 1, 0);
+				peer.deliveries[index]++;
+			}
+			protocol.queue_ack(frame->sequence_num);
+		}
+		else
+		{
+			protocol.process_frame(frame.get());
+		}
+	}
+
+	while (peer.sent < frame_count && now_us >= peer.next_send_us && protocol.can_send_async(protocol.peek_next_sequence()))
+	{
+		uint8_t data[MAX_DATA_LEN];
+		memset(data, 0, payload);
+		memcpy(data, &peer.sent, sizeof(peer.sent));
+		FrameHandle frame = frame_pool.acquire();
+		if (!frame || !protocol.create_frame(TYPE_DATA, data, payload, frame.get()) ||
+			!protocol.send_async(frame, send_complete, &peer)) break;
+		peer.sent++;
+		peer.next_send_us += interval_us;
+		busy = true;
+	}
+	return protocol.service_timers() || busy;
+}
+
+struct TwoWayRun
+{
+	bool pass;
+	uint32_t delivered;//both directions
+	uint32_t standalone_acks;
+	uint32_t piggybacked_acks;
+	uint64_t wire_bytes;
+	double seconds;
+};
+
+static TwoWayRun run(uint16_t delay_ms, uint32_t frame_count, uint16_t payload, uint32_t baud, uint32_t interval_us)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(MODE_UART, baud);
+	Peer* peers[2] = { new Peer(), new Peer() };
+	peers[0]->end = &link.master_end;
+	peers[1]->end = &link.slave_end;
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		peers[i]->end->set_blocking(false);//one thread drives both ends
+		peers[i]->protocol.set_communication_interface(peers[i]->end);
+		peers[i]->protocol.set_delayed_ack(delay_ms);
+	}
+
+	uint64_t deadline_us = (uint64_t)frame_count * 100000 + 60000000;
+	while ((peers[0]->completed < frame_count || peers[1]->completed < frame_count) && clock.now_us() < deadline_us)
+	{
+		bool busy = false;
+		for (uint8_t i = 0; i < 2; i++)
+		{
+			busy = peer_step(*peers[i], frame_count, payload, interval_us, clock.now_us()) || busy;
+		}
+		if (!busy) clock.advance_us(20);
+	}
+	//Let the last delayed ACKs go out so both ends are idle
+	for (uint64_t settle_us = clock.now_us() + delay_ms * 1000 + 10000; clock.now_us() < settle_us; clock.advance_us(20))
+	{
+		for (uint8_t i = 0; i < 2; i++) peer_step(*peers[i], frame_count, payload, interval_us, clock.now_us());
+	}
+
+	TwoWayRun result = {};
+	result.pass = true;
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		Peer& peer = *peers[i];
+		uint32_t delivered = 0;
+		for (uint32_t index = 0; index < peer.deliveries.size(); index++)
+		{
+			if (peer.deliveries[index] != 1) result.pass = false;
+			if (peer.deliveries[index]) delivered++;
+		}
+		if (delivered != frame_count || peer.completed != frame_count || peer.failed) result.pass = false;
+		result.delivered += delivered;
+
+		PerformanceMonitor& perf = peer.protocol.get_performance_monitor();
+		result.standalone_acks += perf.get_standalone_acks();
+		result.piggybacked_acks += perf.get_piggybacked_acks();
+		result.wire_bytes += peer.end->get_bytes_sent();
+	}
+	result.seconds = clock.now_us() / 1e6;
+
+	delete peers[0];
+	delete peers[1];
+	set_host_clock(nullptr);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	uint32_t baud = argc > 3 ? strtoul(argv[3], nullptr, 10) : 115200;
+	uint16_t delay_ms = argc > 4 ? (uint16_t)atoi(argv[4]) : 5;
+	uint32_t interval_us = argc > 5 ? strtoul(argv[5], nullptr, 10) : 10000;
+
+	payload = constrain(payload, sizeof(uint32_t), MAX_DATA_LEN);
+	set_host_console(false);
+
+	printf("%lu frames each way, %u byte payload, %lu baud, delayed ACK %u ms\n", (unsigned long)frame_count, payload,
+		(unsigned long)baud, delay_ms);
+	printf("%-22s %-9s %9s %10s %11s %10s %10s %9s %13s %6s\n", "traffic", "ack", "delivered", "ack frames", "piggybacked",
+		"saved", "wire KB", "seconds", "goodput kbps", "result");
+
+	const char* traffic[] = { "backlogged", "one frame per interval" };
+	const uint32_t intervals[] = { 0, interval_us };
+	bool pass = true;
+	for (uint8_t t = 0; t < 2; t++)
+	{
+		uint32_t immediate_acks = 0;
+		for (uint8_t delayed = 0; delayed < 2; delayed++)
+		{
+			TwoWayRun result = run(delayed ? delay_ms : 0, frame_count, payload, baud, intervals[t]);
+			if (!delayed) immediate_acks = result.standalone_acks;
+			int32_t saved = (int32_t)immediate_acks - (int32_t)result.standalone_acks;
+			pass = pass && result.pass;
+			printf("%-22s %-9s %9lu %10lu %11lu %10ld %10.1f %9.3f %13.1f %6s\n", traffic[t], delayed ? "delayed" : "immediate",
+				(unsigned long)result.delivered, (unsigned long)result.standalone_acks, (unsigned long)result.piggybacked_acks,
+				(long)saved, result.wire_bytes / 1024.0, result.seconds,
+				result.seconds > 0 ? result.delivered * payload * 8 / result.seconds / 1000.0 : 0.0, result.pass ? "PASS" : "FAIL");
+		}
+	}
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+//UARTInterface::receive() parse throughput (wall clock, MB/s of wire bytes) on clean and noisy streams
+//Build: host/CMakeLists.txt, target uart_parse_bench
+//Usage: uart_parse_bench [frames=20000] [payload=64] [noise_percent=20] [chunk=512] [rounds=20]
+//The stream is served chunk bytes at a time, like a UART driver buffer between two polls.
+//Noisy: random bytes (START_MARKER included) make up noise_percent of the stream between frames,
+//and every 10th frame is truncated.
+//Exit status 1 if the clean stream does not parse to every frame, or the noisy one yields more valid frames than went in intact.
+
+#include "protocol.h"
+#include "uart_interface.h"
+#include "host_shim.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+//Replays a byte stream, at most chunk bytes become available per poll
+class ChunkedReplaySerial : public HardwareSerial
+{
+private:
+	const std::vector<uint8_t>& stream;
+	size_t chunk;
+	size_t position;
+	size_t window_end;//bytes up to here are "in the driver buffer"
+
+public:
+	ChunkedReplaySerial(const std::vector<uint8_t>& bytes, size_t chunk_size) : HardwareSerial(1), stream(bytes), chunk(chunk_size), position(0), window_end(0) {}
+
+	void rewind() { position = 0; window_end = 0; }
+	bool done() const { return position >= stream.size(); }
+
+	int available() override
+	{
+		if (position == window_end) window_end = position + chunk < stream.size() ? position + chunk : stream.size();
+		return (int)(window_end - position);
+	}
+	int read() override { return position < window_end ? stream[position++] : -1; }
+	int peek() override { return position < window_end ? stream[position] : -1; }
+	size_t readBytes(uint8_t* buffer, size_t length) override
+	{
+		size_t count = window_end - position < length ? window_end - position : length;
+		memcpy(buffer, &stream[position], count);
+		position += count;
+		return count;
+	}
+};
+
+static std::vector<uint8_t> build_stream(uint32_t frame_count, uint16_t payload, uint8_t noise_percent, uint32_t& frames_intact)
+{
+	std::mt19937 rng(0xB0B);
+	Protocol protocol;
+	UartFrame frame;
+	uint8_t data[MAX_DATA_LEN];
+	uint8_t wire[MAX_FRAME_SIZE];
+	std::vector<uint8_t> stream;
+
+	frames_intact = 0;
+	for (uint32_t i = 0; i < frame_count; i++)
+	{
+		for (uint16_t j = 0; j < payload; j++) data[j] = (uint8_t)rng();
+		protocol.create_frame(TYPE_DATA, data, payload, &frame);
+		uint16_t length = Protocol::encode_frame(&frame, wire);
+
+		if (noise_percent)
+		{
+			//noise : frame = p : (100 - p)
+			uint32_t noise = (uint32_t)length * noise_percent / (100 - noise_percent);
+			for (uint32_t j = 0; j < noise; j++) stream.push_back((uint8_t)rng());
+			if (i % 10 == 9) length = (uint16_t)(rng() % length);//truncated frame
+			else frames_intact++;
+		}
+		else
+		{
+			frames_intact++;
+		}
+		stream.insert(stream.end(), wire, wire + length);
+	}
+	return stream;
+}
+
+struct ParseRun
+{
+	double mb_per_second;
+	uint32_t frames;
+	uint32_t valid;
+};
+
+static ParseRun run(const std::vector<uint8_t>& stream, size_t chunk, uint32_t rounds)
+{
+	ChunkedReplaySerial serial(stream, chunk);
+	UARTInterface uart(&serial);
+	Protocol validator;
+	ParseRun result = {};
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t round = 0; round < rounds; round++)
+	{
+		serial.rewind();
+		uart.reset_receiver();
+		while (!serial.done() || uart.available())
+		{
+			FrameHandle frame = uart.receive();
+			if (!frame) continue;
+			result.frames++;
+			uint16_t crc;
+			if (uart.get_rx_crc(crc) && validator.validate_frame(frame.get(), crc)) result.valid++;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	result.mb_per_second = (double)stream.size() * rounds / seconds / 1e6;
+	result.frames /= rounds;
+	result.valid /= rounds;
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t frame_count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+	uint16_t payload = argc > 2 ? (uint16_t)atoi(argv[2]) : 64;
+	uint8_t noise_percent = argc > 3 ? (uint8_t)atoi(argv[3]) : 20;
+	size_t chunk = argc > 4 ? strtoul(argv[4], nullptr, 10) : 512;
+	uint32_t rounds = argc > 5 ? strtoul(argv[5], nullptr, 10) : 20;
+
+	payload = constrain(payload, 1, MAX_DATA_LEN);
+	noise_percent = constrain(noise_percent, 0, 90);
+	if (chunk == 0) chunk = 1;
+	set_host_console(false);
+
+	printf("%lu frames, %u byte payload, %lu byte chunks, %lu rounds, CRC16 %s\n",
+		(unsigned long)frame_count, payload, (unsigned long)chunk, (unsigned long)rounds, CRC16::engine_name());
+	printf("%-12s %12s %10s %10s %10s %6s\n", "stream", "wire bytes", "intact", "valid", "MB/s", "result");
+
+	const uint8_t noise_levels[] = { 0, noise_percent };
+	const char* names[] = { "clean", "noisy" };
+	bool pass = true;
+	for (uint8_t n = 0; n < 2; n++)
+	{
+		uint32_t intact;
+		std::vector<uint8_t> stream = build_stream(frame_count, payload, noise_levels[n], intact);
+		ParseRun result = run(stream, chunk, rounds);
+		bool ok = noise_levels[n] ? result.valid <= intact : result.valid == intact;
+		pass = pass && ok;
+		printf("%-12s %12lu %10lu %10lu %10.1f %6s\n", names[n], (unsigned long)stream.size(), (unsigned long)intact, (unsigned long)result.valid,
+			result.mb_per_second, ok ? "PASS" : "FAIL");
+	}
+	return pass ? 0 : 1;
+}
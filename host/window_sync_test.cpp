@@ -0,0 +1,209 @@
+//Receive window and reorder buffer start-up: the SYN frame overtaken, the sender's first frame lost, sender and receiver restarting mid-stream
+//Build: host/CMakeLists.txt, target window_sync_test (ctest runs it)
+//Usage: window_sync_test
+//Each case streams indexed DATA frames with send_async() over a loopback UART on a virtual clock and
+//checks the slave delivered every index exactly once and every send completed. Exit status 1 on failure.
+
+#include "enhanced_protocol.h"
+#include "loopback_interface.h"
+#include "host_shim.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#define STREAM_PAYLOAD 16
+
+struct SlaveSide
+{
+	EnhancedProtocol* protocol;
+	std::vector<uint8_t> deliveries;//per index
+};
+
+static void slave_step(void* context)
+{
+	SlaveSide* slave = (SlaveSide*)context;
+
+	FrameHandle frame = slave->protocol->get_comm_interface()->receive();
+	if (frame && slave->protocol->validate_received_frame(frame.get()) && frame->packet_type == TYPE_DATA)
+	{
+		if (slave->protocol->accept_data_frame(frame.get()))
+		{
+			uint32_t index;
+			memcpy(&index, frame->data, sizeof(index));
+			if (index >= slave->deliveries.size()) slave->deliveries.resize(index + 1, 0);
+			slave->deliveries[index]++;
+		}
+		slave->protocol->queue_ack(frame->sequence_num);
+	}
+	slave->protocol->service_acks();
+}
+
+struct StreamResult
+{
+	uint32_t completed;
+	uint32_t failed;
+};
+
+static void send_complete(void* context, uint16_t /*seq_num*/, bool delivered)
+{
+	StreamResult* result = (StreamResult*)context;
+	result->completed++;
+	if (!delivered) result->failed++;
+}
+
+//Indices first..first+count-1, up to MAX_ASYNC_SENDS outstanding so later frames overtake a lost one
+static uint32_t stream(EnhancedProtocol& master, VirtualClock& clock, uint32_t first, uint32_t count)
+{
+	StreamResult result = { 0, 0 };
+	uint32_t sent = 0;
+	uint64_t deadline_us = clock.now_us() + 60000000;
+	while (result.completed < count && clock.now_us() < deadline_us)
+	{
+		while (sent < count && master.can_send_async(master.peek_next_sequence()))
+		{
+			uint8_t data[STREAM_PAYLOAD] = { 0 };
+			uint32_t index = first + sent;
+			memcpy(data, &index, sizeof(index));
+			FrameHandle frame = frame_pool.acquire();
+			if (!frame || !master.create_frame(TYPE_DATA, data, sizeof(data), frame.get()) ||
+				!master.send_async(frame, send_complete, &result)) break;
+			sent++;
+		}
+		if (!master.service()) clock.advance_us(20);
+	}
+	return result.failed + (count - result.completed);
+}
+
+struct Case
+{
+	const char* name;
+	uint32_t before;//frames before the restart
+	bool restart_sender;
+	bool restart_receiver;
+	bool drop_first;//the (new) sender's first frame
+	uint32_t after;
+};
+
+static bool run(const Case& test)
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+
+	LoopbackLink link(MODE_UART, 115200);
+	SlaveSide slave;
+	slave.protocol = new EnhancedProtocol(false);
+	slave.protocol->set_communication_interface(&link.slave_end);
+	link.master_end.set_idle_hook(slave_step, &slave);
+
+	EnhancedProtocol* master = new EnhancedProtocol(false);
+	master->set_communication_interface(&link.master_end);
+	master->set_window_size(MAX_WINDOW_SIZE);
+
+	uint32_t failed = 0;
+	if (test.before)
+	{
+		failed += stream(*master, clock, 0, test.before);
+	}
+	if (test.restart_sender)
+	{
+		delete master;
+		master = new EnhancedProtocol(false);
+		master->set_communication_interface(&link.master_end);
+		master->set_window_size(MAX_WINDOW_SIZE);
+	}
+	if (test.restart_receiver)
+	{
+		delete slave.protocol;
+		slave.protocol = new EnhancedProtocol(false);
+		slave.protocol->set_communication_interface(&link.slave_end);
+	}
+	if (test.drop_first) link.master_end.drop_next(1);
+	failed += stream(*master, clock, test.before, test.after);
+
+	uint32_t total = test.before + test.after;
+	uint32_t delivered = 0;
+	uint32_t duplicates = 0;
+	for (uint32_t i = 0; i < total && i < slave.deliveries.size(); i++)
+	{
+		if (slave.deliveries[i]) delivered++;
+		if (slave.deliveries[i] > 1) duplicates += slave.deliveries[i] - 1;
+	}
+	bool pass = delivered == total && duplicates == 0 && failed == 0;
+	printf("%-34s %9lu %8lu %4lu %6lu %6s\n", test.name, (unsigned long)delivered, (unsigned long)total, (unsigned long)duplicates,
+		(unsigned long)failed, pass ? "PASS" : "FAIL");
+
+	link.master_end.set_idle_hook(nullptr, nullptr);
+	delete master;
+	delete slave.protocol;
+	set_host_clock(nullptr);
+	return pass;
+}
+
+//The window on its own: later frames first, then the SYN frame they overtook; a resend RX_WINDOW_SPAN behind
+static bool check_window()
+{
+	ReceiveWindow window;
+	bool pass = window.accept(101) && window.accept(102) && !window.is_synced() &&
+		window.accept(100, true) && window.is_synced() && window.get_cumulative_ack() == 102 &&
+		!window.accept(100, true) && !window.accept(101) &&
+		window.accept(103) && window.get_cumulative_ack() == 103 &&
+		window.accept(0, true) && window.get_cumulative_ack() == 0;//sender restarted
+
+	//A resend of the oldest frame the sender may have outstanding, when the newest one allowed already arrived
+	ReceiveWindow full;
+	full.accept(200, true);
+	for (uint16_t seq = 202; seq < 200 + RX_WINDOW_SPAN; seq++) full.accept(seq);
+	pass = pass && full.accept(201) && full.get_cumulative_ack() == 200 + RX_WINDOW_SPAN - 1 && !full.accept(200);
+	printf("%-34s %32s\n", "window: late SYN, resend at span", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+static FrameHandle sequenced_frame(PacketType type, uint16_t seq_num, bool syn)
+{
+	static Protocol builder;
+	FrameHandle frame = frame_pool.acquire();
+	if (!frame || !builder.create_ack_frame(type, seq_num, nullptr, 0, frame.get())) return FrameHandle();//any type, seq_num as given
+	if (syn) frame->flags |= FRAME_FLAG_SYN;
+	return frame;
+}
+
+//The reorder buffer on its own: a BATCH and a FRAGMENT overtake the SYN DATA frame, delivery starts at the SYN
+static bool check_reorder()
+{
+	VirtualClock clock;
+	set_host_clock(&clock);
+	ReorderBuffer reorder;
+	bool pass = reorder.push(sequenced_frame(TYPE_BATCH, 101, false)) && reorder.push(sequenced_frame(TYPE_FRAGMENT, 102, false)) &&
+		!reorder.pop() && reorder.push(sequenced_frame(TYPE_DATA, 100, true));
+	for (uint16_t seq = 100; pass && seq <= 102; seq++)
+	{
+		FrameHandle frame = reorder.pop();
+		pass = frame && frame->sequence_num == seq;
+	}
+	pass = pass && !reorder.pop() && reorder.get_gaps_skipped() == 0;
+	set_host_clock(nullptr);
+	printf("%-34s %32s\n", "reorder: SYN after later frames", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+int main()
+{
+	set_host_console(false);
+
+	const Case cases[] =
+	{
+		{ "first frame lost", 0, false, false, true, 40 },
+		{ "sender restarts", 100, true, false, false, 40 },
+		{ "sender restarts, first frame lost", 100, true, false, true, 40 },
+		{ "receiver restarts", 40, false, true, false, 40 },
+	};
+
+	printf("%-34s %9s %8s %4s %6s %6s\n", "case", "delivered", "expected", "dups", "failed", "result");
+	bool pass = check_window();
+	pass = check_reorder() && pass;
+	for (uint8_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+	{
+		pass = run(cases[i]) && pass;
+	}
+	return pass ? 0 : 1;
+}
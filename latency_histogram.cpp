@@ -0,0 +1,71 @@
+#include "latency_histogram.h"
+#include <string.h>
+
+LatencyHistogram::LatencyHistogram()
+{
+	reset();
+}
+
+void LatencyHistogram::reset()
+{
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	sum_us = 0;
+	min_us = UINT32_MAX;
+	max_us = 0;
+}
+
+uint16_t LatencyHistogram::bucket_index(uint32_t value_us)
+{
+	//Values below one sub-bucket range are exact
+	if (value_us < LATENCY_SUB_BUCKETS) return (uint16_t)value_us;
+
+	uint8_t exponent = 31 - __builtin_clz(value_us);//floor(log2)
+	if (exponent > LATENCY_MAX_EXPONENT) return LATENCY_BUCKET_COUNT - 1;
+
+	uint8_t shift = exponent - LATENCY_SUB_BUCKET_BITS;
+	uint16_t sub_bucket = (value_us >> shift) & (LATENCY_SUB_BUCKETS - 1);
+	return (uint16_t)((shift + 1) * LATENCY_SUB_BUCKETS + sub_bucket);
+}
+
+uint32_t LatencyHistogram::bucket_upper_bound(uint16_t index)
+{
+	if (index < LATENCY_SUB_BUCKETS) return index;
+
+	uint8_t shift = index / LATENCY_SUB_BUCKETS - 1;
+	uint32_t sub_bucket = index % LATENCY_SUB_BUCKETS;
+	uint32_t lower = (LATENCY_SUB_BUCKETS | sub_bucket) << shift;
+	return lower + ((uint32_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(uint32_t value_us)
+{
+	buckets[bucket_index(value_us)]++;
+	count++;
+	sum_us += value_us;
+	if (value_us < min_us) min_us = value_us;
+	if (value_us > max_us) max_us = value_us;
+}
+
+uint32_t LatencyHistogram::get_percentile(float percentile) const
+{
+	if (count == 0) return 0;
+
+	//Rank of the sample at this percentile, 1-based
+	uint32_t rank = (uint32_t)(percentile / 100.0f * count + 0.5f);
+	if (rank < 1) rank = 1;
+	if (rank > count) rank = count;
+
+	uint32_t seen = 0;
+	for (uint16_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+	{
+		seen += buckets[i];
+		if (seen >= rank)
+		{
+			if (i == LATENCY_BUCKET_COUNT - 1) return max_us;//overflow bucket has no upper bound
+			uint32_t bound = bucket_upper_bound(i);
+			return bound < max_us ? bound : max_us;
+		}
+	}
+	return max_us;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+//Log-bucketed (HDR-style) histogram of microsecond latencies.
+//Each power of two is split into 2^LATENCY_SUB_BUCKET_BITS linear sub-buckets, so a reported
+//value is within 1/16 (6.25%) of the recorded one. Recording is O(1), memory is fixed.
+
+#include <stdint.h>
+
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_EXPONENT 27//largest trackable value ~134 s, larger samples are clamped
+#define LATENCY_BUCKET_COUNT ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 2) * LATENCY_SUB_BUCKETS)
+
+class LatencyHistogram
+{
+private:
+	uint32_t buckets[LATENCY_BUCKET_COUNT];
+	uint32_t count;
+	uint64_t sum_us;
+	uint32_t min_us;
+	uint32_t max_us;
+
+	static uint16_t bucket_index(uint32_t value_us);
+	static uint32_t bucket_upper_bound(uint16_t index);
+
+public:
+	LatencyHistogram();
+
+	void record(uint32_t value_us);
+	void reset();
+
+	uint32_t get_count() const { return count; }
+	uint32_t get_min() const { return count ? min_us : 0; }
+	uint32_t get_max() const { return max_us; }
+	float get_mean() const { return count ? (float)sum_us / count : 0.0f; }
+	uint32_t get_percentile(float percentile) const;//0..100, upper bound of the bucket holding it
+};
+
+#endif // !LATENCY_HISTOGRAM_H
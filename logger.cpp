@@ -0,0 +1,139 @@
+#include "logger.h"
+#include <stdio.h>
+
+Logger logger;
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+Logger::Logger() : enqueue_position(0), dequeue_position(0), dropped(0), dropped_reported(0), output(&Serial)
+{
+	for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+	{
+		ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+bool Logger::push(uint8_t level, const char* format, const LogArg* args, uint8_t count)
+{
+	uint32_t position = enqueue_position.load(std::memory_order_relaxed);
+	Slot* slot;
+	for (;;)
+	{
+		slot = &ring[position & (LOG_RING_SIZE - 1)];
+		int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - position);
+		if (diff == 0)
+		{
+			if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+		}
+		else if (diff < 0)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);//ring full, never block the caller
+			return false;
+		}
+		else
+		{
+			position = enqueue_position.load(std::memory_order_relaxed);
+		}
+	}
+
+	LogRecord& record = slot->record;
+	record.format = format;
+	record.timestamp_ms = millis();
+	record.level = level;
+	record.arg_count = count;
+	for (uint8_t i = 0; i < count; i++) record.args[i] = args[i];
+
+	slot->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+uint16_t Logger::drain(uint16_t max_records)
+{
+	uint16_t written = 0;
+	while (written < max_records)
+	{
+		Slot& slot = ring[dequeue_position & (LOG_RING_SIZE - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != dequeue_position + 1) break;//empty
+
+		LogRecord record = slot.record;
+		slot.sequence.store(dequeue_position + LOG_RING_SIZE, std::memory_order_release);
+		dequeue_position++;
+
+		if (output) format_record(record);
+		written++;
+	}
+
+	uint32_t dropped_now = get_dropped();
+	if (output && dropped_now != dropped_reported)
+	{
+		output->printf("[LOG] %lu records dropped\r\n", (unsigned long)(dropped_now - dropped_reported));
+		dropped_reported = dropped_now;
+	}
+	return written;
+}
+
+uint32_t Logger::get_pending() const
+{
+	return enqueue_position.load(std::memory_order_relaxed) - dequeue_position;
+}
+
+void Logger::format_record(const LogRecord& record)
+{
+	static const char LEVEL_TAGS[] = { '-', 'E', 'W', 'I', 'D' };
+
+	char line[192];
+	int length = snprintf(line, sizeof(line), "[%lu] %c ", (unsigned long)record.timestamp_ms, LEVEL_TAGS[record.level <= LOG_LEVEL_DEBUG ? record.level : 0]);
+
+	//Walk the format, handing each conversion its stored argument with the matching type
+	const char* cursor = record.format;
+	uint8_t arg_index = 0;
+	while (*cursor && length < (int)sizeof(line) - 1)
+	{
+		if (*cursor != '%')
+		{
+			line[length++] = *cursor++;
+			continue;
+		}
+		if (cursor[1] == '%')
+		{
+			line[length++] = '%';
+			cursor += 2;
+			continue;
+		}
+
+		//Copy flags/width/precision, drop length modifiers (arguments are stored as 32-bit)
+		char spec[16];
+		uint8_t spec_length = 0;
+		spec[spec_length++] = *cursor++;
+		while (*cursor && strchr("-+ #0123456789.hlzjt", *cursor))
+		{
+			if (!strchr("hlzjt", *cursor) && spec_length < sizeof(spec) - 2) spec[spec_length++] = *cursor;
+			cursor++;
+		}
+		char conversion = *cursor;
+		if (!conversion) break;
+		cursor++;
+		spec[spec_length++] = conversion;
+		spec[spec_length] = '\0';
+
+		LogArg arg;
+		arg.u = 0;
+		if (arg_index < record.arg_count) arg = record.args[arg_index];
+		arg_index++;
+
+		size_t space = sizeof(line) - length;
+		int added;
+		switch (conversion)
+		{
+		case 'd': case 'i': added = snprintf(&line[length], space, spec, (int)arg.i); break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': added = snprintf(&line[length], space, spec, (double)arg.f); break;
+		case 's': added = snprintf(&line[length], space, spec, arg.s ? arg.s : "(null)"); break;
+		default: added = snprintf(&line[length], space, spec, (unsigned int)arg.u); break;
+		}
+		if (added > 0) length += added < (int)space ? added : (int)space - 1;
+	}
+	if (length > (int)sizeof(line) - 1) length = sizeof(line) - 1;
+	line[length] = '\0';
+
+	output->println(line);
+}
@@ -0,0 +1,120 @@
+#pragma once
+#ifndef LOGGER_H
+#define LOGGER_H
+
+//Deferred logging: hot paths store (format, args) records in a lock-free ring and
+//Logger::drain() formats them to the console in idle time.
+//Calls above LOG_LEVEL compile to nothing, arguments are not evaluated.
+//Formats take up to LOG_MAX_ARGS printf arguments (integers, float, %s on string literals only).
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <atomic>
+#include <type_traits>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE 64//records, power of two
+#define LOG_MAX_ARGS 4
+
+union LogArg
+{
+	uint32_t u;
+	int32_t i;
+	float f;
+	const char* s;
+};
+
+struct LogRecord
+{
+	const char* format;//string literal, doubles as the format ID
+	uint32_t timestamp_ms;
+	uint8_t level;
+	uint8_t arg_count;
+	LogArg args[LOG_MAX_ARGS];
+};
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, LogArg>::type log_arg(T value)
+{
+	LogArg arg;
+	arg.u = (uint32_t)value;
+	return arg;
+}
+inline LogArg log_arg(double value) { LogArg arg; arg.f = (float)value; return arg; }
+inline LogArg log_arg(const char* value) { LogArg arg; arg.s = value; return arg; }
+
+class Logger
+{
+private:
+	//Bounded MPMC queue (one sequence number per slot), used here with a single consumer
+	struct Slot
+	{
+		std::atomic<uint32_t> sequence;
+		LogRecord record;
+	};
+	Slot ring[LOG_RING_SIZE];
+	std::atomic<uint32_t> enqueue_position;
+	uint32_t dequeue_position;//drain() only
+
+	std::atomic<uint32_t> dropped;
+	uint32_t dropped_reported;
+
+	Print* output;
+
+	bool push(uint8_t level, const char* format, const LogArg* args, uint8_t count);
+	void format_record(const LogRecord& record);
+
+public:
+	Logger();
+
+	template<typename... Args>
+	void record(uint8_t level, const char* format, Args... args)
+	{
+		static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+		LogArg packed[sizeof...(Args) + 1] = { log_arg(args)... };
+		push(level, format, packed, sizeof...(Args));
+	}
+
+	uint16_t drain(uint16_t max_records = LOG_RING_SIZE);//returns records written
+	void set_output(Print* print) { output = print; }
+
+	uint32_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+	uint32_t get_pending() const;
+};
+
+extern Logger logger;
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logger.record(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logger.record(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logger.record(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger.record(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#endif // !LOGGER_H
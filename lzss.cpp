@@ -0,0 +1,137 @@
+#include "lzss.h"
+#include "crc16.h"
+#include <string.h>
+
+void LZSS::Dictionary::load(const uint8_t* dictionary, uint16_t dictionary_length)
+{
+	//Positions further back than LZSS_MAX_OFFSET from the payload are never reachable
+	if (dictionary_length > LZSS_MAX_OFFSET)
+	{
+		dictionary += dictionary_length - LZSS_MAX_OFFSET;
+		dictionary_length = LZSS_MAX_OFFSET;
+	}
+	bytes = dictionary;
+	length = dictionary ? dictionary_length : 0;
+	id = CRC16::calculate(bytes, length);
+
+	for (uint16_t i = 0; i < LZSS_HASH_SIZE; i++)
+	{
+		head[i] = LZSS_NO_POSITION;
+	}
+	for (uint16_t i = 0; i + LZSS_MIN_MATCH <= length; i++)
+	{
+		head[hash(&bytes[i])] = i;//later positions win, they are closer to the payload
+	}
+}
+
+uint16_t LZSS::encode(const uint8_t* input, uint16_t length, uint8_t* output, uint16_t capacity, const Dictionary* dictionary)
+{
+	//Positions run through the dictionary and on into the input: base + i is input[i]
+	uint16_t base = dictionary ? dictionary->length : 0;
+	uint16_t table[LZSS_HASH_SIZE];
+	if (dictionary)
+	{
+		memcpy(table, dictionary->head, sizeof(table));
+	}
+	else
+	{
+		for (uint16_t i = 0; i < LZSS_HASH_SIZE; i++) table[i] = LZSS_NO_POSITION;
+	}
+
+	uint16_t out = 0;
+	uint16_t control_index = 0;
+	uint8_t item = 8;//items under the current control byte, 8 = start a new one
+	uint16_t i = 0;
+	while (i < length)
+	{
+		if (item == 8)
+		{
+			if (out >= capacity) return 0;
+			control_index = out++;
+			output[control_index] = 0;
+			item = 0;
+		}
+
+		//Greedy: one candidate per hash, the most recent position with the same 3-byte prefix hash
+		uint16_t match_length = 0;
+		uint16_t match_offset = 0;
+		if (i + LZSS_MIN_MATCH <= length)
+		{
+			uint8_t h = hash(&input[i]);
+			uint16_t candidate = table[h];
+			table[h] = base + i;
+			if (candidate != LZSS_NO_POSITION && base + i - candidate <= LZSS_MAX_OFFSET)
+			{
+				uint16_t limit = length - i < LZSS_MAX_MATCH ? length - i : LZSS_MAX_MATCH;
+				uint16_t position = candidate;
+				while (match_length < limit)
+				{
+					uint8_t byte = position < base ? dictionary->bytes[position] : input[position - base];
+					if (byte != input[i + match_length]) break;
+					match_length++;
+					position++;
+				}
+				match_offset = base + i - candidate;
+			}
+		}
+
+		if (match_length >= LZSS_MIN_MATCH)
+		{
+			if (out + 2 > capacity) return 0;
+			uint16_t code = (uint16_t)((match_offset - 1) | ((match_length - LZSS_MIN_MATCH) << LZSS_OFFSET_BITS));
+			output[out++] = (uint8_t)(code & 0xFF);
+			output[out++] = (uint8_t)(code >> 8);
+			output[control_index] |= (uint8_t)(1 << item);
+
+			//Index the positions the match covers so later text can refer to them
+			for (uint16_t k = 1; k < match_length && i + k + LZSS_MIN_MATCH <= length; k++)
+			{
+				table[hash(&input[i + k])] = base + i + k;
+			}
+			i += match_length;
+		}
+		else
+		{
+			if (out >= capacity) return 0;
+			output[out++] = input[i++];
+		}
+		item++;
+	}
+	return out;
+}
+
+uint16_t LZSS::decode(const uint8_t* input, uint16_t length, uint8_t* output, uint16_t capacity, const Dictionary* dictionary)
+{
+	uint16_t base = dictionary ? dictionary->length : 0;
+	uint16_t in = 0;
+	uint16_t out = 0;
+	while (in < length)
+	{
+		uint8_t control = input[in++];
+		for (uint8_t item = 0; item < 8 && in < length; item++)
+		{
+			if (control & (1 << item))
+			{
+				if (in + 2 > length) return 0;
+				uint16_t code = input[in] | ((uint16_t)input[in + 1] << 8);
+				in += 2;
+				uint16_t offset = (code & (LZSS_MAX_OFFSET - 1)) + 1;
+				uint16_t match_length = (code >> LZSS_OFFSET_BITS) + LZSS_MIN_MATCH;
+				if (offset > base + out || out + match_length > capacity) return 0;
+
+				//Byte by byte: a reference may overlap the bytes it produces
+				uint16_t position = base + out - offset;
+				for (uint16_t k = 0; k < match_length; k++, position++)
+				{
+					output[out++] = position < base ? dictionary->bytes[position] : output[position - base];
+				}
+			}
+			else
+			{
+				if (out >= capacity) return 0;
+				output[out++] = input[in++];
+			}
+		}
+	}
+	return out;
+}
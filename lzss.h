@@ -0,0 +1,48 @@
+#pragma once
+#ifndef LZSS_H
+#define LZSS_H
+
+//Small-window LZSS for frame payloads: a control byte per 8 items, each item a literal byte or a
+//2-byte back reference (offset up to LZSS_MAX_OFFSET, length LZSS_MIN_MATCH..LZSS_MAX_MATCH).
+//References may reach into a preset dictionary that both ends hold, so even a short payload finds
+//its repeated text. No history is kept between payloads: RAM is the dictionary index plus the
+//encoder's hash table on the stack.
+
+#include <stdint.h>
+
+#define LZSS_OFFSET_BITS 10
+#define LZSS_MAX_OFFSET (1 << LZSS_OFFSET_BITS)//1024
+#define LZSS_MIN_MATCH 3//a reference is 2 bytes, shorter matches do not pay
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + (1 << (16 - LZSS_OFFSET_BITS)) - 1)//66
+#define LZSS_HASH_BITS 8
+#define LZSS_HASH_SIZE (1 << LZSS_HASH_BITS)//encoder table, 2 bytes per entry
+#define LZSS_NO_POSITION 0xFFFF
+
+class LZSS
+{
+public:
+	//Preset dictionary: text the payloads are likely to repeat. Only the last LZSS_MAX_OFFSET bytes can be referenced.
+	struct Dictionary
+	{
+		const uint8_t* bytes;//not copied, must outlive the dictionary
+		uint16_t length;
+		uint16_t id;//CRC16 of the bytes, peers compare ids before sending compressed data
+		uint16_t head[LZSS_HASH_SIZE];//last dictionary position per hash, the encoder's starting table
+
+		void load(const uint8_t* dictionary, uint16_t dictionary_length);//nullptr / 0 = no dictionary
+	};
+
+	//Returns the encoded length, 0 if it would not fit in capacity (pass length - 1 to only accept a gain)
+	static uint16_t encode(const uint8_t* input, uint16_t length, uint8_t* output, uint16_t capacity, const Dictionary* dictionary = nullptr);
+	//Returns the decoded length, 0 on a malformed block or one that does not fit in capacity
+	static uint16_t decode(const uint8_t* input, uint16_t length, uint8_t* output, uint16_t capacity, const Dictionary* dictionary = nullptr);
+
+private:
+	static uint8_t hash(const uint8_t* bytes)
+	{
+		uint32_t key = bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16);
+		return (uint8_t)((key * 2654435761UL) >> (32 - LZSS_HASH_BITS));
+	}
+};
+
+#endif // !LZSS_H
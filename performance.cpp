@@ -1,8 +1,8 @@
 #include "performance.h"
 #include <Arduino.h>
-#include <climits>
+#include "logger.h"
 
-PerformanceMonitor::PerformanceMonitor()
+PerformanceMonitor::PerformanceMonitor() : rto_us(0)
 {
 	reset_statistics();
 }
@@ -13,23 +13,48 @@ void PerformanceMonitor::reset_statistics()
 	total_bytes_received = 0;
 	total_packets_sent = 0;
 	total_packets_received = 0;
+	total_payload_bytes_sent = 0;
+
+	memset(window_bytes, 0, sizeof(window_bytes));
+	memset(window_packets, 0, sizeof(window_packets));
+	window_byte_sum = 0;
+	window_packet_sum = 0;
+	window_head_second = 0;
+
+	for (int i = 0; i < SIZE_CLASS_COUNT; i++)
+	{
+		class_packets[i] = 0;
+		class_payload_bytes[i] = 0;
+		class_wire_bytes[i] = 0;
+	}
 
 	lost_packets = 0;
 	sequence_errors = 0;
 	crc_errors = 0;
 	timeouts = 0;
 	retransmissions = 0;
+	standalone_acks = 0;
+	piggybacked_acks = 0;
+	switches = 0;
+	switch_failures = 0;
+	last_switch_us = 0;
+	max_switch_us = 0;
+	compressed_frames = 0;
+	uncompressible_frames = 0;
+	compression_bytes_in = 0;
+	compression_bytes_out = 0;
+	decompression_errors = 0;
+	fec_frames = 0;
+	fec_unprotected_frames = 0;
+	fec_repaired_frames = 0;
+	fec_bytes_corrected = 0;
+	fec_unrepaired_frames = 0;
 
 	//Initialize latency tracking
-	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
-	{
-		latency_samples[i] = 0;
-	}
-	latency_index = 0;
-	total_latency = 0;
-	min_latency = UINT32_MAX;
-	max_latency = 0;
-	last_latency = 0;
+	latency_histogram.reset();
+	last_latency_us = 0;
+	ewma_latency_us = 0;
+	jitter_us = 0;
 
 	//Create Packet Timing
 	memset(packet_start_time, 0, sizeof(packet_start_time));
@@ -37,10 +62,86 @@ void PerformanceMonitor::reset_statistics()
 	measurement_start_time = millis();
 }
 
-void PerformanceMonitor::packet_sent(uint16_t packet_size)
+void PerformanceMonitor::packet_sent(uint16_t packet_size, uint16_t payload_size)
 {
 	total_packets_sent++;
 	total_bytes_sent += packet_size;
+	total_payload_bytes_sent += payload_size;
+
+	uint8_t size_class = payload_size <= SMALL_PAYLOAD_MAX ? 0 : (payload_size <= MEDIUM_PAYLOAD_MAX ? 1 : 2);
+	class_packets[size_class]++;
+	class_payload_bytes[size_class] += payload_size;
+	class_wire_bytes[size_class] += packet_size;
+
+	advance_window((millis() - measurement_start_time) / 1000);
+	uint8_t bucket = window_head_second % PERF_WINDOW_SECONDS;
+	window_bytes[bucket] += packet_size;
+	window_packets[bucket]++;
+	window_byte_sum += packet_size;
+	window_packet_sum++;
+}
+
+void PerformanceMonitor::advance_window(uint32_t now_second)
+{
+	uint32_t steps = now_second - window_head_second;
+	if (steps == 0) return;
+
+	if (steps >= PERF_WINDOW_SECONDS)
+	{
+		memset(window_bytes, 0, sizeof(window_bytes));
+		memset(window_packets, 0, sizeof(window_packets));
+		window_byte_sum = 0;
+		window_packet_sum = 0;
+	}
+	else
+	{
+		//Recycle the buckets of seconds that left the window
+		for (uint32_t second = window_head_second + 1; second <= now_second; second++)
+		{
+			uint8_t bucket = second % PERF_WINDOW_SECONDS;
+			window_byte_sum -= window_bytes[bucket];
+			window_packet_sum -= window_packets[bucket];
+			window_bytes[bucket] = 0;
+			window_packets[bucket] = 0;
+		}
+	}
+	window_head_second = now_second;
+}
+
+uint32_t PerformanceMonitor::window_sum(const uint32_t* buckets, uint32_t sum, uint32_t& span_ms) const
+{
+	//Readers do not advance the ring, buckets that aged out since the last packet are left out here
+	uint32_t elapsed_ms = millis() - measurement_start_time;
+	uint32_t now_second = elapsed_ms / 1000;
+
+	span_ms = (PERF_WINDOW_SECONDS - 1) * 1000 + elapsed_ms % 1000;
+	if (span_ms > elapsed_ms) span_ms = elapsed_ms;
+
+	uint32_t stale = now_second - window_head_second;
+	if (stale >= PERF_WINDOW_SECONDS) return 0;
+	for (uint32_t second = window_head_second + 1; second <= now_second; second++)
+	{
+		sum -= buckets[second % PERF_WINDOW_SECONDS];
+	}
+	return sum;
+}
+
+float PerformanceMonitor::get_windowed_throughput_kbps() const
+{
+	uint32_t span_ms;
+	uint32_t bytes = window_sum(window_bytes, window_byte_sum, span_ms);
+	if (span_ms == 0) return 0.0;
+
+	return bytes * 8.0 / (span_ms / 1000.0) / 1024.0;
+}
+
+float PerformanceMonitor::get_windowed_packet_rate() const
+{
+	uint32_t span_ms;
+	uint32_t packets = window_sum(window_packets, window_packet_sum, span_ms);
+	if (span_ms == 0) return 0.0;
+
+	return packets / (span_ms / 1000.0);
 }
 
 void PerformanceMonitor::packet_received(uint16_t packet_size)
@@ -62,6 +163,21 @@ float PerformanceMonitor::get_throughput_kbps() const
 	return total_bits / time_seconds / 1024.0;
 }
 
+float PerformanceMonitor::get_goodput_kbps() const
+{
+	unsigned long elapsed_time = millis() - measurement_start_time;
+
+	if (elapsed_time == 0) return 0.0;
+
+	return total_payload_bytes_sent * 8.0 / (elapsed_time / 1000.0) / 1024.0;
+}
+
+float PerformanceMonitor::get_wire_efficiency(uint8_t size_class) const
+{
+	if (size_class >= SIZE_CLASS_COUNT || class_wire_bytes[size_class] == 0) return 0.0;
+	return (float)class_payload_bytes[size_class] / class_wire_bytes[size_class] * 100.0;
+}
+
 float PerformanceMonitor::get_packet_rate() const
 {
 	unsigned long current_time = millis();
@@ -75,149 +191,65 @@ float PerformanceMonitor::get_packet_rate() const
 
 void PerformanceMonitor::start_latency_measurement(uint16_t sequence_num)
 {
-	packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = millis();
+	packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = micros();
 }
 
-void PerformanceMonitor::end_latency_measurement(uint16_t sequence_num)
+uint32_t PerformanceMonitor::end_latency_measurement(uint16_t sequence_num)
 {
-	unsigned long end_time = millis();
-	unsigned long start_time = packet_start_time[sequence_num % MAX_SEQUENCE_NUMS];
+	//micros() wraps every ~71 minutes, unsigned subtraction handles it
+	uint32_t latency_us = (uint32_t)micros() - packet_start_time[sequence_num % MAX_SEQUENCE_NUMS];
 
-	/*Serial.print("[DEBUG] END timing - Seq: ");
-	Serial.print(sequence_num);
-	Serial.print(", Start: ");
-	Serial.print(start_time);
-	Serial.print(", End: ");
-	Serial.print(end_time);
-
-	if (start_time == 0) //Have not start yet or have measured
-	{
-		Serial.println(" - SKIP (no start time)");
-		return;
-	}*/
-	//Micro() overflow handled automatically
-	uint32_t latency;
-	if (end_time < start_time)
-	{
-		latency = (ULONG_MAX - start_time) + end_time;
-		Serial.print(" [OVERFLOW_HANDLED]");
-	}
-	else
+	if (latency_us > MAX_VALID_LATENCY_US)
 	{
-		latency = end_time - start_time;
-	}
-
-	Serial.print(", Raw Latency: ");
-	Serial.print(latency);
-	Serial.println(" ms");
-	
-	if (latency < 1 || latency > 5000)
-	{
-		Serial.print("[WARN] Ignoring abnormal latency: ");
-		Serial.print(latency);
-		Serial.print("ms for seq: ");
-		Serial.println(sequence_num);
-		packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = 0;
-		return;
+		LOG_WARN("Ignoring abnormal latency: %lu us for seq %u", latency_us, sequence_num);
+		return 0;
 	}
 
-	if (min_latency == UINT32_MAX) 
+	if (latency_histogram.get_count() == 0)
 	{
-		min_latency = latency;
-		Serial.print("[INIT] First min_latency set to: ");
-		Serial.println(min_latency);
+		ewma_latency_us = latency_us;
 	}
-	
-	//Reset for not measure many time
-	packet_start_time[sequence_num % MAX_SEQUENCE_NUMS] = 0;
-
-	//Update circular buffer
-	total_latency -= latency_samples[latency_index];
-	latency_samples[latency_index] = latency;
-	total_latency += latency;
-
-	//Update min/max
-	if (latency < min_latency)
+	else
 	{
-		Serial.print("[UPDATE] New min_latency: ");
-		Serial.print(latency); Serial.print("ms (was: ");
-		Serial.print(min_latency); Serial.print("ms)");
-		min_latency = latency;
-	}
+		ewma_latency_us += ((float)latency_us - ewma_latency_us) / (1 << LATENCY_EWMA_SHIFT);
 
-	if (latency > max_latency)
-	{
-		Serial.print("[UPDATE] New max_latency: ");
-		Serial.print(latency); Serial.print("ms (was: ");
-		Serial.print(max_latency); Serial.print("ms)");
-		max_latency = latency;
+		//RFC 3550 6.4.1: J += (|D| - J) / 16, D = change in transit time between consecutive samples
+		float transit_delta = (float)latency_us - (float)last_latency_us;
+		if (transit_delta < 0) transit_delta = -transit_delta;
+		jitter_us += (transit_delta - jitter_us) / (1 << JITTER_GAIN_SHIFT);
 	}
 
-	last_latency = latency;
-	latency_index = (latency_index + 1) % LATENCY_BUFFER_SIZE;
-	Serial.print("[BUFFER] Index:");
-	Serial.print(latency_index);
-	Serial.print(" CurrentSample:");
-	Serial.println(latency);
+	latency_histogram.record(latency_us);
+	last_latency_us = latency_us;
+	return latency_us;
 }
 
 float PerformanceMonitor::get_average_latency() const
 {
-	uint32_t valid_samples = 0;
-	uint32_t sum = 0;
-
-	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
-	{
-		if (latency_samples[i] > 0)
-		{
-			sum += latency_samples[i];
-			valid_samples++;
-		}
-	}
-
-	if (valid_samples == 0) return 0.0;
-	return sum / (float)valid_samples;
+	return latency_histogram.get_mean() / 1000.0f;
 }
 
-int PerformanceMonitor::get_max_latency() const
+float PerformanceMonitor::get_max_latency() const
 {
-	if (max_latency == 0 || max_latency == UINT32_MAX)
-	{
-		return 0;
-	}
-	else return max_latency;
+	return latency_histogram.get_max() / 1000.0f;
 }
 
-int PerformanceMonitor::get_min_latency() const
+float PerformanceMonitor::get_min_latency() const
 {
-	if (min_latency == UINT32_MAX)
-	{
-		return 0;
-	}
-	else return min_latency;
+	return latency_histogram.get_min() / 1000.0f;
 }
 
 float PerformanceMonitor::get_average_jitter() const
 {
-	if (min_latency == UINT32_MAX || max_latency == 0) return 0.0;
-
-	uint32_t valid_samples = 0;
-	for (int i = 0; i < LATENCY_BUFFER_SIZE; i++)
-	{
-		if (latency_samples[i] > 0) valid_samples++;
-	}
-
-	if (valid_samples < 2) return 0.0;
-
-	return (max_latency - min_latency) / 2.0;
+	return jitter_us / 1000.0f;
 }
 
-void PerformanceMonitor::packet_lost(uint16_t sequence_num)
+void PerformanceMonitor::packet_lost(uint16_t /*sequence_num*/)
 {
 	lost_packets++;
 }
 
-void PerformanceMonitor::sequence_error(uint16_t expected, uint16_t received)
+void PerformanceMonitor::sequence_error(uint16_t /*expected*/, uint16_t /*received*/)
 {
 	sequence_errors++;
 }
@@ -237,6 +269,49 @@ void PerformanceMonitor::retransmission_occurred()
 	retransmissions++;
 }
 
+void PerformanceMonitor::ack_sent(bool piggybacked)
+{
+	if (piggybacked)
+	{
+		piggybacked_acks++;
+	}
+	else
+	{
+		standalone_acks++;
+	}
+}
+
+void PerformanceMonitor::switch_completed(uint32_t elapsed_us)
+{
+	switches++;
+	last_switch_us = elapsed_us;
+	if (elapsed_us > max_switch_us) max_switch_us = elapsed_us;
+}
+
+void PerformanceMonitor::switch_failed()
+{
+	switch_failures++;
+}
+
+void PerformanceMonitor::payload_compressed(uint16_t original_size, uint16_t compressed_size)
+{
+	compressed_frames++;
+	compression_bytes_in += original_size;
+	compression_bytes_out += compressed_size;
+}
+
+void PerformanceMonitor::fec_repaired(uint8_t bytes_corrected)
+{
+	fec_repaired_frames++;
+	fec_bytes_corrected += bytes_corrected;
+}
+
+float PerformanceMonitor::get_compression_ratio() const
+{
+	if (compression_bytes_in == 0) return 100.0;
+	return (float)compression_bytes_out / compression_bytes_in * 100.0;
+}
+
 float PerformanceMonitor::get_packet_loss_rate() const
 {
 	if (total_packets_sent == 0) return 0.0;
@@ -269,13 +344,35 @@ void PerformanceMonitor::print_statistics()
 	Serial.print(" Packets Received: "); Serial.println(total_packets_received);
 	Serial.print(" Data Sent: "); Serial.print(total_bytes_sent / 1024.0, 2); Serial.println(" KB");
 	Serial.print(" Throughput: "); Serial.print(get_throughput_kbps(), 2); Serial.println(" kbps");
+	Serial.print(" Goodput: "); Serial.print(get_goodput_kbps(), 2); Serial.println(" kbps");
 	Serial.print(" Packet Rate "); Serial.print(get_packet_rate(), 2); Serial.println(" packets/s");
+	Serial.print(" Throughput (last "); Serial.print(PERF_WINDOW_SECONDS); Serial.print("s): "); Serial.print(get_windowed_throughput_kbps(), 2); Serial.println(" kbps");
+	Serial.print(" Packet Rate (last "); Serial.print(PERF_WINDOW_SECONDS); Serial.print("s): "); Serial.print(get_windowed_packet_rate(), 2); Serial.println(" packets/s");
+
+	Serial.println("WIRE EFFICIENCY (payload/wire): ");
+	static const char* class_names[SIZE_CLASS_COUNT] = { " Small (<=32B): ", " Medium (<=96B): ", " Full (>96B): " };
+	for (int i = 0; i < SIZE_CLASS_COUNT; i++)
+	{
+		Serial.print(class_names[i]);
+		Serial.print(class_packets[i]); Serial.print(" pkts, ");
+		Serial.print(class_packets[i] ? (float)class_wire_bytes[i] / class_packets[i] : 0.0, 1); Serial.print(" B/frame, ");
+		Serial.print(get_wire_efficiency(i), 1); Serial.println("%");
+	}
 
 	Serial.println("LATENCY: ");
-	Serial.print(" Average: "); Serial.print(get_average_latency(), 2); Serial.println(" ms");
-	Serial.print(" Min: "); Serial.print(get_min_latency()); Serial.println(" ms");
-	Serial.print(" Max: "); Serial.print(get_max_latency()); Serial.println(" ms");
-	Serial.print(" Jitter: "); Serial.print(get_average_jitter(), 2); Serial.println(" ms");
+	Serial.print(" Samples: "); Serial.println(latency_histogram.get_count());
+	Serial.print(" Average: "); Serial.print(get_average_latency(), 3); Serial.println(" ms");
+	Serial.print(" Min: "); Serial.print(get_min_latency(), 3); Serial.println(" ms");
+	static const float percentiles[] = { 50.0f, 90.0f, 99.0f, 99.9f };
+	static const char* percentile_names[] = { " p50: ", " p90: ", " p99: ", " p99.9: " };
+	for (int i = 0; i < 4; i++)
+	{
+		Serial.print(percentile_names[i]); Serial.print(get_latency_percentile_us(percentiles[i]) / 1000.0, 3); Serial.println(" ms");
+	}
+	Serial.print(" Max: "); Serial.print(get_max_latency(), 3); Serial.println(" ms");
+	Serial.print(" EWMA: "); Serial.print(get_ewma_latency(), 3); Serial.println(" ms");
+	Serial.print(" Jitter (RFC 3550): "); Serial.print(get_average_jitter(), 3); Serial.println(" ms");
+	Serial.print(" RTO: "); Serial.print(rto_us / 1000.0, 3); Serial.println(" ms");
 
 	Serial.println("ERROR ANALYSIS:");
 	Serial.print(" Packet Loss: "); Serial.print(get_packet_loss_rate(), 2); Serial.println("%");
@@ -285,6 +382,29 @@ void PerformanceMonitor::print_statistics()
 	Serial.print(" Retransmissions: "); Serial.println(retransmissions);
 	Serial.print(" Success Rate: "); Serial.print(get_success_rate(), 2); Serial.println("%");
 
+	Serial.println("ACKNOWLEDGEMENTS:");
+	Serial.print(" Standalone: "); Serial.println(standalone_acks);
+	Serial.print(" Piggybacked: "); Serial.println(piggybacked_acks);
+
+	Serial.println("LINK HANDOVER:");
+	Serial.print(" Switches: "); Serial.println(switches);
+	Serial.print(" Failed: "); Serial.println(switch_failures);
+	Serial.print(" Last: "); Serial.print(last_switch_us / 1000.0, 3); Serial.println(" ms");
+	Serial.print(" Max: "); Serial.print(max_switch_us / 1000.0, 3); Serial.println(" ms");
+
+	Serial.println("COMPRESSION:");
+	Serial.print(" Compressed Frames: "); Serial.println(compressed_frames);
+	Serial.print(" Sent Uncompressed: "); Serial.println(uncompressible_frames);
+	Serial.print(" Ratio: "); Serial.print(get_compression_ratio(), 1); Serial.println("%");
+	Serial.print(" Decode Errors: "); Serial.println(decompression_errors);
+
+	Serial.println("FEC:");
+	Serial.print(" Protected Frames: "); Serial.println(fec_frames);
+	Serial.print(" Sent Unprotected: "); Serial.println(fec_unprotected_frames);
+	Serial.print(" Repaired: "); Serial.print(fec_repaired_frames);
+	Serial.print(" ("); Serial.print(fec_bytes_corrected); Serial.println(" bytes)");
+	Serial.print(" Needed Retransmission: "); Serial.println(fec_unrepaired_frames);
+
 	Serial.print("Measurement Duration: ");
 	Serial.print(elapsed_time / 1000.0, 1);
 	Serial.println(" seconds");
@@ -4,27 +4,49 @@
 
 #include <Arduino.h>
 #include <stdint.h>
+#include "latency_histogram.h"
+
+#define PERF_WINDOW_SECONDS 5//windowed throughput span, one bucket per second
+#define LATENCY_EWMA_SHIFT 3//EWMA gain 1/8, as for TCP SRTT
+#define JITTER_GAIN_SHIFT 4//RFC 3550 gain 1/16
 
 class PerformanceMonitor
 {
 private:
-	static const uint8_t LATENCY_BUFFER_SIZE = 50;
 	static const uint16_t MAX_SEQUENCE_NUMS = 256;
+	static const uint32_t MAX_VALID_LATENCY_US = 5000000;//longer samples are stale start times
+
+	//Payload size classes for wire efficiency reporting
+	static const uint8_t SIZE_CLASS_COUNT = 3;
+	static const uint16_t SMALL_PAYLOAD_MAX = 32;
+	static const uint16_t MEDIUM_PAYLOAD_MAX = 96;
 
 	//Throughtput metrics
 	uint32_t total_bytes_sent;
 	uint32_t total_bytes_received;
 	uint32_t total_packets_sent;
 	uint32_t total_packets_received;
+	uint32_t total_payload_bytes_sent;
 	unsigned long measurement_start_time;
 
-	//Latency metrics
-	uint32_t latency_samples[LATENCY_BUFFER_SIZE];
-	uint16_t latency_index;
-	uint32_t total_latency;
-	uint32_t min_latency;
-	uint32_t max_latency;
-	uint32_t last_latency;
+	//Sliding window over the last PERF_WINDOW_SECONDS, bucket = second % PERF_WINDOW_SECONDS
+	uint32_t window_bytes[PERF_WINDOW_SECONDS];
+	uint32_t window_packets[PERF_WINDOW_SECONDS];
+	uint32_t window_byte_sum;
+	uint32_t window_packet_sum;
+	uint32_t window_head_second;//newest bucket, seconds since measurement_start_time
+
+	//Per size class: small, medium, full
+	uint32_t class_packets[SIZE_CLASS_COUNT];
+	uint32_t class_payload_bytes[SIZE_CLASS_COUNT];
+	uint32_t class_wire_bytes[SIZE_CLASS_COUNT];
+
+	//Latency metrics (microseconds)
+	LatencyHistogram latency_histogram;
+	uint32_t last_latency_us;
+	float ewma_latency_us;
+	float jitter_us;//RFC 3550 estimator over consecutive round trips
+	uint32_t rto_us;//retransmission timeout in use, set by the sender (see RtoEstimator)
 
 	//Error tracking
 	uint32_t lost_packets;
@@ -33,25 +55,59 @@ private:
 	uint32_t timeouts;
 	uint32_t retransmissions;
 
-	//Packet timing
-	unsigned long packet_start_time[MAX_SEQUENCE_NUMS];
+	//Acknowledgements
+	uint32_t standalone_acks;
+	uint32_t piggybacked_acks;
+
+	//Link handover (UART <-> SPI), first request to confirmation
+	uint32_t switches;
+	uint32_t switch_failures;
+	uint32_t last_switch_us;
+	uint32_t max_switch_us;
+
+	//Payload compression, application bytes in vs payload bytes out
+	uint32_t compressed_frames;
+	uint32_t uncompressible_frames;//did not shrink, sent as they were
+	uint32_t compression_bytes_in;
+	uint32_t compression_bytes_out;
+	uint32_t decompression_errors;
+
+	//Forward error correction: frames sent with parity, received frames that failed their CRC and what became of them
+	uint32_t fec_frames;
+	uint32_t fec_unprotected_frames;//no room left for the parity, sent without
+	uint32_t fec_repaired_frames;//fixed from the parity, no retransmission
+	uint32_t fec_bytes_corrected;
+	uint32_t fec_unrepaired_frames;//more damage than the parity covers, left to NACK / retransmission
+
+	//Packet timing, micros()
+	uint32_t packet_start_time[MAX_SEQUENCE_NUMS];
 
 public:
 	PerformanceMonitor();
 	
 	//Throughtput measurement
-	void packet_sent(uint16_t packet_size);
+	void packet_sent(uint16_t packet_size, uint16_t payload_size);
 	void packet_received(uint16_t packet_size);
 	float get_throughput_kbps() const;
+	float get_goodput_kbps() const;//payload bytes only
 	float get_packet_rate() const;
+	float get_wire_efficiency(uint8_t size_class) const;//payload / wire bytes, %
+	float get_windowed_throughput_kbps() const;//last PERF_WINDOW_SECONDS
+	float get_windowed_packet_rate() const;
 
 	//Latency measurement
 	void start_latency_measurement(uint16_t sequence_num);
-	void end_latency_measurement(uint16_t sequence_num);
-	float get_average_latency() const;
-	int get_min_latency() const;
-	int get_max_latency() const;
-	float get_average_jitter() const;
+	uint32_t end_latency_measurement(uint16_t sequence_num);//round trip in us, 0 if the sample was rejected
+	float get_average_latency() const;//ms
+	float get_min_latency() const;//ms
+	float get_max_latency() const;//ms
+	float get_average_jitter() const;//ms, RFC 3550
+	float get_ewma_latency() const { return ewma_latency_us / 1000.0f; }//ms
+	uint32_t get_latency_percentile_us(float percentile) const { return latency_histogram.get_percentile(percentile); }
+	uint32_t get_last_latency_us() const { return last_latency_us; }
+	const LatencyHistogram& get_latency_histogram() const { return latency_histogram; }
+	void rto_updated(uint32_t timeout_us) { rto_us = timeout_us; }
+	uint32_t get_rto_us() const { return rto_us; }
 
 	//Error tracking
 	void packet_lost(uint16_t sequence_num);
@@ -59,10 +115,26 @@ public:
 	void crc_error();
 	void timeout_occurred();
 	void retransmission_occurred();
+	void ack_sent(bool piggybacked);
+	void switch_completed(uint32_t elapsed_us);
+	void switch_failed();
+	void payload_compressed(uint16_t original_size, uint16_t compressed_size);
+	void payload_uncompressible() { uncompressible_frames++; }
+	void decompression_failed() { decompression_errors++; }
+	void fec_frame_sent() { fec_frames++; }
+	void fec_frame_unprotected() { fec_unprotected_frames++; }
+	void fec_repaired(uint8_t bytes_corrected);
+	void fec_unrepaired() { fec_unrepaired_frames++; }
 	float get_packet_loss_rate() const;
 	float get_error_rate() const;
 	float get_success_rate() const;
 
+private:
+	void advance_window(uint32_t now_second);
+	uint32_t window_sum(const uint32_t* buckets, uint32_t sum, uint32_t& span_ms) const;
+
+public:
+
 	//Reporting
 	void print_statistics();
 	void reset_statistics();
@@ -72,6 +144,21 @@ public:
 	uint32_t get_packet_received() const { return total_packets_received; }
 	uint32_t get_crc_errors() const { return crc_errors; }
 	uint32_t get_retransmissions() const { return retransmissions; }
+	uint32_t get_standalone_acks() const { return standalone_acks; }
+	uint32_t get_piggybacked_acks() const { return piggybacked_acks; }
+	uint32_t get_switches() const { return switches; }
+	uint32_t get_switch_failures() const { return switch_failures; }
+	uint32_t get_last_switch_us() const { return last_switch_us; }
+	uint32_t get_max_switch_us() const { return max_switch_us; }
+	uint32_t get_compressed_frames() const { return compressed_frames; }
+	uint32_t get_uncompressible_frames() const { return uncompressible_frames; }
+	uint32_t get_decompression_errors() const { return decompression_errors; }
+	float get_compression_ratio() const;//compressed / original payload bytes, %
+	uint32_t get_fec_frames() const { return fec_frames; }
+	uint32_t get_fec_unprotected() const { return fec_unprotected_frames; }
+	uint32_t get_fec_repaired() const { return fec_repaired_frames; }
+	uint32_t get_fec_unrepaired() const { return fec_unrepaired_frames; }
+	uint32_t get_fec_bytes_corrected() const { return fec_bytes_corrected; }
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include "protocol.h"
 #include <Arduino.h>
 #include <cstring>
+#include "logger.h"
 
 Protocol::Protocol() : sequence_counter(0)
 {
@@ -9,64 +10,191 @@ Protocol::Protocol() : sequence_counter(0)
 
 uint16_t Protocol::get_next_sequence()
 {
-	uint16_t seq = sequence_counter;
-	sequence_counter = (sequence_counter + 1) % 65535;
-	return seq;
+	//Wraps over the full 16-bit space so window arithmetic (seq_diff) stays valid
+	return sequence_counter++;
 }
 
 bool Protocol::create_frame(PacketType type, const uint8_t* data, uint16_t data_len, UartFrame* frame)
 {
 	if (data_len > MAX_DATA_LEN || !frame) return false;
+	return build_frame(type, get_next_sequence(), data, data_len, frame);
+}
+
+bool Protocol::create_ack_frame(PacketType type, uint16_t seq_num, const uint8_t* data, uint16_t data_len, UartFrame* frame)
+{
+	if (data_len > MAX_DATA_LEN || !frame) return false;
+	return build_frame(type, seq_num, data, data_len, frame);
+}
 
+bool Protocol::build_frame(PacketType type, uint16_t seq_num, const uint8_t* data, uint16_t data_len, UartFrame* frame)
+{
 	frame->start_marker = START_MARKER;
 	frame->version = PROTOCOL_VERSION;
 	frame->packet_type = type;
-	frame->sequence_num = get_next_sequence();
+	frame->flags = 0;
+	frame->sequence_num = seq_num;
 	frame->data_length = data_len;
+	frame->ack_num = 0;
 	frame->end_marker = END_MARKER;
 
-	//Clear and copy data
-	memset(frame->data, 0, MAX_DATA_LEN);
-	if (data_len > 0)
+	//Only data_len bytes are ever encoded or checksummed, the rest of the buffer is left as is
+	//(data may already be in place, e.g. a batch built inside the frame)
+	if (data_len > 0 && data != frame->data)
 	{
 		memcpy(frame->data, data, data_len);
 	}
 
 	//Calculate CRC
-	uint16_t data_part_size = 1 + 1 + 2 + 2 + data_len;//Version + type + seq + len + data
-	frame->crc16 = CRC16::calculate((uint8_t*)&frame->version, data_part_size);
+	frame->crc16 = calculate_frame_crc(frame);
 
-	perf_monitor.packet_sent(sizeof(UartFrame));
+	perf_monitor.packet_sent(wire_size(frame), data_len);
 	return true;
 }
 
+uint16_t Protocol::calculate_frame_crc(const UartFrame* frame)
+{
+	//Same byte order as on the wire: version + type + seq + len + [ack] + data
+	uint8_t header[FRAME_HEADER_SIZE - 1 + FRAME_ACK_FIELD_SIZE] =
+	{
+		frame->version,
+		(uint8_t)(frame->packet_type | frame->flags),
+		(uint8_t)(frame->sequence_num & 0xFF),
+		(uint8_t)(frame->sequence_num >> 8),
+		(uint8_t)(frame->data_length & 0xFF),
+		(uint8_t)(frame->data_length >> 8),
+		(uint8_t)(frame->ack_num & 0xFF),
+		(uint8_t)(frame->ack_num >> 8)
+	};
+
+	uint16_t crc = CRC16::update(CRC16::begin(), header, header_size(frame) - 1);
+	crc = CRC16::update(crc, frame->data, frame->data_length);
+	return CRC16::finalize(crc);
+}
+
+uint16_t Protocol::encode_header(const UartFrame* frame, uint8_t* buffer)
+{
+	buffer[0] = frame->start_marker;
+	buffer[1] = frame->version;
+	buffer[2] = frame->packet_type | frame->flags;
+	buffer[3] = (uint8_t)(frame->sequence_num & 0xFF);
+	buffer[4] = (uint8_t)(frame->sequence_num >> 8);
+	buffer[5] = (uint8_t)(frame->data_length & 0xFF);
+	buffer[6] = (uint8_t)(frame->data_length >> 8);
+
+	uint16_t position = FRAME_HEADER_SIZE;
+	if (frame->flags & FRAME_FLAG_ACK)
+	{
+		buffer[position++] = (uint8_t)(frame->ack_num & 0xFF);
+		buffer[position++] = (uint8_t)(frame->ack_num >> 8);
+	}
+	return position;
+}
+
+void Protocol::encode_trailer(const UartFrame* frame, uint8_t* buffer)
+{
+	buffer[0] = (uint8_t)(frame->crc16 & 0xFF);
+	buffer[1] = (uint8_t)(frame->crc16 >> 8);
+	buffer[2] = frame->end_marker;
+}
+
+uint16_t Protocol::encode_frame(const UartFrame* frame, uint8_t* buffer)
+{
+	uint16_t position = encode_header(frame, buffer);
+	memcpy(&buffer[position], frame->data, frame->data_length);
+	position += frame->data_length;
+
+	encode_trailer(frame, &buffer[position]);
+	return position + FRAME_TRAILER_SIZE;
+}
+
+void Protocol::decode_header(const uint8_t* header, UartFrame* frame)
+{
+	frame->start_marker = header[0];
+	frame->version = header[1];
+	frame->packet_type = header[2] & FRAME_TYPE_MASK;
+	frame->flags = header[2] & ~FRAME_TYPE_MASK;
+	frame->sequence_num = header[3] | ((uint16_t)header[4] << 8);
+	frame->data_length = header[5] | ((uint16_t)header[6] << 8);
+	frame->ack_num = 0;
+	if (frame->flags & FRAME_FLAG_ACK)
+	{
+		frame->ack_num = header[FRAME_HEADER_SIZE] | ((uint16_t)header[FRAME_HEADER_SIZE + 1] << 8);
+	}
+}
+
+void Protocol::decode_trailer(const uint8_t* trailer, UartFrame* frame)
+{
+	frame->crc16 = trailer[0] | ((uint16_t)trailer[1] << 8);
+	frame->end_marker = trailer[2];
+}
+
+uint16_t Protocol::parse_wire_size(const uint8_t* header)
+{
+	uint16_t data_length = header[5] | ((uint16_t)header[6] << 8);
+	if (data_length > MAX_DATA_LEN) return 0;
+
+	uint16_t extension = (header[2] & FRAME_FLAG_ACK) ? FRAME_ACK_FIELD_SIZE : 0;
+	return FRAME_OVERHEAD + extension + data_length;
+}
+
+bool Protocol::decode_frame(const uint8_t* buffer, uint16_t length, UartFrame* frame)
+{
+	if (!buffer || !frame || length < FRAME_OVERHEAD) return false;
+	if (buffer[0] != START_MARKER) return false;
+
+	uint16_t frame_size = parse_wire_size(buffer);
+	if (frame_size == 0 || length < frame_size) return false;
+
+	const uint8_t* trailer = &buffer[frame_size - FRAME_TRAILER_SIZE];
+	if (trailer[2] != END_MARKER) return false;
+
+	decode_header(buffer, frame);
+	memcpy(frame->data, &buffer[parse_header_size(buffer)], frame->data_length);
+	decode_trailer(trailer, frame);
+	return true;
+}
+
+bool Protocol::frame_intact(const UartFrame* frame)
+{
+	return frame && frame->data_length <= MAX_DATA_LEN && frame->start_marker == START_MARKER &&
+		frame->end_marker == END_MARKER && calculate_frame_crc(frame) == frame->crc16;
+}
+
 bool Protocol::validate_frame(UartFrame* frame)
 {
 	if (!frame) return false;
 
+	if (frame->data_length > MAX_DATA_LEN) return false;
+
+	//Verify CRC
+	return validate_frame(frame, calculate_frame_crc(frame));
+}
+
+bool Protocol::validate_frame(UartFrame* frame, uint16_t calculated_crc)
+{
+	if (!frame) return false;
+
 	//Check marker
 	if (frame->start_marker != START_MARKER || frame->end_marker != END_MARKER)
 	{
 		return false;
 	}
 
-	//Verify CRC
-	uint16_t data_part_size = 1 + 1 + 2 + 2 + frame->data_length;
-	uint16_t calculated_crc = CRC16::calculate((uint8_t*)&frame->version, data_part_size);
-
 	if (calculated_crc != frame->crc16)
 	{
 		record_crc_error();
 		return false;
 	}
 
-	perf_monitor.packet_received(sizeof(UartFrame));
+	perf_monitor.packet_received(wire_size(frame));
 	return true;
 }
 
 bool Protocol::send_reliable(UartFrame* frame, HardwareSerial& serial)
 {
 	int retries = MAX_RETRIES;
+	uint8_t wire[MAX_FRAME_SIZE];
+	uint16_t wire_length = encode_frame(frame, wire);
 	
 	while (retries > 0)
 	{
@@ -74,27 +202,22 @@ bool Protocol::send_reliable(UartFrame* frame, HardwareSerial& serial)
 		start_packet_timing(frame->sequence_num);
 
 		//Send frame
-		serial.write((uint8_t*)frame, sizeof(UartFrame));
+		serial.write(wire, wire_length);
 		serial.flush();
 		delay(2);
 
-		Serial.print("Sent frame ");
-		Serial.print(frame->sequence_num);
-		Serial.println(", waiting for ACK...");
+		LOG_DEBUG("Sent frame %u, waiting for ACK", frame->sequence_num);
 
 		if (wait_for_ack(frame->sequence_num, serial, ACK_TIMEOUT_MS))
 		{
-			Serial.println("ACK received - SUCCESS");
+			LOG_DEBUG("ACK received for frame %u", frame->sequence_num);
 			return true;
 		}
 
 		//Timeout - retry
 		retries--;
 		record_retransmission();
-		Serial.print("Timeout - Retransmitting frame ");
-		Serial.print(frame->sequence_num);
-		Serial.print(", Attemps left: ");
-		Serial.println(retries);
+		LOG_INFO("Timeout - retransmitting frame %u, attempts left: %d", frame->sequence_num, retries);
 	}
 
 	record_timeout();
@@ -108,44 +231,57 @@ bool Protocol::wait_for_ack(uint16_t seq_num, HardwareSerial& serial, uint32_t t
 
 	while (millis() - start_time < timeout_ms)
 	{
-		if (serial.available() >= sizeof(UartFrame))
+		if (serial.available() >= FRAME_HEADER_SIZE)
 		{
+			//Skip bytes until a start marker, then read the rest using the length field
+			if (serial.peek() != START_MARKER)
+			{
+				serial.read();
+				continue;
+			}
+
+			uint8_t wire[MAX_FRAME_SIZE];
+			serial.readBytes(wire, FRAME_HEADER_SIZE);
+			uint16_t frame_size = parse_wire_size(wire);
+			if (frame_size == 0) continue;
+
+			uint16_t remaining = frame_size - FRAME_HEADER_SIZE;
 			UartFrame response;
-			serial.readBytes((uint8_t*)&response, sizeof(UartFrame));
+			if (serial.readBytes(&wire[FRAME_HEADER_SIZE], remaining) != remaining ||
+				!decode_frame(wire, FRAME_HEADER_SIZE + remaining, &response))
+			{
+				LOG_WARN("Framing error");
+				continue;
+			}
 
-			Serial.print("Received frame - Type: ");
-			Serial.print(response.packet_type);
-			Serial.print(", Seq: ");
-			Serial.print(response.sequence_num);
-			Serial.print(", Expected Seq: ");
-			Serial.println(seq_num);
+			LOG_DEBUG("Received frame - type %u, seq %u, expected seq %u", response.packet_type, response.sequence_num, seq_num);
 
 			if (validate_frame(&response))
 			{
 				if (response.packet_type == TYPE_ACK && response.sequence_num == seq_num)
 				{
 					end_packet_timing(seq_num);
-					Serial.println("VALID ACK RECEIVED");
+					LOG_DEBUG("Valid ACK for %u", seq_num);
 					return true;
 				}
 				else if (response.packet_type == TYPE_NACK && response.sequence_num == seq_num)
 				{
-					Serial.println("NACK RECEIVED");
+					LOG_INFO("NACK for %u", seq_num);
 					return false;
 				}
 				else
 				{
-					Serial.println("UNEXPECTED FRAME TYPE OR SEQUENCE");
+					LOG_DEBUG("Unexpected frame type or sequence");
 				}
 			}
 			else
 			{
-				Serial.println("INVALID FRAME CRC");
+				LOG_WARN("Invalid frame CRC");
 			}
 		}
 		delay(1);
 	}
-	Serial.println("ACK TIMEOUT");
+	LOG_INFO("ACK timeout for %u", seq_num);
 	return false;
 }
 
@@ -162,12 +298,31 @@ void Protocol::print_frame_info(UartFrame* frame)
 	case TYPE_NACK: Serial.print("NACK"); break;
 	case TYPE_PING: Serial.print("PING"); break;
 	case TYPE_PONG: Serial.print("PONG"); break;
+	case TYPE_BATCH: Serial.print("BATCH"); break;
+	case TYPE_FRAGMENT: Serial.print("FRAGMENT"); break;
+	case TYPE_SWITCH: Serial.print("SWITCH"); break;
 	default: Serial.print("UNKNOWN"); break;
 	}
 
 	Serial.print(" Len: "); Serial.print(frame->data_length);
+	if (frame->flags & FRAME_FLAG_COMPRESSED)
+	{
+		Serial.print(" (compressed)");
+	}
+	if (frame->flags & FRAME_FLAG_FEC)
+	{
+		Serial.print(" (fec)");
+	}
+	if (frame->flags & FRAME_FLAG_SYN)
+	{
+		Serial.print(" (syn)");
+	}
+	if (frame->flags & FRAME_FLAG_ACK)
+	{
+		Serial.print(" Ack: "); Serial.print(frame->ack_num);
+	}
 	Serial.print(" CRC: 0x"); Serial.print(frame->crc16, HEX);
-	Serial.print(" Valid: "); Serial.print(validate_frame(frame) ? "YES" : "NO");
+	Serial.print(" Valid: "); Serial.print(frame_intact(frame) ? "YES" : "NO");
 }
 
 void Protocol::print_statistics()
@@ -9,8 +9,12 @@
 
 #define START_MARKER 0xAA
 #define END_MARKER 0x55
+//Largest payload per frame: sizes every frame buffer, pool slot, SPI transfer and UART receive state.
+//Set per deployment (-DMAX_DATA_LEN=..., build_opt.h on arduino-esp32), both ends must agree.
+#ifndef MAX_DATA_LEN
 #define MAX_DATA_LEN 128
-#define PROTOCOL_VERSION 0x01
+#endif
+#define PROTOCOL_VERSION 0x02//0x02: packed variable-length wire format
 #define MAX_RETRIES 3
 #define ACK_TIMEOUT_MS 1000
 
@@ -21,25 +25,65 @@ typedef enum
 	TYPE_NACK = 0x03,
 	TYPE_PING = 0x04,
 	TYPE_PONG = 0x05,
+	TYPE_BATCH = 0x06,//DATA carrying several length-prefixed messages (see EnhancedProtocol::send_message)
+	TYPE_FRAGMENT = 0x07,//DATA carrying one slice of a larger message (see fragmentation.h)
+	TYPE_SWITCH = 0x08,//link handover control, not sequenced (see EnhancedProtocol::begin_switch)
 }PacketType;
 
-typedef struct
+//Wire format (little-endian, no padding):
+//start(1) version(1) type|flags(1) seq(2) len(2) [ack(2)] data(len) crc16(2) end(1)
+//CRC16 covers version..data
+#define FRAME_HEADER_SIZE 7
+#define FRAME_TRAILER_SIZE 3
+#define FRAME_OVERHEAD (FRAME_HEADER_SIZE + FRAME_TRAILER_SIZE)
+#define FRAME_ACK_FIELD_SIZE 2
+#define MAX_FRAME_SIZE (FRAME_OVERHEAD + FRAME_ACK_FIELD_SIZE + MAX_DATA_LEN)
+
+//Type byte: low nibble = PacketType, high nibble = flags
+#define FRAME_TYPE_MASK 0x0F
+#define FRAME_FLAG_ACK 0x80//ack field present: piggybacked cumulative ack
+#define FRAME_FLAG_COMPRESSED 0x40//data is LZSS-compressed (see EnhancedProtocol::set_compression), len is the compressed size
+#define FRAME_FLAG_FEC 0x20//data ends in RS_PARITY_BYTES of Reed-Solomon parity (see EnhancedProtocol::set_fec), len includes them
+#define FRAME_FLAG_SYN 0x10//first sequenced frame of the sender: the peer's receive window starts at it
+
+//TYPE_BATCH data area: [len(1) bytes(len)]..., records never span frames
+#define BATCH_RECORD_HEADER_SIZE 1
+#define MAX_BATCH_RECORD_LEN (MAX_DATA_LEN - BATCH_RECORD_HEADER_SIZE > 0xFF ? 0xFF : MAX_DATA_LEN - BATCH_RECORD_HEADER_SIZE)
+
+//In-memory frame, never sent as-is (see Protocol::encode_frame)
+template<uint16_t MaxData>
+struct BasicFrame
 {
+	static const uint16_t max_data_length = MaxData;
+
 	uint8_t start_marker;
 	uint8_t version;
 	uint8_t packet_type;
+	uint8_t flags;
 	uint16_t sequence_num;
 	uint16_t data_length;
-	uint8_t data[MAX_DATA_LEN];
+	uint16_t ack_num;//valid if flags & FRAME_FLAG_ACK
+	uint8_t data[MaxData];
 	uint16_t crc16;
 	uint8_t end_marker;
-}UartFrame;
+};
+
+typedef BasicFrame<MAX_DATA_LEN> UartFrame;
+
+//Wire layout checks, a bad MAX_DATA_LEN fails here instead of corrupting frames at runtime
+static_assert(FRAME_HEADER_SIZE == 3 + 2 * sizeof(uint16_t), "header: start, version, type, seq, len");
+static_assert(FRAME_TRAILER_SIZE == sizeof(uint16_t) + 1, "trailer: crc16, end");
+static_assert(MAX_DATA_LEN >= 8, "MAX_DATA_LEN must fit an ACK with its SACK payload and a fragment header");
+static_assert(MAX_FRAME_SIZE <= 0xFFFF, "len and wire sizes are 16-bit");
+static_assert(sizeof(UartFrame::data) == MAX_DATA_LEN, "UartFrame data area");
 
 class Protocol
 {
 private:
 	uint16_t sequence_counter;
 
+	bool build_frame(PacketType type, uint16_t seq_num, const uint8_t* data, uint16_t data_len, UartFrame* frame);
+
 protected:
 	PerformanceMonitor perf_monitor;
 
@@ -47,9 +91,30 @@ public:
 	Protocol();
 	virtual ~Protocol() = default;
 
-	//Frame creation & validation
-	bool create_frame(PacketType type, const uint8_t* data, uint16_t data_len, UartFrame* frame);
+	//Frame creation & validation, EnhancedProtocol extends create_frame (compression, SYN, FEC)
+	virtual bool create_frame(PacketType type, const uint8_t* data, uint16_t data_len, UartFrame* frame);
+	//ACK/NACK for seq_num, does not consume a sequence number
+	bool create_ack_frame(PacketType type, uint16_t seq_num, const uint8_t* data, uint16_t data_len, UartFrame* frame);
 	bool validate_frame(UartFrame* frame);
+	bool validate_frame(UartFrame* frame, uint16_t calculated_crc);//CRC already computed (e.g. while receiving)
+
+	//Wire encoding
+	static uint16_t calculate_frame_crc(const UartFrame* frame);
+	static bool frame_intact(const UartFrame* frame);//markers, length and CRC, without touching the statistics
+	static uint16_t header_size(const UartFrame* frame) { return FRAME_HEADER_SIZE + ((frame->flags & FRAME_FLAG_ACK) ? FRAME_ACK_FIELD_SIZE : 0); }
+	static uint16_t wire_size(const UartFrame* frame) { return header_size(frame) + frame->data_length + FRAME_TRAILER_SIZE; }
+	static uint16_t parse_wire_size(const uint8_t* header);//from the first FRAME_HEADER_SIZE bytes, 0 if invalid
+	static uint16_t parse_header_size(const uint8_t* header) { return FRAME_HEADER_SIZE + ((header[2] & FRAME_FLAG_ACK) ? FRAME_ACK_FIELD_SIZE : 0); }
+	static uint16_t encode_header(const UartFrame* frame, uint8_t* buffer);//returns header_size(frame)
+	static void encode_trailer(const UartFrame* frame, uint8_t* buffer);//FRAME_TRAILER_SIZE bytes
+	static void decode_header(const uint8_t* header, UartFrame* frame);//parse_header_size(header) bytes, data is left alone
+	static void decode_trailer(const uint8_t* trailer, UartFrame* frame);
+	static uint16_t encode_frame(const UartFrame* frame, uint8_t* buffer);//returns bytes written
+	static bool decode_frame(const uint8_t* buffer, uint16_t length, UartFrame* frame);//markers and length only, CRC is left to validate_frame
+	static bool is_data_frame(const UartFrame* frame)//sequenced and ACKed
+	{
+		return frame->packet_type == TYPE_DATA || frame->packet_type == TYPE_BATCH || frame->packet_type == TYPE_FRAGMENT;
+	}
 
 	//Reliable transmission
 	bool send_reliable(UartFrame* frame, HardwareSerial& serial);
@@ -62,6 +127,7 @@ public:
 	void print_frame_info(UartFrame* frame);
 	void print_statistics();
 	uint16_t get_next_sequence();
+	uint16_t peek_next_sequence() const { return sequence_counter; }//what the next create_frame() will use
 
 	//Error tracking
 	void record_crc_error() { perf_monitor.crc_error(); }//crc_errors++
@@ -69,7 +135,7 @@ public:
 	void record_retransmission() { perf_monitor.retransmission_occurred(); }//retransmissions++
 	void record_packet_lost(uint16_t seq) { perf_monitor.packet_lost(seq); }//lost_packets++
 	void start_packet_timing(uint16_t seq_num) { perf_monitor.start_latency_measurement(seq_num); }
-	void end_packet_timing(uint16_t seq_num) { perf_monitor.end_latency_measurement(seq_num); }
+	uint32_t end_packet_timing(uint16_t seq_num) { return perf_monitor.end_latency_measurement(seq_num); }
 };
 
 #endif
@@ -0,0 +1,182 @@
+#include "protocol_tasks.h"
+#include "logger.h"
+
+static_assert(COMPLETION_QUEUE_DEPTH >= MAX_ASYNC_SENDS, "every outstanding send needs room for its completion");
+
+ProtocolTasks::ProtocolTasks(EnhancedProtocol& owner) :
+	protocol(owner),
+	running(false),
+	rx_overruns(0),
+	inbound_deferred(0),
+	completions_dropped(0)
+#if defined(ARDUINO_ARCH_ESP32)
+	, rx_task(nullptr),
+	tx_task(nullptr),
+	tasks_running(0)
+#endif
+{
+}
+
+void ProtocolTasks::idle()
+{
+#if defined(ARDUINO_ARCH_ESP32)
+	vTaskDelay(1);//one tick, lets loop() and the idle task (watchdog) run
+#else
+	std::this_thread::yield();
+#endif
+}
+
+#if defined(ARDUINO_ARCH_ESP32)
+void ProtocolTasks::rx_task_main(void* context)
+{
+	ProtocolTasks* tasks = (ProtocolTasks*)context;
+	while (tasks->running.load(std::memory_order_relaxed))
+	{
+		if (!tasks->rx_step()) idle();
+	}
+	tasks->tasks_running.fetch_sub(1);
+	vTaskDelete(nullptr);
+}
+
+void ProtocolTasks::tx_task_main(void* context)
+{
+	ProtocolTasks* tasks = (ProtocolTasks*)context;
+	while (tasks->running.load(std::memory_order_relaxed))
+	{
+		if (!tasks->tx_step()) idle();
+	}
+	tasks->tasks_running.fetch_sub(1);
+	vTaskDelete(nullptr);
+}
+#endif
+
+bool ProtocolTasks::start()
+{
+	if (running.load() || !protocol.get_comm_interface()) return false;
+	running.store(true);
+
+#if defined(ARDUINO_ARCH_ESP32)
+	tasks_running.store(2);
+	if (xTaskCreatePinnedToCore(rx_task_main, "proto_rx", PROTOCOL_TASK_STACK, this, PROTOCOL_TASK_PRIORITY, &rx_task, PROTOCOL_TASK_CORE) != pdPASS)
+	{
+		LOG_ERROR("RX task could not be created");
+		tasks_running.store(0);
+		running.store(false);
+		return false;
+	}
+	if (xTaskCreatePinnedToCore(tx_task_main, "proto_tx", PROTOCOL_TASK_STACK, this, PROTOCOL_TASK_PRIORITY, &tx_task, PROTOCOL_TASK_CORE) != pdPASS)
+	{
+		LOG_ERROR("TX task could not be created");
+		tasks_running.store(1);
+		stop();
+		return false;
+	}
+#else
+	rx_thread = std::thread([this]() { while (running.load(std::memory_order_relaxed)) { if (!rx_step()) idle(); } });
+	tx_thread = std::thread([this]() { while (running.load(std::memory_order_relaxed)) { if (!tx_step()) idle(); } });
+#endif
+	return true;
+}
+
+void ProtocolTasks::stop()
+{
+	running.store(false);
+#if defined(ARDUINO_ARCH_ESP32)
+	while (tasks_running.load() > 0) delay(1);
+	rx_task = nullptr;
+	tx_task = nullptr;
+#else
+	if (rx_thread.joinable()) rx_thread.join();
+	if (tx_thread.joinable()) tx_thread.join();
+#endif
+}
+
+bool ProtocolTasks::send(const FrameHandle& frame)
+{
+	return frame && outbound.push(frame);
+}
+
+bool ProtocolTasks::send(PacketType type, const uint8_t* data, uint16_t length)
+{
+	if (length > MAX_DATA_LEN || outbound.full()) return false;
+
+	FrameHandle frame = frame_pool.acquire();
+	if (!frame) return false;
+	frame->packet_type = type;
+	frame->data_length = length;
+	if (length > 0) memcpy(frame->data, data, length);
+	return outbound.push(frame);
+}
+
+FrameHandle ProtocolTasks::receive()
+{
+	FrameHandle frame;
+	inbound.pop(frame);
+	return frame;
+}
+
+bool ProtocolTasks::poll_completion(SendCompletion& completion)
+{
+	return completions.pop(completion);
+}
+
+bool ProtocolTasks::rx_step()
+{
+	CommunicationInterface* link = protocol.get_comm_interface();
+	if (!link || !link->available()) return false;
+
+	FrameHandle frame = link->receive();
+	if (!frame) return true;//bytes consumed, frame not complete yet
+
+	//Validation stays here: it may reuse the CRC the interface computed while receiving
+	if (protocol.validate_received_frame(frame.get()) && !received.push(frame))
+	{
+		rx_overruns.fetch_add(1, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+void ProtocolTasks::send_complete(void* context, uint16_t seq_num, bool delivered)
+{
+	ProtocolTasks* tasks = (ProtocolTasks*)context;
+	SendCompletion completion = { seq_num, delivered };
+	if (!tasks->completions.push(completion))
+	{
+		tasks->completions_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+bool ProtocolTasks::tx_step()
+{
+	bool busy = false;
+	FrameHandle frame;
+
+	//Inbound first, so ACKs free send slots before new frames claim them
+	while (received.pop(frame))
+	{
+		busy = true;
+		protocol.process_frame(frame.get());
+		if (!Protocol::is_data_frame(frame.get())) continue;
+
+		//No room for the application: leave the frame unacknowledged, the peer resends it
+		if (inbound.full())
+		{
+			inbound_deferred.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		if (protocol.accept_data_frame(frame.get())) inbound.push(frame);
+		protocol.queue_ack(frame->sequence_num);
+	}
+
+	while (protocol.can_send_async(protocol.peek_next_sequence()) && outbound.pop(frame))
+	{
+		busy = true;
+		UartFrame* out = frame.get();
+		if (!protocol.create_frame((PacketType)out->packet_type, out->data, out->data_length, out) || !protocol.send_async(frame, send_complete, this))
+		{
+			send_complete(this, out->sequence_num, false);
+		}
+	}
+
+	return protocol.service_timers() || busy;
+}
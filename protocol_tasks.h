@@ -0,0 +1,97 @@
+#pragma once
+#ifndef PROTOCOL_TASKS_H
+#define PROTOCOL_TASKS_H
+
+//Optional threading mode: an RX task owns CommunicationInterface::receive() and frame validation,
+//a TX task owns every other piece of protocol state (sequence numbers, send_async() slots, receive
+//window, ACKs, retransmissions). The application talks to them through SPSC queues only:
+//
+//  application --outbound--> TX --link--> peer
+//  peer --link--> RX --received--> TX --inbound / completions--> application
+//
+//FreeRTOS tasks on the ESP32 (the core loop() does not run on), std::thread on the host.
+//While the tasks run, the application must not call the EnhancedProtocol directly except to read
+//statistics, and must not install a frame handler: accepted DATA arrives through receive().
+
+#include <stdint.h>
+#include <atomic>
+#include "enhanced_protocol.h"
+#include "spsc_queue.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <thread>
+#endif
+
+#ifndef TASK_QUEUE_DEPTH
+#define TASK_QUEUE_DEPTH 4//frames per queue, power of two; every queued frame holds a pool slot
+#endif
+#define COMPLETION_QUEUE_DEPTH 16//power of two, at least MAX_ASYNC_SENDS
+#define PROTOCOL_TASK_STACK 4096
+#define PROTOCOL_TASK_PRIORITY 5//above loop() (1), so a slow display never delays an ACK
+#define PROTOCOL_TASK_CORE 0//loop() runs on core 1
+
+struct SendCompletion
+{
+	uint16_t seq_num;
+	bool delivered;
+};
+
+class ProtocolTasks
+{
+private:
+	EnhancedProtocol& protocol;
+
+	SPSCQueue<FrameHandle, TASK_QUEUE_DEPTH> outbound;//application -> TX, numbered by the TX task
+	SPSCQueue<FrameHandle, TASK_QUEUE_DEPTH> received;//RX -> TX, validated frames
+	SPSCQueue<FrameHandle, TASK_QUEUE_DEPTH> inbound;//TX -> application, accepted DATA
+	SPSCQueue<SendCompletion, COMPLETION_QUEUE_DEPTH> completions;//TX -> application
+
+	std::atomic<bool> running;
+
+	//Statistics
+	std::atomic<uint32_t> rx_overruns;//validated frames dropped, TX task behind
+	std::atomic<uint32_t> inbound_deferred;//DATA left unacknowledged because the application is behind
+	std::atomic<uint32_t> completions_dropped;
+
+#if defined(ARDUINO_ARCH_ESP32)
+	TaskHandle_t rx_task;
+	TaskHandle_t tx_task;
+	std::atomic<uint8_t> tasks_running;
+	static void rx_task_main(void* context);
+	static void tx_task_main(void* context);
+#else
+	std::thread rx_thread;
+	std::thread tx_thread;
+#endif
+
+	static void send_complete(void* context, uint16_t seq_num, bool delivered);
+	static void idle();
+
+public:
+	ProtocolTasks(EnhancedProtocol& owner);
+	~ProtocolTasks() { stop(); }
+
+	bool start();
+	void stop();//returns once both tasks have exited
+	bool is_running() const { return running.load(std::memory_order_relaxed); }
+
+	//Application side, one thread. send() takes a pooled frame with packet_type, data and
+	//data_length filled in; the TX task gives it a sequence number and CRC when it goes out.
+	bool send(const FrameHandle& frame);//false if the outbound queue is full
+	bool send(PacketType type, const uint8_t* data, uint16_t length);//copies into a pool frame
+	FrameHandle receive();//next accepted DATA frame (DATA, BATCH or FRAGMENT), empty if none
+	bool poll_completion(SendCompletion& completion);
+
+	//One pass of each task; start() runs them in loops, or call them by hand from a single thread
+	bool rx_step();
+	bool tx_step();
+
+	uint32_t get_rx_overruns() const { return rx_overruns.load(std::memory_order_relaxed); }
+	uint32_t get_inbound_deferred() const { return inbound_deferred.load(std::memory_order_relaxed); }
+	uint32_t get_completions_dropped() const { return completions_dropped.load(std::memory_order_relaxed); }
+};
+
+#endif // !PROTOCOL_TASKS_H
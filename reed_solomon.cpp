@@ -0,0 +1,242 @@
+#include "reed_solomon.h"
+#include <string.h>
+
+static_assert(RS_PARITY_BYTES >= 2 && RS_PARITY_BYTES <= 16 && RS_PARITY_BYTES % 2 == 0, "RS_PARITY_BYTES must be even, 2..16");
+
+//========================== Compile-time table generation (C++11 constexpr) ==========================
+namespace
+{
+	constexpr uint8_t PRIMITIVE_LOW = 0x1D;//x^8 + x^4 + x^3 + x^2 + 1, alpha = 2
+
+	constexpr uint8_t times_alpha(uint8_t a)
+	{
+		return (a & 0x80) ? (uint8_t)((a << 1) ^ PRIMITIVE_LOW) : (uint8_t)(a << 1);
+	}
+
+	//Shift-and-add multiply, compile time only: at run time the log / exp tables do it
+	constexpr uint8_t slow_mul(uint8_t a, uint8_t b)
+	{
+		return b == 0 ? 0 : (uint8_t)(((b & 1) ? a : 0) ^ slow_mul(times_alpha(a), (uint8_t)(b >> 1)));
+	}
+
+	constexpr uint8_t square(uint8_t a) { return slow_mul(a, a); }
+
+	constexpr uint8_t alpha_pow(uint16_t e)
+	{
+		return e == 0 ? 1 : slow_mul(square(alpha_pow((uint16_t)(e >> 1))), (e & 1) ? 2 : 1);
+	}
+
+	//Walks alpha^e up from e = 0 until it hits value; log(0) is never looked up
+	constexpr uint8_t find_log(uint8_t value, uint16_t e, uint8_t power)
+	{
+		return e >= 255 ? 0 : power == value ? (uint8_t)e : find_log(value, (uint16_t)(e + 1), times_alpha(power));
+	}
+
+	//Coefficient of x^k in (x - alpha^0)(x - alpha^1)...(x - alpha^(n-1))
+	constexpr uint8_t generator_coefficient(uint8_t n, uint8_t k)
+	{
+		return n == 0 ? (k == 0 ? 1 : 0) :
+			(uint8_t)((k > 0 ? generator_coefficient(n - 1, k - 1) : 0) ^ slow_mul(generator_coefficient(n - 1, k), alpha_pow(n - 1)));
+	}
+
+	template<uint16_t... I> struct IndexList {};
+	template<uint16_t N, uint16_t... I> struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+	template<uint16_t... I> struct MakeIndexList<0, I...> { typedef IndexList<I...> type; };
+
+	//exp[] runs to 510 so a product of two logs never needs a % 255
+	template<typename Indices> struct ExpTable;
+	template<uint16_t... I> struct ExpTable<IndexList<I...> >
+	{
+		static constexpr uint8_t values[sizeof...(I)] = { alpha_pow(I % 255)... };
+	};
+	template<uint16_t... I> constexpr uint8_t ExpTable<IndexList<I...> >::values[sizeof...(I)];
+
+	template<typename Indices> struct LogTable;
+	template<uint16_t... I> struct LogTable<IndexList<I...> >
+	{
+		static constexpr uint8_t values[sizeof...(I)] = { find_log((uint8_t)I, 0, 1)... };
+	};
+	template<uint16_t... I> constexpr uint8_t LogTable<IndexList<I...> >::values[sizeof...(I)];
+
+	//Generator without its leading 1, highest degree first: the LFSR taps
+	template<typename Indices> struct GeneratorTable;
+	template<uint16_t... I> struct GeneratorTable<IndexList<I...> >
+	{
+		static constexpr uint8_t values[sizeof...(I)] = { generator_coefficient(RS_PARITY_BYTES, (uint8_t)(RS_PARITY_BYTES - 1 - I))... };
+	};
+	template<uint16_t... I> constexpr uint8_t GeneratorTable<IndexList<I...> >::values[sizeof...(I)];
+
+	typedef ExpTable<MakeIndexList<510>::type> Exp;
+	typedef LogTable<MakeIndexList<256>::type> Log;
+	typedef GeneratorTable<MakeIndexList<RS_PARITY_BYTES>::type> Generator;
+
+	static_assert(Exp::values[8] == 0x1D && Exp::values[255] == 1, "GF(256) exp table mismatch");
+	static_assert(Log::values[2] == 1 && Log::values[0x1D] == 8, "GF(256) log table mismatch");
+	static_assert(generator_coefficient(2, 2) == 1 && generator_coefficient(2, 1) == 3 && generator_coefficient(2, 0) == 2,
+		"(x - 1)(x - 2) must be x^2 + 3x + 2");
+
+	inline uint8_t mul(uint8_t a, uint8_t b)
+	{
+		return (a && b) ? Exp::values[Log::values[a] + Log::values[b]] : 0;
+	}
+
+	inline uint8_t div(uint8_t a, uint8_t b)
+	{
+		return a ? Exp::values[Log::values[a] + 255 - Log::values[b]] : 0;
+	}
+
+	//a * alpha^e, e in 0..254
+	inline uint8_t mul_alpha(uint8_t a, uint8_t e)
+	{
+		return a ? Exp::values[Log::values[a] + e] : 0;
+	}
+
+	//p[0] + p[1] x + ... at x = alpha^e
+	inline uint8_t evaluate(const uint8_t* p, uint8_t degree, uint8_t e)
+	{
+		uint8_t value = p[degree];
+		for (int16_t i = degree - 1; i >= 0; i--)
+		{
+			value = (uint8_t)(mul_alpha(value, e) ^ p[i]);
+		}
+		return value;
+	}
+}
+
+void ReedSolomon::begin(uint8_t* parity)
+{
+	memset(parity, 0, RS_PARITY_BYTES);
+}
+
+void ReedSolomon::update(uint8_t* parity, const uint8_t* data, uint16_t length)
+{
+	//Division by the generator, one message byte per step; parity[0] is the highest degree
+	for (uint16_t i = 0; i < length; i++)
+	{
+		uint8_t feedback = data[i] ^ parity[0];
+		if (feedback == 0)
+		{
+			memmove(parity, parity + 1, RS_PARITY_BYTES - 1);
+			parity[RS_PARITY_BYTES - 1] = 0;
+			continue;
+		}
+
+		uint8_t log_feedback = Log::values[feedback];
+		for (uint8_t j = 0; j < RS_PARITY_BYTES - 1; j++)
+		{
+			uint8_t tap = Generator::values[j];
+			parity[j] = parity[j + 1] ^ (tap ? Exp::values[log_feedback + Log::values[tap]] : 0);
+		}
+		uint8_t tap = Generator::values[RS_PARITY_BYTES - 1];
+		parity[RS_PARITY_BYTES - 1] = tap ? Exp::values[log_feedback + Log::values[tap]] : 0;
+	}
+}
+
+void ReedSolomon::encode(const uint8_t* message, uint16_t length, uint8_t* parity)
+{
+	begin(parity);
+	update(parity, message, length);
+}
+
+int16_t ReedSolomon::decode(uint8_t* codeword, uint16_t length)
+{
+	if (length <= RS_PARITY_BYTES || length > RS_MAX_CODEWORD) return -1;
+
+	//Syndromes S_j = c(alpha^j); codeword[0] is the coefficient of x^(length-1)
+	uint8_t syndromes[RS_PARITY_BYTES];
+	bool intact = true;
+	for (uint8_t j = 0; j < RS_PARITY_BYTES; j++)
+	{
+		uint8_t s = 0;
+		for (uint16_t k = 0; k < length; k++)
+		{
+			s = (uint8_t)(mul_alpha(s, j) ^ codeword[k]);
+		}
+		syndromes[j] = s;
+		if (s) intact = false;
+	}
+	if (intact) return 0;
+
+	//Berlekamp-Massey: error locator lambda(x) = product of (1 - X_i x), lowest degree first
+	uint8_t lambda[RS_PARITY_BYTES + 1] = { 1 };
+	uint8_t previous[RS_PARITY_BYTES + 1] = { 1 };
+	uint8_t scratch[RS_PARITY_BYTES + 1];
+	uint8_t errors = 0;
+	uint8_t shift = 1;
+	uint8_t last_discrepancy = 1;
+	for (uint8_t n = 0; n < RS_PARITY_BYTES; n++)
+	{
+		uint8_t discrepancy = syndromes[n];
+		for (uint8_t i = 1; i <= errors; i++)
+		{
+			discrepancy ^= mul(lambda[i], syndromes[n - i]);
+		}
+		if (discrepancy == 0)
+		{
+			shift++;
+			continue;
+		}
+
+		uint8_t scale = div(discrepancy, last_discrepancy);
+		bool grow = 2 * errors <= n;
+		if (grow) memcpy(scratch, lambda, sizeof(lambda));
+		for (uint8_t i = shift; i <= RS_PARITY_BYTES; i++)
+		{
+			lambda[i] ^= mul(scale, previous[i - shift]);
+		}
+		if (grow)
+		{
+			errors = n + 1 - errors;
+			memcpy(previous, scratch, sizeof(previous));
+			last_discrepancy = discrepancy;
+			shift = 1;
+		}
+		else
+		{
+			shift++;
+		}
+	}
+	if (errors > RS_PARITY_BYTES / 2) return -1;
+
+	//Chien search: byte k (degree p = length-1-k) is wrong if lambda(alpha^-p) == 0
+	uint16_t positions[RS_PARITY_BYTES / 2];
+	uint8_t found = 0;
+	for (uint16_t k = 0; k < length; k++)
+	{
+		uint8_t p = (uint8_t)(length - 1 - k);
+		if (evaluate(lambda, errors, (uint8_t)((255 - p) % 255)) != 0) continue;
+		if (found == errors) return -1;
+		positions[found++] = k;
+	}
+	if (found != errors) return -1;
+
+	//Forney: omega(x) = S(x) lambda(x) mod x^RS_PARITY_BYTES, e = X omega(X^-1) / lambda'(X^-1)
+	uint8_t omega[RS_PARITY_BYTES];
+	for (uint8_t i = 0; i < RS_PARITY_BYTES; i++)
+	{
+		uint8_t value = 0;
+		for (uint8_t j = 0; j <= i && j <= errors; j++)
+		{
+			value ^= mul(syndromes[i - j], lambda[j]);
+		}
+		omega[i] = value;
+	}
+
+	//The formal derivative keeps the odd terms only
+	uint8_t derivative[RS_PARITY_BYTES] = { 0 };
+	for (uint8_t i = 1; i <= errors; i += 2)
+	{
+		derivative[i - 1] = lambda[i];
+	}
+
+	for (uint8_t i = 0; i < found; i++)
+	{
+		uint8_t p = (uint8_t)(length - 1 - positions[i]);
+		uint8_t inverse = (uint8_t)((255 - p) % 255);
+		uint8_t denominator = evaluate(derivative, errors ? errors - 1 : 0, inverse);
+		if (denominator == 0) return -1;
+		uint8_t magnitude = mul_alpha(div(evaluate(omega, RS_PARITY_BYTES - 1, inverse), denominator), p);
+		codeword[positions[i]] ^= magnitude;
+	}
+	return found;
+}
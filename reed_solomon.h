@@ -0,0 +1,30 @@
+#pragma once
+#ifndef REED_SOLOMON_H
+#define REED_SOLOMON_H
+
+//Systematic Reed-Solomon over GF(256) (polynomial 0x11D, generator roots alpha^0..alpha^(RS_PARITY_BYTES-1)).
+//RS_PARITY_BYTES parity bytes after a message repair up to RS_PARITY_BYTES / 2 corrupted bytes anywhere in
+//message or parity. Codes are shortened: message + parity up to RS_MAX_CODEWORD bytes. The field and generator
+//tables are built at compile time like the CRC16 tables; decoding only runs for codewords that need it.
+
+#include <stdint.h>
+
+#ifndef RS_PARITY_BYTES
+#define RS_PARITY_BYTES 8//corrects 4 bytes
+#endif
+#define RS_MAX_CODEWORD 255
+
+class ReedSolomon
+{
+public:
+	//Streaming encoder like CRC16: begin(parity); update(parity, ...) over the whole message; parity is then final
+	static void begin(uint8_t* parity);
+	static void update(uint8_t* parity, const uint8_t* data, uint16_t length);
+	static void encode(const uint8_t* message, uint16_t length, uint8_t* parity);
+
+	//codeword = message followed by its parity, corrected in place.
+	//Returns the bytes corrected (0 = intact), -1 if it holds more errors than the parity can repair.
+	static int16_t decode(uint8_t* codeword, uint16_t length);
+};
+
+#endif // !REED_SOLOMON_H
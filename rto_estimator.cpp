@@ -0,0 +1,70 @@
+#include "rto_estimator.h"
+
+#define RTO_MAX_BACKOFF 6//64x, RTO_MAX_US caps it anyway
+
+RtoEstimator::RtoEstimator() : min_us(RTO_MIN_US), max_us(RTO_MAX_US)
+{
+	reset();
+}
+
+void RtoEstimator::reset()
+{
+	srtt_x8 = 0;
+	rttvar_x4 = 0;
+	rto_us = clamp(RTO_INITIAL_US);
+	backoff_shift = 0;
+	has_sample = false;
+	samples = 0;
+	backoffs = 0;
+}
+
+void RtoEstimator::set_bounds(uint32_t minimum_us, uint32_t maximum_us)
+{
+	min_us = minimum_us;
+	max_us = maximum_us < minimum_us ? minimum_us : maximum_us;
+	rto_us = clamp(rto_us);
+}
+
+uint32_t RtoEstimator::clamp(uint32_t value_us) const
+{
+	if (value_us < min_us) return min_us;
+	if (value_us > max_us) return max_us;
+	return value_us;
+}
+
+void RtoEstimator::sample(uint32_t rtt_us)
+{
+	if (!has_sample)
+	{
+		//RFC 6298 2.2: SRTT = R, RTTVAR = R/2
+		srtt_x8 = rtt_us << 3;
+		rttvar_x4 = (rtt_us >> 1) << 2;
+		has_sample = true;
+	}
+	else
+	{
+		//RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R
+		int32_t error = (int32_t)rtt_us - (int32_t)(srtt_x8 >> 3);
+		srtt_x8 += error;
+		if (error < 0) error = -error;
+		rttvar_x4 += error - (int32_t)(rttvar_x4 >> 2);
+	}
+
+	//RTO = SRTT + max(G, 4 * RTTVAR)
+	uint32_t variance = rttvar_x4 < RTO_CLOCK_GRANULARITY_US ? RTO_CLOCK_GRANULARITY_US : rttvar_x4;
+	rto_us = clamp((srtt_x8 >> 3) + variance);
+	backoff_shift = 0;
+	samples++;
+}
+
+void RtoEstimator::backoff()
+{
+	if (backoff_shift < RTO_MAX_BACKOFF) backoff_shift++;
+	backoffs++;
+}
+
+uint32_t RtoEstimator::get_rto_us() const
+{
+	uint64_t backed_off = (uint64_t)rto_us << backoff_shift;
+	return backed_off > max_us ? max_us : (uint32_t)backed_off;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef RTO_ESTIMATOR_H
+#define RTO_ESTIMATOR_H
+
+//Retransmission timeout from measured round trips (Jacobson/Karels, RFC 6298), in microseconds.
+//SRTT and RTTVAR are kept scaled by 8 and 4 so the 1/8 and 1/4 gains stay in integer arithmetic.
+//Karn's rule is the caller's job: only feed samples of frames that were sent once.
+
+#include <stdint.h>
+
+#ifndef RTO_INITIAL_US
+#define RTO_INITIAL_US 1000000UL//before the first sample (RFC 6298: 1 s)
+#endif
+#ifndef RTO_MIN_US
+#define RTO_MIN_US 2000UL//covers the 1 ms ACK polling granularity
+#endif
+#ifndef RTO_MAX_US
+#define RTO_MAX_US 4000000UL
+#endif
+#define RTO_CLOCK_GRANULARITY_US 1000//G: ACKs are polled every millisecond
+
+class RtoEstimator
+{
+private:
+	uint32_t srtt_x8;
+	uint32_t rttvar_x4;
+	uint32_t rto_us;//without backoff
+	uint8_t backoff_shift;
+	bool has_sample;
+
+	uint32_t min_us;
+	uint32_t max_us;
+	uint32_t samples;
+	uint32_t backoffs;
+
+	uint32_t clamp(uint32_t value_us) const;
+
+public:
+	RtoEstimator();
+
+	void sample(uint32_t rtt_us);//new measurement, clears the backoff
+	void backoff();//timeout: double the RTO until the next valid sample
+	void reset();
+	void set_bounds(uint32_t minimum_us, uint32_t maximum_us);
+
+	uint32_t get_rto_us() const;//current timeout, backoff applied
+	uint32_t get_srtt_us() const { return srtt_x8 >> 3; }
+	uint32_t get_rttvar_us() const { return rttvar_x4 >> 2; }
+	uint8_t get_backoff() const { return backoff_shift; }
+	uint32_t get_samples() const { return samples; }
+	uint32_t get_backoffs() const { return backoffs; }
+};
+
+#endif // !RTO_ESTIMATOR_H
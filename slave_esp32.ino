@@ -1,6 +1,8 @@
 #include "enhanced_protocol.h"
 #include "uart_interface.h"
 #include "spi_interface.h"
+#include "compression_dictionary.h"
+#include "logger.h"
 #include <SPI.h>
 #include <Wire.h>
 #include <LiquidCrystal_I2C.h>
@@ -21,11 +23,18 @@ HardwareSerial SerialPort(2);
 #define SPI_SCK 18
 #define SPI_CS 5
 
+//Slave sends no DATA of its own yet, so nothing could carry a delayed ACK
+#define DELAYED_ACK_MS 0
+#define REASSEMBLY_BUFFER_SIZE MAX_MESSAGE_SIZE//largest fragmented message accepted, anything the master can send
+#define LINK_BONDING false//Must match the master: DATA arrives over UART and SPI together and is put back in order
+#define UART_FEC false//Reed-Solomon parity on our ACKs over UART; the master's FEC frames are repaired either way
+
 EnhancedProtocol protocol(false);//Slave no need auto_switch
 UARTInterface uart_interface(&SerialPort, 115200);
 SPIInterface spi_interface(false, SPI_CS);//Slave SPI
 
 static unsigned long last_data_time = 0;
+static uint8_t reassembly_buffer[REASSEMBLY_BUFFER_SIZE];
 
 void display_on_lcd(const String& line1, const String& line2 = "")//Hàm hiển thị cho màn lcd
 {
@@ -84,15 +93,32 @@ void display_received_data(const String& data, uint16_t seq_num)
     last_data_time = millis();
 }
 
+void handle_message(const uint8_t* data, uint8_t length)//Một message trong batch frame
+{
+    String message = "";
+    for(int i = 0; i < length; i++)
+    {
+        message += (char)data[i];
+    }
+    Serial.print("Message: ");
+    Serial.println(message);
+}
+
+void handle_large_message(uint8_t message_id, const uint8_t* data, uint32_t length)//Message ghép từ các fragment
+{
+    Serial.print("Message ");
+    Serial.print(message_id);
+    Serial.print(" reassembled: ");
+    Serial.print(length);
+    Serial.println(" bytes");
+    display_on_lcd("MSG#" + String(message_id), String(length) + " bytes");
+}
+
 void send_ack(uint16_t seq_num)
 {
-    UartFrame ack_frame;
-    uint8_t empty_data[1] = {0};
-    
-    if(protocol.create_frame(TYPE_ACK, empty_data, 0, &ack_frame))
+    //ACK carries cumulative ack + SACK bitmap for a windowed sender
+    if(protocol.send_ack(seq_num))
     {
-        ack_frame.sequence_num = seq_num;
-        protocol.get_comm_interface()->send(&ack_frame);
 
         Serial.print("Sent ACK for frame ");
         Serial.println(seq_num);
@@ -104,13 +130,8 @@ void send_ack(uint16_t seq_num)
 
 void send_nack(uint16_t seq_num)
 {
-    UartFrame nack_frame;
-    uint8_t empty_data[1] = {0};
-    
-    if(protocol.create_frame(TYPE_NACK, empty_data, 0, &nack_frame))
+    if(protocol.send_nack(seq_num))
     {
-        nack_frame.sequence_num = seq_num;
-        protocol.get_comm_interface()->send(&nack_frame);
 
         Serial.print("Sent NACK for frame ");
         Serial.println(seq_num);
@@ -120,39 +141,102 @@ void send_nack(uint16_t seq_num)
 
 }
 
-void process_received_frame(UartFrame* frame)
+void deliver_data(UartFrame* frame)
+{
+    String received_data = "";
+    String mode_info = protocol.get_current_mode() == MODE_UART ? "UART" : "SPI";
+
+    for(int i = 0; i < frame->data_length; i++)
+    {
+        received_data += (char)frame->data[i];
+    }
+    Serial.print("Data via ");
+    Serial.print(protocol.is_bonding() ? "UART+SPI" : mode_info);
+    Serial.print(": ");
+    Serial.println(received_data);
+
+    display_received_data(received_data, frame->sequence_num);
+}
+
+void deliver_batch(UartFrame* frame)
 {
+    uint16_t messages = protocol.deliver_batch(frame);//handle_message per record
+    Serial.print("Batch of ");
+    Serial.print(messages);
+    Serial.println(" messages");
+    display_on_lcd("RX#" + String(frame->sequence_num), String(messages) + " messages");
+}
+
+void process_received_frame(const FrameHandle& handle)
+{
+    UartFrame* frame = handle.get();
     Serial.print("<<< SLAVE RECEIVED [");
     Serial.print(protocol.get_current_mode() == MODE_UART ? "UART" : "SPI");
     Serial.print("]: ");
     protocol.print_frame_info(frame);
     Serial.println();
 
-    if(protocol.validate_frame(frame))
+    if(protocol.validate_received_frame(frame))
     {
         switch(frame->packet_type)
         {
             case TYPE_DATA:
             {
-                String received_data = "";
-                String mode_info = protocol.get_current_mode() == MODE_UART ? "UART" : "SPI";
-                
-                for(int i = 0; i < frame->data_length; i++)
+                if(!protocol.accept_data_frame(frame))
                 {
-                    received_data += (char)frame->data[i];
+                    //Our ACK was lost, the sender retransmitted
+                    Serial.print("Duplicate frame, re-sending ACK for seq: ");
+                    Serial.println(frame->sequence_num);
+                    send_ack(frame->sequence_num);
+                    break;
                 }
-                Serial.print("Data via ");
-                Serial.print(mode_info);
-                Serial.print(": ");
-                Serial.println(received_data);
 
-                display_received_data(received_data, frame->sequence_num);
+                Serial.print("ACK for seq: ");
+                Serial.println(frame->sequence_num);
+                protocol.queue_ack(frame->sequence_num);//Immediate unless DELAYED_ACK_MS > 0
 
-                Serial.print("Sending ACK for seq: ");
+                //Bonded, a frame that overtook an earlier one waits for it, receive_frames() delivers it later
+                if(protocol.is_bonding() && protocol.hold_in_order(handle))
+                {
+                    break;
+                }
+                deliver_data(frame);
+                break;
+            }
+            case TYPE_BATCH:
+            {
+                if(!protocol.accept_data_frame(frame))
+                {
+                    send_ack(frame->sequence_num);
+                    break;
+                }
+                Serial.print("Batch, ACK for seq: ");
                 Serial.println(frame->sequence_num);
-                send_ack(frame->sequence_num);
+                last_data_time = millis();
+                protocol.queue_ack(frame->sequence_num);
+                if(protocol.is_bonding() && protocol.hold_in_order(handle))
+                {
+                    break;
+                }
+                deliver_batch(frame);
                 break;
             }
+            case TYPE_FRAGMENT:
+                if(!protocol.can_reassemble(frame))
+                {
+                    //Malformed or larger than the reassembly buffer: no ACK, the master's send_fragmented() fails
+                    Serial.print("Fragment rejected, not ACKed, seq: ");
+                    Serial.println(frame->sequence_num);
+                    break;
+                }
+                protocol.queue_ack(frame->sequence_num);
+                last_data_time = millis();
+                if(!protocol.accept_data_frame(frame) || (protocol.is_bonding() && protocol.hold_in_order(handle)))
+                {
+                    break;
+                }
+                protocol.deliver_fragment(frame);//handle_large_message once the last piece is in
+                break;
             case TYPE_ACK:
                 Serial.println("ACK processed - THIS SHOULD NOT HAPPEN ON SLAVE");
                 break;
@@ -161,10 +245,14 @@ void process_received_frame(UartFrame* frame)
                 break;
             case TYPE_PING:
                 Serial.println("PING received");
+                protocol.process_frame(frame);//Compression probe: answered with our dictionary id
                 break;
             case TYPE_PONG:
                 Serial.println("PONG received");
                 break;
+            case TYPE_SWITCH:
+                protocol.process_frame(frame);//Master moves the link, we answer and follow
+                break;
         }
     }
     else
@@ -191,10 +279,21 @@ void display_detailed_mode()
 
 void receive_frames()
 {
-    UartFrame frame;
-    if(protocol.get_comm_interface()->receive(&frame))
+    FrameHandle frame = protocol.receive_frame();//pooled, returned when it goes out of scope; reads both links during a handover
+    if(frame)
+    {
+        process_received_frame(frame);
+    }
+
+    //Frames held back by the reorder buffer, now in sequence
+    for(FrameHandle next = protocol.next_in_order(); next; next = protocol.next_in_order())
     {
-        process_received_frame(&frame);
+        switch(next->packet_type)
+        {
+            case TYPE_DATA: deliver_data(next.get()); break;
+            case TYPE_BATCH: deliver_batch(next.get()); break;
+            case TYPE_FRAGMENT: protocol.deliver_fragment(next.get()); break;
+        }
     }
 }
 
@@ -210,8 +309,7 @@ void handle_mode_switch()
         Serial.print("Communication mode changed to: ");
         Serial.println(current_mode == MODE_UART ? "UART" : "SPI");
 
-        display_on_lcd("Mode Changed", current_mode == MODE_UART ? "UART" : "SPI");
-        delay(1000);
+        display_on_lcd("Mode Changed", current_mode == MODE_UART ? "UART" : "SPI");//no delay here, the old link is still being drained
 
         last_mode = current_mode;
     }
@@ -233,9 +331,23 @@ void setup()
     //Initial SPI
     SPI.begin(SPI_SCK, SPI_MISO, SPI_MOSI, SPI_CS);
 
-    //Set default interface(UART)
+    //Set default interface(UART), the master may hand over to the other one
     protocol.set_communication_interface(&spi_interface);
+    protocol.add_interface(&uart_interface);
+    protocol.set_delayed_ack(DELAYED_ACK_MS);
+    protocol.set_message_handler(handle_message);
+    protocol.set_reassembly_buffer(reassembly_buffer, sizeof(reassembly_buffer), handle_large_message);
+    protocol.set_compression_dictionary((const uint8_t*)TELEMETRY_DICTIONARY, sizeof(TELEMETRY_DICTIONARY) - 1);//must match the master's
     uart_interface.begin();
+    if(UART_FEC)
+    {
+        protocol.set_fec(MODE_UART, true);
+    }
+    if(LINK_BONDING)
+    {
+        uart_interface.set_tx_flush(false);//ACKs on UART must not hold up the SPI link
+        protocol.set_bonding(true);
+    }
 
     //Khởi tạo cấu hình cho màn lcd
     lcd.init();
@@ -273,6 +385,8 @@ void loop()
 
     //Nhận và xử lí frame
     receive_frames();
+    protocol.service_timers();//Delayed ACKs and handover timeouts
+    logger.drain(8);//Format deferred log records in idle time
 
     //Mode changing check every 2s
     handle_mode_switch();
@@ -295,6 +409,11 @@ void loop()
     if(millis() - last_stats_display > 20000)
     {
         protocol.print_statistics();
+        frame_pool.print_statistics();
+        if(protocol.is_bonding())
+        {
+            protocol.print_link_statistics();
+        }
         last_stats_display = millis();
     }
 
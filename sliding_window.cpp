@@ -0,0 +1,217 @@
+#include "sliding_window.h"
+
+void encode_sack(uint8_t* buffer, uint16_t cumulative_ack, uint32_t bitmap)
+{
+	buffer[0] = (uint8_t)(cumulative_ack & 0xFF);
+	buffer[1] = (uint8_t)(cumulative_ack >> 8);
+	buffer[2] = (uint8_t)(bitmap & 0xFF);
+	buffer[3] = (uint8_t)(bitmap >> 8);
+	buffer[4] = (uint8_t)(bitmap >> 16);
+	buffer[5] = (uint8_t)(bitmap >> 24);
+}
+
+bool ack_covers(const UartFrame* ack, uint16_t seq_num)
+{
+	if (!ack) return false;
+
+	//Cumulative ack piggybacked on any frame
+	if (ack->flags & FRAME_FLAG_ACK)
+	{
+		int16_t offset = seq_diff(seq_num, ack->ack_num);
+		if (offset <= 0 && offset > -RX_WINDOW_SPAN) return true;
+	}
+
+	if (ack->packet_type != TYPE_ACK) return false;
+	if (ack->sequence_num == seq_num) return true;
+	if (ack->data_length < SACK_PAYLOAD_SIZE) return false;
+
+	uint16_t cumulative_ack = ack->data[0] | ((uint16_t)ack->data[1] << 8);
+	uint32_t bitmap = ack->data[2] | ((uint32_t)ack->data[3] << 8) | ((uint32_t)ack->data[4] << 16) | ((uint32_t)ack->data[5] << 24);
+
+	int16_t offset = seq_diff(seq_num, cumulative_ack);
+	if (offset <= 0) return offset > -RX_WINDOW_SPAN;//already inside the cumulative range
+	if (offset > RX_WINDOW_SPAN) return false;
+	return (bitmap >> (offset - 1)) & 1;
+}
+
+ReceiveWindow::ReceiveWindow()
+{
+	reset();
+}
+
+void ReceiveWindow::reset()
+{
+	synced = false;
+	anchored = false;
+	syn_seen = false;
+	stream_start = 0;
+	next_expected = 0;
+	received_bitmap = 0;
+}
+
+void ReceiveWindow::restart(uint16_t seq_num, bool syn)
+{
+	synced = true;
+	anchored = syn;
+	syn_seen = syn;
+	stream_start = seq_num;
+	next_expected = seq_num;
+	received_bitmap = 0;
+}
+
+bool ReceiveWindow::move_back(uint16_t seq_num)
+{
+	uint16_t shift = next_expected - seq_num;
+	if (shift >= RX_WINDOW_SPAN) return false;
+
+	//[stream_start, next_expected) was all received, the gap before it was not
+	uint32_t bitmap = received_bitmap << shift;
+	for (uint16_t i = stream_start - seq_num; i < shift; i++)
+	{
+		bitmap |= (uint32_t)1 << i;
+	}
+	received_bitmap = bitmap;
+	next_expected = seq_num;
+	stream_start = seq_num;
+	return true;
+}
+
+bool ReceiveWindow::accept(uint16_t seq_num, bool syn)
+{
+	int16_t offset = seq_diff(seq_num, next_expected);
+	if (!synced || offset < -RX_WINDOW_SPAN)
+	{
+		restart(seq_num, syn);
+	}
+	else if (syn && !(syn_seen && seq_num == stream_start))
+	{
+		//Start of a stream we have not seen: the one whose later frames got here first, or a restarted sender
+		if (anchored || !seq_before(seq_num, stream_start) || !move_back(seq_num)) restart(seq_num, true);
+		anchored = true;
+		syn_seen = true;
+	}
+	else if (!anchored && seq_before(seq_num, stream_start))
+	{
+		//Older than anything seen yet, the start is still unknown
+		if (!move_back(seq_num)) restart(seq_num, false);
+	}
+
+	offset = seq_diff(seq_num, next_expected);
+	if (offset < 0) return false;//already delivered
+
+	if (offset >= RX_WINDOW_SPAN)
+	{
+		//Sender gave up on the oldest frames, slide forward so seq_num fits
+		uint16_t shift = offset - (RX_WINDOW_SPAN - 1);
+		received_bitmap = shift >= 32 ? 0 : (received_bitmap >> shift);
+		next_expected += shift;
+		offset = RX_WINDOW_SPAN - 1;
+	}
+
+	uint32_t bit = (uint32_t)1 << offset;
+	if (received_bitmap & bit) return false;//duplicate of an out-of-order frame
+	received_bitmap |= bit;
+
+	//Advance over the in-order run
+	while (received_bitmap & 1)
+	{
+		received_bitmap >>= 1;
+		next_expected++;
+	}
+
+	//Outstanding sends span less than RX_WINDOW_SPAN: anything older than the start was ACKed before we saw it
+	if (!anchored && seq_diff(next_expected, stream_start) >= RX_WINDOW_SPAN) anchored = true;
+	return true;
+}
+
+ReorderBuffer::ReorderBuffer() : synced(false), anchored(false), next_delivery(0), furthest(0), held(0), gap_since(0),
+	gaps_skipped(0), overflows(0)
+{
+}
+
+void ReorderBuffer::reset()
+{
+	for (uint8_t i = 0; i < REORDER_SLOTS; i++)
+	{
+		slots[i].release();
+	}
+	parked.release();
+	synced = false;
+	anchored = false;
+	next_delivery = 0;
+	furthest = 0;
+	held = 0;
+}
+
+bool ReorderBuffer::push(const FrameHandle& frame)
+{
+	if (!frame) return false;
+
+	uint16_t seq = frame->sequence_num;
+	bool syn = (frame->flags & FRAME_FLAG_SYN) != 0;
+	if (!synced)
+	{
+		next_delivery = seq;
+		furthest = seq;
+		synced = true;
+		anchored = syn;
+	}
+	else if (!anchored)
+	{
+		//Later frames got here first: start at the earliest one, the SYN frame fixes it
+		if (seq_before(seq, next_delivery) && seq_diff(furthest, seq) < REORDER_SLOTS) next_delivery = seq;
+		if (seq_before(furthest, seq)) furthest = seq;
+		if (syn && seq == next_delivery) anchored = true;
+	}
+
+	int16_t offset = seq_diff(seq, next_delivery);
+	if (offset < 0) return false;//late, its gap was skipped
+	if (offset >= REORDER_SLOTS)
+	{
+		overflows++;
+		if (parked) return false;
+		parked = frame;
+		return true;
+	}
+
+	FrameHandle& slot = slots[seq % REORDER_SLOTS];
+	if (slot) return false;//duplicate, callers filter these with ReceiveWindow first
+	slot = frame;
+	if (held++ == 0) gap_since = millis();
+	return true;
+}
+
+FrameHandle ReorderBuffer::pop()
+{
+	if (held == 0)
+	{
+		if (!parked) return FrameHandle();
+		FrameHandle frame = parked;
+		parked.release();
+		next_delivery = frame->sequence_num + 1;
+		gaps_skipped++;
+		return frame;
+	}
+
+	if (!anchored)
+	{
+		//An earlier frame may still be on its way
+		if (!parked && millis() - gap_since < REORDER_HOLD_MS) return FrameHandle();
+		anchored = true;
+	}
+	if (!slots[next_delivery % REORDER_SLOTS])
+	{
+		if (!parked && millis() - gap_since < REORDER_HOLD_MS) return FrameHandle();
+
+		//Give up on the gap, continue with the next frame held
+		while (!slots[next_delivery % REORDER_SLOTS]) next_delivery++;
+		gaps_skipped++;
+	}
+
+	FrameHandle frame = slots[next_delivery % REORDER_SLOTS];
+	slots[next_delivery % REORDER_SLOTS].release();
+	next_delivery++;
+	held--;
+	gap_since = millis();//the next gap, if any, starts now
+	return frame;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef SLIDING_WINDOW_H
+#define SLIDING_WINDOW_H
+
+//Selective-repeat ARQ helpers: sequence arithmetic and receiver window
+
+#include <stdint.h>
+#include "protocol.h"
+#include "frame_pool.h"
+
+#define MAX_WINDOW_SIZE 16//sender window limit
+#define RX_WINDOW_SPAN 32//receiver tracks this many sequences (one bitmap word)
+#define SACK_PAYLOAD_SIZE 6//cumulative ack (2) + SACK bitmap (4)
+#define REORDER_SLOTS MAX_WINDOW_SIZE//frames held behind a gap, each holds a pool frame
+#define REORDER_HOLD_MS 500//a gap open this long is given up on (the sender ran out of retries)
+
+//Serial number arithmetic on the 16-bit sequence space
+inline int16_t seq_diff(uint16_t a, uint16_t b) { return (int16_t)(a - b); }
+inline bool seq_before(uint16_t a, uint16_t b) { return seq_diff(a, b) < 0; }
+
+//ACK payload (optional): cumulative ack = every seq up to and including it was received,
+//bitmap bit i = (cumulative ack + 1 + i) was received.
+//An ACK without payload acknowledges only its own sequence_num (stop-and-wait).
+//Any frame with FRAME_FLAG_ACK also acknowledges everything up to its ack_num.
+void encode_sack(uint8_t* buffer, uint16_t cumulative_ack, uint32_t bitmap);
+bool ack_covers(const UartFrame* ack, uint16_t seq_num);
+
+//The window starts at the sender's FRAME_FLAG_SYN frame. Without it (lost, or we restarted mid-stream)
+//it starts at the first frame seen and moves back for earlier ones: until RX_WINDOW_SPAN frames in a row
+//show the sender has nothing older outstanding (its sends span less than that), the start is unknown and no cumulative ack is given.
+//A frame more than RX_WINDOW_SPAN behind cannot be a retransmission: the sender restarted, resync on it.
+//(Its sends span RX_WINDOW_SPAN - 1, so a resend of its oldest frame can be exactly RX_WINDOW_SPAN behind.)
+class ReceiveWindow
+{
+private:
+	bool synced;//a frame has fixed the window
+	bool anchored;//nothing before next_expected is still missing: cumulative ack and SACK are valid
+	bool syn_seen;//stream_start came from FRAME_FLAG_SYN
+	uint16_t stream_start;//lowest sequence accepted since the window (re)started
+	uint16_t next_expected;
+	uint32_t received_bitmap;//bit i = next_expected + i received
+
+	void restart(uint16_t seq_num, bool syn);
+	bool move_back(uint16_t seq_num);//start the window at an earlier seq_num, false if it does not fit
+
+public:
+	ReceiveWindow();
+
+	bool accept(uint16_t seq_num, bool syn = false);//false for duplicates
+	void reset();
+
+	uint16_t get_cumulative_ack() const { return next_expected - 1; }
+	uint32_t get_sack_bitmap() const { return received_bitmap; }
+	bool is_synced() const { return synced && anchored; }//cumulative ack and SACK may be sent
+};
+
+//Puts accepted DATA, BATCH and FRAGMENT frames back in sequence order: frames striped over bonded links,
+//or resent by selective repeat, arrive out of order. Frames are held as pooled handles, slot = seq % REORDER_SLOTS.
+//Delivery starts at the sender's FRAME_FLAG_SYN frame, as ReceiveWindow does. Until it arrives the start
+//moves back for earlier frames, and nothing is delivered before REORDER_HOLD_MS (SYN lost, or we restarted mid-stream).
+class ReorderBuffer
+{
+private:
+	FrameHandle slots[REORDER_SLOTS];
+	FrameHandle parked;//arrived too far ahead: the gaps before it are given up on without waiting
+	bool synced;
+	bool anchored;//next_delivery is the start of the stream, or the wait for it expired
+	uint16_t next_delivery;
+	uint16_t furthest;//highest sequence held while not anchored
+	uint8_t held;
+	uint32_t gap_since;//millis(), head gap open since
+	uint32_t gaps_skipped;
+	uint32_t overflows;
+
+public:
+	ReorderBuffer();
+
+	//false: deliver the frame now, it is behind the delivery point (its gap was given up on).
+	//A frame more than REORDER_SLOTS past an open gap means the sender gave up on the gap: it is parked
+	//and delivered after everything held, skipping the gaps at once.
+	bool push(const FrameHandle& frame);
+	FrameHandle pop();//next frame in order, empty while the gap before it is open
+	void reset();
+
+	uint8_t get_held() const { return held; }
+	uint32_t get_gaps_skipped() const { return gaps_skipped; }
+	uint32_t get_overflows() const { return overflows; }
+};
+
+#endif // !SLIDING_WINDOW_H
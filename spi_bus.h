@@ -0,0 +1,37 @@
+#pragma once
+#ifndef SPI_BUS_H
+#define SPI_BUS_H
+
+//Asynchronous SPI bus driver used by SPIInterface for queued master transfers.
+//A transaction is queued without blocking, finishes in queue order and is handed back by poll()/wait().
+
+#include <stdint.h>
+#include "protocol.h"
+
+#define SPI_QUEUE_DEPTH 2//transactions in flight: one on the bus, the next one prepared behind it
+#define SPI_TRANSFER_SIZE ((MAX_FRAME_SIZE + 3) & ~3)//multiple of 4 for DMA
+#define SPI_QUEUE_MIN_TRANSFER 16//bytes clocked even for shorter frames, fits an ACK with its SACK payload
+#define SPI_QUEUE_TIMEOUT_US 10000//longest wait for a free transaction buffer
+
+struct SPITransaction
+{
+	alignas(4) uint8_t tx[SPI_TRANSFER_SIZE];
+	alignas(4) uint8_t rx[SPI_TRANSFER_SIZE];
+	uint16_t length;//bytes clocked in each direction
+	int8_t cs_pin;//slave addressed on a shared bus (SPIBusManager), -1 = the driver's own CS
+};
+
+class SPIBusDriver
+{
+public:
+	virtual ~SPIBusDriver() {}
+
+	virtual bool begin(uint32_t clock_hz) = 0;
+	virtual bool queue(SPITransaction* transaction) = 0;//returns immediately, false if the driver queue is full
+	virtual SPITransaction* poll() = 0;//oldest finished transaction, nullptr if it is still on the bus
+	virtual SPITransaction* wait(uint32_t timeout_us) = 0;//blocks for the oldest queued transaction
+	virtual uint8_t get_in_flight() const = 0;
+	virtual uint32_t get_clock_hz() const = 0;
+};
+
+#endif // !SPI_BUS_H
@@ -0,0 +1,485 @@
+#include "spi_bus_manager.h"
+#include <Arduino.h>
+#include "logger.h"
+
+bool SPISlaveLink::send(const UartFrame* frame)
+{
+	if (!frame || !manager) return false;
+	return manager->enqueue(slave, frame);
+}
+
+FrameHandle SPISlaveLink::receive()
+{
+	return manager ? manager->dequeue(slave) : FrameHandle();
+}
+
+bool SPISlaveLink::available()
+{
+	if (!manager) return false;
+	manager->run_bus();
+	return manager->slaves[slave].rx_count > 0;
+}
+
+void SPISlaveLink::reset_receiver()
+{
+	if (!manager) return;
+	SPIBusManager::Slave& entry = manager->slaves[slave];
+	for (uint8_t i = 0; i < entry.rx_count; i++)
+	{
+		entry.rx[(entry.rx_head + i) % SPI_SLAVE_RX_DEPTH].release();
+	}
+	entry.rx_head = 0;
+	entry.rx_count = 0;
+}
+
+uint32_t SPISlaveLink::get_baud_rate() const
+{
+	if (!manager) return SPI_CLOCK_SPEED;
+	return manager->bus ? manager->bus->get_clock_hz() : manager->spi_settings.clock;
+}
+
+SPIBusManager::SPIBusManager(uint8_t spi_bus) :
+	spi(new SPIClass(spi_bus)),
+	spi_settings(SPI_CLOCK_SPEED, SPI_BIT_ORDER, SPI_MODE_CONFIG),
+	bus(nullptr),
+	clock_hz(0),
+	slave_count(0),
+	cursor(0),
+	in_flight_head(0),
+	in_flight(0),
+	frame_handler(nullptr),
+	handler_context(nullptr),
+	rounds(0),
+	stats_started(0)
+{
+}
+
+SPIBusManager::~SPIBusManager()
+{
+	spi->end();
+	delete spi;
+}
+
+uint8_t SPIBusManager::add_slave(uint8_t cs_pin, uint8_t weight)
+{
+	if (slave_count == SPI_MAX_SLAVES) return SPI_NO_SLAVE;
+
+	uint8_t index = slave_count++;
+	Slave& slave = slaves[index];
+	slave.cs_pin = cs_pin;
+	slave.weight = weight ? weight : 1;
+	slave.credit = slave.weight;
+	slave.poll_length = SPI_POLL_LENGTH;
+	slave.poll_interval_us = SPI_POLL_INTERVAL_US;
+	slave.last_transaction_us = micros();
+	slave.response_due = false;
+	slave.tx_head = 0;
+	slave.tx_count = 0;
+	slave.tx_in_flight = 0;
+	slave.poll_in_flight = false;
+	slave.rx_head = 0;
+	slave.rx_count = 0;
+
+	//One peer per protocol: no second link to hand over to
+	slave.link.manager = this;
+	slave.link.slave = index;
+	slave.protocol.enable_auto_switch(false);
+	slave.protocol.set_communication_interface(&slave.link);
+	reset_statistics();
+	return index;
+}
+
+void SPIBusManager::begin(uint32_t clock)
+{
+	clock_hz = clock;
+	spi_settings = SPISettings(clock_hz, SPI_BIT_ORDER, SPI_MODE_CONFIG);
+	if (bus)
+	{
+		//The bus driver owns the pins and drives CS itself
+		if (!bus->begin(clock_hz)) LOG_ERROR("SPI bus driver failed to start");
+	}
+	else
+	{
+		for (uint8_t i = 0; i < slave_count; i++)
+		{
+			pinMode(slaves[i].cs_pin, OUTPUT);
+			digitalWrite(slaves[i].cs_pin, HIGH);
+		}
+		spi->begin(SPI_SCK, SPI_MISO, SPI_MOSI, -1);
+	}
+	update_rto_floors();
+	LOG_INFO("SPI bus: %u slaves, %s transfers", slave_count, bus ? "queued" : "blocking");
+}
+
+void SPIBusManager::update_rto_floors()
+{
+	if (!clock_hz) return;
+
+	//A frame can wait behind a full queue for the slave's turns and its ACK comes back in the turn after,
+	//so a low-weight slave's RTO must cover that many rounds or its queued frames time out on a clean bus.
+	//A bus driver adds the transactions already queued to it.
+	uint16_t total_weight = 0;
+	for (uint8_t i = 0; i < slave_count; i++) total_weight += slaves[i].weight;
+	uint32_t transaction_us = (uint32_t)((uint64_t)SPI_TRANSFER_SIZE * 8 * 1000000 / clock_hz) + 2 * SPI_CS_DELAY_US;
+	uint32_t queued_us = bus ? SPI_QUEUE_DEPTH * transaction_us : 0;
+	for (uint8_t i = 0; i < slave_count; i++)
+	{
+		uint32_t rounds = (SPI_SLAVE_TX_DEPTH + slaves[i].weight) / slaves[i].weight;
+		uint32_t floor_us = rounds * total_weight * transaction_us + queued_us;
+		slaves[i].protocol.set_rto_bounds(floor_us > RTO_MIN_US ? floor_us : RTO_MIN_US, RTO_MAX_US);
+	}
+}
+
+void SPIBusManager::set_bus_driver(SPIBusDriver* driver)
+{
+	//Let what is on the old bus finish first
+	while (bus && in_flight)
+	{
+		SPITransaction* done = bus->wait(SPI_QUEUE_TIMEOUT_US);
+		if (!done) break;
+		finish_oldest(done);
+	}
+	bus = driver;
+	in_flight = 0;
+
+	//Already running: the new driver starts at the same clock
+	if (bus && clock_hz && !bus->begin(clock_hz)) LOG_ERROR("SPI bus driver failed to start");
+	update_rto_floors();
+}
+
+void SPIBusManager::set_weight(uint8_t slave, uint8_t weight)
+{
+	if (slave >= slave_count) return;
+	slaves[slave].weight = weight ? weight : 1;
+	if (slaves[slave].credit > slaves[slave].weight) slaves[slave].credit = slaves[slave].weight;
+	update_rto_floors();
+}
+
+void SPIBusManager::set_poll(uint8_t slave, uint32_t interval_us, uint16_t length)
+{
+	if (slave >= slave_count) return;
+	slaves[slave].poll_interval_us = interval_us;
+	slaves[slave].poll_length = constrain(length, SPI_QUEUE_MIN_TRANSFER, SPI_TRANSFER_SIZE);
+}
+
+bool SPIBusManager::enqueue(uint8_t index, const UartFrame* frame)
+{
+	Slave& slave = slaves[index];
+
+	//Queue full: keep the bus going (the other slaves get their turns too) until this one's turn frees a buffer
+	run_bus();
+	while (slave.tx_count == SPI_SLAVE_TX_DEPTH)
+	{
+		SPITransaction* done = bus && in_flight ? bus->wait(SPI_QUEUE_TIMEOUT_US) : nullptr;
+		if (done) finish_oldest(done);
+		if (!run_bus() && !done)
+		{
+			//Bus stalled, or the slave's responses are not being read
+			LOG_WARN("SPI slave %u queue stalled, frame %u not queued", index, frame->sequence_num);
+			return false;
+		}
+	}
+
+	SPITransaction& transaction = slave.tx[(slave.tx_head + slave.tx_count) % SPI_SLAVE_TX_DEPTH];
+	uint16_t length = Protocol::encode_frame(frame, transaction.tx);
+	transaction.length = length < SPI_QUEUE_MIN_TRANSFER ? SPI_QUEUE_MIN_TRANSFER : length;
+	memset(&transaction.tx[length], 0, transaction.length - length);
+	slave.tx_count++;
+
+	run_bus();//goes out at once if the bus is free
+	return true;
+}
+
+FrameHandle SPIBusManager::dequeue(uint8_t index)
+{
+	run_bus();
+	Slave& slave = slaves[index];
+	if (slave.rx_count == 0) return FrameHandle();
+
+	FrameHandle frame = slave.rx[slave.rx_head];
+	slave.rx[slave.rx_head].release();
+	slave.rx_head = (slave.rx_head + 1) % SPI_SLAVE_RX_DEPTH;
+	slave.rx_count--;
+	return frame;
+}
+
+bool SPIBusManager::has_work(const Slave& slave, uint32_t now, bool& poll) const
+{
+	//Its answers would have nowhere to go
+	if (slave.rx_count == SPI_SLAVE_RX_DEPTH) return false;
+
+	if (slave.tx_count > slave.tx_in_flight)
+	{
+		poll = false;
+		return true;
+	}
+
+	//A transfer still on the bus brings back whatever the slave has
+	if (slave.tx_in_flight || slave.poll_in_flight) return false;
+	poll = true;
+	return slave.response_due || (slave.poll_interval_us && now - slave.last_transaction_us >= slave.poll_interval_us);
+}
+
+uint8_t SPIBusManager::next_slave(bool& poll)
+{
+	uint32_t now = micros();
+	for (uint8_t pass = 0; pass < 2; pass++)
+	{
+		bool waiting = false;//has work but spent its credit
+		for (uint8_t i = 0; i < slave_count; i++)
+		{
+			uint8_t index = (cursor + i) % slave_count;
+			Slave& slave = slaves[index];
+			if (!has_work(slave, now, poll)) continue;
+			if (slave.credit == 0)
+			{
+				waiting = true;
+				continue;
+			}
+
+			//Up to weight transactions back to back, then the next slave
+			slave.credit--;
+			cursor = slave.credit ? index : (index + 1) % slave_count;
+			return index;
+		}
+		if (!waiting) break;
+
+		//Every slave with work spent its credit: next round
+		for (uint8_t i = 0; i < slave_count; i++)
+		{
+			slaves[i].credit = slaves[i].weight;
+		}
+		rounds++;
+	}
+	return SPI_NO_SLAVE;
+}
+
+bool SPIBusManager::run_bus()
+{
+	bool busy = false;
+	if (bus)
+	{
+		SPITransaction* done;
+		while (in_flight && (done = bus->poll()) != nullptr)
+		{
+			finish_oldest(done);
+			busy = true;
+		}
+	}
+
+	//Blocking transfers take the CPU: at most one round per call
+	uint16_t budget = 0;
+	for (uint8_t i = 0; i < slave_count; i++) budget += slaves[i].weight;
+	while (budget-- > 0 && (!bus || in_flight < SPI_QUEUE_DEPTH))
+	{
+		bool poll = false;
+		uint8_t next = next_slave(poll);
+		if (next == SPI_NO_SLAVE || !start_transaction(next, poll)) break;
+		busy = true;
+	}
+	return busy;
+}
+
+bool SPIBusManager::start_transaction(uint8_t index, bool poll)
+{
+	Slave& slave = slaves[index];
+	SPITransaction* transaction;
+	if (poll)
+	{
+		transaction = &slave.poll;
+		memset(transaction->tx, 0, slave.poll_length);
+		transaction->length = slave.poll_length;
+	}
+	else
+	{
+		//Clock at least the slave's longest response, it answers inside our transfer
+		transaction = &slave.tx[(slave.tx_head + slave.tx_in_flight) % SPI_SLAVE_TX_DEPTH];
+		if (transaction->length < slave.poll_length)
+		{
+			memset(&transaction->tx[transaction->length], 0, slave.poll_length - transaction->length);
+			transaction->length = slave.poll_length;
+		}
+	}
+	transaction->cs_pin = (int8_t)slave.cs_pin;
+
+	if (bus)
+	{
+		if (!bus->queue(transaction)) return false;
+		uint8_t position = (in_flight_head + in_flight) % SPI_QUEUE_DEPTH;
+		in_flight_slave[position] = index;
+		in_flight_poll[position] = poll;
+		in_flight++;
+	}
+
+	slave.last_transaction_us = micros();
+	slave.transactions++;
+	if (poll)
+	{
+		slave.polls++;
+		slave.poll_in_flight = true;
+	}
+	else
+	{
+		slave.tx_in_flight++;
+	}
+
+	if (!bus)
+	{
+		transfer_blocking(slave, transaction);
+		complete_transaction(index, poll, transaction);
+	}
+	return true;
+}
+
+void SPIBusManager::transfer_blocking(Slave& slave, SPITransaction* transaction)
+{
+	digitalWrite(slave.cs_pin, LOW);
+	delayMicroseconds(SPI_CS_DELAY_US);
+
+	spi->beginTransaction(spi_settings);
+	spi->transferBytes(transaction->tx, transaction->rx, transaction->length);
+	if (transaction->rx[0] == START_MARKER)
+	{
+		//Response is longer than what we clocked, keep CS low and clock the rest
+		uint16_t frame_size = Protocol::parse_wire_size(transaction->rx);
+		if (frame_size > transaction->length && frame_size <= SPI_TRANSFER_SIZE)
+		{
+			uint16_t rest = frame_size - transaction->length;
+			memset(&transaction->tx[transaction->length], 0, rest);
+			spi->transferBytes(&transaction->tx[transaction->length], &transaction->rx[transaction->length], rest);
+			transaction->length = frame_size;
+		}
+	}
+	spi->endTransaction();
+
+	delayMicroseconds(SPI_CS_DELAY_US);
+	digitalWrite(slave.cs_pin, HIGH);
+}
+
+void SPIBusManager::finish_oldest(SPITransaction* transaction)
+{
+	uint8_t index = in_flight_slave[in_flight_head];
+	bool poll = in_flight_poll[in_flight_head];
+	in_flight_head = (in_flight_head + 1) % SPI_QUEUE_DEPTH;
+	in_flight--;
+	complete_transaction(index, poll, transaction);
+}
+
+void SPIBusManager::complete_transaction(uint8_t index, bool poll, SPITransaction* transaction)
+{
+	Slave& slave = slaves[index];
+	if (poll)
+	{
+		slave.poll_in_flight = false;
+	}
+	else
+	{
+		slave.tx_bytes += Protocol::parse_wire_size(transaction->tx);
+		slave.tx_head = (slave.tx_head + 1) % SPI_SLAVE_TX_DEPTH;
+		slave.tx_count--;
+		slave.tx_in_flight--;
+	}
+
+	//After our frame its answer is due; after a poll only if the slave had something (it may hold more)
+	uint16_t frame_size = transaction->rx[0] == START_MARKER ? Protocol::parse_wire_size(transaction->rx) : 0;
+	slave.response_due = !poll || frame_size > 0;
+	if (frame_size == 0)
+	{
+		if (poll) slave.empty_polls++;
+		return;
+	}
+	if (frame_size > transaction->length)
+	{
+		//Lost, the slave's protocol resends it; polls clock enough from now on
+		slave.truncated++;
+		if (frame_size <= SPI_TRANSFER_SIZE && frame_size > slave.poll_length) slave.poll_length = frame_size;
+		LOG_WARN("SPI slave %u response truncated, %u of %u bytes clocked", index, transaction->length, frame_size);
+		return;
+	}
+
+	slave.rx_bytes += frame_size;
+	FrameHandle frame = slave.rx_count < SPI_SLAVE_RX_DEPTH ? frame_pool.acquire() : FrameHandle();
+	if (!frame)
+	{
+		slave.dropped++;
+		return;
+	}
+	if (!Protocol::decode_frame(transaction->rx, frame_size, frame.get())) return;
+	slave.rx[(slave.rx_head + slave.rx_count) % SPI_SLAVE_RX_DEPTH] = frame;
+	slave.rx_count++;
+}
+
+bool SPIBusManager::service()
+{
+	bool busy = false;
+	for (uint8_t i = 0; i < slave_count; i++)
+	{
+		EnhancedProtocol& protocol = slaves[i].protocol;
+		for (FrameHandle frame = protocol.receive_frame(); frame; frame = protocol.receive_frame())
+		{
+			busy = true;
+			if (!protocol.validate_received_frame(frame.get())) continue;
+			if (Protocol::is_data_frame(frame.get()))
+			{
+				if (protocol.accept_data_frame(frame.get()) && frame_handler) frame_handler(handler_context, i, frame.get());
+				protocol.queue_ack(frame->sequence_num);
+			}
+			else
+			{
+				protocol.process_frame(frame.get());
+			}
+		}
+		busy = protocol.service_timers() || busy;
+	}
+	return run_bus() || busy;
+}
+
+float SPIBusManager::get_slave_throughput_kbps(uint8_t slave) const
+{
+	uint32_t elapsed_ms = millis() - stats_started;
+	if (elapsed_ms == 0 || slave >= slave_count) return 0.0;
+	return (slaves[slave].tx_bytes + slaves[slave].rx_bytes) * 8.0 / elapsed_ms;//bits per ms = kbps
+}
+
+float SPIBusManager::get_throughput_kbps() const
+{
+	float total = 0;
+	for (uint8_t i = 0; i < slave_count; i++)
+	{
+		total += get_slave_throughput_kbps(i);
+	}
+	return total;
+}
+
+void SPIBusManager::print_statistics()
+{
+	Serial.println("SPI BUS:");
+	Serial.print(" Rounds: "); Serial.println(rounds);
+	for (uint8_t i = 0; i < slave_count; i++)
+	{
+		Slave& slave = slaves[i];
+		PerformanceMonitor& perf = slave.protocol.get_performance_monitor();
+		Serial.printf(" Slave %u (CS %u, weight %u): %lu transactions, %lu polls (%lu empty), %.2f kbps\n", i, slave.cs_pin, slave.weight,
+			(unsigned long)slave.transactions, (unsigned long)slave.polls, (unsigned long)slave.empty_polls, get_slave_throughput_kbps(i));
+		Serial.printf("  Retransmissions %lu, CRC errors %lu, truncated %lu, dropped %lu\n", (unsigned long)perf.get_retransmissions(),
+			(unsigned long)perf.get_crc_errors(), (unsigned long)slave.truncated, (unsigned long)slave.dropped);
+	}
+	Serial.print(" Aggregate: "); Serial.print(get_throughput_kbps(), 2); Serial.println(" kbps");
+}
+
+void SPIBusManager::reset_statistics()
+{
+	for (uint8_t i = 0; i < slave_count; i++)
+	{
+		Slave& slave = slaves[i];
+		slave.transactions = 0;
+		slave.polls = 0;
+		slave.empty_polls = 0;
+		slave.tx_bytes = 0;
+		slave.rx_bytes = 0;
+		slave.truncated = 0;
+		slave.dropped = 0;
+	}
+	rounds = 0;
+	stats_started = millis();
+}
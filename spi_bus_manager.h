@@ -0,0 +1,160 @@
+#pragma once
+#ifndef SPI_BUS_MANAGER_H
+#define SPI_BUS_MANAGER_H
+
+//Master side of one SPI bus shared by several slaves (sensor nodes). The manager owns the SPIClass
+//and a table of slaves, each with its own CS pin and its own EnhancedProtocol: sequence space,
+//windows, RTO and PerformanceMonitor are per slave. A slave's protocol talks through an SPISlaveLink
+//whose frames wait in that slave's queue until run_bus() gives it the bus.
+//
+//Scheduling is weighted round-robin over transactions: a slave gets up to its weight in back-to-back
+//transactions per round while it has work, and slaves with nothing to do are skipped. "Work" is a
+//queued frame, or a poll: a slave answers in the transaction after the one that carried our frame,
+//so it is polled after a frame, after a response that carried a frame (it may hold more), and every
+//poll interval so an idle sensor can report. begin() raises each slave's minimum RTO to the rounds its
+//queue and the ACK after it can take at its weight; set_weight() and set_bus_driver() redo it.
+
+#include "enhanced_protocol.h"
+#include "spi_bus.h"
+#include "spi_interface.h"
+#include <SPI.h>
+
+#define SPI_MAX_SLAVES 4
+#define SPI_SLAVE_TX_DEPTH (SPI_QUEUE_DEPTH + 2)//encoded frames: up to two on the bus and the next ones waiting for the slave's turn
+#define SPI_SLAVE_RX_DEPTH 4//decoded responses waiting for the slave's protocol
+#define SPI_POLL_INTERVAL_US 20000//an idle slave is polled this often, 0 = only after traffic
+#define SPI_POLL_LENGTH SPI_QUEUE_MIN_TRANSFER//bytes a poll clocks at first, grows to the longest response seen
+#define SPI_NO_SLAVE 0xFF
+
+//Validated DATA, BATCH or FRAGMENT from a slave (unpack with deliver_batch/deliver_fragment), the manager ACKs it
+typedef void (*SlaveFrameHandler)(void* context, uint8_t slave, UartFrame* frame);
+
+class SPIBusManager;
+
+//CommunicationInterface of one slave on the shared bus, handed to that slave's EnhancedProtocol
+class SPISlaveLink : public CommunicationInterface
+{
+private:
+	friend class SPIBusManager;
+	SPIBusManager* manager;
+	uint8_t slave;
+
+public:
+	SPISlaveLink() : manager(nullptr), slave(SPI_NO_SLAVE) {}
+
+	bool send(const UartFrame* frame) override;//queues it, waits on the bus only while the slave's queue is full
+	FrameHandle receive() override;
+	bool available() override;
+
+	CommunicationMode get_mode() override { return MODE_SPI; }
+	void begin() override {}
+	void reset_receiver() override;
+
+	uint32_t get_baud_rate() const override;
+	bool is_connected() const override { return manager != nullptr; }
+};
+
+class SPIBusManager
+{
+private:
+	struct Slave
+	{
+		uint8_t cs_pin;
+		uint8_t weight;//transactions per round
+		uint8_t credit;//left this round
+		uint16_t poll_length;
+		uint32_t poll_interval_us;
+		uint32_t last_transaction_us;//micros()
+		bool response_due;//its next transaction is expected to bring a frame
+
+		SPISlaveLink link;
+		EnhancedProtocol protocol;
+
+		//Ring of encoded frames, the first tx_in_flight from tx_head are on the bus
+		SPITransaction tx[SPI_SLAVE_TX_DEPTH];
+		uint8_t tx_head;
+		uint8_t tx_count;
+		uint8_t tx_in_flight;
+		SPITransaction poll;
+		bool poll_in_flight;
+
+		FrameHandle rx[SPI_SLAVE_RX_DEPTH];
+		uint8_t rx_head;
+		uint8_t rx_count;
+
+		//Statistics since reset_statistics()
+		uint32_t transactions;
+		uint32_t polls;
+		uint32_t empty_polls;//the slave had nothing to send
+		uint32_t tx_bytes;//frame bytes to the slave
+		uint32_t rx_bytes;//frame bytes from the slave
+		uint32_t truncated;//response longer than the transfer clocked
+		uint32_t dropped;//rx queue full or pool exhausted
+	};
+
+	SPIClass* spi;
+	SPISettings spi_settings;
+	SPIBusDriver* bus;//nullptr = blocking SPIClass transfers
+	uint32_t clock_hz;//from begin(), 0 before it
+
+	Slave slaves[SPI_MAX_SLAVES];
+	uint8_t slave_count;
+	uint8_t cursor;//round-robin position
+
+	//Transactions queued to the driver, oldest first (they complete in order)
+	uint8_t in_flight_slave[SPI_QUEUE_DEPTH];
+	bool in_flight_poll[SPI_QUEUE_DEPTH];
+	uint8_t in_flight_head;
+	uint8_t in_flight;
+
+	SlaveFrameHandler frame_handler;
+	void* handler_context;
+
+	uint32_t rounds;
+	uint32_t stats_started;//millis()
+
+public:
+	SPIBusManager(uint8_t spi_bus = HSPI);
+	~SPIBusManager();
+
+	uint8_t add_slave(uint8_t cs_pin, uint8_t weight = 1);//slave index, SPI_NO_SLAVE if the table is full
+	void begin(uint32_t clock = SPI_CLOCK_SPEED);//after add_slave(): CS pins idle high
+	void set_bus_driver(SPIBusDriver* driver);//must honour SPITransaction::cs_pin (ESP32DMABus drives one device only)
+	void set_weight(uint8_t slave, uint8_t weight);
+	void set_poll(uint8_t slave, uint32_t interval_us, uint16_t length = SPI_POLL_LENGTH);
+	void set_frame_handler(SlaveFrameHandler handler, void* context) { frame_handler = handler; handler_context = context; }
+
+	//One pass of the master loop: every slave's responses (ACKs to its protocol, DATA to the frame
+	//handler) and timers, then the bus. Returns true if anything happened.
+	bool service();
+	bool run_bus();//completes finished transfers and starts the next ones, never waits
+
+	uint8_t get_slave_count() const { return slave_count; }
+	EnhancedProtocol& get_protocol(uint8_t slave) { return slaves[slave].protocol; }
+	bool has_room(uint8_t slave) const { return slaves[slave].tx_count < SPI_SLAVE_TX_DEPTH; }//send() would not wait
+
+	//Statistics
+	uint32_t get_transactions(uint8_t slave) const { return slaves[slave].transactions; }
+	uint32_t get_polls(uint8_t slave) const { return slaves[slave].polls; }
+	uint32_t get_empty_polls(uint8_t slave) const { return slaves[slave].empty_polls; }
+	uint32_t get_truncated(uint8_t slave) const { return slaves[slave].truncated; }
+	uint32_t get_rounds() const { return rounds; }
+	float get_slave_throughput_kbps(uint8_t slave) const;//frame bytes both ways since reset_statistics()
+	float get_throughput_kbps() const;//all slaves
+	void print_statistics();
+	void reset_statistics();
+
+private:
+	friend class SPISlaveLink;
+	bool enqueue(uint8_t slave, const UartFrame* frame);
+	FrameHandle dequeue(uint8_t slave);
+	bool has_work(const Slave& slave, uint32_t now, bool& poll) const;
+	uint8_t next_slave(bool& poll);//SPI_NO_SLAVE if nobody has work
+	bool start_transaction(uint8_t slave, bool poll);
+	void transfer_blocking(Slave& slave, SPITransaction* transaction);
+	void complete_transaction(uint8_t slave, bool poll, SPITransaction* transaction);
+	void finish_oldest(SPITransaction* transaction);//driver handed back the oldest transaction
+	void update_rto_floors();//after begin(), on weight and bus driver changes
+};
+
+#endif // !SPI_BUS_MANAGER_H
@@ -1,15 +1,28 @@
 #include "spi_interface.h"
 #include <Arduino.h>
+#include "logger.h"
 
 SPIInterface::SPIInterface(bool master, uint8_t cs) :
 	is_master(master),
 	cs_pin(cs),
 	spi(nullptr),
+	tx_frame(nullptr),
+	tx_header_length(0),
+	tx_length(0),
+	rx_length(0),
 	data_ready(false),
 	last_packet_time(0),
 	packet_start_time(0),
-	master_sequence_counter(0)
-
+	master_sequence_counter(0),
+	bus(nullptr),
+	tx_next(0),
+	in_flight(0),
+	rx_head(0),
+	rx_count(0),
+	response_length(SPI_QUEUE_MIN_TRANSFER),
+	completed_transactions(0),
+	truncated_responses(0),
+	dropped_responses(0)
 {
 	if (is_master)
 	{
@@ -48,6 +61,14 @@ void SPIInterface::begin()
 
 void SPIInterface::begin_master()
 {
+	if (bus)
+	{
+		//The bus driver owns the pins and drives CS itself
+		if (!bus->begin(SPI_CLOCK_SPEED)) LOG_ERROR("[MASTER] SPI bus driver failed to start");
+		Serial.printf("[MASTER] SPI queued transfers, %d buffers\n", SPI_QUEUE_DEPTH);
+		return;
+	}
+
 	Serial.println("[MASTER] Initializing SPI Master...");
 
 	//Simple MASTER: CS pin always be controlled
@@ -97,37 +118,44 @@ bool SPIInterface::send(const UartFrame* frame)
 {
 	if (!frame)
 	{
-		Serial.println("have not had frame yet");
+		LOG_ERROR("SPI send without a frame");
 		return false;
 	}
 
-	memcpy(tx_buffer, frame, sizeof(UartFrame));//Chuyen frame vao tx_frame
+	if (bus && is_master) return send_queued(frame);
 
-	if (is_master)
-	{
-		return send_master();
-	}
-	else
-	{
-		return send_slave();
-	}
+	tx_frame = frame;
+	tx_header_length = Protocol::encode_header(frame, tx_header);
+	Protocol::encode_trailer(frame, tx_trailer);
+	tx_length = Protocol::wire_size(frame);
+
+	bool sent = is_master ? send_master() : send_slave();
+	tx_frame = nullptr;//frame is only borrowed for the transfer
+	return sent;
 }
 
 bool SPIInterface::send_master()
 {
 	digitalWrite(cs_pin, LOW);
-	Serial.println("[DEBUG] Setting CS LOW");
-	Serial.printf("CS Sending Signal: %s\n", (digitalRead(SPI_CS) == LOW) ? "LOW" : "HIGH");
+	LOG_DEBUG("SPI CS LOW (reads %s)", digitalRead(cs_pin) == LOW ? "LOW" : "HIGH");
 	delayMicroseconds(SPI_CS_DELAY_US * 2);
 
 	spi->beginTransaction(spi_settings);
-	spi->transferBytes(tx_buffer, rx_buffer, sizeof(UartFrame));
+	uint16_t data_length = tx_frame->data_length;
+	spi->transferBytes(tx_header, rx_buffer, tx_header_length);
+	spi->transferBytes(tx_frame->data, &rx_buffer[tx_header_length], data_length);
+	spi->transferBytes(tx_trailer, &rx_buffer[tx_header_length + data_length], FRAME_TRAILER_SIZE);
+	rx_length = response_size(tx_length);
+	for (uint16_t i = tx_length; i < rx_length; i++)
+	{
+		//Response is longer than our frame, keep CS low and clock the rest
+		rx_buffer[i] = spi->transfer(0);
+	}
 	spi->endTransaction();
 
 	delayMicroseconds(SPI_CS_DELAY_US * 2);
 	digitalWrite(cs_pin, HIGH);
-	Serial.println("[DEBUG] Setting CS HIGH");
-	Serial.printf("CS Sending Signal: %s\n", (digitalRead(SPI_CS) == LOW) ? "LOW" : "HIGH");
+	LOG_DEBUG("SPI CS HIGH (reads %s)", digitalRead(cs_pin) == LOW ? "LOW" : "HIGH");
 
 	if (rx_buffer[0] == START_MARKER)
 	{
@@ -135,7 +163,7 @@ bool SPIInterface::send_master()
 		return true;
 	}
 
-	Serial.printf("[MASTER] Invalid response: 0x%02X\n", rx_buffer[0]);
+	LOG_WARN("[MASTER] Invalid SPI response: 0x%02X", rx_buffer[0]);
 	return false;
 }
 
@@ -144,10 +172,18 @@ bool SPIInterface::send_slave()
 	if (digitalRead(cs_pin) == LOW)
 	{
 		spi->beginTransaction(SPISettings(SPI_CLOCK_SPEED, SPI_BIT_ORDER, SPI_MODE0));
-		for (size_t i = 0; i < sizeof(UartFrame); i++)
+		uint16_t needed = tx_length;
+		for (uint16_t i = 0; i < needed; i++)
 		{
-			rx_buffer[i] = spi->transfer(tx_buffer[i]);
+			rx_buffer[i] = spi->transfer(tx_byte(i));
+			if (i + 1 == FRAME_HEADER_SIZE)
+			{
+				//Header complete, the master's frame may be longer than ours
+				uint16_t incoming = response_size(FRAME_HEADER_SIZE);
+				if (incoming > needed) needed = incoming;
+			}
 		}
+		rx_length = needed;
 
 		spi->endTransaction();
 
@@ -160,12 +196,153 @@ bool SPIInterface::send_slave()
 	return false;
 }
 
-bool SPIInterface::receive(UartFrame* frame)
+bool SPIInterface::send_queued(const UartFrame* frame)
 {
-	if (!frame || !data_ready) return false;
-	memcpy(frame, rx_buffer, sizeof(UartFrame));
-	data_ready = false;
+	service_bus();
+	if (in_flight == SPI_QUEUE_DEPTH)
+	{
+		//Both buffers busy: wait for the oldest transfer to free one
+		SPITransaction* done = bus->wait(SPI_QUEUE_TIMEOUT_US);
+		if (!done)
+		{
+			LOG_WARN("SPI bus stalled, frame %u not queued", frame->sequence_num);
+			return false;
+		}
+		complete_transaction(done);
+	}
+
+	SPITransaction& transaction = transactions[tx_next];
+	uint16_t length = Protocol::encode_frame(frame, transaction.tx);
+	//The slave answers inside our transfer: clock at least its longest response so far
+	transaction.length = length < response_length ? response_length : length;
+	memset(&transaction.tx[length], 0, transaction.length - length);
+	transaction.cs_pin = -1;
+
+	if (!bus->queue(&transaction)) return false;
+	tx_next = (tx_next + 1) % SPI_QUEUE_DEPTH;
+	in_flight++;
+	return true;//queued, the slave's response arrives through receive()
+}
+
+void SPIInterface::service_bus()
+{
+	SPITransaction* done;
+	while (in_flight && (done = bus->poll()) != nullptr)
+	{
+		complete_transaction(done);
+	}
+}
+
+void SPIInterface::complete_transaction(SPITransaction* transaction)
+{
+	in_flight--;
+	completed_transactions++;
+	if (transaction->rx[0] != START_MARKER) return;//slave had nothing to send
+
+	uint16_t frame_size = Protocol::parse_wire_size(transaction->rx);
+	if (frame_size == 0) return;
+	if (frame_size > transaction->length)
+	{
+		//Lost, the slave's protocol resends it; transfers clock enough from now on
+		truncated_responses++;
+		if (frame_size <= SPI_TRANSFER_SIZE && frame_size > response_length) response_length = frame_size;
+		LOG_WARN("SPI response truncated, %u of %u bytes clocked", transaction->length, frame_size);
+		return;
+	}
+
+	FrameHandle frame = rx_count < SPI_RX_QUEUE_DEPTH ? frame_pool.acquire() : FrameHandle();
+	if (!frame)
+	{
+		dropped_responses++;
+		return;
+	}
+	if (!Protocol::decode_frame(transaction->rx, frame_size, frame.get())) return;
+	rx_queue[(rx_head + rx_count) % SPI_RX_QUEUE_DEPTH] = frame;
+	rx_count++;
+}
+
+bool SPIInterface::flush(uint32_t timeout_us)
+{
+	if (!bus) return true;
+
+	uint32_t start = micros();
+	while (in_flight)
+	{
+		uint32_t elapsed = micros() - start;
+		if (elapsed >= timeout_us) return false;
+		SPITransaction* done = bus->wait(timeout_us - elapsed);
+		if (done) complete_transaction(done);
+	}
 	return true;
 }
 
-bool SPIInterface::available() { return data_ready; }
\ No newline at end of file
+void SPIInterface::set_bus_driver(SPIBusDriver* driver)
+{
+	if (!is_master) return;//the slave answers inside the master's transfer, it stays on polling
+
+	flush();
+	bus = driver;
+	reset_receiver();
+}
+
+void SPIInterface::reset_receiver()
+{
+	data_ready = false;
+	for (uint8_t i = 0; i < rx_count; i++)
+	{
+		rx_queue[(rx_head + i) % SPI_RX_QUEUE_DEPTH].release();
+	}
+	rx_head = 0;
+	rx_count = 0;
+}
+
+FrameHandle SPIInterface::receive()
+{
+	if (bus)
+	{
+		service_bus();
+		if (rx_count == 0) return FrameHandle();
+
+		FrameHandle frame = rx_queue[rx_head];
+		rx_queue[rx_head].release();
+		rx_head = (rx_head + 1) % SPI_RX_QUEUE_DEPTH;
+		rx_count--;
+		return frame;
+	}
+
+	if (!data_ready) return FrameHandle();
+	data_ready = false;
+
+	//The bus clocks both directions into one buffer, so this is the single copy into the pooled frame
+	FrameHandle frame = frame_pool.acquire();
+	if (!frame || !Protocol::decode_frame(rx_buffer, rx_length, frame.get())) return FrameHandle();
+	return frame;
+}
+
+uint8_t SPIInterface::tx_byte(uint16_t position) const
+{
+	if (position < tx_header_length) return tx_header[position];
+	position -= tx_header_length;
+	if (position < tx_frame->data_length) return tx_frame->data[position];
+	position -= tx_frame->data_length;
+	return position < FRAME_TRAILER_SIZE ? tx_trailer[position] : 0;
+}
+
+uint16_t SPIInterface::response_size(uint16_t clocked) const
+{
+	//Wire size announced by the peer's header, or 'clocked' if there is no valid header
+	if (clocked < FRAME_HEADER_SIZE || rx_buffer[0] != START_MARKER) return clocked;
+
+	uint16_t frame_size = Protocol::parse_wire_size(rx_buffer);
+	return frame_size ? frame_size : clocked;
+}
+
+bool SPIInterface::available()
+{
+	if (bus)
+	{
+		service_bus();
+		return rx_count > 0;
+	}
+	return data_ready;
+}
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include "communication_interface.h"
 #include "protocol.h"
+#include "spi_bus.h"
 #include <SPI.h>
 
 #define SPI_MOSI 23
@@ -15,6 +16,7 @@
 #define SPI_MODE_CONFIG SPI_MODE0
 #define SPI_BIT_ORDER MSBFIRST
 #define SPI_CS_DELAY_US 10
+#define SPI_RX_QUEUE_DEPTH 4//decoded responses of completed queued transfers
 
 class SPIInterface : public CommunicationInterface
 {
@@ -24,9 +26,16 @@ private:
 	SPIClass* spi;
 	SPISettings spi_settings;
 
-	//Buffer for slave response
-	uint8_t tx_buffer[sizeof(UartFrame)];
-	uint8_t rx_buffer[sizeof(UartFrame)];
+	//Outgoing frame is clocked out as header + frame data + trailer, without a wire copy
+	const UartFrame* tx_frame;
+	uint8_t tx_header[FRAME_HEADER_SIZE + FRAME_ACK_FIELD_SIZE];
+	uint8_t tx_trailer[FRAME_TRAILER_SIZE];
+	uint16_t tx_header_length;
+	uint16_t tx_length;
+
+	//Full-duplex bus buffer for the peer's frame (wire format, see Protocol::encode_frame)
+	uint8_t rx_buffer[MAX_FRAME_SIZE];
+	uint16_t rx_length;
 	volatile bool data_ready;
 	
 	uint32_t last_packet_time;
@@ -34,6 +43,20 @@ private:
 
 	uint16_t master_sequence_counter;
 
+	//Queued master transfers (set_bus_driver): the next frame is encoded into a free transaction
+	//buffer while the previous one is still on the bus, responses come back through rx_queue
+	SPIBusDriver* bus;
+	SPITransaction transactions[SPI_QUEUE_DEPTH];//used in order, transfers complete in order
+	uint8_t tx_next;
+	uint8_t in_flight;
+	FrameHandle rx_queue[SPI_RX_QUEUE_DEPTH];
+	uint8_t rx_head;
+	uint8_t rx_count;
+	uint16_t response_length;//bytes a transfer clocks at least, grows to the longest response seen
+	uint32_t completed_transactions;
+	uint32_t truncated_responses;//response longer than the transfer clocked
+	uint32_t dropped_responses;//rx_queue full or pool exhausted
+
 public:
 	SPIInterface(bool master_mode = true, uint8_t cs_pin = SPI_CS);
 	~SPIInterface();
@@ -42,7 +65,7 @@ public:
 	bool send(const UartFrame* frame) override;
 	bool send_master();
 	bool send_slave();
-	bool receive(UartFrame* frame) override;
+	FrameHandle receive() override;
 	bool available() override;
 
 	CommunicationMode get_mode() override { return MODE_SPI; }
@@ -50,9 +73,23 @@ public:
 	void begin_master();
 	void begin_slave();
 
-	void reset_receiver() override { data_ready = false; }
+	void reset_receiver() override;
 	bool is_connected() const override { return spi != nullptr; }
-	uint32_t get_baud_rate() const override { return SPI_CLOCK_SPEED; }
+	uint32_t get_baud_rate() const override { return bus ? bus->get_clock_hz() : SPI_CLOCK_SPEED; }
+
+	//Master only: route transfers through an asynchronous bus driver (nullptr = blocking SPIClass transfers)
+	void set_bus_driver(SPIBusDriver* driver);
+	bool flush(uint32_t timeout_us = SPI_QUEUE_TIMEOUT_US);//waits for every queued transfer
+	uint32_t get_completed_transactions() const { return completed_transactions; }
+	uint32_t get_truncated_responses() const { return truncated_responses; }
+	uint32_t get_dropped_responses() const { return dropped_responses; }
+
+private:
+	uint16_t response_size(uint16_t clocked) const;
+	uint8_t tx_byte(uint16_t position) const;//wire byte of tx_frame, 0 past its end
+	bool send_queued(const UartFrame* frame);
+	void service_bus();//collects finished transactions without blocking
+	void complete_transaction(SPITransaction* transaction);
 };
 
 #endif // !SPI_INTERFACE_H
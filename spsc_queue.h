@@ -0,0 +1,72 @@
+#pragma once
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+//Bounded lock-free queue for exactly one producer thread and one consumer thread.
+//Indices run free and are masked on access; the producer publishes with a release store of
+//tail, the consumer frees slots with a release store of head. Nothing blocks: a full queue
+//refuses push(), an empty one refuses pop().
+
+#include <stdint.h>
+#include <atomic>
+
+template<typename T, uint16_t Capacity>
+class SPSCQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of two");
+
+private:
+	T items[Capacity];
+	std::atomic<uint32_t> head;//next slot to read, written by the consumer
+	std::atomic<uint32_t> tail;//next slot to write, written by the producer
+
+public:
+	SPSCQueue() : head(0), tail(0) {}
+
+	//Producer: fill the slot from back() in place, then publish it with push_back()
+	T* back()
+	{
+		uint32_t position = tail.load(std::memory_order_relaxed);
+		if (position - head.load(std::memory_order_acquire) == Capacity) return nullptr;
+		return &items[position & (Capacity - 1)];
+	}
+	void push_back() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+	bool push(const T& item)
+	{
+		T* slot = back();
+		if (!slot) return false;
+		*slot = item;
+		push_back();
+		return true;
+	}
+
+	//Consumer: read the slot at front() in place, then free it with pop_front()
+	T* front()
+	{
+		uint32_t position = head.load(std::memory_order_relaxed);
+		if (tail.load(std::memory_order_acquire) == position) return nullptr;
+		return &items[position & (Capacity - 1)];
+	}
+	void pop_front() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+	bool pop(T& item)
+	{
+		T* slot = front();
+		if (!slot) return false;
+		item = *slot;
+		*slot = T();//drop the queue's copy (e.g. a FrameHandle reference) before the slot is reused
+		pop_front();
+		return true;
+	}
+
+	//Either side, a snapshot. head first: it never passes the tail read after it
+	uint16_t size() const
+	{
+		uint32_t first = head.load(std::memory_order_acquire);
+		return (uint16_t)(tail.load(std::memory_order_acquire) - first);
+	}
+	bool empty() const { return size() == 0; }
+	bool full() const { return size() == Capacity; }
+	static uint16_t capacity() { return Capacity; }
+};
+
+#endif // !SPSC_QUEUE_H
@@ -1,9 +1,12 @@
 #include "uart_interface.h"
 #include <Arduino.h>
+#include <string.h>
+#include "logger.h"
 
-UARTInterface::UARTInterface(HardwareSerial* serial_port, uint32_t baud) : serial(serial_port), baud_rate(baud), rx_state(STATE_WAITING_START), rx_index(0) 
+UARTInterface::UARTInterface(HardwareSerial* serial_port, uint32_t baud, UartFraming framing_mode) : serial(serial_port), baud_rate(baud), framing(framing_mode), tx_flush(true), rx_state(STATE_WAITING_START), rx_index(0),
+	rx_header_size(FRAME_HEADER_SIZE), rx_frame_size(FRAME_OVERHEAD), last_byte_time(0), framing_errors(0), rx_head(0), rx_tail(0), rx_crc(0), rx_crc_ready(false)
 {
-	memset(rx_buffer, 0, sizeof(UartFrame));
+	reset_receiver();
 }
 
 void UARTInterface::begin()
@@ -17,81 +20,273 @@ void UARTInterface::begin()
 	reset_receiver();
 }
 
+void UARTInterface::set_framing(UartFraming framing_mode)
+{
+	framing = framing_mode;
+	reset_receiver();
+}
+
 void UARTInterface::reset_receiver()
 {
 	//Resetting for new UART transfer
+	rx_frame.release();
+	last_byte_time = 0;
+	rx_crc_ready = false;
+	if (framing == FRAMING_COBS)
+	{
+		begin_frame();//line is idle, the next byte opens a block
+	}
+	else
+	{
+		rx_state = STATE_WAITING_START;
+	}
+}
+
+void UARTInterface::drop_frame()
+{
+	//Framing error: release the frame and hunt for the next start marker / delimiter
+	framing_errors++;
+	rx_frame.release();
+	rx_crc_ready = false;
 	rx_state = STATE_WAITING_START;
+}
+
+void UARTInterface::begin_frame()
+{
 	rx_index = 0;
-	memset(rx_buffer, 0, sizeof(UartFrame));
-	last_byte_time = 0;
+	rx_header[rx_index++] = START_MARKER;
+	rx_header_size = FRAME_HEADER_SIZE;
+	rx_frame_size = FRAME_OVERHEAD;//zero-length frame until data_length is known
+	rx_crc = CRC16::begin();
+	rx_crc_ready = false;
+	cobs_decoder.reset();
+	rx_state = STATE_RECEIVING_FRAME;
 }
 
 bool UARTInterface::send(const UartFrame* frame)
 {
-	if (!serial) return false;
+	if (!serial || !frame) return false;
+	if (framing == FRAMING_COBS) return send_cobs(frame);
+
+	//Header and trailer are encoded on the side, data goes out straight from the frame
+	uint8_t header[FRAME_HEADER_SIZE + FRAME_ACK_FIELD_SIZE];
+	uint8_t trailer[FRAME_TRAILER_SIZE];
+	uint16_t header_length = Protocol::encode_header(frame, header);
+	Protocol::encode_trailer(frame, trailer);
+
+	size_t bytes_written = serial->write(header, header_length);
+	bytes_written += serial->write(frame->data, frame->data_length);
+	bytes_written += serial->write(trailer, FRAME_TRAILER_SIZE);
+	if (tx_flush) serial->flush();
+	return bytes_written == Protocol::wire_size(frame);//Sending completed
+}
+
+bool UARTInterface::send_cobs(const UartFrame* frame)
+{
+	//Markers are implied by the delimiter, so only version..crc is stuffed
+	uint8_t wire[MAX_FRAME_SIZE];
+	uint8_t encoded[COBS_MAX_ENCODED_SIZE(MAX_FRAME_SIZE) + 1];
+	uint16_t wire_length = Protocol::encode_frame(frame, wire);
+	uint16_t encoded_length = COBS::encode(&wire[1], wire_length - 2, encoded);
+	encoded[encoded_length++] = COBS_DELIMITER;
 
-	size_t bytes_written = serial->write((uint8_t*)frame, sizeof(UartFrame));
-	serial->flush();
-	return bytes_written == sizeof(UartFrame);//Sending completed
+	size_t bytes_written = serial->write(encoded, encoded_length);
+	if (tx_flush) serial->flush();
+	return bytes_written == encoded_length;
 }
 
-bool UARTInterface::receive(UartFrame* frame)
+FrameHandle UARTInterface::receive()
 {
 	//Using Receiver State Machine for receiving
-	
-	if (!serial) return false;
 
-	while (serial->available())
-	{
-		uint8_t byte = serial->read();
-		last_byte_time = millis();
+	if (!serial) return FrameHandle();
 
-		switch (rx_state)
+	while (rx_head < rx_tail || fill_rx_chunk())
+	{
+		FrameHandle frame;
+		if (framing == FRAMING_COBS)
+		{
+			if (rx_state == STATE_RECEIVING_FRAME) frame = receive_cobs_byte(rx_chunk[rx_head++]);
+			else if (hunt(COBS_DELIMITER)) frame = receive_cobs_byte(COBS_DELIMITER);
+		}
+		else if (rx_state == STATE_RECEIVING_FRAME)
+		{
+			frame = receive_span();
+		}
+		else if (hunt(START_MARKER))
 		{
-		case STATE_WAITING_START:
-			if (byte == START_MARKER)
-			{
-				rx_index = 0;
-				rx_buffer[rx_index++] = byte;
-				rx_state = STATE_RECEIVING_FRAME;
-			}
-			break;
-
-		case STATE_RECEIVING_FRAME:
-			rx_buffer[rx_index++] = byte;
-
-			if (rx_index >= sizeof(UartFrame))
-			{
-				//Copy to output frame
-				memcpy(frame, rx_buffer, sizeof(UartFrame));
-
-				if (frame->end_marker == END_MARKER)
-				{
-					rx_state = STATE_WAITING_START;
-					return true;//Valid frame
-				}
-				else
-				{
-					Serial.println("Invalid end marker");
-					reset_receiver();
-					return false;//framing error
-				}
-			}
-			break;
+			rx_frame = frame_pool.acquire();
+			if (rx_frame) begin_frame();//else pool exhausted, drop the frame (counted by the pool)
 		}
+		if (frame) return frame;
 	}
 
-	if (rx_state == STATE_RECEIVING_FRAME && check_timeout())
+	//COBS resyncs on delimiters, the timeout only abandons a block the sender never finished
+	bool in_frame = rx_state == STATE_RECEIVING_FRAME && (framing == FRAMING_MARKERS || cobs_decoder.code != 0);
+	if (in_frame && check_timeout())
 	{
 		reset_receiver();
 	}
 
-	return false;//No complete frame available yet
+	return FrameHandle();//No complete frame available yet
+}
+
+bool UARTInterface::fill_rx_chunk()
+{
+	//One bulk read of what the driver already holds, readBytes() never waits for more
+	int waiting = serial->available();
+	if (waiting <= 0) return false;
+
+	rx_head = 0;
+	rx_tail = (uint16_t)serial->readBytes(rx_chunk, waiting < UART_RX_CHUNK_SIZE ? waiting : UART_RX_CHUNK_SIZE);
+	last_byte_time = millis();
+	return rx_tail > 0;
+}
+
+bool UARTInterface::hunt(uint8_t marker)
+{
+	const uint8_t* found = (const uint8_t*)memchr(&rx_chunk[rx_head], marker, rx_tail - rx_head);
+	if (!found)
+	{
+		rx_head = rx_tail;//noise
+		return false;
+	}
+	rx_head = (uint16_t)(found - rx_chunk) + 1;
+	return true;
+}
+
+FrameHandle UARTInterface::receive_span()
+{
+	//Next point where the header or trailer has to be looked at
+	uint16_t trailer_start = rx_frame_size - FRAME_TRAILER_SIZE;
+	uint16_t boundary;
+	if (rx_index < FRAME_HEADER_SIZE) boundary = FRAME_HEADER_SIZE;
+	else if (rx_index < rx_header_size) boundary = rx_header_size;
+	else if (rx_index < trailer_start) boundary = trailer_start;
+	else boundary = rx_frame_size;
+
+	uint16_t length = boundary - rx_index;
+	if (length > rx_tail - rx_head) length = rx_tail - rx_head;
+	const uint8_t* bytes = &rx_chunk[rx_head];
+
+	if (rx_index < rx_header_size) memcpy(&rx_header[rx_index], bytes, length);
+	else if (rx_index < trailer_start) memcpy(&rx_frame->data[rx_index - rx_header_size], bytes, length);
+	else memcpy(&rx_trailer[rx_index - trailer_start], bytes, length);
+
+	//CRC covers version..data, i.e. everything before the trailer
+	if (rx_index < trailer_start)
+	{
+		rx_crc = CRC16::update(rx_crc, bytes, length);
+	}
+	rx_head += length;
+	rx_index += length;
+	return check_boundary();
+}
+
+FrameHandle UARTInterface::receive_byte(uint8_t byte)
+{
+	uint16_t trailer_start = rx_frame_size - FRAME_TRAILER_SIZE;
+	if (rx_index < rx_header_size) rx_header[rx_index] = byte;
+	else if (rx_index < trailer_start) rx_frame->data[rx_index - rx_header_size] = byte;
+	else rx_trailer[rx_index - trailer_start] = byte;
+
+	//CRC covers version..data, i.e. everything before the trailer
+	if (rx_index < trailer_start)
+	{
+		rx_crc = CRC16::update(rx_crc, byte);
+	}
+	rx_index++;
+	return check_boundary();
+}
+
+FrameHandle UARTInterface::check_boundary()
+{
+	if (rx_index == FRAME_HEADER_SIZE)
+	{
+		rx_frame_size = Protocol::parse_wire_size(rx_header);
+		if (rx_frame_size == 0)
+		{
+			drop_frame();//corrupt length
+			return FrameHandle();
+		}
+		rx_header_size = Protocol::parse_header_size(rx_header);
+	}
+
+	if (rx_index == rx_header_size)
+	{
+		Protocol::decode_header(rx_header, rx_frame.get());
+	}
+	else if (rx_index == rx_frame_size)
+	{
+		Protocol::decode_trailer(rx_trailer, rx_frame.get());
+		if (rx_frame->end_marker != END_MARKER)
+		{
+			LOG_WARN("UART invalid end marker, frame %u dropped", rx_frame->sequence_num);
+			drop_frame();
+			return FrameHandle();//framing error
+		}
+
+		rx_crc = CRC16::finalize(rx_crc);
+		rx_crc_ready = true;
+		rx_state = STATE_WAITING_START;
+
+		FrameHandle frame = rx_frame;
+		rx_frame.release();
+		return frame;//Valid frame
+	}
+	return FrameHandle();
+}
+
+FrameHandle UARTInterface::receive_cobs_byte(uint8_t byte)
+{
+	if (byte == COBS_DELIMITER)
+	{
+		FrameHandle frame;
+		if (rx_state == STATE_RECEIVING_FRAME && rx_frame)
+		{
+			//The delimiter stands in for the end marker
+			if (cobs_decoder.complete() && rx_index == rx_frame_size - 1) frame = receive_byte(END_MARKER);
+			else drop_frame();//truncated block
+		}
+		else if (rx_state == STATE_RECEIVING_FRAME && cobs_decoder.code != 0)
+		{
+			framing_errors++;//block too short to hold a header
+		}
+		rx_frame.release();
+		begin_frame();
+		return frame;
+	}
+	if (rx_state != STATE_RECEIVING_FRAME) return FrameHandle();//hunting for a delimiter
+
+	uint8_t decoded;
+	if (!cobs_decoder.feed(byte, decoded)) return FrameHandle();
+	if (rx_index >= rx_frame_size - 1)
+	{
+		drop_frame();//overlong block, the end marker position must be reached by the delimiter
+		return FrameHandle();
+	}
+	if (!rx_frame)
+	{
+		rx_frame = frame_pool.acquire();
+		if (!rx_frame)
+		{
+			rx_state = STATE_WAITING_START;//pool exhausted, drop the frame (counted by the pool)
+			return FrameHandle();
+		}
+	}
+	return receive_byte(decoded);
 }
 
 bool UARTInterface::available()
 {
-	return serial->available() > 0;//UART Mode is ready
+	return rx_head < rx_tail || serial->available() > 0;//UART Mode is ready
+}
+
+bool UARTInterface::get_rx_crc(uint16_t& crc) const
+{
+	if (!rx_crc_ready) return false;
+	crc = rx_crc;
+	return true;
 }
 
 bool UARTInterface::check_timeout()
@@ -3,26 +3,60 @@
 #define UART_INTERFACE_H
 
 #include "communication_interface.h"
+#include "cobs.h"
 #include <HardwareSerial.h>
 
+//Byte framing on the wire, both ends must agree
+enum UartFraming
+{
+	FRAMING_MARKERS,//start/end markers, resync by hunting START_MARKER (default)
+	FRAMING_COBS//COBS-stuffed frame without markers, 0x00 delimited, resync at the next delimiter
+};
+
+#ifndef UART_FRAMING
+#define UART_FRAMING FRAMING_MARKERS
+#endif
+
+//Bytes pulled from the serial driver per readBytes() call
+#ifndef UART_RX_CHUNK_SIZE
+#define UART_RX_CHUNK_SIZE 256
+#endif
+
 class UARTInterface : public CommunicationInterface 
 {
 private:
 	HardwareSerial* serial;
 	uint32_t baud_rate;
+	UartFraming framing;
+	bool tx_flush;//wait for the FIFO to drain after each frame
 
 	//State Machine Variables
 	ReceiverState rx_state;
-	uint8_t rx_buffer[sizeof(UartFrame)];
-	uint8_t rx_index;
+	FrameHandle rx_frame;//pooled frame being received, data bytes are written straight into it
+	uint8_t rx_header[FRAME_HEADER_SIZE + FRAME_ACK_FIELD_SIZE];
+	uint8_t rx_trailer[FRAME_TRAILER_SIZE];
+	uint16_t rx_index;//wire position
+	uint16_t rx_header_size;
+	uint16_t rx_frame_size;//zero-length frame size until data_length is known, then the full wire size
 	unsigned long last_byte_time;
+	COBS::Decoder cobs_decoder;
+	uint32_t framing_errors;
+
+	//Bulk read buffer, refilled from the driver once [rx_head, rx_tail) is used up
+	uint8_t rx_chunk[UART_RX_CHUNK_SIZE];
+	uint16_t rx_head;
+	uint16_t rx_tail;
+
+	//Incremental CRC, updated per byte while STATE_RECEIVING_FRAME
+	uint16_t rx_crc;
+	bool rx_crc_ready;//rx_crc holds the finished CRC of the last returned frame
 
 public:
-	UARTInterface(HardwareSerial* serial_port,uint32_t baud = 115200);
+	UARTInterface(HardwareSerial* serial_port,uint32_t baud = 115200, UartFraming framing_mode = UART_FRAMING);
 
 	//CommunicationInterface implement
 	bool send(const UartFrame* frame) override;
-	bool receive(UartFrame* frame) override;
+	FrameHandle receive() override;
 	bool available() override;
 
 	CommunicationMode get_mode() override { return MODE_UART; }
@@ -31,9 +65,26 @@ public:
 
 	uint32_t get_baud_rate() const override { return baud_rate; }
 	bool is_connected() const override { return serial != nullptr; }
+	bool get_rx_crc(uint16_t& crc) const override;
+
+	UartFraming get_framing() const { return framing; }
+	void set_framing(UartFraming framing_mode);//resets the receiver
+	uint32_t get_framing_errors() const { return framing_errors; }//bad markers, lengths or COBS blocks
+
+	//false: send() returns once the frame is in the driver's TX buffer, so a bonded SPI link is not held up
+	void set_tx_flush(bool flush) { tx_flush = flush; }
 
 private:
 	bool check_timeout();
+	void begin_frame();
+	void drop_frame();
+	bool fill_rx_chunk();
+	bool hunt(uint8_t marker);//skips buffered bytes up to and including marker
+	FrameHandle receive_span();//buffered bytes up to the next header/trailer boundary
+	FrameHandle receive_byte(uint8_t byte);//one wire byte after the start marker
+	FrameHandle check_boundary();//parses header/trailer once rx_index reaches them
+	FrameHandle receive_cobs_byte(uint8_t byte);
+	bool send_cobs(const UartFrame* frame);
 };
 
 #endif